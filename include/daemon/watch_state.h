@@ -0,0 +1,58 @@
+#ifndef WATCH_STATE_H
+#define WATCH_STATE_H
+
+#include <stdint.h>
+#include "path_filter.h"
+
+/**
+ * Snapshot of watched paths kept by daemon between runs, so changes made
+ * while it was down can be reported on start. Stored as single mmapped file:
+ * header, roots, entries (sorted by name within root), names.
+ */
+
+#define WATCH_STATE_MAGIC		0x54534d53
+#define WATCH_STATE_VERSION		1
+
+struct watch_state_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t checksum;		// FNV-1a of everything after header
+	uint32_t roots_count;
+	uint32_t entries_count;
+	uint64_t names_size;
+};
+
+struct watch_state_root {
+	uint64_t path_offset;
+	uint32_t first_entry;
+	uint32_t entries_count;
+};
+
+/**
+ * Watched path itself has empty name, directory entries have their names
+ */
+struct watch_state_entry {
+	uint64_t name_offset;
+	uint64_t inode;
+	uint64_t size;
+	int64_t mtime_ns;
+	int64_t ctime_ns;
+};
+
+/**
+ * Path watched by file monitor, filter may be NULL
+ */
+struct watch_root {
+	const char* path;
+	path_filter_t filter;
+};
+
+/**
+ * Stats roots and their directory entries with parallel statx sweep.
+ * If report is set, logs paths created, modified or deleted since snapshot
+ * stored in state_file. Then atomically replaces state_file with new snapshot.
+ */
+int watch_state_sync(const char* state_file, const struct watch_root* roots,
+					 int roots_count, int report);
+
+#endif
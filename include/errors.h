@@ -41,6 +41,11 @@
  */
 #define E_MONITOR_INVALID_STATE		7
 
+/**
+ * When shared module of monitor backend cannot be loaded
+ */
+#define E_BACKEND_UNAVAILABLE		8
+
 #ifdef DAEMON
 	#define E_FORK 					100
 	#define E_SET_SID 				101
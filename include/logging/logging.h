@@ -1,9 +1,111 @@
 #ifndef LOGGING_H
 #define LOGGING_H
 
+#include <stdio.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+#define LOG_LEVEL_TRACE		0
+#define LOG_LEVEL_DEBUG		1
+#define LOG_LEVEL_INFO		2
+#define LOG_LEVEL_WARN		3
+#define LOG_LEVEL_ERROR		4
+
+/**
+ * Calls below this level are compiled out, e.g. -DSLM_LOG_MIN_LEVEL=2
+ * drops trace and debug ones. Errors are never dropped.
+ */
+#ifndef SLM_LOG_MIN_LEVEL
+#define SLM_LOG_MIN_LEVEL	LOG_LEVEL_TRACE
+#endif
+
+/**
+ * SIGUSR2 value (sigqueue): level for all monitors, or
+ * LOG_LEVEL_REQUEST(n, level) for n-th monitor (counting from 1) only.
+ * slmd counts config lines instead, so a bad line does not shift numbers.
+ */
+#define LOG_LEVEL_REQUEST(monitor, level)	(((monitor) << 8) | (level))
+
+/**
+ * Process wide level, SLM_LOG_LEVEL environment variable sets it on start
+ */
+extern atomic_int log_level;
+
+/**
+ * Level checked by calls of this thread: process wide one, or level of
+ * monitor whose event is being processed
+ */
+extern _Thread_local atomic_int* log_scope;
+
+/**
+ * Checks level before arguments are evaluated, disabled call costs
+ * one load and one branch. Errors are logged whatever level is set.
+ */
+#define log_enabled(level) \
+	((level) >= LOG_LEVEL_ERROR \
+	 || ((level) >= SLM_LOG_MIN_LEVEL \
+		 && (level) >= atomic_load_explicit(log_scope, memory_order_relaxed)))
+
+#define log_at(level, ...) do { \
+	if (log_enabled(level)) log_message(level, __VA_ARGS__); \
+} while (0)
+
+#define log_trace(...)	log_at(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define log_debug(...)	log_at(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define log_info(...)	log_at(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_warn(...)	log_at(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_error(...)	log_at(LOG_LEVEL_ERROR, __VA_ARGS__)
+
 int initialize_logging();
 int destroy_logging();
-void log_info(const char* format, ...);
-void log_error(const char* format, ...);
 
-#endif
\ No newline at end of file
+/**
+ * Writes message whatever level is set, use log_* macros instead
+ */
+void log_message(int level, const char* format, ...);
+
+/**
+ * Parses level name: trace, debug, info, warn or error
+ */
+int log_level_from_string(const char* name);
+
+const char* log_level_name(int level);
+
+/**
+ * Copies length bytes of fd starting at offset to log file as they are,
+ * with sendfile unless log is stream compressed or sink does not support it.
+ * Advances offset, returns number of bytes copied or -1.
+ */
+long log_copy_from(int fd, off_t* offset, size_t length);
+
+/**
+ * Opens log files in O_APPEND mode and binds them to stdout/stderr.
+ * If error_path is NULL, errors go to the log file.
+ */
+int set_log_files(const char* log_path, const char* error_path);
+
+/**
+ * Reopens log files by their paths, e.g. after external logrotate moved them.
+ * Safe to call while monitors are writing: no line is lost or duplicated.
+ */
+int reopen_logging();
+
+/**
+ * Enables built-in rotation. max_size is in bytes, interval is in seconds,
+ * 0 disables corresponding trigger. Rotated segments are gzipped in
+ * background if compress is set and slm was built with zlib.
+ */
+void set_log_rotation(long max_size, long interval, int compress);
+
+/**
+ * Writes log file as block-framed zlib stream compressed in background.
+ * Returns CALL_FAILURE if slm was built without zlib.
+ */
+int set_log_stream_compression(int enabled);
+
+/**
+ * Decompresses log written with stream compression to output.
+ */
+int dump_compressed_log(const char* path, FILE* output);
+
+#endif
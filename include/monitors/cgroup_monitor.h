@@ -0,0 +1,68 @@
+#ifndef CGROUP_MONITOR_H
+#define CGROUP_MONITOR_H
+
+#include <stdint.h>
+#include "monitor_alloc.h"
+#include "ingest.h"
+
+struct monitor_t;
+typedef struct monitor_t* monitor_t;
+
+/**
+ * Counters of memory.events which are reported when they grow
+ */
+#define CGROUP_MEMORY_EVENTS	3	// oom, oom_kill, oom_group_kill
+
+/**
+ * Last seen state of one cgroup. Only its directory is watched:
+ * kernfs reports modification of cgroup.events and memory.events
+ * to the watch of their directory.
+ */
+struct cgroup_entry {
+	int wd;
+	uint8_t populated;
+	uint8_t dirty;				// files changed in current batch of events
+	uint32_t memory_events[CGROUP_MEMORY_EVENTS];
+	char* path;
+};
+
+/**
+ * Entries are kept in dense array indexed by open addressing table of
+ * watch descriptor -> position + 1, all cgroups share one inotify instance
+ */
+struct cgroup_monitor {
+	const char* root;
+	int inotify_fd;
+	struct cgroup_entry* entries;
+	int count;
+	int capacity;
+	int* index;
+	uint32_t index_mask;
+	int* dirty;					// watch descriptors of dirty entries
+	int dirty_count;
+	unsigned long overflows;
+	ingest_source_t source;
+};
+
+typedef struct cgroup_monitor* cgroup_monitor_t;
+
+extern struct monitor_slab cgroup_monitor_slab;
+
+int cgroup_monitor_from_args(int argc, char* argv[], monitor_t*);
+
+int cgroup_start(monitor_t);
+
+int cgroup_stop(monitor_t);
+
+void cgroup_join(monitor_t);
+
+int cgroup_monitor_destroy(monitor_t);
+
+void cgroup_print_usage();
+
+/**
+ * Looks entry up by watch descriptor in index, NULL if it is not watched
+ */
+struct cgroup_entry* cgroup_find_entry(cgroup_monitor_t, int wd);
+
+#endif
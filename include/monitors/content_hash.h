@@ -0,0 +1,62 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Block size of content tables, changed ranges are reported with this
+ * granularity
+ */
+#define CONTENT_BLOCK_SIZE		4096
+
+#define CONTENT_MAX_RANGES		8
+
+/**
+ * 64-bit XXH64 hash, four independent lanes per 32 byte stripe
+ */
+uint64_t hash64(const void* data, size_t length, uint64_t seed);
+
+struct content_range {
+	uint64_t from;
+	uint64_t to;	// inclusive
+};
+
+struct content_change {
+	int known;				// file had been hashed before
+	int changed;
+	uint64_t old_size;
+	uint64_t new_size;
+	int ranges_count;
+	int ranges_truncated;	// more than CONTENT_MAX_RANGES ranges changed
+	struct content_range ranges[CONTENT_MAX_RANGES];
+};
+
+struct content_table;
+typedef struct content_table* content_table_t;
+
+content_table_t content_table_new();
+
+/**
+ * Hashes all regular files at path (path itself or entries of directory),
+ * so that first change is compared against something
+ */
+void content_baseline(content_table_t, const char* path);
+
+/**
+ * Rehashes file stored under name and compares it with stored hashes.
+ * Only tail is rehashed for files which grew by a write and kept first,
+ * last and sampled blocks of old size, other edits of growing file in
+ * between are not seen.
+ */
+int content_update(content_table_t, const char* path, const char* name,
+				   struct content_change*);
+
+void content_forget(content_table_t, const char* name);
+
+/**
+ * Logs hashed bytes and throughput, then frees table
+ */
+void content_table_destroy(content_table_t, const char* path);
+
+#endif
@@ -4,21 +4,46 @@
 #define DBUS_MONITOR_TYPE_NM		1
 #define DBUS_MONITOR_TYPE_UDISKS	2
 
+#include <stdint.h>
+#include <stddef.h>
 #include <pthread.h>
-#include <glib.h>
+#include <stdatomic.h>
+#include "monitor_alloc.h"
 
 struct monitor_t;
 typedef struct monitor_t* monitor_t;
 
+struct dbus_monitor;
+typedef struct dbus_monitor* dbus_monitor_t;
+
+// GLib types are only named here, so the core does not need GLib headers
+struct _GError;
+struct _GMainLoop;
+struct _GDBusConnection;
+
+/**
+ * Where monitor connects to: system bus by default, or bus at --bus-address,
+ * e.g. private dbus-daemon of benchmark
+ */
+struct dbus_source_ops {
+	struct _GDBusConnection* (*connect)(dbus_monitor_t, struct _GError**);
+};
+
+extern const struct dbus_source_ops dbus_system_bus_source;
+
+extern const struct dbus_source_ops dbus_address_source;
+
 struct dbus_monitor {
 	int type;
+	const struct dbus_source_ops* source_ops;
+	const char* bus_address;
+	atomic_ulong signals;		// received, replayed ones included
 
-	GMainLoop* subscription_loop;
-	pthread_t thread;
-	pthread_mutex_t state_mutex;
+	struct _GMainLoop* subscription_loop;
+	struct _GDBusConnection* connection;
 };
 
-typedef struct dbus_monitor* dbus_monitor_t;
+extern struct monitor_slab dbus_monitor_slab;
 
 int dbus_monitor_from_args(int argc, char* argv[], monitor_t*);
 
@@ -30,6 +55,17 @@ void dbus_join(monitor_t);
 
 int dbus_monitor_destroy(monitor_t);
 
+/**
+ * Decodes input recorded in trace, runs on replaying thread
+ */
+int dbus_replay(monitor_t, uint32_t source, const char* data, size_t length);
+
+/**
+ * Emits count synthetic signals on private bus of --bus-address and
+ * reports ns per event or their latency, see inject_events
+ */
+int dbus_inject(monitor_t, unsigned long count, int mode);
+
 void dbus_print_usage(int type);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,106 @@
+#ifndef EVENT_PIPELINE_H
+#define EVENT_PIPELINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/**
+ * Events are read by monitoring threads and processed (filtered, enriched,
+ * logged) by worker pool. Each worker owns bounded lock-free MPSC queue,
+ * each monitor is bound to one worker. Events are stamped when submitted,
+ * and worker handles events of all its monitors in order of stamps: it
+ * holds back up to queue capacity of them until no older one can arrive.
+ */
+
+#define MONITOR_EVENT_NAME_LENGTH	256
+
+#define BACKPRESSURE_BLOCK			0
+#define BACKPRESSURE_DROP_OLDEST	1
+#define BACKPRESSURE_SAMPLE			2
+
+/**
+ * Capacity of each worker queue
+ */
+#define EVENT_QUEUE_CAPACITY		4096
+
+/**
+ * Events of a monitor which may wait in queue before backpressure applies
+ */
+#define MONITOR_QUEUE_LIMIT			256
+
+/**
+ * Producer blocked by the limit sleeps until its monitor has that many
+ * events left, so it is woken once per batch rather than per event
+ */
+#define MONITOR_QUEUE_RESUME		(MONITOR_QUEUE_LIMIT / 2)
+
+/**
+ * With sample policy, one of that many events is kept while over the limit
+ */
+#define BACKPRESSURE_SAMPLE_RATE	16
+
+struct monitor_t;
+typedef struct monitor_t* monitor_t;
+
+struct monitor_event;
+typedef void (*monitor_event_handler)(monitor_t, struct monitor_event*);
+
+/**
+ * Compact event record. kind and value are backend specific,
+ * name is optional (directory entry, object path, device property).
+ */
+struct monitor_event {
+	monitor_t monitor;
+	monitor_event_handler handler;
+	uint64_t time_ns;			// monotonic time of submission
+	uint32_t kind;
+	uint32_t value;
+	char name[MONITOR_EVENT_NAME_LENGTH];
+};
+
+/**
+ * Per-monitor part of pipeline state, embedded into monitor_t
+ */
+struct monitor_queue_state {
+	int backpressure;
+	int worker;
+	atomic_int queued;
+	atomic_int skip;
+	atomic_ulong dropped;
+	atomic_ulong handled;		// passed to handler, skipped ones not counted
+	unsigned int sampled;
+};
+
+int event_pipeline_start(int workers_count, size_t queue_capacity);
+
+void event_pipeline_stop();
+
+/**
+ * Parses backpressure policy name: block, drop-oldest or sample
+ */
+int backpressure_from_string(const char* name);
+
+void monitor_queue_init(struct monitor_queue_state*, int backpressure);
+
+/**
+ * Passes event to monitor's worker. If pipeline is not started,
+ * handler is called in place.
+ */
+void submit_monitor_event(monitor_t, monitor_event_handler,
+						  uint32_t kind, uint32_t value, const char* name);
+
+/**
+ * Waits until worker processed all events of the monitor.
+ * Must be called after monitor stopped producing.
+ */
+void drain_monitor_events(monitor_t);
+
+/**
+ * Waits until worker handled count events of the monitor since it was
+ * created, or timeout_ms passed without worker waking waiters.
+ * Returns number of events handled.
+ */
+unsigned long wait_monitor_handled(monitor_t, unsigned long count, long timeout_ms);
+
+#endif
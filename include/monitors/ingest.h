@@ -0,0 +1,93 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <sys/types.h>
+
+/**
+ * Shared ingestion engine: one thread waits on descriptors of all monitors
+ * instead of each monitor polling its own descriptor. Built on epoll, or on
+ * io_uring when compiled with SLM_WITH_IO_URING: reads stay posted on every
+ * read source and completions are reaped in batches.
+ */
+
+/**
+ * Size of buffer passed to read handler
+ */
+#define INGEST_READ_BUFFER_SIZE		8192
+
+/**
+ * SLM_INGEST=epoll in environment keeps io_uring build on epoll,
+ * e.g. to compare both engines
+ */
+#define INGEST_ENGINE_ENVIRONMENT	"SLM_INGEST"
+
+/**
+ * Handler return values
+ */
+#define INGEST_CONTINUE				0
+#define INGEST_STOP					1
+
+struct ingest_source;
+typedef struct ingest_source* ingest_source_t;
+
+/**
+ * Receives data read from descriptor. Length 0 reports end of file, source
+ * is not read any more after that. Negative length is -errno, source is
+ * read further only if handler returns INGEST_CONTINUE (e.g. for ENOBUFS
+ * of netlink socket which lost messages but stays usable).
+ */
+typedef int (*ingest_read_handler)(void* context, const char* data, ssize_t length);
+
+/**
+ * Called when descriptor became readable, handler reads it by itself
+ * and must leave it drained (descriptor should be non-blocking).
+ */
+typedef int (*ingest_ready_handler)(void* context);
+
+/**
+ * Called once source is removed and none of its handlers may run any more
+ */
+typedef void (*ingest_release_handler)(void* context);
+
+int ingest_start();
+
+/**
+ * Stops engine thread. Sources must be removed before.
+ */
+void ingest_stop();
+
+const char* ingest_engine_name();
+
+/**
+ * Adding returns once engine thread attached descriptor, so failure (e.g. of
+ * epoll_ctl) reaches caller, which then neither removes nor gets release of
+ * source.
+ */
+
+/**
+ * Engine reads descriptor by itself and passes data to handler
+ */
+int ingest_add_read(int fd, ingest_read_handler, ingest_release_handler,
+					void* context, ingest_source_t*);
+
+/**
+ * Engine only reports readiness of descriptor
+ */
+int ingest_add_ready(int fd, ingest_ready_handler, ingest_release_handler,
+					 void* context, ingest_source_t*);
+
+/**
+ * Engine reports exceptional condition (POLLPRI) of descriptor, like change
+ * of /proc/self/mountinfo or fired PSI trigger; handler re-reads it by itself
+ */
+int ingest_add_priority(int fd, ingest_ready_handler, ingest_release_handler,
+						void* context, ingest_source_t*);
+
+/**
+ * Asynchronously removes source, release handler is called on engine thread
+ * when it is done. Must be called exactly once per source, also for one
+ * whose handler returned INGEST_STOP. Safe to call from handlers.
+ */
+void ingest_remove(ingest_source_t);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef INJECTOR_H
+#define INJECTOR_H
+
+struct monitor_t;
+typedef struct monitor_t* monitor_t;
+
+/**
+ * Seconds without progress after which injection gives up waiting
+ * for monitor to receive events
+ */
+#define INJECT_STALL_TIMEOUT	5
+
+/**
+ * Events are sent as fast as monitor takes them, ns per event is reported
+ */
+#define INJECT_THROUGHPUT	0
+
+/**
+ * Each event is sent once previous one was logged, percentiles of time
+ * from send to its handler returning are reported
+ */
+#define INJECT_LATENCY		1
+
+/**
+ * Starts monitor on in-process stand-in of its event source and drives count
+ * synthetic events through real decoding and logging, then stops it and
+ * reports them as mode says. udev monitors are fed from socketpair, D-Bus
+ * monitors from signals emitted on private bus given with --bus-address.
+ * Ingestion engine and event pipeline must be started.
+ */
+int inject_events(monitor_t, unsigned long count, int mode);
+
+/**
+ * Logs min, median, 99th percentile and max of latencies, sorts them
+ */
+void log_inject_latency(const char* what, long* latencies_ns, unsigned long count);
+
+#endif
@@ -1,22 +1,67 @@
 #ifndef INOTIFY_MONITOR_H
 #define INOTIFY_MONITOR_H
 
-#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "monitor_alloc.h"
+#include "path_filter.h"
+#include "ingest.h"
+#include "content_hash.h"
+
+#define INOTIFY_MODES_COUNT 5
 
 struct monitor_t;
 typedef struct monitor_t* monitor_t;
 
+/**
+ * Dead window is time from reading event about reappeared path until its
+ * watch is added again, events in between are lost. Unwatched time spans
+ * from disappearance of path, nothing happens to it meanwhile.
+ * Overflow of inotify queue loses events, path is watched again after it.
+ */
+struct inotify_rearm_stats {
+	unsigned long count;
+	unsigned long overflows;
+	long gone_at_ns;			// monotonic time path disappeared, 0 if watched
+	long max_unwatched_ns;
+	long max_dead_window_ns;
+	long total_dead_window_ns;
+};
+
+/**
+ * State of --content and --tail modes, allocated only for monitors using them
+ */
+struct inotify_extras {
+	content_table_t content;	// set in --content mode
+	// --tail mode, followed file is touched only by pipeline worker once started
+	int tail;
+	int tail_fd;				// -1 while path is absent
+	off_t tail_offset;
+};
+
+/**
+ * Kept small, as daemon may run a monitor per watched file: the parent
+ * directory and name looked for in it are taken from file_path when needed,
+ * rarely used state is allocated separately.
+ */
 struct inotify_monitor {
 	int inotify_file_descriptor;
-	char* file_path;
-	char* mode;
-
-	pthread_t thread;
-	pthread_mutex_t state_mutex;
+	uint32_t mask;
+	const char* file_path;
+	path_filter_t filter;
+	ingest_source_t source;
+	// path is watched again through its parent directory when it reappears,
+	// watches are changed only by engine thread once started
+	int parent_watch;			// -1 if parent cannot be watched
+	int file_watch;				// -1 while path is absent
+	struct inotify_rearm_stats* rearm;	// allocated when path is gone first time
+	struct inotify_extras* extras;		// NULL without --content and --tail
 };
 
 typedef struct inotify_monitor* inotify_monitor_t;
 
+extern struct monitor_slab inotify_monitor_slab;
+
 int inotify_monitor_from_args(int argc, char* argv[], monitor_t*);
 
 int inotify_start(monitor_t);
@@ -27,6 +72,11 @@ void inotify_join(monitor_t);
 
 int inotify_monitor_destroy(monitor_t);
 
+/**
+ * Decodes input recorded in trace, runs on replaying thread
+ */
+int inotify_replay(monitor_t, uint32_t source, const char* data, size_t length);
+
 void inotify_print_usage();
 
 #endif 
\ No newline at end of file
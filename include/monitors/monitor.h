@@ -4,29 +4,95 @@
 #include "inotify_monitor.h"
 #include "dbus_monitor.h"
 #include "udev_monitor.h"
+#include "netlink_monitor.h"
+#include "netstat_monitor.h"
+#include "process_monitor.h"
+#include "mounts_monitor.h"
+#include "pressure_monitor.h"
+#include "cgroup_monitor.h"
+#include "event_pipeline.h"
+#include "trace.h"
+#include "ingest.h"
+#include <stdatomic.h>
 
 #define MONITOR_TYPE_INVALID 		0
 #define MONITOR_TYPE_INOTIFY		1
 #define MONITOR_TYPE_DBUS 			2
 #define MONITOR_TYPE_UDEV		 	3
+#define MONITOR_TYPE_NETLINK		4
+#define MONITOR_TYPE_NETSTAT		5
+#define MONITOR_TYPE_PROCESS		6
+#define MONITOR_TYPE_MOUNTS			7
+#define MONITOR_TYPE_PRESSURE		8
+#define MONITOR_TYPE_CGROUP			9
 
 #define MONITOR_STATE_NOT_INITIALIZED 	0
 #define MONITOR_STATE_INITIALIZED 		1
 #define MONITOR_STATE_RUNNING 			2
 #define MONITOR_STATE_DYING 			3
 #define MONITOR_STATE_DEAD	 			4
+#define MONITOR_STATE_EXITING			5
+
+/*
+ * Lifecycle: INITIALIZED -> RUNNING -> DYING -> DEAD, RUNNING -> DEAD when
+ * monitor dies by itself. All transitions are compare-and-swap, so a call
+ * made in wrong state fails with E_MONITOR_INVALID_STATE instead of racing.
+ * EXITING is held while joiners are woken, before DEAD lets them free it.
+ */
+
+struct monitor_t;
+typedef struct monitor_t* monitor_t;
+
+/**
+ * Backend operations monitor dispatches to, replay and inject are
+ * NULL when backend does not support them
+ */
+struct monitor_ops {
+	int (*start)(monitor_t);
+	int (*stop)(monitor_t);
+	void (*join)(monitor_t);
+	int (*destroy)(monitor_t);
+	int (*replay)(monitor_t, uint32_t source, const char* data, size_t length);
+	int (*inject)(monitor_t, unsigned long count, int mode);
+};
+
+/**
+ * Entry of backend registry, monitor command line is parsed by backend
+ * registered for its command. Backends of shared modules are registered
+ * with module name only, and are looked up in table the module exports
+ * as MONITOR_MODULE_SYMBOL once it is loaded.
+ */
+struct monitor_backend {
+	const char* command;		// e.g. "--file"
+	const char* name;			// value of --backend
+	int is_default;				// taken when --backend is not given
+	const char* module;			// shared module providing it, NULL if built in
+	int (*from_args)(int argc, char* argv[], monitor_t*);
+	void (*print_usage)(void);
+	struct monitor_slab* slab;
+};
+
+#define MONITOR_MODULE_SYMBOL "slm_module_backends"
 
 struct monitor_t {
 	int type;
+	const struct monitor_ops* ops;
 	union {
 		inotify_monitor_t inotify;
 		dbus_monitor_t dbus;
 		udev_monitor_t udev;
+		netlink_monitor_t netlink;
+		netstat_monitor_t netstat;
+		process_monitor_t process;
+		mounts_monitor_t mounts;
+		pressure_monitor_t pressure;
+		cgroup_monitor_t cgroup;
 	};
 
-	int state;
+	_Atomic int state;
+	atomic_int log_level;		// checked by log calls of its event handlers
+	struct monitor_queue_state events;
 };
-typedef struct monitor_t* monitor_t;
 
 int monitor_from_args(int argc, char* argv[], monitor_t*);
 
@@ -38,4 +104,49 @@ void join_monitor(monitor_t);
 
 int destroy_monitor(monitor_t);
 
+/**
+ * Passes input read from trace to decoding of monitor which is not started
+ */
+int replay_monitor_input(monitor_t, uint32_t source, const char* data, size_t length);
+
+static inline int monitor_state(monitor_t monitor) {
+	return atomic_load_explicit(&monitor->state, memory_order_acquire);
+}
+
+/**
+ * Moves monitor from one state to another if it is in expected state
+ */
+int monitor_transition(monitor_t, int from, int to);
+
+/**
+ * Marks running or dying monitor dead and wakes up joiners, logs error in
+ * any other state. Monitoring thread must not touch monitor after this call.
+ */
+void mark_monitor_dead(monitor_t);
+
+/**
+ * Blocks until monitor is dead (returns at once if it was never started)
+ */
+void wait_monitor_dead(monitor_t);
+
+/**
+ * Takes dead or never started monitor for destruction
+ */
+int claim_monitor_for_destroy(monitor_t);
+
+/**
+ * Starts detached monitoring thread, it reports its end with mark_monitor_dead
+ */
+int start_monitor_thread(monitor_t, void* (*routine)(void*));
+
+/**
+ * Applies LOG_LEVEL_REQUEST to monitors, async-signal-safe
+ */
+int set_monitors_log_level(monitor_t* monitors, int count, int request);
+
+/**
+ * Collects userspace memory used by all live monitors
+ */
+void get_monitor_memory_stats(struct monitor_memory_stats*);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,53 @@
+#ifndef MONITOR_ALLOC_H
+#define MONITOR_ALLOC_H
+
+#include <stddef.h>
+#include <stdalign.h>
+#include <pthread.h>
+
+/**
+ * Fixed-size object allocator. Each backend keeps one slab sized for
+ * monitor_t together with its own state, so a monitor is a single allocation.
+ */
+struct monitor_slab {
+	size_t object_size;
+	size_t object_alignment;
+	void* free_list;
+	void* chunks;
+	size_t objects_used;
+	size_t bytes_reserved;
+	pthread_mutex_t mutex;
+};
+
+/**
+ * Objects are packed by alignment of their type, not of max_align_t
+ */
+#define MONITOR_SLAB_INITIALIZER(type) \
+	{ sizeof(type), alignof(type), NULL, NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER }
+
+void* slab_alloc(struct monitor_slab*);
+
+void slab_free(struct monitor_slab*, void* object);
+
+/**
+ * Returns shared copy of path. Equal paths share storage, copies live until
+ * process exit: they are not reference counted, so paths dropped from config
+ * on reload stay allocated and arena grows with number of distinct paths ever
+ * configured (reload of unchanged config adds nothing). Returns NULL if path
+ * is longer than PATH_MAX or memory is exhausted.
+ */
+const char* intern_path(const char* path);
+
+struct monitor_memory_stats {
+	size_t monitors;
+	size_t slab_bytes;
+	size_t path_bytes;
+};
+
+/**
+ * Adds usage of the slab to stats. Path arena usage is added once per call
+ * with slab == NULL.
+ */
+void monitor_memory_stats_add(struct monitor_slab*, struct monitor_memory_stats*);
+
+#endif
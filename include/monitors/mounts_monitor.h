@@ -0,0 +1,63 @@
+#ifndef MOUNTS_MONITOR_H
+#define MOUNTS_MONITOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "monitor_alloc.h"
+#include "ingest.h"
+
+struct monitor_t;
+typedef struct monitor_t* monitor_t;
+
+/**
+ * Mount as it was last seen in mountinfo. Strings share one allocation.
+ */
+struct mount_entry {
+	int id;
+	uint32_t generation;		// of last mountinfo pass which listed it
+	char* point;
+	char* fstype;
+	char* source;
+	char* options;				// per-mount and superblock options
+};
+
+/**
+ * Mounts are kept in dense array, indexed by open addressing table of
+ * mount ID -> position + 1, so each change costs one pass over mountinfo.
+ */
+struct mounts_monitor {
+	int fd;
+	char* buffer;
+	size_t buffer_size;
+	struct mount_entry* mounts;
+	int count;
+	int capacity;
+	int* index;
+	uint32_t index_mask;
+	uint32_t generation;
+	ingest_source_t source;
+};
+
+typedef struct mounts_monitor* mounts_monitor_t;
+
+extern struct monitor_slab mounts_monitor_slab;
+
+int mounts_monitor_from_args(int argc, char* argv[], monitor_t*);
+
+int mounts_start(monitor_t);
+
+int mounts_stop(monitor_t);
+
+void mounts_join(monitor_t);
+
+int mounts_monitor_destroy(monitor_t);
+
+void mounts_print_usage();
+
+/**
+ * Compares mount table with mountinfo text, which is split in place, and
+ * reports mounts, unmounts and remounts if report_changes is set
+ */
+int mounts_diff(monitor_t, char* mountinfo, int report_changes);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef NETLINK_ATTR_H
+#define NETLINK_ATTR_H
+
+#include <stdint.h>
+#include <linux/rtnetlink.h>
+
+/**
+ * Indexes attributes of one rtnetlink message by type without copying or
+ * allocating: table[type] points into message, types above max are skipped,
+ * missing ones stay NULL. table must have max + 1 entries.
+ */
+void netlink_parse_attributes(const struct rtattr* table[], int max,
+							  const struct rtattr* attribute, int length);
+
+/**
+ * Payload of attribute, NULL if it is missing or shorter than size
+ */
+const void* netlink_attribute_data(const struct rtattr* attribute, size_t size);
+
+#endif
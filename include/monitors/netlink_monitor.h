@@ -0,0 +1,46 @@
+#ifndef NETLINK_MONITOR_H
+#define NETLINK_MONITOR_H
+
+#include <net/if.h>
+#include "monitor_alloc.h"
+#include "ingest.h"
+
+struct monitor_t;
+typedef struct monitor_t* monitor_t;
+
+/**
+ * Last reported state of link, kept direct-mapped by interface index
+ * so only changes are reported and addresses/routes get link names
+ */
+#define NETLINK_LINKS_COUNT		256
+
+struct netlink_link {
+	int index;				// 0 if slot is empty
+	unsigned int state;
+	char name[IF_NAMESIZE];
+};
+
+struct netlink_monitor {
+	int socket_fd;
+	unsigned long overruns;		// ENOBUFS, messages were lost
+	ingest_source_t source;
+	struct netlink_link links[NETLINK_LINKS_COUNT];
+};
+
+typedef struct netlink_monitor* netlink_monitor_t;
+
+extern struct monitor_slab netlink_monitor_slab;
+
+int netlink_monitor_from_args(int argc, char* argv[], monitor_t*);
+
+int netlink_start(monitor_t);
+
+int netlink_stop(monitor_t);
+
+void netlink_join(monitor_t);
+
+int netlink_monitor_destroy(monitor_t);
+
+void netlink_print_usage();
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef NETSTAT_MONITOR_H
+#define NETSTAT_MONITOR_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <net/if.h>
+#include "monitor_alloc.h"
+#include "ingest.h"
+
+struct monitor_t;
+typedef struct monitor_t* monitor_t;
+
+#define NETSTAT_DIRECTIONS		2	// rx, tx
+
+/**
+ * Counters of interface at previous sample and rates last reported for it
+ */
+struct netstat_interface {
+	int index;
+	int seen;					// in current dump, interfaces gone from it are dropped
+	char name[IF_NAMESIZE];
+	long sampled_at_ns;			// dump which updated counters, rate is taken since it
+	uint64_t bytes[NETSTAT_DIRECTIONS];
+	uint64_t faults[NETSTAT_DIRECTIONS];		// errors + drops
+	double reported_rate[NETSTAT_DIRECTIONS];
+	int above_threshold[NETSTAT_DIRECTIONS];
+};
+
+struct netstat_monitor {
+	long interval_ms;
+	double threshold;			// bytes/s, 0 if not set
+	double change_percent;
+	int timer_fd;
+	int socket_fd;
+	uint32_t sequence;
+	int dump_pending;			// requested, neither done nor failed yet
+	long dump_started_ns;
+	int dump_cursor;
+	unsigned long dumps_completed;
+	unsigned long dumps_abandoned;
+	struct netstat_interface* interfaces;
+	int interfaces_count;
+	int interfaces_capacity;
+	ingest_source_t source;		// sampling timer
+	ingest_source_t dump_source;
+	atomic_int live_sources;	// monitor is dead once both were released
+};
+
+typedef struct netstat_monitor* netstat_monitor_t;
+
+extern struct monitor_slab netstat_monitor_slab;
+
+int netstat_monitor_from_args(int argc, char* argv[], monitor_t*);
+
+int netstat_start(monitor_t);
+
+int netstat_stop(monitor_t);
+
+void netstat_join(monitor_t);
+
+int netstat_monitor_destroy(monitor_t);
+
+void netstat_print_usage();
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef PATH_FILTER_H
+#define PATH_FILTER_H
+
+/**
+ * Byte trie stored in flat node array. Used for prefix patterns ("name*"),
+ * literal names and, walked over reversed names, suffix patterns ("*.log").
+ */
+struct pattern_trie_node {
+	int first_child;
+	int next_sibling;
+	unsigned char byte;
+	unsigned char flags;
+};
+
+struct pattern_trie {
+	struct pattern_trie_node* nodes;
+	int nodes_count;
+	int nodes_capacity;
+};
+
+/**
+ * Set of glob patterns compiled into prefix and suffix tries. Only patterns
+ * which are not plain literal/prefix/suffix fall back to fnmatch.
+ */
+struct path_matcher {
+	struct pattern_trie prefixes;
+	struct pattern_trie suffixes;
+	char** globs;
+	int globs_count;
+	int patterns_count;
+};
+
+/**
+ * Name is accepted if it matches no exclude pattern and, when include
+ * patterns are given, matches at least one of them.
+ */
+struct path_filter {
+	struct path_matcher include;
+	struct path_matcher exclude;
+};
+
+typedef struct path_filter* path_filter_t;
+
+path_filter_t path_filter_new();
+
+int path_filter_add(path_filter_t, const char* pattern, int exclude);
+
+int path_filter_accepts(path_filter_t, const char* name);
+
+void path_filter_destroy(path_filter_t);
+
+#endif
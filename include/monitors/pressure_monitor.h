@@ -0,0 +1,54 @@
+#ifndef PRESSURE_MONITOR_H
+#define PRESSURE_MONITOR_H
+
+#include <stdatomic.h>
+#include "monitor_alloc.h"
+#include "ingest.h"
+
+struct monitor_t;
+typedef struct monitor_t* monitor_t;
+
+#define PRESSURE_RESOURCES_COUNT	3	// memory, cpu, io
+
+/**
+ * PSI trigger registered on one pressure file, the descriptor stays open
+ * both to keep trigger and to read averages when it fires
+ */
+struct pressure_trigger {
+	monitor_t monitor;
+	int fd;
+	const char* directory;		// /proc/pressure or cgroup directory
+	const char* resource;
+	unsigned long fired;
+	ingest_source_t source;
+};
+
+struct pressure_monitor {
+	int full;					// all tasks stalled instead of some
+	long stall_us;
+	long window_us;
+	int resources;				// bit per resource
+	const char** directories;
+	int directories_count;
+	struct pressure_trigger* triggers;
+	int triggers_count;
+	atomic_int live_sources;	// monitor is dead once all were released
+};
+
+typedef struct pressure_monitor* pressure_monitor_t;
+
+extern struct monitor_slab pressure_monitor_slab;
+
+int pressure_monitor_from_args(int argc, char* argv[], monitor_t*);
+
+int pressure_start(monitor_t);
+
+int pressure_stop(monitor_t);
+
+void pressure_join(monitor_t);
+
+int pressure_monitor_destroy(monitor_t);
+
+void pressure_print_usage();
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef PROCESS_MONITOR_H
+#define PROCESS_MONITOR_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "monitor_alloc.h"
+#include "ingest.h"
+
+struct monitor_t;
+typedef struct monitor_t* monitor_t;
+
+/**
+ * Names of recently seen processes, so exits (when /proc entry may be gone)
+ * are still reported with name. Least recently used entry is replaced.
+ */
+#define PROCESS_CACHE_SIZE		1024	// power of two
+#define PROCESS_COMM_LENGTH		16		// TASK_COMM_LEN
+
+#define PROCESS_EVENT_FORK		1
+#define PROCESS_EVENT_EXEC		2
+#define PROCESS_EVENT_EXIT		3
+#define PROCESS_EVENT_OVERRUN	4
+
+/**
+ * Reported fields of proc connector message
+ */
+struct process_message {
+	uint32_t kind;				// PROCESS_EVENT_*, 0 for other proc events
+	pid_t pid;					// tgid
+	int detail;					// parent tgid of fork, wait status of exit
+};
+
+struct process_entry {
+	pid_t pid;					// 0 if entry is free
+	int matches;				// passes --comm/--cgroup filters
+	int newer;					// LRU list, -1 at ends
+	int older;
+	int next;					// hash chain, -1 at end
+	char comm[PROCESS_COMM_LENGTH];
+};
+
+struct process_monitor {
+	int socket_fd;
+	char comm_filter[PROCESS_COMM_LENGTH];	// empty if not set
+	const char* cgroup_filter;				// interned, NULL if not set
+	unsigned long overruns;		// ENOBUFS, messages were lost
+	unsigned long received;
+	ingest_source_t source;
+	// touched only by worker of the monitor
+	int newest;
+	int oldest;
+	int cached;
+	int buckets[PROCESS_CACHE_SIZE];
+	struct process_entry cache[PROCESS_CACHE_SIZE];
+};
+
+typedef struct process_monitor* process_monitor_t;
+
+extern struct monitor_slab process_monitor_slab;
+
+int process_monitor_from_args(int argc, char* argv[], monitor_t*);
+
+int process_start(monitor_t);
+
+int process_stop(monitor_t);
+
+void process_join(monitor_t);
+
+int process_monitor_destroy(monitor_t);
+
+void process_print_usage();
+
+/**
+ * Attaches socket filter which passes only fork, exec and exit of
+ * processes, so it can be checked on any socket
+ */
+int process_attach_filter(int fd);
+
+/**
+ * Decodes netlink message of proc connector, fails on messages which are
+ * too short or of other connector
+ */
+int process_decode(const char* data, size_t length, struct process_message*);
+
+#endif
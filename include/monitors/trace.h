@@ -0,0 +1,77 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+
+struct monitor_t;
+typedef struct monitor_t* monitor_t;
+
+/**
+ * Trace keeps raw inputs of one monitor as backend got them, so they can be
+ * fed again through the same decoding and dispatch without root, devices
+ * or system bus. Records are written in order they were received.
+ */
+
+#define TRACE_MAGIC					0x544d4c53	// "SLMT" in little endian
+#define TRACE_VERSION				1
+
+#define TRACE_SOURCE_INOTIFY		1	// bytes read from inotify descriptor
+#define TRACE_SOURCE_INOTIFY_WATCHES 2	// parent and file watch descriptors
+#define TRACE_SOURCE_UEVENT			3	// KEY=VALUE\0 properties of udev device
+#define TRACE_SOURCE_DBUS_SIGNAL	4	// signal name\0 type\0 serialized GVariant
+
+#define TRACE_REPLAY_ORIGINAL_SPEED	0
+#define TRACE_REPLAY_AS_FAST		1
+
+struct trace_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t monitor_type;
+	uint32_t reserved;
+};
+
+/**
+ * Record header, payload follows padded to 8 bytes
+ */
+struct trace_record {
+	uint64_t time_ns;			// since recording started
+	uint32_t source;
+	uint32_t length;
+};
+
+extern atomic_int trace_recording;
+
+static inline int trace_is_recording() {
+	return atomic_load_explicit(&trace_recording, memory_order_relaxed);
+}
+
+/**
+ * Creates trace file for inputs of monitor, which is not started yet
+ */
+int trace_record_start(const char* path, monitor_t);
+
+/**
+ * Closes trace, returns number of records written to it
+ */
+unsigned long trace_record_stop();
+
+/**
+ * Appends record made of parts, may be called from any thread
+ */
+void trace_write(uint32_t source, const struct iovec* parts, int parts_count);
+
+/**
+ * Feeds records of trace to monitor which was created with same arguments
+ * as recorded one but not started, then waits until its events are processed
+ */
+int trace_replay(const char* path, monitor_t, int speed);
+
+/**
+ * Makes running replay return after current record, safe in signal handler
+ */
+void trace_replay_stop();
+
+#endif
@@ -1,23 +1,65 @@
 #ifndef UDEVs_MONITOR_H
 #define UDEVs_MONITOR_H
 
-#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "monitor_alloc.h"
+#include "ingest.h"
 
 struct monitor_t;
 typedef struct monitor_t* monitor_t;
 
+struct udev;
+struct udev_monitor;
+
 #define UDEV_MONITOR_TYPE_POWER		1
 #define UDEV_MONITOR_TYPE_BLUETOOTH	2
+#define UDEV_MONITOR_TYPE_DISKS		3
+
+/**
+ * Socket buffer of disks monitor, all block devices of a hub or
+ * enclosure are announced at once
+ */
+#define UDEV_DISKS_RECEIVE_BUFFER	(1 << 20)
+
+/**
+ * Properties of device kept in trace record, the rest is dropped
+ */
+#define TRACE_UEVENT_MAX_PROPERTIES	128
+
+/**
+ * Where monitor takes devices from. open registers source in ingestion
+ * engine, close runs once it was released.
+ */
+struct udev_source_ops {
+	int (*open)(monitor_t);
+	void (*close)(monitor_t);
+};
+
+/**
+ * udev netlink socket, default
+ */
+extern const struct udev_source_ops udev_netlink_source;
+
+/**
+ * Descriptor delivering KEY=VALUE\0 property lists, one per datagram,
+ * e.g. socketpair fed by benchmark. Monitor dies when it is closed.
+ */
+extern const struct udev_source_ops udev_datagram_source;
 
 struct z_udev_monitor {
 	int type;
-
-	pthread_t thread;
-	pthread_mutex_t state_mutex;
+	const struct udev_source_ops* source_ops;
+	struct udev* udev;
+	struct udev_monitor* connection;
+	int datagram_fd;
+	ingest_source_t source;
 };
 
 typedef struct z_udev_monitor* udev_monitor_t;
 
+extern struct monitor_slab udev_monitor_slab;
+
 
 int udev_monitor_from_args(int argc, char* argv[], monitor_t*);
 
@@ -29,6 +71,23 @@ void udev_join(monitor_t);
 
 int udev_monitor_destroy(monitor_t);
 
+/**
+ * Makes monitor, which is not started yet, take devices from datagrams of fd
+ * instead of udev. Monitor owns fd afterwards.
+ */
+int udev_monitor_use_datagrams(monitor_t, int fd);
+
+/**
+ * Decodes input recorded in trace, runs on replaying thread
+ */
+int udev_replay(monitor_t, uint32_t source, const char* data, size_t length);
+
+/**
+ * Feeds count synthetic uevents through socketpair and reports ns per
+ * event or their latency, see inject_events
+ */
+int udev_inject(monitor_t, unsigned long count, int mode);
+
 
 void udev_print_usage(int type);
 
@@ -0,0 +1,19 @@
+#ifndef MONOTONIC_H
+#define MONOTONIC_H
+
+#include <time.h>
+
+/**
+ * CLOCK_MONOTONIC in nanoseconds, for timing and deadlines
+ */
+static inline long monotonic_ns() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+static inline long monotonic_us() {
+	return monotonic_ns() / 1000;
+}
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+/**
+ * Benchmarks and stress checks run as "slm bench <name> [arguments]".
+ * Results are logged with log_info, so numbers of two builds can be
+ * compared line by line. Returns exit status of slm.
+ */
+int run_benchmark(int argc, char* argv[]);
+
+/**
+ * Prints names and arguments of available benchmarks
+ */
+void print_benchmarks_usage();
+
+#endif //BENCHMARKS_H
@@ -9,23 +9,88 @@
 #include <monitors/monitor.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include "logging.h"
-#include "glib.h"
+#include "daemon/watch_state.h"
+#include "hot_files.h"
 
 #define COMMAND_BUFFER_SIZE 1024
+#define DEFAULT_WORKERS_COUNT 2
+#define DEFAULT_STATE_INTERVAL 300
+#define DEFAULT_HOT_INTERVAL 600
 
 static char* log_file_name = NULL;
 static char* conf_file_name = NULL;
 static char* error_file_name = NULL;
 static char* pid_file_name = NULL;
+static char* state_file_name = NULL;
 
-static FILE* log_file = NULL;
-static FILE* error_file = NULL;
+static long log_max_size = 0;
+static long log_rotate_interval = 0;
+static int log_compress = 0;
+static int log_stream_compress = 0;
+static int workers_count = DEFAULT_WORKERS_COUNT;
+static int state_interval = DEFAULT_STATE_INTERVAL;
+static int hot_files_count = 0;
+static int hot_interval = DEFAULT_HOT_INTERVAL;
+static time_t next_state_save = 0;
+static time_t next_hot_report = 0;
 
-static int running = 1;
-static GArray* monitors_array = NULL;
+static volatile sig_atomic_t running = 1;
+static volatile sig_atomic_t reopen_logs_requested = 0;
+static volatile sig_atomic_t reload_requested = 0;
+static volatile sig_atomic_t timer_expired = 0;
+static volatile sig_atomic_t log_level_requested = 0;
+static volatile sig_atomic_t log_level_request = -1;	// -1 toggles info and debug
+static monitor_t* monitors_array = NULL;
 static int monitors_array_size = 0;
+static int monitors_array_capacity = 0;
+// config line of each monitor, log level requests are numbered by it
+static int* monitors_lines = NULL;
+
+/*
+ * Persists state of paths watched by file monitors. With report set,
+ * first logs what changed since last saved state.
+ */
+static void sync_watch_state(int report) {
+	if (state_file_name == NULL) return;
+	struct watch_root* roots = (struct watch_root*)malloc(
+			(monitors_array_size + 1) * sizeof(struct watch_root));
+	if (roots == NULL) {
+		log_error("cannot save watch state: out of memory");
+		return;
+	}
+	int roots_count = 0;
+	for (int i = 0; i < monitors_array_size; i++) {
+		monitor_t monitor = monitors_array[i];
+		if (monitor->type == MONITOR_TYPE_INOTIFY) {
+			roots[roots_count].path = monitor->inotify->file_path;
+			roots[roots_count].filter = monitor->inotify->filter;
+			roots_count++;
+		}
+	}
+	if (watch_state_sync(state_file_name, roots, roots_count, report) != CALL_SUCCESS) {
+		log_error("cannot save watch state to %s", state_file_name);
+	}
+	free(roots);
+}
+
+static int add_monitor(monitor_t monitor, int line) {
+	if (monitors_array_size == monitors_array_capacity) {
+		int capacity = monitors_array_capacity > 0 ? monitors_array_capacity * 2 : 16;
+		monitor_t* monitors = (monitor_t*)realloc(monitors_array, capacity * sizeof(monitor_t));
+		if (monitors == NULL) return E_OUT_OF_MEMORY;
+		monitors_array = monitors;
+		int* lines = (int*)realloc(monitors_lines, capacity * sizeof(int));
+		if (lines == NULL) return E_OUT_OF_MEMORY;
+		monitors_lines = lines;
+		monitors_array_capacity = capacity;
+	}
+	monitors_lines[monitors_array_size] = line;
+	monitors_array[monitors_array_size++] = monitor;
+	return CALL_SUCCESS;
+}
 
 int apply_configs() {
 	FILE* conf_file = fopen(conf_file_name, "r");
@@ -67,12 +132,22 @@ int apply_configs() {
 				token = strtok (NULL, " ");
 			}
 		}
+		if (argc == 0) {
+			// blank line, still counted so monitors keep their numbers
+			parsing_line++;
+			continue;
+		}
 		monitor_t new_monitor;
-		log_info("Starting monitor %s", argv[0]);
+		log_info("Starting monitor %s from config line %d", argv[0], parsing_line);
 		if (monitor_from_args(argc, argv, &new_monitor) == CALL_SUCCESS) {
-			g_array_append_val(monitors_array, new_monitor);
-			monitors_array_size++;
-			start_monitor(new_monitor);
+			if (add_monitor(new_monitor, parsing_line) != CALL_SUCCESS) {
+				destroy_monitor(new_monitor);
+				fclose(conf_file);
+				return E_OUT_OF_MEMORY;
+			}
+			if (start_monitor(new_monitor) != CALL_SUCCESS) {
+				log_error("Cannot start monitor from config line %d", parsing_line);
+			}
 		} else {
 			log_error("Cannot parse line %d: %s", parsing_line, argv_string_copy);
 		}
@@ -81,24 +156,34 @@ int apply_configs() {
 
 	fclose(conf_file);
 
+	struct monitor_memory_stats stats;
+	get_monitor_memory_stats(&stats);
+	if (stats.monitors > 0) {
+		log_info("%zu monitors use %zu bytes (%zu in objects, %zu in paths), %zu bytes per monitor",
+				 stats.monitors, stats.slab_bytes + stats.path_bytes, stats.slab_bytes,
+				 stats.path_bytes, (stats.slab_bytes + stats.path_bytes) / stats.monitors);
+	}
+
+	// monitors are already running, so nothing falls between sweep and watch
+	sync_watch_state(1);
 	return CALL_SUCCESS;
 }
 
 static void kill_all_monitors() {
 	for (int i = 0; i < monitors_array_size; i++) {
-		monitor_t monitor = g_array_index(monitors_array, monitor_t, i);
+		monitor_t monitor = monitors_array[i];
 		stop_monitor(monitor);
 	}
 	for (int i = 0; i < monitors_array_size; i++) {
-		monitor_t monitor = g_array_index(monitors_array, monitor_t, i);
+		monitor_t monitor = monitors_array[i];
 		join_monitor(monitor);
 		destroy_monitor(monitor);
 	}
-	g_array_free(monitors_array, TRUE);
 	monitors_array_size = 0;
 }
 
 int reload_configs() {
+	sync_watch_state(0);
 	kill_all_monitors();
 	return apply_configs();
 }
@@ -106,13 +191,96 @@ int reload_configs() {
 
 void signal_handler(int signal) {
 	if (signal == SIGINT) {
-		kill_all_monitors();
 		running = 0;
 	} else if (signal == SIGHUP) {
-		reload_configs();
+		reload_requested = 1;
+	} else if (signal == SIGUSR1) {
+		reopen_logs_requested = 1;
+	} else if (signal == SIGALRM) {
+		timer_expired = 1;
 	}
 }
 
+/*
+ * SIGUSR2 carries LOG_LEVEL_REQUEST as sigqueue value
+ */
+void log_level_handler(int signal, siginfo_t* info, void* context) {
+	log_level_request = info->si_code == SI_QUEUE ? info->si_value.sival_int : -1;
+	log_level_requested = 1;
+}
+
+/*
+ * Monitor of request is numbered by config line, returns request numbered
+ * by position in monitors_array or -1 if no monitor started from that line
+ */
+static int request_by_position(int request) {
+	int line = request >> 8;
+	if (line == 0) return request;
+	for (int i = 0; i < monitors_array_size; i++) {
+		if (monitors_lines[i] == line) return LOG_LEVEL_REQUEST(i + 1, request & 0xff);
+	}
+	return -1;
+}
+
+static void apply_log_level_request() {
+	int request = log_level_request;
+	if (request < 0) {
+		request = LOG_LEVEL_REQUEST(0, atomic_load(&log_level) == LOG_LEVEL_DEBUG
+									   ? LOG_LEVEL_INFO : LOG_LEVEL_DEBUG);
+	}
+	int position_request = request_by_position(request);
+	if (position_request < 0) {
+		log_error("no monitor runs from config line %d", request >> 8);
+	} else if (set_monitors_log_level(monitors_array, monitors_array_size,
+									  position_request) != CALL_SUCCESS) {
+		log_error("invalid log level request %d", request);
+	} else if (request >> 8 == 0) {
+		log_info("log level set to %s", log_level_name(request & 0xff));
+	} else {
+		log_info("log level of monitor from config line %d set to %s", request >> 8,
+				 log_level_name(request & 0xff));
+	}
+}
+
+/*
+ * Periodic state saves and hot files reports share one alarm,
+ * it is armed for the nearest of them
+ */
+static void schedule_alarm() {
+	time_t next = next_state_save;
+	if (next_hot_report != 0 && (next == 0 || next_hot_report < next)) {
+		next = next_hot_report;
+	}
+	if (next == 0) return;
+	time_t now = time(NULL);
+	alarm(next > now ? (unsigned int)(next - now) : 1);
+}
+
+static void run_periodic_tasks() {
+	time_t now = time(NULL);
+	if (next_state_save != 0 && now >= next_state_save) {
+		sync_watch_state(0);
+		next_state_save = now + state_interval;
+	}
+	if (next_hot_report != 0 && now >= next_hot_report) {
+		hot_files_report(hot_files_count, 1);
+		next_hot_report = now + hot_interval;
+	}
+	schedule_alarm();
+}
+
+static long parse_size(const char* size_string) {
+	char* suffix;
+	long size = strtol(size_string, &suffix, 10);
+	switch (*suffix) {
+		case 'G': size *= 1024;	// fall through
+		case 'M': size *= 1024;	// fall through
+		case 'K': size *= 1024;	break;
+		default: {}
+	}
+	return size;
+}
+
 int daemonize() {
 	pid_t pid, sid;
 	pid = fork();
@@ -136,17 +304,13 @@ int daemonize() {
 	for (int fd = 0; fd <= sysconf(_SC_OPEN_MAX); fd++) {
 		close(fd);
 	}
-	log_file = fopen(log_file_name, "a");
-	if (log_file == NULL || dup2(fileno(log_file), fileno(stdout)) == -1) {
-		printf("can not open logs\n");
+	open("/dev/null", O_RDONLY);	// takes stdin slot
+	if (set_log_files(log_file_name, error_file_name) != CALL_SUCCESS) {
 		return E_OPEN_LOGS;
 	}
-
-	error_file = fopen(error_file_name, "a");
-	if (error_file == NULL || dup2(fileno(error_file), fileno(stderr)) == -1) {
-		log_error("cannot open error file %", error_file_name);
-		error_file = log_file;
-		dup2(fileno(stderr), fileno(error_file));
+	set_log_rotation(log_max_size, log_rotate_interval, log_compress);
+	if (set_log_stream_compression(log_stream_compress) != CALL_SUCCESS) {
+		log_error("cannot enable compressed log stream, writing plain text");
 	}
 
 	FILE* pid_file = fopen(pid_file_name, "w");
@@ -170,13 +334,22 @@ int main(int argc, char *argv[]) {
 		{"log-file", required_argument, 0, 'l'},
 		{"pid-file", required_argument, 0, 'p'},
 		{"error-file", optional_argument, 0, 'e'},
+		{"log-max-size", required_argument, 0, 's'},
+		{"log-rotate-interval", required_argument, 0, 'i'},
+		{"log-compress", no_argument, 0, 'z'},
+		{"log-stream-compress", no_argument, 0, 'x'},
+		{"workers", required_argument, 0, 'w'},
+		{"state-file", required_argument, 0, 'f'},
+		{"state-interval", required_argument, 0, 't'},
+		{"hot-files", required_argument, 0, 'k'},
+		{"hot-interval", required_argument, 0, 'r'},
 		{NULL, 0, 0, 0}
 	};
 
 	int current_option = -1;
 	int c;
 	initialize_logging();
-	while ((c = getopt_long(argc, argv, "+l:c:p:e", options, &current_option)) != -1) {
+	while ((c = getopt_long(argc, argv, "+l:c:p:es:i:zxw:f:t:k:r:", options, &current_option)) != -1) {
 		switch (c) {
 			case 'c': {
 				conf_file_name = optarg;
@@ -190,6 +363,42 @@ int main(int argc, char *argv[]) {
 				error_file_name = optarg;
 				break;
 			}
+			case 's': {
+				log_max_size = parse_size(optarg);
+				break;
+			}
+			case 'i': {
+				log_rotate_interval = strtol(optarg, NULL, 10);
+				break;
+			}
+			case 'z': {
+				log_compress = 1;
+				break;
+			}
+			case 'w': {
+				workers_count = (int)strtol(optarg, NULL, 10);
+				break;
+			}
+			case 'x': {
+				log_stream_compress = 1;
+				break;
+			}
+			case 'f': {
+				state_file_name = optarg;
+				break;
+			}
+			case 't': {
+				state_interval = (int)strtol(optarg, NULL, 10);
+				break;
+			}
+			case 'k': {
+				hot_files_count = (int)strtol(optarg, NULL, 10);
+				break;
+			}
+			case 'r': {
+				hot_interval = (int)strtol(optarg, NULL, 10);
+				break;
+			}
 			case 'p': {
 				log_info("pid file: %s", optarg);
 				pid_file_name = optarg;
@@ -211,11 +420,29 @@ int main(int argc, char *argv[]) {
 	}
 
 	struct sigaction systemctl_sigaction;
+	memset(&systemctl_sigaction, 0, sizeof(systemctl_sigaction));
 	systemctl_sigaction.sa_handler = signal_handler;
 	sigaction(SIGINT, &systemctl_sigaction, NULL);
 	sigaction(SIGHUP, &systemctl_sigaction, NULL);
+	sigaction(SIGUSR1, &systemctl_sigaction, NULL);
+	sigaction(SIGALRM, &systemctl_sigaction, NULL);
+	struct sigaction level_sigaction;
+	memset(&level_sigaction, 0, sizeof(level_sigaction));
+	level_sigaction.sa_sigaction = log_level_handler;
+	level_sigaction.sa_flags = SA_SIGINFO;
+	sigaction(SIGUSR2, &level_sigaction, NULL);
+
+	// handled signals are delivered only inside sigsuspend, so none is missed
+	sigset_t handled_signals;
+	sigset_t wait_mask;
+	sigemptyset(&handled_signals);
+	sigaddset(&handled_signals, SIGINT);
+	sigaddset(&handled_signals, SIGHUP);
+	sigaddset(&handled_signals, SIGUSR1);
+	sigaddset(&handled_signals, SIGALRM);
+	sigaddset(&handled_signals, SIGUSR2);
+	sigprocmask(SIG_BLOCK, &handled_signals, &wait_mask);
 
-	monitors_array = g_array_new(FALSE, FALSE, sizeof(monitor_t));
 	log_info("before daemonize");
 	int call_result = daemonize();
 
@@ -227,15 +454,63 @@ int main(int argc, char *argv[]) {
 		return call_result;
 	}
 
+	if (event_pipeline_start(workers_count, EVENT_QUEUE_CAPACITY) != CALL_SUCCESS) {
+		log_error("cannot start event workers, processing events in monitor threads");
+	}
+	if (ingest_start() != CALL_SUCCESS) {
+		log_error("cannot start ingestion engine, exit");
+		event_pipeline_stop();
+		return EXIT_FAILURE;
+	}
+
+	if (hot_files_count > 0
+		&& hot_files_enable(hot_files_count * HOT_FILES_CAPACITY_FACTOR) != CALL_SUCCESS) {
+		log_error("cannot count hot files");
+		hot_files_count = 0;
+	}
+
 	call_result = apply_configs();
 	if (call_result != EXIT_SUCCESS) {
-		fclose(log_file);
-		if (error_file != log_file) fclose(error_file);
 		return call_result;
 	}
 
-	while(running) pause();
+	if (state_file_name != NULL && state_interval > 0) {
+		next_state_save = time(NULL) + state_interval;
+	}
+	if (hot_files_count > 0 && hot_interval > 0) {
+		next_hot_report = time(NULL) + hot_interval;
+	}
+	schedule_alarm();
+	while(running) {
+		sigsuspend(&wait_mask);
+		if (timer_expired) {
+			timer_expired = 0;
+			run_periodic_tasks();
+		}
+		if (reload_requested) {
+			reload_requested = 0;
+			reload_configs();
+		}
+		if (log_level_requested) {
+			log_level_requested = 0;
+			apply_log_level_request();
+		}
+		if (reopen_logs_requested) {
+			reopen_logs_requested = 0;
+			if (reopen_logging() != CALL_SUCCESS) {
+				log_error("cannot reopen log files");
+			} else {
+				log_info("log files were reopened");
+			}
+		}
+	}
 
+	sync_watch_state(0);
+	kill_all_monitors();
+	ingest_stop();
+	event_pipeline_stop();
+	hot_files_report(hot_files_count, 0);
+	hot_files_disable();
 	log_info("daemon is dead");
 	destroy_logging();
 	return EXIT_SUCCESS;
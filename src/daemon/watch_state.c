@@ -0,0 +1,494 @@
+#define _GNU_SOURCE	// statx
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <logging/logging.h>
+#include "errors.h"
+#include "daemon/watch_state.h"
+
+#define SWEEP_BATCH_SIZE		256
+#define SWEEP_MAX_THREADS		8
+#define SWEEP_INITIAL_ENTRIES	1024
+#define SWEEP_INITIAL_NAMES		16384
+
+#define STATX_FIELDS	(STATX_INO | STATX_SIZE | STATX_MTIME | STATX_CTIME)
+
+struct sweep_entry {
+	uint32_t root;
+	int exists;
+	size_t name_offset;
+	uint64_t inode;
+	uint64_t size;
+	int64_t mtime_ns;
+	int64_t ctime_ns;
+};
+
+struct sweep {
+	const struct watch_root* roots;
+	int roots_count;
+	DIR** root_dirs;		// NULL for roots which are not directories
+	size_t* root_first;		// index of first entry of each root
+	struct sweep_entry* entries;
+	size_t entries_count;
+	size_t entries_capacity;
+	char* names;
+	size_t names_size;
+	size_t names_capacity;
+	atomic_size_t next_batch;
+};
+
+struct snapshot {
+	void* data;
+	size_t size;
+	const struct watch_state_header* header;
+	const struct watch_state_root* roots;
+	const struct watch_state_entry* entries;
+	const char* names;
+};
+
+struct sync_counters {
+	unsigned long created;
+	unsigned long modified;
+	unsigned long deleted;
+};
+
+static const char* sort_names;
+
+static uint64_t checksum(const unsigned char* data, size_t length) {
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static int add_entry(struct sweep* sweep, uint32_t root, const char* name) {
+	size_t length = strlen(name);
+	if (sweep->entries_count == sweep->entries_capacity) {
+		size_t capacity = sweep->entries_capacity == 0 ? SWEEP_INITIAL_ENTRIES
+													   : sweep->entries_capacity * 2;
+		struct sweep_entry* entries = (struct sweep_entry*)realloc(
+				sweep->entries, capacity * sizeof(struct sweep_entry));
+		if (entries == NULL) return E_OUT_OF_MEMORY;
+		sweep->entries = entries;
+		sweep->entries_capacity = capacity;
+	}
+	if (sweep->names_size + length + 1 > sweep->names_capacity) {
+		size_t capacity = sweep->names_capacity == 0 ? SWEEP_INITIAL_NAMES
+													 : sweep->names_capacity;
+		while (capacity < sweep->names_size + length + 1) capacity *= 2;
+		char* names = (char*)realloc(sweep->names, capacity);
+		if (names == NULL) return E_OUT_OF_MEMORY;
+		sweep->names = names;
+		sweep->names_capacity = capacity;
+	}
+	struct sweep_entry* entry = &sweep->entries[sweep->entries_count++];
+	memset(entry, 0, sizeof(struct sweep_entry));
+	entry->root = root;
+	entry->name_offset = sweep->names_size;
+	memcpy(sweep->names + sweep->names_size, name, length + 1);
+	sweep->names_size += length + 1;
+	return CALL_SUCCESS;
+}
+
+static int compare_entries(const void* first, const void* second) {
+	return strcmp(sort_names + ((const struct sweep_entry*)first)->name_offset,
+				  sort_names + ((const struct sweep_entry*)second)->name_offset);
+}
+
+/*
+ * Lists roots and their directory entries, single threaded: getdents
+ * returns many names per call, so listing is cheap compared to stat
+ */
+static int list_roots(struct sweep* sweep) {
+	for (int i = 0; i < sweep->roots_count; i++) {
+		sweep->root_first[i] = sweep->entries_count;
+		if (add_entry(sweep, i, "") != CALL_SUCCESS) return E_OUT_OF_MEMORY;
+		DIR* dir = opendir(sweep->roots[i].path);
+		sweep->root_dirs[i] = dir;
+		if (dir == NULL) continue;
+		struct dirent* dirent;
+		while ((dirent = readdir(dir)) != NULL) {
+			if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0) {
+				continue;
+			}
+			if (add_entry(sweep, i, dirent->d_name) != CALL_SUCCESS) return E_OUT_OF_MEMORY;
+		}
+	}
+	sweep->root_first[sweep->roots_count] = sweep->entries_count;
+
+	sort_names = sweep->names;
+	for (int i = 0; i < sweep->roots_count; i++) {
+		qsort(sweep->entries + sweep->root_first[i],
+			  sweep->root_first[i + 1] - sweep->root_first[i],
+			  sizeof(struct sweep_entry), compare_entries);
+	}
+	return CALL_SUCCESS;
+}
+
+static void stat_entry(struct sweep* sweep, struct sweep_entry* entry) {
+	const char* name = sweep->names + entry->name_offset;
+	int dir_fd = AT_FDCWD;
+	if (name[0] == '\0') {
+		name = sweep->roots[entry->root].path;
+	} else {
+		// relative to already opened directory, so path is not resolved again
+		dir_fd = dirfd(sweep->root_dirs[entry->root]);
+	}
+	struct statx attributes;
+	if (statx(dir_fd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+			  STATX_FIELDS, &attributes) != 0) {
+		entry->exists = 0;
+		return;
+	}
+	entry->exists = 1;
+	entry->inode = attributes.stx_ino;
+	entry->size = attributes.stx_size;
+	entry->mtime_ns = attributes.stx_mtime.tv_sec * 1000000000LL + attributes.stx_mtime.tv_nsec;
+	entry->ctime_ns = attributes.stx_ctime.tv_sec * 1000000000LL + attributes.stx_ctime.tv_nsec;
+}
+
+static void* sweep_thread(void* sweep_ptr) {
+	struct sweep* sweep = (struct sweep*)sweep_ptr;
+	while (1) {
+		size_t first = atomic_fetch_add(&sweep->next_batch, SWEEP_BATCH_SIZE);
+		if (first >= sweep->entries_count) break;
+		size_t last = first + SWEEP_BATCH_SIZE;
+		if (last > sweep->entries_count) last = sweep->entries_count;
+		for (size_t i = first; i < last; i++) {
+			stat_entry(sweep, &sweep->entries[i]);
+		}
+	}
+	return NULL;
+}
+
+static int stat_entries(struct sweep* sweep) {
+	long threads_count = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t batches = (sweep->entries_count + SWEEP_BATCH_SIZE - 1) / SWEEP_BATCH_SIZE;
+	if (threads_count > SWEEP_MAX_THREADS) threads_count = SWEEP_MAX_THREADS;
+	if ((size_t)threads_count > batches) threads_count = batches;
+	if (threads_count < 1) threads_count = 1;
+
+	atomic_init(&sweep->next_batch, 0);
+	pthread_t threads[SWEEP_MAX_THREADS];
+	int started = 0;
+	// calling thread takes part in sweep too
+	for (int i = 1; i < threads_count; i++) {
+		if (pthread_create(&threads[started], NULL, sweep_thread, sweep) != 0) break;
+		started++;
+	}
+	sweep_thread(sweep);
+	for (int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	return started + 1;
+}
+
+static void release_sweep(struct sweep* sweep) {
+	for (int i = 0; sweep->root_dirs != NULL && i < sweep->roots_count; i++) {
+		if (sweep->root_dirs[i] != NULL) closedir(sweep->root_dirs[i]);
+	}
+	free(sweep->root_dirs);
+	free(sweep->root_first);
+	free(sweep->entries);
+	free(sweep->names);
+}
+
+static int load_snapshot(const char* state_file, struct snapshot* snapshot) {
+	memset(snapshot, 0, sizeof(struct snapshot));
+	int fd = open(state_file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return CALL_FAILURE;
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(struct watch_state_header)) {
+		close(fd);
+		return CALL_FAILURE;
+	}
+	void* data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return CALL_FAILURE;
+	snapshot->data = data;
+	snapshot->size = file_stat.st_size;
+
+	const struct watch_state_header* header = (const struct watch_state_header*)data;
+	size_t expected_size = sizeof(struct watch_state_header)
+			+ header->roots_count * sizeof(struct watch_state_root)
+			+ header->entries_count * sizeof(struct watch_state_entry)
+			+ header->names_size;
+	if (header->magic != WATCH_STATE_MAGIC || header->version != WATCH_STATE_VERSION
+		|| expected_size != snapshot->size || header->names_size == 0
+		|| checksum((const unsigned char*)data + sizeof(struct watch_state_header),
+					snapshot->size - sizeof(struct watch_state_header)) != header->checksum) {
+		log_error("watch state %s is corrupted, ignoring it", state_file);
+		munmap(data, snapshot->size);
+		snapshot->data = NULL;
+		return CALL_FAILURE;
+	}
+	snapshot->header = header;
+	snapshot->roots = (const struct watch_state_root*)(header + 1);
+	snapshot->entries = (const struct watch_state_entry*)(snapshot->roots + header->roots_count);
+	snapshot->names = (const char*)(snapshot->entries + header->entries_count);
+	// offsets are checked once here, last name is terminated, so all are
+	if (snapshot->names[header->names_size - 1] != '\0') {
+		munmap(data, snapshot->size);
+		snapshot->data = NULL;
+		return CALL_FAILURE;
+	}
+	for (uint32_t i = 0; i < header->roots_count; i++) {
+		const struct watch_state_root* root = &snapshot->roots[i];
+		if (root->path_offset >= header->names_size
+			|| root->first_entry > header->entries_count
+			|| root->entries_count > header->entries_count - root->first_entry) {
+			munmap(data, snapshot->size);
+			snapshot->data = NULL;
+			return CALL_FAILURE;
+		}
+	}
+	for (uint32_t i = 0; i < header->entries_count; i++) {
+		if (snapshot->entries[i].name_offset >= header->names_size) {
+			munmap(data, snapshot->size);
+			snapshot->data = NULL;
+			return CALL_FAILURE;
+		}
+	}
+	return CALL_SUCCESS;
+}
+
+static void report_change(const struct watch_root* root, const char* name, const char* what,
+				   unsigned long* counter) {
+	if (name[0] != '\0' && !path_filter_accepts(root->filter, name)) return;
+	(*counter)++;
+	log_info("file %s%s%s was %s while daemon was down", root->path,
+			 name[0] != '\0' ? "/" : "", name, what);
+}
+
+static int entry_changed(const struct watch_state_entry* old, const struct sweep_entry* new) {
+	return old->inode != new->inode || old->size != new->size
+		   || old->mtime_ns != new->mtime_ns || old->ctime_ns != new->ctime_ns;
+}
+
+/*
+ * Both sides are sorted by name, so one merge pass finds all differences
+ */
+static void diff_root(struct snapshot* snapshot, const struct watch_state_root* old_root,
+					  struct sweep* sweep, int root_index, struct sync_counters* counters) {
+	const struct watch_root* root = &sweep->roots[root_index];
+	uint32_t old = old_root->first_entry;
+	uint32_t old_end = old_root->first_entry + old_root->entries_count;
+	size_t new = sweep->root_first[root_index];
+	size_t new_end = sweep->root_first[root_index + 1];
+
+	while (old < old_end || new < new_end) {
+		if (new < new_end && !sweep->entries[new].exists) {
+			new++;
+			continue;
+		}
+		int compare;
+		if (old == old_end) {
+			compare = 1;
+		} else if (new == new_end) {
+			compare = -1;
+		} else {
+			compare = strcmp(snapshot->names + snapshot->entries[old].name_offset,
+							 sweep->names + sweep->entries[new].name_offset);
+		}
+		if (compare < 0) {
+			report_change(root, snapshot->names + snapshot->entries[old].name_offset,
+				   "deleted", &counters->deleted);
+			old++;
+		} else if (compare > 0) {
+			report_change(root, sweep->names + sweep->entries[new].name_offset,
+				   "created", &counters->created);
+			new++;
+		} else {
+			if (entry_changed(&snapshot->entries[old], &sweep->entries[new])) {
+				report_change(root, sweep->names + sweep->entries[new].name_offset,
+					   "modified", &counters->modified);
+			}
+			old++;
+			new++;
+		}
+	}
+}
+
+static void diff_snapshot(struct snapshot* snapshot, struct sweep* sweep,
+						  struct sync_counters* counters) {
+	for (int i = 0; i < sweep->roots_count; i++) {
+		for (uint32_t j = 0; j < snapshot->header->roots_count; j++) {
+			if (strcmp(snapshot->names + snapshot->roots[j].path_offset,
+					   sweep->roots[i].path) == 0) {
+				diff_root(snapshot, &snapshot->roots[j], sweep, i, counters);
+				break;
+			}
+		}
+		// roots missing in snapshot were just added, nothing to compare with
+	}
+}
+
+static int sync_directory(const char* state_file) {
+	char directory[PATH_MAX];
+	const char* slash = strrchr(state_file, '/');
+	if (slash == NULL) {
+		strcpy(directory, ".");
+	} else if (slash == state_file) {
+		strcpy(directory, "/");
+	} else {
+		snprintf(directory, sizeof(directory), "%.*s", (int)(slash - state_file), state_file);
+	}
+	int fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) return CALL_FAILURE;
+	int result = fsync(fd);
+	close(fd);
+	return result == 0 ? CALL_SUCCESS : CALL_FAILURE;
+}
+
+/*
+ * Writes snapshot next to state file and renames it over, so state file is
+ * always either old or new complete snapshot
+ */
+static int write_snapshot(const char* state_file, struct sweep* sweep) {
+	uint32_t entries_count = 0;
+	uint64_t names_size = 0;
+	for (int i = 0; i < sweep->roots_count; i++) {
+		names_size += strlen(sweep->roots[i].path) + 1;
+	}
+	for (size_t i = 0; i < sweep->entries_count; i++) {
+		if (!sweep->entries[i].exists) continue;
+		entries_count++;
+		names_size += strlen(sweep->names + sweep->entries[i].name_offset) + 1;
+	}
+	size_t size = sizeof(struct watch_state_header)
+			+ sweep->roots_count * sizeof(struct watch_state_root)
+			+ entries_count * sizeof(struct watch_state_entry) + names_size;
+
+	char temporary_file[PATH_MAX];
+	if (snprintf(temporary_file, sizeof(temporary_file), "%s.tmp", state_file)
+		>= (int)sizeof(temporary_file)) {
+		return CALL_FAILURE;
+	}
+	int fd = open(temporary_file, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		log_error("cannot write watch state %s: %s", temporary_file, strerror(errno));
+		return CALL_FAILURE;
+	}
+	void* data = MAP_FAILED;
+	if (ftruncate(fd, size) == 0) {
+		data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	if (data == MAP_FAILED) {
+		log_error("cannot write watch state %s: %s", temporary_file, strerror(errno));
+		close(fd);
+		unlink(temporary_file);
+		return CALL_FAILURE;
+	}
+
+	struct watch_state_header* header = (struct watch_state_header*)data;
+	struct watch_state_root* roots = (struct watch_state_root*)(header + 1);
+	struct watch_state_entry* entries = (struct watch_state_entry*)(roots + sweep->roots_count);
+	char* names = (char*)(entries + entries_count);
+	uint64_t names_used = 0;
+	uint32_t entry_index = 0;
+	for (int i = 0; i < sweep->roots_count; i++) {
+		size_t length = strlen(sweep->roots[i].path);
+		roots[i].path_offset = names_used;
+		memcpy(names + names_used, sweep->roots[i].path, length + 1);
+		names_used += length + 1;
+		roots[i].first_entry = entry_index;
+		for (size_t j = sweep->root_first[i]; j < sweep->root_first[i + 1]; j++) {
+			struct sweep_entry* entry = &sweep->entries[j];
+			if (!entry->exists) continue;
+			const char* name = sweep->names + entry->name_offset;
+			length = strlen(name);
+			entries[entry_index].name_offset = names_used;
+			entries[entry_index].inode = entry->inode;
+			entries[entry_index].size = entry->size;
+			entries[entry_index].mtime_ns = entry->mtime_ns;
+			entries[entry_index].ctime_ns = entry->ctime_ns;
+			memcpy(names + names_used, name, length + 1);
+			names_used += length + 1;
+			entry_index++;
+		}
+		roots[i].entries_count = entry_index - roots[i].first_entry;
+	}
+	header->magic = WATCH_STATE_MAGIC;
+	header->version = WATCH_STATE_VERSION;
+	header->roots_count = sweep->roots_count;
+	header->entries_count = entries_count;
+	header->names_size = names_size;
+	header->checksum = checksum((const unsigned char*)data + sizeof(struct watch_state_header),
+								size - sizeof(struct watch_state_header));
+
+	int result = msync(data, size, MS_SYNC);
+	munmap(data, size);
+	if (result != 0 || fsync(fd) != 0) {
+		log_error("cannot write watch state %s: %s", temporary_file, strerror(errno));
+		close(fd);
+		unlink(temporary_file);
+		return CALL_FAILURE;
+	}
+	close(fd);
+	if (rename(temporary_file, state_file) != 0) {
+		log_error("cannot replace watch state %s: %s", state_file, strerror(errno));
+		unlink(temporary_file);
+		return CALL_FAILURE;
+	}
+	sync_directory(state_file);
+	return CALL_SUCCESS;
+}
+
+int watch_state_sync(const char* state_file, const struct watch_root* roots,
+					 int roots_count, int report) {
+	struct timespec started;
+	clock_gettime(CLOCK_MONOTONIC, &started);
+
+	struct sweep sweep;
+	memset(&sweep, 0, sizeof(struct sweep));
+	sweep.roots = roots;
+	sweep.roots_count = roots_count;
+	sweep.root_dirs = (DIR**)calloc(roots_count + 1, sizeof(DIR*));
+	sweep.root_first = (size_t*)calloc(roots_count + 1, sizeof(size_t));
+	if (sweep.root_dirs == NULL || sweep.root_first == NULL) {
+		release_sweep(&sweep);
+		return E_OUT_OF_MEMORY;
+	}
+	if (list_roots(&sweep) != CALL_SUCCESS) {
+		release_sweep(&sweep);
+		return E_OUT_OF_MEMORY;
+	}
+	int threads_count = stat_entries(&sweep);
+
+	struct sync_counters counters = {0, 0, 0};
+	if (report) {
+		struct snapshot snapshot;
+		if (load_snapshot(state_file, &snapshot) == CALL_SUCCESS) {
+			diff_snapshot(&snapshot, &sweep, &counters);
+			munmap(snapshot.data, snapshot.size);
+		}
+	}
+	int result = write_snapshot(state_file, &sweep);
+
+	struct timespec finished;
+	clock_gettime(CLOCK_MONOTONIC, &finished);
+	long elapsed_ms = (finished.tv_sec - started.tv_sec) * 1000
+					  + (finished.tv_nsec - started.tv_nsec) / 1000000;
+	if (report) {
+		log_info("watch state: %zu paths swept in %ld ms by %d threads, "
+				 "%lu created, %lu modified, %lu deleted while daemon was down",
+				 sweep.entries_count, elapsed_ms, threads_count,
+				 counters.created, counters.modified, counters.deleted);
+	}
+	release_sweep(&sweep);
+	return result;
+}
@@ -2,70 +2,691 @@
 #include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <memory.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#ifdef SLM_WITH_ZLIB
+	#include <zlib.h>
+#endif
 #include "errors.h"
 #include "logging.h"
 
-#define ERROR_TYPE_LABEL 	"ERROR"
-#define INFO_TYPE_LABEL 	"INFO"
+#define LOG_LEVEL_ENVIRONMENT	"SLM_LOG_LEVEL"
+
+#define ROTATED_NAME_LENGTH		4096
+#define COMPRESS_QUEUE_SIZE		16
+#define COMPRESS_BUFFER_SIZE	65536
+
+#define STREAM_BLOCK_SIZE		65536
+#define STREAM_BLOCKS_COUNT		3
+#define STREAM_FLUSH_TIMEOUT	1
+#define STREAM_FRAME_MAGIC		0x5a4d4c53	// "SLMZ" in little endian
+
+#define COPY_BUFFER_SIZE		65536
 
 static pthread_mutex_t log_mutex;
 
-enum log_type {
-	INFO,
-	ERROR
+static const char* level_labels[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERROR" };
+
+atomic_int log_level = LOG_LEVEL_INFO;
+_Thread_local atomic_int* log_scope = &log_level;
+
+/*
+ * Log file bound to one of standard streams. Stream fd is replaced with dup2,
+ * so FILE* users and monitors never see closed descriptor.
+ */
+struct log_sink {
+	const char* path;
+	int stream_fd;
+	long size;
+	time_t opened_at;
+};
+
+static struct log_sink info_sink = { NULL, STDOUT_FILENO, 0, 0 };
+static struct log_sink error_sink = { NULL, STDERR_FILENO, 0, 0 };
+static int errors_to_log = 0;
+
+static long rotation_max_size = 0;
+static long rotation_interval = 0;
+static int rotation_compress = 0;
+
+static void log_common(const char* format, int level, va_list args);
+static int open_sink_locked(struct log_sink* sink);
+static int rotate_sink_locked(struct log_sink* sink, time_t now);
+static int needs_rotation(struct log_sink* sink, time_t now);
+static int write_fully(int fd, const void* data, size_t length);
+
+#ifdef SLM_WITH_ZLIB
+static pthread_t compress_thread;
+static pthread_mutex_t compress_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compress_cond = PTHREAD_COND_INITIALIZER;
+static char* compress_queue[COMPRESS_QUEUE_SIZE];
+static int compress_queue_head = 0;
+static int compress_queue_length = 0;
+static int compress_running = 0;
+static int compress_stopping = 0;
+
+static void* compressing_thread(void* arg);
+
+/*
+ * Compressed stream is a sequence of independent frames:
+ * magic, raw length, compressed length, crc32 of raw data (all uint32),
+ * followed by zlib data. A crash or torn write loses only the last frame.
+ * Memory is bounded by STREAM_BLOCKS_COUNT blocks: one is being filled by
+ * writers, the rest are waiting for (or under) compression.
+ */
+struct stream_block {
+	size_t length;
+	char data[STREAM_BLOCK_SIZE];
+};
+
+struct stream_frame_header {
+	uint32_t magic;
+	uint32_t raw_length;
+	uint32_t compressed_length;
+	uint32_t checksum;
 };
 
-static void log_common(const char* format, enum log_type, va_list args);
+static struct stream_block stream_blocks[STREAM_BLOCKS_COUNT];
+static pthread_t stream_thread;
+static pthread_mutex_t stream_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stream_cond = PTHREAD_COND_INITIALIZER;
+static int stream_head = 0;
+static int stream_queued = 0;
+static int stream_stopping = 0;
+static unsigned long stream_raw_bytes = 0;
+static unsigned long stream_compressed_bytes = 0;
+// frames written to info sink since it was opened, counted for rotation
+static atomic_long stream_sink_bytes = 0;
+
+static void* stream_compressing_thread(void* arg);
+static int stream_append_locked(const char* time_string, const char* label,
+								const char* format, va_list args);
+static void stream_append_raw_locked(const char* data, size_t length);
+static void stream_submit_locked(int may_wait);
+static void stream_drain_locked();
+#endif
+static int stream_compression = 0;
+static void enqueue_compression(const char* rotated_path);
 
 int initialize_logging() {
 	if (pthread_mutex_init(&log_mutex, NULL) != 0) return CALL_FAILURE;
+	const char* level_name = getenv(LOG_LEVEL_ENVIRONMENT);
+	if (level_name != NULL) {
+		int level = log_level_from_string(level_name);
+		if (level < 0) {
+			log_error("unknown log level %s", level_name);
+		} else {
+			atomic_store(&log_level, level);
+		}
+	}
 	return CALL_SUCCESS;
 }
 
+int log_level_from_string(const char* name) {
+	for (int level = LOG_LEVEL_TRACE; level <= LOG_LEVEL_ERROR; level++) {
+		if (strcasecmp(name, level_labels[level]) == 0) return level;
+	}
+	return -1;
+}
+
+const char* log_level_name(int level) {
+	if (level < LOG_LEVEL_TRACE || level > LOG_LEVEL_ERROR) return "UNKNOWN";
+	return level_labels[level];
+}
+
 int destroy_logging() {
+#ifdef SLM_WITH_ZLIB
+	if (stream_compression) {
+		log_info("compressed log stream: %lu bytes of text written as %lu bytes",
+				 stream_raw_bytes, stream_compressed_bytes);
+		pthread_mutex_lock(&log_mutex);
+		stream_drain_locked();
+		stream_compression = 0;
+		pthread_mutex_unlock(&log_mutex);
+		pthread_mutex_lock(&stream_mutex);
+		stream_stopping = 1;
+		pthread_cond_broadcast(&stream_cond);
+		pthread_mutex_unlock(&stream_mutex);
+		pthread_join(stream_thread, NULL);
+	}
+	pthread_mutex_lock(&compress_mutex);
+	int was_running = compress_running;
+	compress_stopping = 1;
+	pthread_cond_signal(&compress_cond);
+	pthread_mutex_unlock(&compress_mutex);
+	if (was_running) pthread_join(compress_thread, NULL);
+#endif
 	if (pthread_mutex_destroy(&log_mutex) != 0) return CALL_FAILURE;
 	return CALL_SUCCESS;
 }
 
-void log_info(const char* format, ...) {
-	va_list args;
-	va_start(args, format);
-	log_common(format, INFO, args);
-	va_end(args);
+int set_log_files(const char* log_path, const char* error_path) {
+	int result = CALL_SUCCESS;
+	pthread_mutex_lock(&log_mutex);
+	info_sink.path = log_path;
+	error_sink.path = error_path;
+	errors_to_log = (error_path == NULL);
+	if (open_sink_locked(&info_sink) != CALL_SUCCESS) {
+		result = CALL_FAILURE;
+	} else if (!errors_to_log && open_sink_locked(&error_sink) != CALL_SUCCESS) {
+		errors_to_log = 1;
+		error_sink.path = NULL;
+		dup2(STDOUT_FILENO, STDERR_FILENO);
+	}
+	pthread_mutex_unlock(&log_mutex);
+	return result;
+}
+
+int reopen_logging() {
+	int result = CALL_SUCCESS;
+	pthread_mutex_lock(&log_mutex);
+#ifdef SLM_WITH_ZLIB
+	// frame being written must not be split between old and new file
+	if (stream_compression && info_sink.path != NULL) {
+		stream_drain_locked();
+	}
+#endif
+	if (info_sink.path != NULL && open_sink_locked(&info_sink) != CALL_SUCCESS) {
+		result = CALL_FAILURE;
+	}
+	if (!errors_to_log && error_sink.path != NULL
+		&& open_sink_locked(&error_sink) != CALL_SUCCESS) {
+		result = CALL_FAILURE;
+	}
+	pthread_mutex_unlock(&log_mutex);
+	return result;
 }
 
-void log_error(const char* format, ...) {
+void set_log_rotation(long max_size, long interval, int compress) {
+	pthread_mutex_lock(&log_mutex);
+	rotation_max_size = max_size;
+	rotation_interval = interval;
+	rotation_compress = compress;
+	pthread_mutex_unlock(&log_mutex);
+#ifdef SLM_WITH_ZLIB
+	if (compress) {
+		pthread_mutex_lock(&compress_mutex);
+		if (!compress_running && pthread_create(&compress_thread, NULL,
+												compressing_thread, NULL) == 0) {
+			compress_running = 1;
+		}
+		pthread_mutex_unlock(&compress_mutex);
+	}
+#else
+	if (compress) {
+		log_error("slm was built without zlib, rotated logs will not be compressed");
+	}
+#endif
+}
+
+int set_log_stream_compression(int enabled) {
+#ifdef SLM_WITH_ZLIB
+	if (!enabled || stream_compression) return CALL_SUCCESS;
+	stream_stopping = 0;
+	if (pthread_create(&stream_thread, NULL, stream_compressing_thread, NULL) != 0) {
+		return CALL_FAILURE;
+	}
+	pthread_mutex_lock(&log_mutex);
+	fflush(stdout);
+	stream_compression = 1;
+	pthread_mutex_unlock(&log_mutex);
+	return CALL_SUCCESS;
+#else
+	return enabled ? CALL_FAILURE : CALL_SUCCESS;
+#endif
+}
+
+void log_message(int level, const char* format, ...) {
 	va_list args;
 	va_start(args, format);
-	log_common(format, ERROR, args);
+	log_common(format, level, args);
 	va_end(args);
 }
 
-static void log_common(const char* format, enum log_type log_type, va_list args) {
-	FILE* log_file = stdout;
-	char* log_label;
-	switch (log_type) {
-		case INFO: {
-			log_file = stdout;
-			log_label = INFO_TYPE_LABEL;
-			break;
+long log_copy_from(int fd, off_t* offset, size_t length) {
+	long copied = 0;
+	pthread_mutex_lock(&log_mutex);
+	time_t now = time(NULL);
+	if (info_sink.path != NULL && needs_rotation(&info_sink, now)) {
+		rotate_sink_locked(&info_sink, now);
+	}
+	fflush(stdout);
+	int use_sendfile = !stream_compression;
+	while ((size_t)copied < length) {
+		ssize_t count = -1;
+		if (use_sendfile) {
+			count = sendfile(info_sink.stream_fd, fd, offset, length - copied);
+			if (count < 0 && (errno == EINVAL || errno == ENOSYS)) {
+				// sink does not take sendfile, e.g. it is a terminal
+				use_sendfile = 0;
+				continue;
+			}
+		} else {
+			static char buffer[COPY_BUFFER_SIZE];
+			size_t chunk = length - copied < sizeof(buffer) ? length - copied : sizeof(buffer);
+			count = pread(fd, buffer, chunk, *offset);
+			if (count > 0) {
+#ifdef SLM_WITH_ZLIB
+				if (stream_compression) {
+					stream_append_raw_locked(buffer, count);
+				} else
+#endif
+				if (write_fully(info_sink.stream_fd, buffer, count) != CALL_SUCCESS) {
+					count = -1;
+				}
+			}
+			if (count > 0) *offset += count;
 		}
-		default:
-		case ERROR: {
-			log_file = stderr;
-			log_label = ERROR_TYPE_LABEL;
+		if (count < 0 && errno == EINTR) continue;
+		if (count <= 0) {
+			if (copied == 0 && count < 0) copied = -1;
+			break;
 		}
+		copied += count;
+	}
+	if (copied > 0 && !stream_compression) info_sink.size += copied;
+	pthread_mutex_unlock(&log_mutex);
+	return copied;
+}
+
+static void log_common(const char* format, int level, va_list args) {
+	FILE* log_file = stdout;
+	struct log_sink* sink = &info_sink;
+	const char* log_label = log_level_name(level);
+	// warnings and errors go to error log
+	if (level >= LOG_LEVEL_WARN) {
+		log_file = stderr;
+		sink = errors_to_log ? &info_sink : &error_sink;
 	}
 	time_t rawtime;
-	struct tm* timeinfo;
-	time(&rawtime);
-	timeinfo = localtime(&rawtime);
+	struct tm timeinfo;
+	char time_buffer[32];
 
 	pthread_mutex_lock(&log_mutex);
-	fprintf(log_file, "%s [%s]: ", strtok(asctime(timeinfo), "\n"), log_label);
-	vfprintf(log_file, format, args);
-	fprintf(log_file, "\n");
-	fflush(log_file);
+	time(&rawtime);
+	localtime_r(&rawtime, &timeinfo);
+	if (sink->path != NULL && needs_rotation(sink, rawtime)) {
+		rotate_sink_locked(sink, rawtime);
+	}
+	const char* time_string = strtok(asctime_r(&timeinfo, time_buffer), "\n");
+#ifdef SLM_WITH_ZLIB
+	if (stream_compression && sink == &info_sink) {
+		// size grows by compressed frames, counted by compressor
+		stream_append_locked(time_string, log_label, format, args);
+	} else
+#endif
+	{
+		int written = fprintf(log_file, "%s [%s]: ", time_string, log_label);
+		written += vfprintf(log_file, format, args);
+		written += fprintf(log_file, "\n");
+		fflush(log_file);
+		if (written > 0) sink->size += written;
+	}
 	pthread_mutex_unlock(&log_mutex);
 }
+
+static int needs_rotation(struct log_sink* sink, time_t now) {
+	long size = sink->size;
+#ifdef SLM_WITH_ZLIB
+	if (sink == &info_sink) size += atomic_load(&stream_sink_bytes);
+#endif
+	if (rotation_max_size > 0 && size >= rotation_max_size) return 1;
+	if (rotation_interval > 0 && now - sink->opened_at >= rotation_interval) return 1;
+	return 0;
+}
+
+/*
+ * Opens sink path and atomically replaces stream descriptor with it.
+ * Must be called with log_mutex held so no line is written in between.
+ */
+static int open_sink_locked(struct log_sink* sink) {
+	int fd = open(sink->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return CALL_FAILURE;
+	}
+	fflush(sink->stream_fd == STDOUT_FILENO ? stdout : stderr);
+	if (fd != sink->stream_fd && dup2(fd, sink->stream_fd) == -1) {
+		close(fd);
+		return CALL_FAILURE;
+	}
+	struct stat file_stat;
+	sink->size = (fstat(fd, &file_stat) == 0) ? file_stat.st_size : 0;
+	sink->opened_at = time(NULL);
+#ifdef SLM_WITH_ZLIB
+	// stream is drained before reopen, so no frame is counted twice
+	if (sink == &info_sink) atomic_store(&stream_sink_bytes, 0);
+#endif
+	if (fd != sink->stream_fd) close(fd);
+	if (sink == &info_sink && errors_to_log) {
+		fflush(stderr);
+		dup2(STDOUT_FILENO, STDERR_FILENO);
+	}
+	return CALL_SUCCESS;
+}
+
+static int rotated_name_taken(const char* rotated_path) {
+	char gz_path[ROTATED_NAME_LENGTH + sizeof(".gz")];
+	snprintf(gz_path, sizeof(gz_path), "%s.gz", rotated_path);
+	return access(rotated_path, F_OK) == 0 || access(gz_path, F_OK) == 0;
+}
+
+static int rotate_sink_locked(struct log_sink* sink, time_t now) {
+	char rotated_path[ROTATED_NAME_LENGTH];
+	char time_suffix[32];
+	struct tm timeinfo;
+	localtime_r(&now, &timeinfo);
+	strftime(time_suffix, sizeof(time_suffix), "%Y%m%d-%H%M%S", &timeinfo);
+
+	snprintf(rotated_path, ROTATED_NAME_LENGTH, "%s.%s", sink->path, time_suffix);
+	for (int i = 1; rotated_name_taken(rotated_path); i++) {
+		snprintf(rotated_path, ROTATED_NAME_LENGTH, "%s.%s.%d", sink->path, time_suffix, i);
+	}
+#ifdef SLM_WITH_ZLIB
+	if (stream_compression && sink == &info_sink) {
+		stream_drain_locked();
+	}
+#endif
+	if (rename(sink->path, rotated_path) != 0) {
+		// keep writing to current file, retry when limits are hit again
+		sink->opened_at = now;
+		sink->size = 0;
+#ifdef SLM_WITH_ZLIB
+		if (sink == &info_sink) atomic_store(&stream_sink_bytes, 0);
+#endif
+		return CALL_FAILURE;
+	}
+	if (open_sink_locked(sink) != CALL_SUCCESS) {
+		return CALL_FAILURE;
+	}
+	if (rotation_compress && !(stream_compression && sink == &info_sink)) {
+		enqueue_compression(rotated_path);
+	}
+	return CALL_SUCCESS;
+}
+
+static int write_fully(int fd, const void* data, size_t length) {
+	const char* position = data;
+	while (length > 0) {
+		ssize_t written = write(fd, position, length);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			return CALL_FAILURE;
+		}
+		position += written;
+		length -= written;
+	}
+	return CALL_SUCCESS;
+}
+
+#ifdef SLM_WITH_ZLIB
+static void enqueue_compression(const char* rotated_path) {
+	pthread_mutex_lock(&compress_mutex);
+	if (compress_running && compress_queue_length < COMPRESS_QUEUE_SIZE) {
+		char* path_copy = strdup(rotated_path);
+		if (path_copy != NULL) {
+			int tail = (compress_queue_head + compress_queue_length) % COMPRESS_QUEUE_SIZE;
+			compress_queue[tail] = path_copy;
+			compress_queue_length++;
+			pthread_cond_signal(&compress_cond);
+		}
+	}
+	// if compressor is behind, segment is just left uncompressed
+	pthread_mutex_unlock(&compress_mutex);
+}
+
+static int compress_file(const char* path) {
+	char gz_path[ROTATED_NAME_LENGTH + sizeof(".gz")];
+	snprintf(gz_path, sizeof(gz_path), "%s.gz", path);
+	int in_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (in_fd < 0) return CALL_FAILURE;
+	gzFile out = gzopen(gz_path, "wb");
+	if (out == NULL) {
+		close(in_fd);
+		return CALL_FAILURE;
+	}
+	char buffer[COMPRESS_BUFFER_SIZE];
+	ssize_t bytes_read;
+	int result = CALL_SUCCESS;
+	while ((bytes_read = read(in_fd, buffer, COMPRESS_BUFFER_SIZE)) > 0) {
+		if (gzwrite(out, buffer, (unsigned)bytes_read) != bytes_read) {
+			result = CALL_FAILURE;
+			break;
+		}
+	}
+	if (bytes_read < 0) result = CALL_FAILURE;
+	if (gzclose(out) != Z_OK) result = CALL_FAILURE;
+	close(in_fd);
+	if (result == CALL_SUCCESS) {
+		unlink(path);
+	} else {
+		unlink(gz_path);
+	}
+	return result;
+}
+
+static void* compressing_thread(void* arg) {
+	pthread_mutex_lock(&compress_mutex);
+	while (1) {
+		while (compress_queue_length == 0 && !compress_stopping) {
+			pthread_cond_wait(&compress_cond, &compress_mutex);
+		}
+		if (compress_queue_length == 0) break;
+		char* path = compress_queue[compress_queue_head];
+		compress_queue_head = (compress_queue_head + 1) % COMPRESS_QUEUE_SIZE;
+		compress_queue_length--;
+		pthread_mutex_unlock(&compress_mutex);
+
+		if (compress_file(path) != CALL_SUCCESS) {
+			log_error("cannot compress rotated log %s", path);
+		}
+		free(path);
+
+		pthread_mutex_lock(&compress_mutex);
+	}
+	compress_running = 0;
+	pthread_mutex_unlock(&compress_mutex);
+	return NULL;
+}
+
+/*
+ * Formats log line into currently filled block. Called with log_mutex held.
+ */
+static int stream_append_locked(const char* time_string, const char* label,
+								const char* format, va_list args) {
+	for (int attempt = 0; attempt < 2; attempt++) {
+		pthread_mutex_lock(&stream_mutex);
+		struct stream_block* block =
+				&stream_blocks[(stream_head + stream_queued) % STREAM_BLOCKS_COUNT];
+		pthread_mutex_unlock(&stream_mutex);
+
+		size_t free_space = STREAM_BLOCK_SIZE - block->length;
+		char* line = block->data + block->length;
+		va_list args_copy;
+		va_copy(args_copy, args);
+		int header_length = snprintf(line, free_space, "%s [%s]: ", time_string, label);
+		int message_length = 0;
+		if (header_length >= 0 && (size_t)header_length < free_space) {
+			message_length = vsnprintf(line + header_length,
+									   free_space - header_length, format, args_copy);
+		}
+		va_end(args_copy);
+		size_t line_length = (size_t)header_length + (size_t)message_length + 1;
+		if (header_length >= 0 && message_length >= 0 && line_length <= free_space) {
+			line[line_length - 1] = '\n';
+			block->length += line_length;
+			return (int)line_length;
+		}
+		if (block->length == 0) {
+			// line is longer than block, store truncated
+			block->length = STREAM_BLOCK_SIZE;
+			block->data[STREAM_BLOCK_SIZE - 1] = '\n';
+			stream_submit_locked(1);
+			return STREAM_BLOCK_SIZE;
+		}
+		stream_submit_locked(1);
+	}
+	return 0;
+}
+
+/*
+ * Appends bytes as they are, splitting them between blocks.
+ * Called with log_mutex held.
+ */
+static void stream_append_raw_locked(const char* data, size_t length) {
+	while (length > 0) {
+		pthread_mutex_lock(&stream_mutex);
+		struct stream_block* block =
+				&stream_blocks[(stream_head + stream_queued) % STREAM_BLOCKS_COUNT];
+		pthread_mutex_unlock(&stream_mutex);
+
+		size_t free_space = STREAM_BLOCK_SIZE - block->length;
+		size_t chunk = length < free_space ? length : free_space;
+		memcpy(block->data + block->length, data, chunk);
+		block->length += chunk;
+		data += chunk;
+		length -= chunk;
+		if (block->length == STREAM_BLOCK_SIZE) stream_submit_locked(1);
+	}
+}
+
+/*
+ * Passes filled block to compressor, waits for free block if all are busy
+ * and may_wait is set. Called with log_mutex held.
+ */
+static void stream_submit_locked(int may_wait) {
+	pthread_mutex_lock(&stream_mutex);
+	struct stream_block* block =
+			&stream_blocks[(stream_head + stream_queued) % STREAM_BLOCKS_COUNT];
+	if (block->length > 0 && (may_wait || stream_queued < STREAM_BLOCKS_COUNT - 1)) {
+		while (stream_queued == STREAM_BLOCKS_COUNT - 1) {
+			pthread_cond_wait(&stream_cond, &stream_mutex);
+		}
+		stream_queued++;
+		stream_blocks[(stream_head + stream_queued) % STREAM_BLOCKS_COUNT].length = 0;
+		pthread_cond_broadcast(&stream_cond);
+	}
+	pthread_mutex_unlock(&stream_mutex);
+}
+
+static void stream_drain_locked() {
+	stream_submit_locked(1);
+	pthread_mutex_lock(&stream_mutex);
+	while (stream_queued > 0) {
+		pthread_cond_wait(&stream_cond, &stream_mutex);
+	}
+	pthread_mutex_unlock(&stream_mutex);
+}
+
+static void* stream_compressing_thread(void* arg) {
+	static Bytef compressed[sizeof(struct stream_frame_header) + STREAM_BLOCK_SIZE + STREAM_BLOCK_SIZE / 1000 + 64];
+	sigset_t blocking_mask;
+	sigfillset(&blocking_mask);
+	pthread_sigmask(SIG_BLOCK, &blocking_mask, NULL);
+
+	pthread_mutex_lock(&stream_mutex);
+	while (1) {
+		if (stream_queued == 0) {
+			if (stream_stopping) break;
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += STREAM_FLUSH_TIMEOUT;
+			if (pthread_cond_timedwait(&stream_cond, &stream_mutex, &deadline) == ETIMEDOUT) {
+				// idle: flush partially filled block so logs show up in time.
+				// Writers wait for this thread with log_mutex held, so it is only
+				// tried: a busy writer submits the block itself or it is retried
+				// after next timeout, queued blocks are re-checked first.
+				pthread_mutex_unlock(&stream_mutex);
+				if (pthread_mutex_trylock(&log_mutex) == 0) {
+					if (stream_compression) stream_submit_locked(0);
+					pthread_mutex_unlock(&log_mutex);
+				}
+				pthread_mutex_lock(&stream_mutex);
+			}
+			continue;
+		}
+		struct stream_block* block = &stream_blocks[stream_head];
+		pthread_mutex_unlock(&stream_mutex);
+
+		struct stream_frame_header header;
+		uLongf compressed_length = sizeof(compressed) - sizeof(struct stream_frame_header);
+		if (compress2(compressed + sizeof(struct stream_frame_header), &compressed_length,
+					  (const Bytef*)block->data, block->length, Z_DEFAULT_COMPRESSION) == Z_OK) {
+			header.magic = STREAM_FRAME_MAGIC;
+			header.raw_length = (uint32_t)block->length;
+			header.compressed_length = (uint32_t)compressed_length;
+			header.checksum = (uint32_t)crc32(0L, (const Bytef*)block->data, block->length);
+			memcpy(compressed, &header, sizeof(header));
+			size_t frame_length = sizeof(struct stream_frame_header) + compressed_length;
+			if (write_fully(STDOUT_FILENO, compressed, frame_length) == CALL_SUCCESS) {
+				stream_raw_bytes += block->length;
+				stream_compressed_bytes += frame_length;
+				atomic_fetch_add(&stream_sink_bytes, frame_length);
+			}
+		}
+
+		pthread_mutex_lock(&stream_mutex);
+		stream_head = (stream_head + 1) % STREAM_BLOCKS_COUNT;
+		stream_queued--;
+		pthread_cond_broadcast(&stream_cond);
+	}
+	pthread_mutex_unlock(&stream_mutex);
+	return NULL;
+}
+
+int dump_compressed_log(const char* path, FILE* output) {
+	FILE* input = fopen(path, "r");
+	if (input == NULL) {
+		fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+		return CALL_FAILURE;
+	}
+	static Bytef compressed[STREAM_BLOCK_SIZE * 2];
+	static Bytef raw[STREAM_BLOCK_SIZE];
+	struct stream_frame_header header;
+	int result = CALL_SUCCESS;
+	long frame_offset = 0;
+	while (fread(&header, sizeof(header), 1, input) == 1) {
+		if (header.magic != STREAM_FRAME_MAGIC
+			|| header.raw_length > STREAM_BLOCK_SIZE
+			|| header.compressed_length > sizeof(compressed)) {
+			fprintf(stderr, "%s: bad frame at offset %ld\n", path, frame_offset);
+			result = CALL_FAILURE;
+			break;
+		}
+		if (fread(compressed, 1, header.compressed_length, input) != header.compressed_length) {
+			fprintf(stderr, "%s: truncated frame at offset %ld\n", path, frame_offset);
+			result = CALL_FAILURE;
+			break;
+		}
+		uLongf raw_length = sizeof(raw);
+		if (uncompress(raw, &raw_length, compressed, header.compressed_length) != Z_OK
+			|| raw_length != header.raw_length
+			|| crc32(0L, raw, raw_length) != header.checksum) {
+			fprintf(stderr, "%s: corrupted frame at offset %ld\n", path, frame_offset);
+			result = CALL_FAILURE;
+			break;
+		}
+		fwrite(raw, 1, raw_length, output);
+		frame_offset += sizeof(header) + header.compressed_length;
+	}
+	fflush(output);
+	fclose(input);
+	return result;
+}
+#else
+static void enqueue_compression(const char* rotated_path) {
+	(void)rotated_path;
+}
+
+int dump_compressed_log(const char* path, FILE* output) {
+	fprintf(stderr, "slm was built without zlib, cannot read %s\n", path);
+	return CALL_FAILURE;
+}
+#endif
@@ -0,0 +1,430 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+
+#include <monitors/monitor.h>
+#include <logging/logging.h>
+#include "errors.h"
+#include "monitor_alloc.h"
+#include "ingest.h"
+
+#define CGROUP_DEFAULT_ROOT		"/sys/fs/cgroup"
+#define CGROUP_WATCH_MASK		(IN_MODIFY | IN_CREATE | IN_ONLYDIR | IN_DONT_FOLLOW)
+#define CGROUP_READ_SIZE		512
+
+#define DIRTY_CGROUP_EVENTS		1
+#define DIRTY_MEMORY_EVENTS		2
+
+#define CGROUP_EVENT_STATE		1
+#define CGROUP_EVENT_OVERFLOW	2
+
+static const char* memory_event_names[CGROUP_MEMORY_EVENTS] = {
+	"oom", "oom_kill", "oom_group_kill"
+};
+
+static int read_events(void* monitor_ptr, const char* data, ssize_t length);
+static void release_monitor(void* monitor_ptr);
+static void process_event(monitor_t monitor, struct monitor_event* event);
+
+struct cgroup_monitor_object {
+	struct monitor_t monitor;
+	struct cgroup_monitor cgroup;
+};
+
+struct monitor_slab cgroup_monitor_slab =
+		MONITOR_SLAB_INITIALIZER(struct cgroup_monitor_object);
+
+static const struct monitor_ops cgroup_ops = {
+	cgroup_start, cgroup_stop, cgroup_join, cgroup_monitor_destroy, NULL, NULL
+};
+
+int cgroup_monitor_from_args(int argc, char* argv[], monitor_t* monitor) {
+	if (argc > 2) return E_INVALID_MONITOR_ARGUMENT;
+	const char* root = intern_path(argc == 2 ? argv[1] : CGROUP_DEFAULT_ROOT);
+	if (root == NULL) return E_INVALID_MONITOR_ARGUMENT;
+	struct cgroup_monitor_object* object =
+			(struct cgroup_monitor_object*)slab_alloc(&cgroup_monitor_slab);
+	if (object == NULL) {
+		log_error("slab_alloc: %s", strerror(errno));
+		return E_OUT_OF_MEMORY;
+	}
+	*monitor = &object->monitor;
+	(*monitor)->type = MONITOR_TYPE_CGROUP;
+	(*monitor)->ops = &cgroup_ops;
+	(*monitor)->cgroup = &object->cgroup;
+	(*monitor)->cgroup->root = root;
+	(*monitor)->cgroup->inotify_fd = -1;
+	atomic_init(&(*monitor)->state, MONITOR_STATE_INITIALIZED);
+	return CALL_SUCCESS;
+}
+
+static void free_entries(cgroup_monitor_t cgroup_monitor) {
+	for (int i = 0; i < cgroup_monitor->count; i++) {
+		free(cgroup_monitor->entries[i].path);
+	}
+	free(cgroup_monitor->entries);
+	free(cgroup_monitor->index);
+	free(cgroup_monitor->dirty);
+	cgroup_monitor->entries = NULL;
+	cgroup_monitor->index = NULL;
+	cgroup_monitor->dirty = NULL;
+	cgroup_monitor->count = 0;
+	cgroup_monitor->capacity = 0;
+}
+
+static int add_cgroup(monitor_t monitor, const char* path, int report_changes);
+
+int cgroup_start(monitor_t monitor) {
+	if (monitor_transition(monitor, MONITOR_STATE_INITIALIZED,
+						   MONITOR_STATE_RUNNING) != CALL_SUCCESS) {
+		log_error("cannot start monitor wich is not in \'initialized\' state");
+		return E_MONITOR_INVALID_STATE;
+	}
+	cgroup_monitor_t cgroup_monitor = monitor->cgroup;
+	cgroup_monitor->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (cgroup_monitor->inotify_fd < 0) {
+		log_error("inotify_init1: %s", strerror(errno));
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
+		return CALL_FAILURE;
+	}
+	// state found by initial walk is baseline, only later changes are reported
+	int result = add_cgroup(monitor, cgroup_monitor->root, 0);
+	// entries belong to engine thread once source is added
+	int count = cgroup_monitor->count;
+	if (result != CALL_SUCCESS
+		|| ingest_add_read(cgroup_monitor->inotify_fd, read_events, release_monitor, monitor,
+						   &cgroup_monitor->source) != CALL_SUCCESS) {
+		close(cgroup_monitor->inotify_fd);
+		cgroup_monitor->inotify_fd = -1;
+		free_entries(cgroup_monitor);
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
+		return CALL_FAILURE;
+	}
+	log_info("cgroup monitor was created, %d cgroups under %s", count, cgroup_monitor->root);
+	return CALL_SUCCESS;
+}
+
+int cgroup_stop(monitor_t monitor) {
+	if (monitor_transition(monitor, MONITOR_STATE_RUNNING,
+						   MONITOR_STATE_DYING) != CALL_SUCCESS) {
+		return E_MONITOR_INVALID_STATE;
+	}
+	ingest_remove(monitor->cgroup->source);
+	return CALL_SUCCESS;
+}
+
+void cgroup_join(monitor_t monitor) {
+	wait_monitor_dead(monitor);
+	log_info("cgroup monitor was stopped");
+}
+
+void cgroup_print_usage() {
+	printf("%s%s%s",
+		   "Aimed to monitor OOM kills and population changes of cgroups (v2)\n",
+		   "Usage: slm --cgroup [root]\n",
+		   "\t root - cgroup directory watched with all cgroups below, /sys/fs/cgroup by default\n");
+}
+
+int cgroup_monitor_destroy(monitor_t monitor) {
+	if (claim_monitor_for_destroy(monitor) != CALL_SUCCESS) {
+		return E_MONITOR_INVALID_STATE;
+	}
+	cgroup_monitor_t cgroup_monitor = monitor->cgroup;
+	if (cgroup_monitor->overflows > 0) {
+		log_error("cgroup inotify queue overflowed %lu times", cgroup_monitor->overflows);
+	}
+	if (cgroup_monitor->inotify_fd >= 0) close(cgroup_monitor->inotify_fd);
+	free_entries(cgroup_monitor);
+	log_info("cgroup monitor was killed");
+	slab_free(&cgroup_monitor_slab, monitor);
+	return CALL_SUCCESS;
+}
+
+/*
+ * Returns index slot holding watch descriptor or empty slot where it belongs
+ */
+static uint32_t index_find(cgroup_monitor_t cgroup_monitor, int wd) {
+	uint32_t slot = ((uint32_t)wd * 2654435761u) & cgroup_monitor->index_mask;
+	while (cgroup_monitor->index[slot] != 0
+		   && cgroup_monitor->entries[cgroup_monitor->index[slot] - 1].wd != wd) {
+		slot = (slot + 1) & cgroup_monitor->index_mask;
+	}
+	return slot;
+}
+
+struct cgroup_entry* cgroup_find_entry(cgroup_monitor_t cgroup_monitor, int wd) {
+	int position = cgroup_monitor->index[index_find(cgroup_monitor, wd)];
+	return position > 0 ? &cgroup_monitor->entries[position - 1] : NULL;
+}
+
+/*
+ * Removes watch descriptor with backward shift, so probe chains stay without holes
+ */
+static void index_remove(cgroup_monitor_t cgroup_monitor, int wd) {
+	uint32_t mask = cgroup_monitor->index_mask;
+	uint32_t hole = index_find(cgroup_monitor, wd);
+	if (cgroup_monitor->index[hole] == 0) return;
+	uint32_t slot = hole;
+	while (1) {
+		slot = (slot + 1) & mask;
+		if (cgroup_monitor->index[slot] == 0) break;
+		uint32_t home = ((uint32_t)cgroup_monitor->entries[cgroup_monitor->index[slot] - 1].wd
+						 * 2654435761u) & mask;
+		// entry may fill the hole unless its home lies cyclically in (hole, slot]
+		if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+			cgroup_monitor->index[hole] = cgroup_monitor->index[slot];
+			hole = slot;
+		}
+	}
+	cgroup_monitor->index[hole] = 0;
+}
+
+static int grow_entries(cgroup_monitor_t cgroup_monitor) {
+	int capacity = cgroup_monitor->capacity == 0 ? 256 : cgroup_monitor->capacity * 2;
+	struct cgroup_entry* entries = (struct cgroup_entry*)realloc(
+			cgroup_monitor->entries, capacity * sizeof(struct cgroup_entry));
+	if (entries == NULL) return E_OUT_OF_MEMORY;
+	cgroup_monitor->entries = entries;
+	int* dirty = (int*)realloc(cgroup_monitor->dirty, capacity * sizeof(int));
+	if (dirty == NULL) return E_OUT_OF_MEMORY;
+	cgroup_monitor->dirty = dirty;
+	uint32_t size = 2;
+	while (size < (uint32_t)capacity * 2) size <<= 1;
+	int* index = (int*)calloc(size, sizeof(int));
+	if (index == NULL) return E_OUT_OF_MEMORY;
+	free(cgroup_monitor->index);
+	cgroup_monitor->index = index;
+	cgroup_monitor->index_mask = size - 1;
+	cgroup_monitor->capacity = capacity;
+	for (int i = 0; i < cgroup_monitor->count; i++) {
+		cgroup_monitor->index[index_find(cgroup_monitor, entries[i].wd)] = i + 1;
+	}
+	return CALL_SUCCESS;
+}
+
+/*
+ * Last entry takes place of removed one, so array stays dense
+ */
+static void remove_entry(cgroup_monitor_t cgroup_monitor, int wd) {
+	struct cgroup_entry* entry = cgroup_find_entry(cgroup_monitor, wd);
+	if (entry == NULL) return;
+	int position = (int)(entry - cgroup_monitor->entries);
+	int last = cgroup_monitor->count - 1;
+	free(entry->path);
+	index_remove(cgroup_monitor, wd);
+	if (position != last) {
+		cgroup_monitor->entries[position] = cgroup_monitor->entries[last];
+		cgroup_monitor->index[index_find(cgroup_monitor,
+										 cgroup_monitor->entries[position].wd)] = position + 1;
+	}
+	cgroup_monitor->count--;
+}
+
+static int read_file(const char* directory, const char* name, char* buffer, size_t size) {
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", directory, name);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return CALL_FAILURE;
+	ssize_t length = read(fd, buffer, size - 1);
+	close(fd);
+	if (length < 0) return CALL_FAILURE;
+	buffer[length] = '\0';
+	return CALL_SUCCESS;
+}
+
+static unsigned long read_key(const char* text, const char* key) {
+	size_t length = strlen(key);
+	for (const char* line = text; line != NULL && *line != '\0';
+		 line = strchr(line, '\n'), line = line != NULL ? line + 1 : NULL) {
+		if (strncmp(line, key, length) == 0 && line[length] == ' ') {
+			return strtoul(line + length + 1, NULL, 10);
+		}
+	}
+	return 0;
+}
+
+static void report(monitor_t monitor, uint32_t kind, const char* format, ...)
+		__attribute__((format(printf, 3, 4)));
+
+static void report(monitor_t monitor, uint32_t kind, const char* format, ...) {
+	char text[MONITOR_EVENT_NAME_LENGTH];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+	submit_monitor_event(monitor, process_event, kind, 0, text);
+}
+
+/*
+ * Re-reads changed files of cgroup, reports populated transitions and
+ * growth of OOM counters when report is set
+ */
+static void read_state(monitor_t monitor, struct cgroup_entry* entry, int files, int report_changes) {
+	char text[CGROUP_READ_SIZE];
+	if ((files & DIRTY_CGROUP_EVENTS)
+		&& read_file(entry->path, "cgroup.events", text, sizeof(text)) == CALL_SUCCESS) {
+		uint8_t populated = read_key(text, "populated") != 0;
+		if (report_changes && populated != entry->populated) {
+			report(monitor, CGROUP_EVENT_STATE, "cgroup %s became %s", entry->path,
+				   populated ? "populated" : "empty");
+		}
+		entry->populated = populated;
+	}
+	if ((files & DIRTY_MEMORY_EVENTS)
+		&& read_file(entry->path, "memory.events", text, sizeof(text)) == CALL_SUCCESS) {
+		for (int i = 0; i < CGROUP_MEMORY_EVENTS; i++) {
+			uint32_t value = (uint32_t)read_key(text, memory_event_names[i]);
+			if (report_changes && value > entry->memory_events[i]) {
+				report(monitor, CGROUP_EVENT_STATE, "cgroup %s: %u new %s events, %u in total",
+					   entry->path, value - entry->memory_events[i], memory_event_names[i],
+					   value);
+			}
+			entry->memory_events[i] = value;
+		}
+	}
+}
+
+/*
+ * Watches cgroup directory and all cgroups below it. Already watched
+ * directories are only descended, so walk also recovers from overflow.
+ * Newly found cgroup is compared with empty one when report_changes is set:
+ * runtime may move task into cgroup before it is read, its populated state
+ * and early OOM kills must not become silent baseline.
+ */
+static int add_cgroup(monitor_t monitor, const char* path, int report_changes) {
+	cgroup_monitor_t cgroup_monitor = monitor->cgroup;
+	int wd = inotify_add_watch(cgroup_monitor->inotify_fd, path, CGROUP_WATCH_MASK);
+	if (wd < 0) {
+		log_error("cannot watch cgroup %s: %s", path, strerror(errno));
+		return CALL_FAILURE;
+	}
+	if (cgroup_monitor->count == cgroup_monitor->capacity
+		&& grow_entries(cgroup_monitor) != CALL_SUCCESS) {
+		inotify_rm_watch(cgroup_monitor->inotify_fd, wd);
+		return E_OUT_OF_MEMORY;
+	}
+	uint32_t slot = index_find(cgroup_monitor, wd);
+	if (cgroup_monitor->index[slot] == 0) {
+		char* copy = strdup(path);
+		if (copy == NULL) {
+			inotify_rm_watch(cgroup_monitor->inotify_fd, wd);
+			return E_OUT_OF_MEMORY;
+		}
+		struct cgroup_entry* entry = &cgroup_monitor->entries[cgroup_monitor->count++];
+		memset(entry, 0, sizeof(struct cgroup_entry));
+		entry->wd = wd;
+		entry->path = copy;
+		cgroup_monitor->index[slot] = cgroup_monitor->count;
+		read_state(monitor, entry, DIRTY_CGROUP_EVENTS | DIRTY_MEMORY_EVENTS, report_changes);
+	}
+
+	DIR* directory = opendir(path);
+	if (directory == NULL) return CALL_SUCCESS;		// removed meanwhile
+	struct dirent* child;
+	char child_path[PATH_MAX];
+	while ((child = readdir(directory)) != NULL) {
+		if (child->d_type != DT_DIR || strcmp(child->d_name, ".") == 0
+			|| strcmp(child->d_name, "..") == 0) {
+			continue;
+		}
+		snprintf(child_path, sizeof(child_path), "%s/%s", path, child->d_name);
+		if (add_cgroup(monitor, child_path, report_changes) == E_OUT_OF_MEMORY) {
+			closedir(directory);
+			return E_OUT_OF_MEMORY;
+		}
+	}
+	closedir(directory);
+	return CALL_SUCCESS;
+}
+
+static void read_dirty(monitor_t monitor) {
+	cgroup_monitor_t cgroup_monitor = monitor->cgroup;
+	for (int i = 0; i < cgroup_monitor->dirty_count; i++) {
+		struct cgroup_entry* entry = cgroup_find_entry(cgroup_monitor, cgroup_monitor->dirty[i]);
+		if (entry == NULL) continue;	// removed in same batch
+		read_state(monitor, entry, entry->dirty, 1);
+		entry->dirty = 0;
+	}
+	cgroup_monitor->dirty_count = 0;
+}
+
+static void mark_dirty(monitor_t monitor, struct cgroup_entry* entry, int files) {
+	cgroup_monitor_t cgroup_monitor = monitor->cgroup;
+	if (entry->dirty == 0) {
+		// list may be full of removed cgroups after churn
+		if (cgroup_monitor->dirty_count == cgroup_monitor->capacity) read_dirty(monitor);
+		cgroup_monitor->dirty[cgroup_monitor->dirty_count++] = entry->wd;
+	}
+	entry->dirty |= files;
+}
+
+/*
+ * Runs on engine thread. Modifications are only marked while batch is
+ * parsed, each changed cgroup is then read once per batch.
+ */
+static int read_events(void* monitor_ptr, const char* data, ssize_t length) {
+	monitor_t monitor = (monitor_t)monitor_ptr;
+	cgroup_monitor_t cgroup_monitor = monitor->cgroup;
+	if (length <= 0) {
+		log_error("cgroup inotify read: %s", length == 0 ? "end of file" : strerror(-length));
+		// if stop won the race, it has already removed the source
+		if (monitor_transition(monitor, MONITOR_STATE_RUNNING,
+							   MONITOR_STATE_DYING) == CALL_SUCCESS) {
+			ingest_remove(cgroup_monitor->source);
+		}
+		return INGEST_STOP;
+	}
+	char path[PATH_MAX];
+	const char* end = data + length;
+	while (data < end) {
+		const struct inotify_event* event = (const struct inotify_event*)data;
+		data += sizeof(struct inotify_event) + event->len;
+		if (event->mask & IN_Q_OVERFLOW) {
+			cgroup_monitor->overflows++;
+			submit_monitor_event(monitor, process_event, CGROUP_EVENT_OVERFLOW, 0, NULL);
+			add_cgroup(monitor, cgroup_monitor->root, 1);
+			for (int i = 0; i < cgroup_monitor->count; i++) {
+				mark_dirty(monitor, &cgroup_monitor->entries[i],
+						   DIRTY_CGROUP_EVENTS | DIRTY_MEMORY_EVENTS);
+			}
+			continue;
+		}
+		if (event->mask & IN_IGNORED) {
+			remove_entry(cgroup_monitor, event->wd);	// cgroup was removed
+			continue;
+		}
+		struct cgroup_entry* entry = cgroup_find_entry(cgroup_monitor, event->wd);
+		if (entry == NULL || event->len == 0) continue;
+		if ((event->mask & IN_CREATE) && (event->mask & IN_ISDIR)) {
+			snprintf(path, sizeof(path), "%s/%s", entry->path, event->name);
+			add_cgroup(monitor, path, 1);
+		} else if (event->mask & IN_MODIFY) {
+			if (strcmp(event->name, "cgroup.events") == 0) {
+				mark_dirty(monitor, entry, DIRTY_CGROUP_EVENTS);
+			} else if (strcmp(event->name, "memory.events") == 0) {
+				mark_dirty(monitor, entry, DIRTY_MEMORY_EVENTS);
+			}
+		}
+	}
+	read_dirty(monitor);
+	return INGEST_CONTINUE;
+}
+
+static void release_monitor(void* monitor_ptr) {
+	mark_monitor_dead((monitor_t)monitor_ptr);
+}
+
+static void process_event(monitor_t monitor, struct monitor_event* event) {
+	if (event->kind == CGROUP_EVENT_STATE) {
+		log_info("%s", event->name);
+	} else if (event->kind == CGROUP_EVENT_OVERFLOW) {
+		log_error("cgroup inotify queue overflowed, all cgroups were read again");
+	}
+}
@@ -0,0 +1,406 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <logging/logging.h>
+#include "errors.h"
+#include "content_hash.h"
+
+#define PRIME64_1	0x9E3779B185EBCA87ULL
+#define PRIME64_2	0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3	0x165667B19E3779F9ULL
+#define PRIME64_4	0x85EBCA77C2B2AE63ULL
+#define PRIME64_5	0x27D4EB2F165667C5ULL
+
+#define CONTENT_READ_BLOCKS		64
+#define CONTENT_INITIAL_BUCKETS	64
+#define CONTENT_APPEND_PROBES	8
+
+struct content_entry {
+	struct content_entry* next;
+	char* name;
+	uint64_t inode;
+	uint64_t size;
+	int64_t mtime_ns;
+	int64_t ctime_ns;
+	uint64_t blocks_count;
+	uint64_t* hashes;
+};
+
+struct content_table {
+	struct content_entry** buckets;
+	size_t buckets_count;
+	size_t entries_count;
+	uint64_t bytes_hashed;
+	uint64_t hash_ns;
+};
+
+static inline uint64_t rotate_left(uint64_t value, int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t read64(const unsigned char* data) {
+	uint64_t value;
+	memcpy(&value, data, sizeof(value));	// little endian hosts only
+	return value;
+}
+
+static inline uint32_t read32(const unsigned char* data) {
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+static inline uint64_t hash_round(uint64_t accumulator, uint64_t input) {
+	accumulator += input * PRIME64_2;
+	accumulator = rotate_left(accumulator, 31);
+	return accumulator * PRIME64_1;
+}
+
+static inline uint64_t merge_round(uint64_t hash, uint64_t lane) {
+	hash ^= hash_round(0, lane);
+	return hash * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t hash64(const void* data, size_t length, uint64_t seed) {
+	const unsigned char* position = (const unsigned char*)data;
+	const unsigned char* end = position + length;
+	uint64_t hash;
+
+	if (length >= 32) {
+		// lanes do not depend on each other, so they run in parallel
+		uint64_t lane1 = seed + PRIME64_1 + PRIME64_2;
+		uint64_t lane2 = seed + PRIME64_2;
+		uint64_t lane3 = seed;
+		uint64_t lane4 = seed - PRIME64_1;
+		const unsigned char* limit = end - 32;
+		do {
+			lane1 = hash_round(lane1, read64(position));
+			lane2 = hash_round(lane2, read64(position + 8));
+			lane3 = hash_round(lane3, read64(position + 16));
+			lane4 = hash_round(lane4, read64(position + 24));
+			position += 32;
+		} while (position <= limit);
+		hash = rotate_left(lane1, 1) + rotate_left(lane2, 7)
+			   + rotate_left(lane3, 12) + rotate_left(lane4, 18);
+		hash = merge_round(hash, lane1);
+		hash = merge_round(hash, lane2);
+		hash = merge_round(hash, lane3);
+		hash = merge_round(hash, lane4);
+	} else {
+		hash = seed + PRIME64_5;
+	}
+	hash += length;
+
+	for (; position + 8 <= end; position += 8) {
+		hash ^= hash_round(0, read64(position));
+		hash = rotate_left(hash, 27) * PRIME64_1 + PRIME64_4;
+	}
+	if (position + 4 <= end) {
+		hash ^= (uint64_t)read32(position) * PRIME64_1;
+		hash = rotate_left(hash, 23) * PRIME64_2 + PRIME64_3;
+		position += 4;
+	}
+	for (; position < end; position++) {
+		hash ^= *position * PRIME64_5;
+		hash = rotate_left(hash, 11) * PRIME64_1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= PRIME64_3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+static size_t bucket_of(content_table_t table, const char* name) {
+	return hash64(name, strlen(name), 0) & (table->buckets_count - 1);
+}
+
+static struct content_entry* find_entry(content_table_t table, const char* name) {
+	for (struct content_entry* entry = table->buckets[bucket_of(table, name)];
+		 entry != NULL; entry = entry->next) {
+		if (strcmp(entry->name, name) == 0) return entry;
+	}
+	return NULL;
+}
+
+static void grow_table(content_table_t table) {
+	size_t buckets_count = table->buckets_count * 2;
+	struct content_entry** buckets = (struct content_entry**)calloc(
+			buckets_count, sizeof(struct content_entry*));
+	if (buckets == NULL) return;	// keeps working with longer chains
+	for (size_t i = 0; i < table->buckets_count; i++) {
+		struct content_entry* entry = table->buckets[i];
+		while (entry != NULL) {
+			struct content_entry* next = entry->next;
+			size_t bucket = hash64(entry->name, strlen(entry->name), 0) & (buckets_count - 1);
+			entry->next = buckets[bucket];
+			buckets[bucket] = entry;
+			entry = next;
+		}
+	}
+	free(table->buckets);
+	table->buckets = buckets;
+	table->buckets_count = buckets_count;
+}
+
+static struct content_entry* add_entry(content_table_t table, const char* name) {
+	if (table->entries_count >= table->buckets_count) {
+		grow_table(table);
+	}
+	struct content_entry* entry = (struct content_entry*)calloc(1, sizeof(struct content_entry));
+	if (entry == NULL) return NULL;
+	entry->name = strdup(name);
+	if (entry->name == NULL) {
+		free(entry);
+		return NULL;
+	}
+	size_t bucket = bucket_of(table, name);
+	entry->next = table->buckets[bucket];
+	table->buckets[bucket] = entry;
+	table->entries_count++;
+	return entry;
+}
+
+static void add_range(struct content_change* change, uint64_t from, uint64_t to) {
+	change->changed = 1;
+	if (change->ranges_count > 0 && change->ranges[change->ranges_count - 1].to + 1 == from) {
+		change->ranges[change->ranges_count - 1].to = to;
+	} else if (change->ranges_count < CONTENT_MAX_RANGES) {
+		change->ranges[change->ranges_count].from = from;
+		change->ranges[change->ranges_count].to = to;
+		change->ranges_count++;
+	} else {
+		change->ranges_truncated = 1;
+	}
+}
+
+static uint64_t elapsed_ns(const struct timespec* from) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - from->tv_sec) * 1000000000ULL + now.tv_nsec - from->tv_nsec;
+}
+
+content_table_t content_table_new() {
+	content_table_t table = (content_table_t)calloc(1, sizeof(struct content_table));
+	if (table == NULL) return NULL;
+	table->buckets = (struct content_entry**)calloc(CONTENT_INITIAL_BUCKETS,
+													sizeof(struct content_entry*));
+	if (table->buckets == NULL) {
+		free(table);
+		return NULL;
+	}
+	table->buckets_count = CONTENT_INITIAL_BUCKETS;
+	return table;
+}
+
+/*
+ * Block which holds old end of file: if its old part is intact,
+ * only bytes after old end are reported
+ */
+static uint64_t tail_block_change_start(struct content_entry* entry, uint64_t block,
+										const unsigned char* data, uint64_t block_start) {
+	if (entry->size > block_start && entry->size < block_start + CONTENT_BLOCK_SIZE
+		&& hash64(data, entry->size - block_start, 0) == entry->hashes[block]) {
+		return entry->size;
+	}
+	return block_start;
+}
+
+/*
+ * Stat consistent with writes past old end only: same file grew and was
+ * last changed by a write. Copies which rewrite file in place and restore
+ * its mtime leave ctime newer than mtime.
+ */
+static int appended_only(struct content_entry* entry, const struct stat* file_stat,
+						 int64_t mtime_ns, int64_t ctime_ns) {
+	return entry->inode == file_stat->st_ino && (uint64_t)file_stat->st_size > entry->size
+		   && entry->size >= CONTENT_BLOCK_SIZE && mtime_ns > entry->mtime_ns
+		   && ctime_ns == mtime_ns;
+}
+
+/*
+ * Compares first, last and evenly spaced full blocks of old size with
+ * stored hashes instead of rehashing whole prefix. Edits between probes
+ * of a file which also grew are missed, see --content usage.
+ */
+static int prefix_kept(content_table_t table, int fd, struct content_entry* entry,
+					   unsigned char* buffer) {
+	uint64_t last_full = entry->size / CONTENT_BLOCK_SIZE - 1;
+	uint64_t previous = UINT64_MAX;
+	for (uint64_t probe = 0; probe < CONTENT_APPEND_PROBES; probe++) {
+		uint64_t block = last_full * probe / (CONTENT_APPEND_PROBES - 1);
+		if (block == previous) continue;
+		previous = block;
+		if (pread(fd, buffer, CONTENT_BLOCK_SIZE, block * CONTENT_BLOCK_SIZE) != CONTENT_BLOCK_SIZE) {
+			return 0;
+		}
+		table->bytes_hashed += CONTENT_BLOCK_SIZE;
+		if (hash64(buffer, CONTENT_BLOCK_SIZE, 0) != entry->hashes[block]) return 0;
+	}
+	return 1;
+}
+
+int content_update(content_table_t table, const char* path, const char* name,
+				   struct content_change* change) {
+	memset(change, 0, sizeof(struct content_change));
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (errno == ENOENT) content_forget(table, name);
+		return CALL_FAILURE;
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+		close(fd);
+		return CALL_FAILURE;
+	}
+	int64_t mtime_ns = file_stat.st_mtim.tv_sec * 1000000000LL + file_stat.st_mtim.tv_nsec;
+	int64_t ctime_ns = file_stat.st_ctim.tv_sec * 1000000000LL + file_stat.st_ctim.tv_nsec;
+	uint64_t size = file_stat.st_size;
+	struct content_entry* entry = find_entry(table, name);
+	change->known = entry != NULL;
+	change->old_size = entry != NULL ? entry->size : 0;
+	change->new_size = size;
+	if (entry != NULL && entry->inode == file_stat.st_ino && entry->size == size
+		&& entry->mtime_ns == mtime_ns) {
+		close(fd);
+		return CALL_SUCCESS;
+	}
+
+	uint64_t blocks_count = (size + CONTENT_BLOCK_SIZE - 1) / CONTENT_BLOCK_SIZE;
+	uint64_t* hashes = (uint64_t*)malloc((blocks_count + 1) * sizeof(uint64_t));
+	unsigned char* buffer = (unsigned char*)malloc(CONTENT_READ_BLOCKS * CONTENT_BLOCK_SIZE);
+	if (hashes == NULL || buffer == NULL) {
+		free(hashes);
+		free(buffer);
+		close(fd);
+		return E_OUT_OF_MEMORY;
+	}
+	// editors replace file by renaming new one over it, blocks are compared anyway
+	struct content_entry* old = entry;
+
+	uint64_t first_block = 0;
+	if (old != NULL && appended_only(old, &file_stat, mtime_ns, ctime_ns)
+		&& prefix_kept(table, fd, old, buffer)) {
+		first_block = old->size / CONTENT_BLOCK_SIZE;
+		memcpy(hashes, old->hashes, first_block * sizeof(uint64_t));
+	}
+
+	uint64_t offset = first_block * CONTENT_BLOCK_SIZE;
+	uint64_t block = first_block;
+	while (offset < size) {
+		size_t wanted = CONTENT_READ_BLOCKS * CONTENT_BLOCK_SIZE;
+		if (size - offset < wanted) wanted = size - offset;	// file may grow meanwhile
+		ssize_t length = pread(fd, buffer, wanted, offset);
+		if (length <= 0) {
+			if (length < 0 && errno == EINTR) continue;
+			size = offset;		// truncated while reading
+			break;
+		}
+		struct timespec started;
+		clock_gettime(CLOCK_MONOTONIC, &started);
+		for (ssize_t position = 0; position < length; position += CONTENT_BLOCK_SIZE, block++) {
+			size_t block_length = length - position < CONTENT_BLOCK_SIZE ? length - position
+																		  : CONTENT_BLOCK_SIZE;
+			hashes[block] = hash64(buffer + position, block_length, 0);
+			uint64_t block_start = offset + position;
+			if (old == NULL) continue;
+			if (block >= old->blocks_count) {
+				add_range(change, block_start, block_start + block_length - 1);
+			} else if (hashes[block] != old->hashes[block]) {
+				add_range(change, tail_block_change_start(old, block, buffer + position, block_start),
+						  block_start + block_length - 1);
+			}
+		}
+		table->hash_ns += elapsed_ns(&started);
+		offset += length;
+		table->bytes_hashed += length;
+	}
+	free(buffer);
+	close(fd);
+
+	if (old != NULL && size < old->size) {
+		add_range(change, size, old->size - 1);
+	}
+	if (entry == NULL) {
+		entry = add_entry(table, name);
+		if (entry == NULL) {
+			free(hashes);
+			return E_OUT_OF_MEMORY;
+		}
+	}
+	free(entry->hashes);
+	entry->hashes = hashes;
+	entry->blocks_count = (size + CONTENT_BLOCK_SIZE - 1) / CONTENT_BLOCK_SIZE;
+	entry->inode = file_stat.st_ino;
+	entry->size = size;
+	entry->mtime_ns = mtime_ns;
+	entry->ctime_ns = ctime_ns;
+	change->new_size = size;
+	return CALL_SUCCESS;
+}
+
+void content_baseline(content_table_t table, const char* path) {
+	struct content_change change;
+	DIR* dir = opendir(path);
+	if (dir == NULL) {
+		content_update(table, path, "", &change);
+		return;
+	}
+	char entry_path[PATH_MAX];
+	struct dirent* dirent;
+	while ((dirent = readdir(dir)) != NULL) {
+		if (dirent->d_type != DT_REG && dirent->d_type != DT_UNKNOWN) continue;
+		if (snprintf(entry_path, sizeof(entry_path), "%s/%s", path, dirent->d_name)
+			>= (int)sizeof(entry_path)) {
+			continue;
+		}
+		content_update(table, entry_path, dirent->d_name, &change);
+	}
+	closedir(dir);
+}
+
+void content_forget(content_table_t table, const char* name) {
+	struct content_entry** link = &table->buckets[bucket_of(table, name)];
+	while (*link != NULL) {
+		struct content_entry* entry = *link;
+		if (strcmp(entry->name, name) == 0) {
+			*link = entry->next;
+			free(entry->name);
+			free(entry->hashes);
+			free(entry);
+			table->entries_count--;
+			return;
+		}
+		link = &entry->next;
+	}
+}
+
+void content_table_destroy(content_table_t table, const char* path) {
+	if (table == NULL) return;
+	if (table->hash_ns > 0) {
+		log_info("content of %s: %llu bytes hashed at %.2f GB/s", path,
+				 (unsigned long long)table->bytes_hashed,
+				 (double)table->bytes_hashed / table->hash_ns);
+	}
+	for (size_t i = 0; i < table->buckets_count; i++) {
+		struct content_entry* entry = table->buckets[i];
+		while (entry != NULL) {
+			struct content_entry* next = entry->next;
+			free(entry->name);
+			free(entry->hashes);
+			free(entry);
+			entry = next;
+		}
+	}
+	free(table->buckets);
+	free(table);
+}
@@ -0,0 +1,206 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <monitors/monitor.h>
+#include <logging/logging.h>
+#include <gio/gio.h>
+#include "errors.h"
+#include "monotonic.h"
+#include "injector.h"
+
+struct synthetic_signal {
+	const char* object_path;
+	const char* interface;
+	const char* name;
+	const char* type;
+	const char* parameters;		// GVariant text format
+	GVariant* value;
+};
+
+static struct synthetic_signal udisks_signals[2] = {
+	{ "/org/freedesktop/UDisks2", "org.freedesktop.DBus.ObjectManager", "InterfacesAdded",
+	  "(oa{sa{sv}})", "('/org/freedesktop/UDisks2/drives/Injected_Disk', "
+	  "{'org.freedesktop.UDisks2.Drive': {'Model': <'Injected Disk'>, "
+	  "'ConnectionBus': <'usb'>}})", NULL },
+	{ "/org/freedesktop/UDisks2", "org.freedesktop.DBus.ObjectManager", "InterfacesRemoved",
+	  "(oas)", "('/org/freedesktop/UDisks2/drives/Injected_Disk', "
+	  "['org.freedesktop.UDisks2.Drive'])", NULL }
+};
+
+static struct synthetic_signal nm_signals[2] = {
+	{ "/org/freedesktop/NetworkManager", "org.freedesktop.NetworkManager", "StateChanged",
+	  "(u)", "(20,)", NULL },
+	{ "/org/freedesktop/NetworkManager", "org.freedesktop.NetworkManager", "StateChanged",
+	  "(u)", "(70,)", NULL }
+};
+
+static void free_signals(struct synthetic_signal* signals) {
+	for (int i = 0; i < 2; i++) {
+		if (signals[i].value != NULL) g_variant_unref(signals[i].value);
+		signals[i].value = NULL;
+	}
+}
+
+static int parse_signals(struct synthetic_signal* signals) {
+	for (int i = 0; i < 2; i++) {
+		GError* error = NULL;
+		signals[i].value = g_variant_parse(G_VARIANT_TYPE(signals[i].type),
+										   signals[i].parameters, NULL, NULL, &error);
+		if (signals[i].value == NULL) {
+			log_error("cannot build %s signal: %s", signals[i].name, error->message);
+			g_error_free(error);
+			free_signals(signals);
+			return CALL_FAILURE;
+		}
+		g_variant_ref_sink(signals[i].value);
+	}
+	return CALL_SUCCESS;
+}
+
+static int emit(GDBusConnection* connection, struct synthetic_signal* signal) {
+	GError* error = NULL;
+	if (!g_dbus_connection_emit_signal(connection, NULL, signal->object_path,
+									   signal->interface, signal->name,
+									   signal->value, &error)) {
+		log_error("cannot emit %s: %s", signal->name, error->message);
+		g_error_free(error);
+		return CALL_FAILURE;
+	}
+	return CALL_SUCCESS;
+}
+
+/*
+ * Waits until monitor received count signals more than baseline,
+ * returns number received
+ */
+static unsigned long wait_signals(dbus_monitor_t dbus_monitor, unsigned long baseline,
+								  unsigned long count) {
+	unsigned long received = 0;
+	long progress_ns = monotonic_ns();
+	while (received < count
+		   && monotonic_ns() - progress_ns < INJECT_STALL_TIMEOUT * 1000000000L) {
+		struct timespec pause = { 0, 1000000 };
+		nanosleep(&pause, NULL);
+		unsigned long now = atomic_load(&dbus_monitor->signals) - baseline;
+		if (now != received) progress_ns = monotonic_ns();
+		received = now;
+	}
+	return received;
+}
+
+/*
+ * Signals emitted before monitor subscribed are not delivered to it,
+ * so they are repeated until first one arrives
+ */
+static int wait_subscribed(GDBusConnection* connection, dbus_monitor_t dbus_monitor,
+						   struct synthetic_signal* signal) {
+	for (int attempt = 0; attempt < INJECT_STALL_TIMEOUT * 100; attempt++) {
+		if (emit(connection, signal) != CALL_SUCCESS) return CALL_FAILURE;
+		struct timespec pause = { 0, 10000000 };
+		nanosleep(&pause, NULL);
+		if (atomic_load(&dbus_monitor->signals) > 0) {
+			nanosleep(&pause, NULL);	// let repeated ones arrive too
+			return CALL_SUCCESS;
+		}
+	}
+	return CALL_FAILURE;
+}
+
+/*
+ * Emits signals one by one, each once previous one was logged,
+ * returns number of them logged
+ */
+static unsigned long emit_paced(GDBusConnection* connection, monitor_t monitor,
+								struct synthetic_signal* signals, long* latencies,
+								unsigned long count) {
+	// repeated signals of wait_subscribed may still arrive
+	drain_monitor_events(monitor);
+	unsigned long handled = atomic_load(&monitor->events.handled);
+	for (unsigned long emitted = 0; emitted < count; emitted++) {
+		long emitted_ns = monotonic_ns();
+		if (emit(connection, &signals[emitted % 2]) != CALL_SUCCESS) return emitted;
+		handled++;
+		if (wait_monitor_handled(monitor, handled, INJECT_STALL_TIMEOUT * 1000) < handled) {
+			log_error("signal %lu was not logged", emitted + 1);
+			return emitted;
+		}
+		latencies[emitted] = monotonic_ns() - emitted_ns;
+	}
+	return count;
+}
+
+int dbus_inject(monitor_t monitor, unsigned long count, int mode) {
+	dbus_monitor_t dbus_monitor = monitor->dbus;
+	if (dbus_monitor->source_ops != &dbus_address_source) {
+		log_error("injection into dbus monitor needs --bus-address of private bus");
+		return E_INVALID_MONITOR_ARGUMENT;
+	}
+	long* latencies = NULL;
+	if (mode == INJECT_LATENCY) {
+		latencies = (long*)malloc(count * sizeof(long));
+		if (latencies == NULL) return E_OUT_OF_MEMORY;
+	}
+	struct synthetic_signal* signals =
+			dbus_monitor->type == DBUS_MONITOR_TYPE_UDISKS ? udisks_signals : nm_signals;
+	if (parse_signals(signals) != CALL_SUCCESS) {
+		free(latencies);
+		return CALL_FAILURE;
+	}
+	GError* error = NULL;
+	GDBusConnection* connection = g_dbus_connection_new_for_address_sync(
+			dbus_monitor->bus_address, G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT
+			| G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION, NULL, NULL, &error);
+	if (connection == NULL) {
+		log_error("cannot connect to %s: %s", dbus_monitor->bus_address, error->message);
+		g_error_free(error);
+		free_signals(signals);
+		free(latencies);
+		return CALL_FAILURE;
+	}
+	if (start_monitor(monitor) != CALL_SUCCESS) {
+		g_object_unref(connection);
+		free_signals(signals);
+		free(latencies);
+		return CALL_FAILURE;
+	}
+
+	int result = CALL_SUCCESS;
+	if (wait_subscribed(connection, dbus_monitor, &signals[1]) != CALL_SUCCESS) {
+		log_error("dbus monitor does not receive signals");
+		result = CALL_FAILURE;
+	}
+	unsigned long received = 0;
+	long started_ns = monotonic_ns();
+	if (result == CALL_SUCCESS && latencies != NULL) {
+		received = emit_paced(connection, monitor, signals, latencies, count);
+		if (received < count) result = CALL_FAILURE;
+	} else if (result == CALL_SUCCESS) {
+		unsigned long baseline = atomic_load(&dbus_monitor->signals);
+		unsigned long emitted = 0;
+		while (emitted < count && emit(connection, &signals[emitted % 2]) == CALL_SUCCESS) {
+			emitted++;
+		}
+		g_dbus_connection_flush_sync(connection, NULL, NULL);
+		received = wait_signals(dbus_monitor, baseline, emitted);
+		if (received < emitted) {
+			log_error("only %lu of %lu signals arrived", received, emitted);
+		}
+	}
+	stop_monitor(monitor);
+	join_monitor(monitor);
+	long elapsed_ns = monotonic_ns() - started_ns;
+	if (result == CALL_SUCCESS && latencies != NULL) {
+		log_inject_latency("signals", latencies, received);
+	} else if (result == CALL_SUCCESS) {
+		log_info("inject: %lu signals in %.3f s, %.0f ns per event", received,
+				 elapsed_ns / 1e9, received > 0 ? (double)elapsed_ns / received : 0.0);
+	}
+	g_object_unref(connection);
+	free_signals(signals);
+	free(latencies);
+	return result;
+}
@@ -2,13 +2,18 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <getopt.h>
 #include <pthread.h>
+#include <time.h>
 
 #include <monitors/monitor.h>
 #include <logging/logging.h>
 #include <errno.h>
 #include <monitors/dbus_monitor.h>
 #include "errors.h"
+#include "monotonic.h"
+#include "monitor_alloc.h"
+#include "trace.h"
 #include <gio/gio.h>
 
 #define INTERFACES_ADDED_SIGNAL 	"InterfacesAdded"
@@ -16,36 +21,50 @@
 #define UDISKS_SERVICE_NAME		 	"org.freedesktop.DBus.ObjectManager"
 #define UDISKS_OBJECT_PATH		 	"/org/freedesktop/UDisks2"
 #define UDISKS_DRIVER_OBJECT_PATH 	"/org/freedesktop/UDisks2/drives/"
+#define UDISKS_BUS_NAME				"org.freedesktop.UDisks2"
+#define UDISKS_DRIVE_INTERFACE		"org.freedesktop.UDisks2.Drive"
 #define NM_SERVICE_NAME		 		"org.freedesktop.NetworkManager"
 #define NM_OBJECT_PATH		 		"/org/freedesktop/NetworkManager"
 #define NM_STATE_CHANGED_SIGNAL		"StateChanged"
+#define PROPERTIES_INTERFACE		"org.freedesktop.DBus.Properties"
+
+#define DBUS_EVENT_DRIVE_ADDED		1
+#define DBUS_EVENT_DRIVE_REMOVED	2
+#define DBUS_EVENT_NM_STATE			3
+#define DBUS_EVENT_SNAPSHOT			4
+
+#define OPTION_BUS_ADDRESS			'A'
 
 static void* monitoring_thread(void* dbus_monitor_ptr);
-static void mark_dead(monitor_t monitor);
+static void process_event(monitor_t monitor, struct monitor_event* event);
+
+struct dbus_monitor_object {
+	struct monitor_t monitor;
+	struct dbus_monitor dbus;
+};
+
+struct monitor_slab dbus_monitor_slab =
+		MONITOR_SLAB_INITIALIZER(struct dbus_monitor_object);
+
+static const struct monitor_ops dbus_ops = {
+	dbus_start, dbus_stop, dbus_join, dbus_monitor_destroy, dbus_replay, dbus_inject
+};
 
 int dbus_monitor_from_args(int argc, char* argv[], monitor_t* monitor) {
-	if (argc > 1) return E_INVALID_MONITOR_ARGUMENT;
-	*monitor = (monitor_t)malloc(sizeof(struct monitor_t));
-	if (*monitor == NULL) {
-		log_error("malloc: %s", strerror(errno));
+	struct dbus_monitor_object* object =
+			(struct dbus_monitor_object*)slab_alloc(&dbus_monitor_slab);
+	if (object == NULL) {
+		log_error("slab_alloc: %s", strerror(errno));
 		return E_OUT_OF_MEMORY;
 	}
+	*monitor = &object->monitor;
 	(*monitor)->type = MONITOR_TYPE_DBUS;
-
-	(*monitor)->dbus = (dbus_monitor_t)malloc(sizeof(struct dbus_monitor));
-	if ((*monitor)->dbus == NULL) {
-		log_error("malloc: %s", strerror(errno));
-		free(monitor);
-		return E_OUT_OF_MEMORY;
-	}
-	memset((*monitor)->dbus, '\0', sizeof(struct dbus_monitor));
+	(*monitor)->ops = &dbus_ops;
+	(*monitor)->dbus = &object->dbus;
 	dbus_monitor_t dbus_monitor = (*monitor)->dbus;
-
-	if (pthread_mutex_init(&(dbus_monitor->state_mutex), NULL) != 0) {
-		free(dbus_monitor);
-		free((*monitor));
-		return CALL_FAILURE;
-	};
+	dbus_monitor->source_ops = &dbus_system_bus_source;
+	dbus_monitor->bus_address = NULL;
+	atomic_init(&dbus_monitor->signals, 0);
 
 	if(strcmp(argv[0], "--disks") == 0) {
 		dbus_monitor->type = DBUS_MONITOR_TYPE_UDISKS;
@@ -53,49 +72,82 @@ int dbus_monitor_from_args(int argc, char* argv[], monitor_t* monitor) {
 		dbus_monitor->type = DBUS_MONITOR_TYPE_NM;
 	} else {
 		log_error("unknow dbus monitor type %s", argv[0]);
-		free(dbus_monitor);
-		free((*monitor));
+		slab_free(&dbus_monitor_slab, object);
+		return E_INVALID_MONITOR_ARGUMENT;
+	}
+
+	static struct option long_options[] = {
+		{"bus-address", required_argument, 0, OPTION_BUS_ADDRESS},
+		{NULL, 0, 0, 0}
+	};
+	opterr = 0;
+	optind = 1;
+	int c;
+	while ((c = getopt_long(argc, argv, "+", long_options, NULL)) != -1) {
+		if (c != OPTION_BUS_ADDRESS) {
+			slab_free(&dbus_monitor_slab, object);
+			return E_INVALID_MONITOR_ARGUMENT;
+		}
+		dbus_monitor->bus_address = intern_path(optarg);
+		if (dbus_monitor->bus_address == NULL) {
+			log_error("bus address is too long: %s", optarg);
+			slab_free(&dbus_monitor_slab, object);
+			return E_INVALID_MONITOR_ARGUMENT;
+		}
+		dbus_monitor->source_ops = &dbus_address_source;
+	}
+	if (argc != optind) {
+		slab_free(&dbus_monitor_slab, object);
 		return E_INVALID_MONITOR_ARGUMENT;
 	}
 
-	pthread_mutex_lock(&(dbus_monitor->state_mutex));
-	(*monitor)->state = MONITOR_STATE_INITIALIZED;
-	pthread_mutex_unlock(&(dbus_monitor->state_mutex));
+	atomic_init(&(*monitor)->state, MONITOR_STATE_INITIALIZED);
 	return CALL_SUCCESS;
 }
 
+static GDBusConnection* connect_system_bus(dbus_monitor_t dbus_monitor, GError** error) {
+	return g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, error);
+}
+
+static GDBusConnection* connect_address(dbus_monitor_t dbus_monitor, GError** error) {
+	return g_dbus_connection_new_for_address_sync(dbus_monitor->bus_address,
+			G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT
+			| G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION, NULL, NULL, error);
+}
+
+const struct dbus_source_ops dbus_system_bus_source = { connect_system_bus };
+
+const struct dbus_source_ops dbus_address_source = { connect_address };
+
 int dbus_start(monitor_t monitor) {
-	pthread_mutex_lock(&(monitor->dbus->state_mutex));
-	if (monitor->state != MONITOR_STATE_INITIALIZED) {
+	if (monitor_transition(monitor, MONITOR_STATE_INITIALIZED,
+						   MONITOR_STATE_RUNNING) != CALL_SUCCESS) {
 		log_error("cannot start monitor wich is not in \'initialized\' state");
-		pthread_mutex_unlock(&(monitor->dbus->state_mutex));
 		return E_MONITOR_INVALID_STATE;
 	}
-	if (pthread_create(&(monitor->dbus->thread),
-					   NULL, monitoring_thread, monitor) != 0) {
+	// loop exists before thread, so stop can always quit it
+	if (monitor->dbus->subscription_loop == NULL) {
+		monitor->dbus->subscription_loop = g_main_loop_new(NULL, FALSE);
+	}
+	if (start_monitor_thread(monitor, monitoring_thread) != CALL_SUCCESS) {
 		log_error("dbus pthread_create: %s", strerror(errno));
-		pthread_mutex_unlock(&(monitor->dbus->state_mutex));
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
 		return CALL_FAILURE;
 	}
-	monitor->state = MONITOR_STATE_RUNNING;
-	pthread_mutex_unlock(&(monitor->dbus->state_mutex));
 	return CALL_SUCCESS;
 }
 
 int dbus_stop(monitor_t monitor) {
-	pthread_mutex_lock(&(monitor->dbus->state_mutex));
-	if (monitor->state != MONITOR_STATE_RUNNING) {
-		pthread_mutex_unlock(&(monitor->dbus->state_mutex));
+	if (monitor_transition(monitor, MONITOR_STATE_RUNNING,
+						   MONITOR_STATE_DYING) != CALL_SUCCESS) {
 		return E_MONITOR_INVALID_STATE;
 	}
-	monitor->state = MONITOR_STATE_DYING;
 	g_main_loop_quit(monitor->dbus->subscription_loop);
-	pthread_mutex_unlock(&(monitor->dbus->state_mutex));
 	return CALL_SUCCESS;
 }
 
 void dbus_join(monitor_t monitor) {
-	pthread_join(monitor->dbus->thread, NULL);
+	wait_monitor_dead(monitor);
 	log_info("dbus monitor was stopped");
 }
 
@@ -103,61 +155,75 @@ void dbus_print_usage(int type) {
 	if (type == DBUS_MONITOR_TYPE_UDISKS) {
 		printf("%s%s",
 			   "Aimed to monitor disks events (disk added/removed)\n",
-			   "Usage: slm --disks\n");
+			   "Usage: slm --disks [--bus-address address]\n");
 	} else {
 		printf("%s%s",
 			   "Aimed to monitor network events (networking stage changes)\n",
-			   "Usage: slm --network\n");
+			   "Usage: slm --network [--bus-address address]\n");
 	}
 }
 
+static void print_network_usage() {
+	dbus_print_usage(DBUS_MONITOR_TYPE_NM);
+}
+
+static void print_disks_usage() {
+	dbus_print_usage(DBUS_MONITOR_TYPE_UDISKS);
+}
+
+const struct monitor_backend slm_module_backends[] = {
+	{ "--network", "dbus", 1, NULL, dbus_monitor_from_args, print_network_usage,
+	  &dbus_monitor_slab },
+	{ "--disks", "dbus", 1, NULL, dbus_monitor_from_args, print_disks_usage,
+	  &dbus_monitor_slab },
+	{ NULL }
+};
+
 int dbus_monitor_destroy(monitor_t monitor) {
-	if (monitor->state == MONITOR_STATE_RUNNING
-		|| monitor->state == MONITOR_STATE_DYING) {
+	if (claim_monitor_for_destroy(monitor) != CALL_SUCCESS) {
 		return E_MONITOR_INVALID_STATE;
 	}
 	log_info("dbus monitor was gracefuly destroyed");
-	dbus_monitor_t dbus_monitor = monitor->dbus;
-	free(dbus_monitor);
-	free(monitor);
+	if (monitor->dbus->subscription_loop != NULL) {
+		g_main_loop_unref(monitor->dbus->subscription_loop);
+	}
+	slab_free(&dbus_monitor_slab, monitor);
 	return CALL_SUCCESS;
 }
 
-typedef struct dbus_callback_parameters {
-	GDBusConnection* connection;
-	int* monitor_type;
-} dbus_callback_parameters;
-
-static int get_dbus_string_property(GDBusConnection* connection,
-									const char* service,
-									const char* obj_path,
-									const char* prop_interface,
-									const char* prop_name,
-									char** return_value) {
-	GError* error = NULL;
-	GVariant* parameter = g_dbus_connection_call_sync (connection,
-					service,
-					obj_path,
-					"org.freedesktop.DBus.Properties",
-					"Get",
-					g_variant_new ("(ss)", prop_interface, prop_name),
-					G_VARIANT_TYPE ("(v)"),
-					G_DBUS_CALL_FLAGS_NONE,
-					-1,
-					NULL,
-					&error);
-	if (parameter == NULL) {
-		log_error("Error reading property \'%s\' of \'%s\': %s\n", prop_name,
-				  prop_interface, error->message);
-		g_error_free (error);
-		return CALL_FAILURE;
-	}
-	GVariant* tmp;
-	g_variant_get (parameter, "(v)", &tmp);
-	g_variant_get (tmp, "s", return_value);
-	return CALL_SUCCESS;
+/*
+ * Describes drive from interfaces and properties of its object (a{sa{sv}}),
+ * as both InterfacesAdded and GetManagedObjects carry them, so nothing is
+ * requested per drive. Returns 0 if object has no drive interface.
+ */
+static int describe_drive(GVariant* interfaces, const char* verb, char* text, size_t size) {
+	GVariant* drive = g_variant_lookup_value(interfaces, UDISKS_DRIVE_INTERFACE,
+											 G_VARIANT_TYPE_VARDICT);
+	if (drive == NULL) return 0;
+	const gchar* model = NULL;
+	const gchar* bus = NULL;
+	g_variant_lookup(drive, "Model", "&s", &model);
+	g_variant_lookup(drive, "ConnectionBus", "&s", &bus);
+	snprintf(text, size, "Disk \'%s\' %s via %s", model != NULL ? model : "unknown",
+			 verb, bus != NULL && bus[0] != '\0' ? bus : "unknown bus");
+	g_variant_unref(drive);
+	return 1;
+}
+
+static void record_signal(const char* signal_name, GVariant* parameters) {
+	const gchar* type = g_variant_get_type_string(parameters);
+	struct iovec parts[3] = {
+		{ (void*)signal_name, strlen(signal_name) + 1 },
+		{ (void*)type, strlen(type) + 1 },
+		{ (void*)g_variant_get_data(parameters), g_variant_get_size(parameters) }
+	};
+	trace_write(TRACE_SOURCE_DBUS_SIGNAL, parts, 3);
 }
 
+/*
+ * Signal handler on subscription loop thread: only decodes signal
+ * and passes it to pipeline worker.
+ */
 static void udisks_callback (GDBusConnection *connection,
 					  const gchar* sender_name,
 					  const gchar* object_path,
@@ -165,49 +231,83 @@ static void udisks_callback (GDBusConnection *connection,
 					  const gchar* signal_name,
 					  GVariant* parameters,
 					  gpointer user_data) {
-	dbus_callback_parameters* cp = (dbus_callback_parameters*)user_data;
-	if (*(cp->monitor_type) == DBUS_MONITOR_TYPE_UDISKS) {
+	monitor_t monitor = (monitor_t)user_data;
+	atomic_fetch_add_explicit(&monitor->dbus->signals, 1, memory_order_relaxed);
+	if (trace_is_recording()) {
+		record_signal(signal_name, parameters);
+	}
+	if (monitor->dbus->type == DBUS_MONITOR_TYPE_UDISKS) {
 		if (strcmp(signal_name, INTERFACES_ADDED_SIGNAL) == 0) {
 			const gchar* new_interface_object_path;
-			g_variant_get (parameters, "(oa{sa{sv}})", &new_interface_object_path, NULL);
+			GVariant* interfaces;
+			g_variant_get (parameters, "(&o@a{sa{sv}})", &new_interface_object_path, &interfaces);
+			char text[MONITOR_EVENT_NAME_LENGTH];
 			if (new_interface_object_path - strstr(new_interface_object_path,
-								 UDISKS_DRIVER_OBJECT_PATH) == 0) {
-				gchar* disk_model_s;
-				gchar* disk_connection_bus_s;
-				int call_result = get_dbus_string_property(connection,
-						"org.freedesktop.UDisks2",
-						new_interface_object_path,
-						"org.freedesktop.UDisks2.Drive",
-						"Model", &disk_model_s);
-				if (call_result != CALL_SUCCESS) {
-					return;
-				}
-				call_result = get_dbus_string_property(connection,
-										 "org.freedesktop.UDisks2",
-										 new_interface_object_path,
-										 "org.freedesktop.UDisks2.Drive",
-										 "ConnectionBus", &disk_connection_bus_s);
-				if (call_result != CALL_SUCCESS) {
-					return;
-				}
-				log_info("Disk \'%s\' has been connected via %s",
-						 disk_model_s, disk_connection_bus_s);
-				g_free(disk_connection_bus_s);
-				g_free(disk_model_s);
+								 UDISKS_DRIVER_OBJECT_PATH) == 0
+				&& describe_drive(interfaces, "has been connected", text, sizeof(text))) {
+				submit_monitor_event(monitor, process_event, DBUS_EVENT_DRIVE_ADDED, 0, text);
 			}
+			g_variant_unref(interfaces);
 		} else if (strcmp(signal_name, INTERFACES_REMOVED_SIGNAL) == 0) {
 			const gchar *old_interface_object_path;
-			g_variant_get(parameters, "(oas)", &old_interface_object_path, NULL);
+			g_variant_get(parameters, "(&oas)", &old_interface_object_path, NULL);
 			if (old_interface_object_path - strstr(old_interface_object_path,
 												   UDISKS_DRIVER_OBJECT_PATH) == 0) {
-				log_info("Disk \'%s\' removed", old_interface_object_path);
+				submit_monitor_event(monitor, process_event, DBUS_EVENT_DRIVE_REMOVED, 0,
+									 old_interface_object_path);
 			}
 		}
-	} else if (*(cp->monitor_type) == DBUS_MONITOR_TYPE_NM) {
+	} else if (monitor->dbus->type == DBUS_MONITOR_TYPE_NM) {
 		if (strcmp(signal_name, NM_STATE_CHANGED_SIGNAL) == 0) {
-			const guint new_state;
+			guint new_state;
 			g_variant_get(parameters, "(u)", &new_state);
-			switch (new_state) {
+			submit_monitor_event(monitor, process_event, DBUS_EVENT_NM_STATE, new_state, NULL);
+		}
+	}
+}
+
+/*
+ * Rebuilds signal parameters from trace and passes them to signal handler
+ */
+int dbus_replay(monitor_t monitor, uint32_t source, const char* data, size_t length) {
+	if (source != TRACE_SOURCE_DBUS_SIGNAL) return CALL_FAILURE;
+	const char* signal_name = data;
+	size_t name_length = strnlen(signal_name, length);
+	if (name_length == length) return CALL_FAILURE;
+	const char* type = signal_name + name_length + 1;
+	size_t type_length = strnlen(type, length - name_length - 1);
+	if (name_length + 1 + type_length == length || !g_variant_type_string_is_valid(type)) {
+		return CALL_FAILURE;
+	}
+	const char* serialized = type + type_length + 1;
+	size_t size = length - (size_t)(serialized - data);
+	// GVariant expects data aligned for its type, record payload is not
+	void* copy = malloc(size > 0 ? size : 1);
+	if (copy == NULL) return E_OUT_OF_MEMORY;
+	memcpy(copy, serialized, size);
+	GVariant* parameters = g_variant_new_from_data(G_VARIANT_TYPE(type), copy, size,
+												   FALSE, free, copy);
+	g_variant_ref_sink(parameters);
+	udisks_callback(NULL, NULL, NULL, NULL, signal_name, parameters, monitor);
+	g_variant_unref(parameters);
+	return CALL_SUCCESS;
+}
+
+/*
+ * Reports decoded event, runs on pipeline worker
+ */
+static void process_event(monitor_t monitor, struct monitor_event* event) {
+	switch (event->kind) {
+		case DBUS_EVENT_DRIVE_ADDED: {
+			log_info("%s", event->name);
+			break;
+		}
+		case DBUS_EVENT_DRIVE_REMOVED: {
+			log_info("Disk \'%s\' removed", event->name);
+			break;
+		}
+		case DBUS_EVENT_NM_STATE: {
+			switch (event->value) {
 				case 10 : {
 					log_info("networking disabled");
 					break;
@@ -228,9 +328,78 @@ static void udisks_callback (GDBusConnection *connection,
 //					log_info("NM device state changed to %u",  new_state);
 				};
 			}
+			break;
+		}
+		case DBUS_EVENT_SNAPSHOT: {
+			log_info("initial state of %s dbus objects read in %.2f ms",
+					 event->name, event->value / 1000.0);
+			break;
+		}
+		default: {}
+	}
+}
 
+static GVariant* call_sync(GDBusConnection* connection, const char* bus_name,
+						   const char* object_path, const char* interface,
+						   const char* method, GVariant* parameters,
+						   const char* reply_type) {
+	GError* error = NULL;
+	GVariant* reply = g_dbus_connection_call_sync(connection, bus_name, object_path,
+												  interface, method, parameters,
+												  G_VARIANT_TYPE(reply_type),
+												  G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+	if (reply == NULL) {
+		log_error("cannot read initial state from %s: %s", bus_name, error->message);
+		g_error_free(error);
+	}
+	return reply;
+}
+
+/*
+ * Reports current state with one call after signals were subscribed:
+ * GetManagedObjects for UDisks2 drives, GetAll for NetworkManager
+ */
+static void submit_snapshot(monitor_t monitor, GDBusConnection* connection) {
+	long started = monotonic_us();
+	unsigned int objects_count = 0;
+	if (monitor->dbus->type == DBUS_MONITOR_TYPE_UDISKS) {
+		GVariant* reply = call_sync(connection, UDISKS_BUS_NAME, UDISKS_OBJECT_PATH,
+									UDISKS_SERVICE_NAME, "GetManagedObjects", NULL,
+									"(a{oa{sa{sv}}})");
+		if (reply == NULL) return;
+		GVariantIter* objects;
+		const gchar* object_path;
+		GVariant* interfaces;
+		g_variant_get(reply, "(a{oa{sa{sv}}})", &objects);
+		while (g_variant_iter_loop(objects, "{&o@a{sa{sv}}}", &object_path, &interfaces)) {
+			objects_count++;
+			char text[MONITOR_EVENT_NAME_LENGTH];
+			if (object_path - strstr(object_path, UDISKS_DRIVER_OBJECT_PATH) == 0
+				&& describe_drive(interfaces, "is connected", text, sizeof(text))) {
+				submit_monitor_event(monitor, process_event, DBUS_EVENT_DRIVE_ADDED, 0, text);
+			}
+		}
+		g_variant_iter_free(objects);
+		g_variant_unref(reply);
+	} else {
+		GVariant* reply = call_sync(connection, NM_SERVICE_NAME, NM_OBJECT_PATH,
+									PROPERTIES_INTERFACE, "GetAll",
+									g_variant_new("(s)", NM_SERVICE_NAME), "(a{sv})");
+		if (reply == NULL) return;
+		GVariant* properties = g_variant_get_child_value(reply, 0);
+		guint32 state;
+		objects_count = 1;
+		if (g_variant_lookup(properties, "State", "u", &state)) {
+			submit_monitor_event(monitor, process_event, DBUS_EVENT_NM_STATE, state, NULL);
 		}
+		g_variant_unref(properties);
+		g_variant_unref(reply);
 	}
+
+	char count[16];
+	snprintf(count, sizeof(count), "%u", objects_count);
+	submit_monitor_event(monitor, process_event, DBUS_EVENT_SNAPSHOT,
+						 (uint32_t)(monotonic_us() - started), count);
 }
 
 static void* monitoring_thread(void* monitor_ptr) {
@@ -242,24 +411,21 @@ static void* monitoring_thread(void* monitor_ptr) {
 	sigset_t blocking_mask;
 	if (sigfillset(&blocking_mask) != 0) {
 		log_error("cannot create sigmask for dbus thread, exit");
-		pthread_mutex_lock(&(dbus_monitor->state_mutex));
-		monitor->state = MONITOR_STATE_DEAD;
-		pthread_mutex_unlock(&(dbus_monitor->state_mutex));
+		mark_monitor_dead(monitor);
 		return NULL;
 	}
 	if (pthread_sigmask(SIG_BLOCK, &blocking_mask, NULL) != 0) {
 		log_error("cannot mask dbus signals, exit");
-		pthread_mutex_lock(&(dbus_monitor->state_mutex));
-		monitor->state = MONITOR_STATE_DEAD;
-		pthread_mutex_unlock(&(dbus_monitor->state_mutex));
+		mark_monitor_dead(monitor);
 		return NULL;
 	}
 
 	GError *error = NULL;
-	GDBusConnection* connection = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+	GDBusConnection* connection = dbus_monitor->source_ops->connect(dbus_monitor, &error);
 	if (connection == NULL) {
 		g_printerr ("Error connecting to D-Bus address: %s\n", error->message);
 		g_error_free (error);
+		mark_monitor_dead(monitor);
 		return NULL;
 	}
 
@@ -268,10 +434,7 @@ static void* monitoring_thread(void* monitor_ptr) {
 	const char* object_path;
 	const char* service_name;
 
-	dbus_callback_parameters cp = {
-			connection,
-			&(dbus_monitor->type)
-	};
+	dbus_monitor->connection = connection;
 
 	guint add_subscription_id = 0;
 	guint remove_subscription_id = 0;
@@ -291,7 +454,7 @@ static void* monitoring_thread(void* monitor_ptr) {
 				 NULL,
 				 G_DBUS_SIGNAL_FLAGS_NONE,
 				 udisks_callback,
-				 &cp,
+				 monitor,
 				 NULL);
 		remove_subscription_id = g_dbus_connection_signal_subscribe
 				(connection,
@@ -302,7 +465,7 @@ static void* monitoring_thread(void* monitor_ptr) {
 				 NULL,
 				 G_DBUS_SIGNAL_FLAGS_NONE,
 				 udisks_callback,
-				 &cp,
+				 monitor,
 				 NULL);
 	} else if(dbus_monitor->type == DBUS_MONITOR_TYPE_NM) {
 		interface_added_method = NM_STATE_CHANGED_SIGNAL;//NM_DEVICE_ADDED_SIGNAL;
@@ -318,19 +481,22 @@ static void* monitoring_thread(void* monitor_ptr) {
 				 NULL,
 				 G_DBUS_SIGNAL_FLAGS_NONE,
 				 udisks_callback,
-				 &cp,
+				 monitor,
 				 NULL);
 	} else {
 		log_error("unexpected dbus monitor type: %d", dbus_monitor->type);
 		g_object_unref (connection);
-		pthread_mutex_lock(&(dbus_monitor->state_mutex));
-		monitor->state = MONITOR_STATE_DEAD;
-		pthread_mutex_unlock(&(dbus_monitor->state_mutex));
+		mark_monitor_dead(monitor);
 		return NULL;
 	}
 
-	dbus_monitor->subscription_loop = g_main_loop_new(NULL, FALSE);
-	g_main_loop_run(dbus_monitor->subscription_loop);
+	// signals come after snapshot, they are dispatched by loop only
+	if (monitor_state(monitor) != MONITOR_STATE_DYING) {
+		submit_snapshot(monitor, connection);
+	}
+	if (monitor_state(monitor) != MONITOR_STATE_DYING) {
+		g_main_loop_run(dbus_monitor->subscription_loop);
+	}
 	if(dbus_monitor->type == DBUS_MONITOR_TYPE_UDISKS) {
 		g_dbus_connection_signal_unsubscribe(connection, add_subscription_id);
 		g_dbus_connection_signal_unsubscribe(connection, remove_subscription_id);
@@ -338,12 +504,12 @@ static void* monitoring_thread(void* monitor_ptr) {
 		g_dbus_connection_signal_unsubscribe(connection, add_subscription_id);
 	}
 
-	g_main_loop_unref(dbus_monitor->subscription_loop);
+	// workers may still enrich queued events through connection
+	drain_monitor_events(monitor);
+	dbus_monitor->connection = NULL;
 	g_object_unref (connection);
 
-	pthread_mutex_lock(&(dbus_monitor->state_mutex));
-	monitor->state = MONITOR_STATE_DEAD;
-	pthread_mutex_unlock(&(dbus_monitor->state_mutex));
+	mark_monitor_dead(monitor);
 	pthread_exit(NULL);
 	return NULL;
 }
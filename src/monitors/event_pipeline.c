@@ -0,0 +1,469 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdalign.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <logging/logging.h>
+#include "monitor.h"
+#include "errors.h"
+#include "monotonic.h"
+#include "event_pipeline.h"
+
+#define CACHE_LINE_SIZE				64
+
+/*
+ * Bounded queue by D. Vyukov: each cell carries sequence number telling
+ * whether it is free for producer of given position or ready for consumer.
+ * Producers only contend on enqueue position with single CAS.
+ */
+struct event_cell {
+	atomic_size_t sequence;
+	struct monitor_event event;
+};
+
+/*
+ * Min-heap of popped events by stamp, ties keep order of arrival
+ */
+struct reorder_buffer {
+	struct monitor_event* events;
+	uint64_t* arrivals;
+	int* heap;			// indices of events, earliest first
+	int* free_slots;
+	int capacity;
+	int count;
+	uint64_t next_arrival;
+};
+
+struct event_queue {
+	struct event_cell* cells;
+	size_t mask;
+	struct reorder_buffer reorder;
+	alignas(CACHE_LINE_SIZE) atomic_size_t enqueue_position;
+	atomic_int in_flight;	// producers between taking stamp and push
+	alignas(CACHE_LINE_SIZE) atomic_size_t dequeue_position;
+	sem_t items;
+	pthread_t thread;
+	// blocked producers and drains sleep on progress, which worker bumps
+	// only while there are waiters: after each event for producers waiting
+	// for free cell, when monitor is down to MONITOR_QUEUE_RESUME or 0 events
+	// for those waiting for a monitor
+	alignas(CACHE_LINE_SIZE) atomic_int progress;
+	atomic_int waiters;
+	atomic_int push_waiters;
+};
+
+static struct event_queue* workers = NULL;
+static int workers_count = 0;
+static atomic_int next_worker = 0;
+static atomic_int stopping = 0;
+
+static void* worker_thread(void* queue_ptr);
+
+static int reorder_init(struct reorder_buffer* buffer, int capacity) {
+	buffer->events = (struct monitor_event*)malloc(capacity * sizeof(struct monitor_event));
+	buffer->arrivals = (uint64_t*)malloc(capacity * sizeof(uint64_t));
+	buffer->heap = (int*)malloc(capacity * sizeof(int));
+	buffer->free_slots = (int*)malloc(capacity * sizeof(int));
+	buffer->capacity = capacity;
+	buffer->count = 0;
+	buffer->next_arrival = 0;
+	if (buffer->events == NULL || buffer->arrivals == NULL || buffer->heap == NULL
+		|| buffer->free_slots == NULL) {
+		return E_OUT_OF_MEMORY;
+	}
+	for (int i = 0; i < capacity; i++) {
+		buffer->free_slots[i] = capacity - 1 - i;
+	}
+	return CALL_SUCCESS;
+}
+
+static void reorder_destroy(struct reorder_buffer* buffer) {
+	free(buffer->events);
+	free(buffer->arrivals);
+	free(buffer->heap);
+	free(buffer->free_slots);
+}
+
+static int reorder_before(const struct reorder_buffer* buffer, int first, int second) {
+	uint64_t first_ns = buffer->events[first].time_ns;
+	uint64_t second_ns = buffer->events[second].time_ns;
+	return first_ns < second_ns
+		   || (first_ns == second_ns && buffer->arrivals[first] < buffer->arrivals[second]);
+}
+
+static void reorder_add(struct reorder_buffer* buffer, const struct monitor_event* event) {
+	int slot = buffer->free_slots[buffer->capacity - 1 - buffer->count];
+	buffer->events[slot] = *event;
+	buffer->arrivals[slot] = buffer->next_arrival++;
+	int position = buffer->count++;
+	while (position > 0) {
+		int parent = (position - 1) / 2;
+		if (!reorder_before(buffer, slot, buffer->heap[parent])) break;
+		buffer->heap[position] = buffer->heap[parent];
+		position = parent;
+	}
+	buffer->heap[position] = slot;
+}
+
+/*
+ * Removes earliest event from heap, its slot stays valid until next add
+ */
+static struct monitor_event* reorder_take(struct reorder_buffer* buffer) {
+	int slot = buffer->heap[0];
+	int last = buffer->heap[--buffer->count];
+	int position = 0;
+	while (1) {
+		int child = 2 * position + 1;
+		if (child >= buffer->count) break;
+		if (child + 1 < buffer->count
+			&& reorder_before(buffer, buffer->heap[child + 1], buffer->heap[child])) {
+			child++;
+		}
+		if (!reorder_before(buffer, buffer->heap[child], last)) break;
+		buffer->heap[position] = buffer->heap[child];
+		position = child;
+	}
+	if (buffer->count > 0) buffer->heap[position] = last;
+	buffer->free_slots[buffer->capacity - 1 - buffer->count] = slot;
+	return &buffer->events[slot];
+}
+
+static int queue_init(struct event_queue* queue, size_t capacity) {
+	size_t size = 1;
+	while (size < capacity) size <<= 1;
+	queue->cells = (struct event_cell*)malloc(size * sizeof(struct event_cell));
+	if (queue->cells == NULL) return E_OUT_OF_MEMORY;
+	for (size_t i = 0; i < size; i++) {
+		atomic_init(&queue->cells[i].sequence, i);
+	}
+	queue->mask = size - 1;
+	if (reorder_init(&queue->reorder, (int)size) != CALL_SUCCESS) {
+		reorder_destroy(&queue->reorder);
+		free(queue->cells);
+		return E_OUT_OF_MEMORY;
+	}
+	atomic_init(&queue->enqueue_position, 0);
+	atomic_init(&queue->in_flight, 0);
+	atomic_init(&queue->dequeue_position, 0);
+	atomic_init(&queue->progress, 0);
+	atomic_init(&queue->waiters, 0);
+	atomic_init(&queue->push_waiters, 0);
+	if (sem_init(&queue->items, 0, 0) != 0) {
+		reorder_destroy(&queue->reorder);
+		free(queue->cells);
+		return CALL_FAILURE;
+	}
+	return CALL_SUCCESS;
+}
+
+static void queue_destroy(struct event_queue* queue) {
+	sem_destroy(&queue->items);
+	reorder_destroy(&queue->reorder);
+	free(queue->cells);
+}
+
+static int queue_push(struct event_queue* queue, const struct monitor_event* event,
+					  size_t name_length) {
+	struct event_cell* cell;
+	size_t position = atomic_load_explicit(&queue->enqueue_position, memory_order_relaxed);
+	while (1) {
+		cell = &queue->cells[position & queue->mask];
+		size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+		if (difference == 0) {
+			if (atomic_compare_exchange_weak_explicit(&queue->enqueue_position, &position,
+													  position + 1, memory_order_relaxed,
+													  memory_order_relaxed)) {
+				break;
+			}
+		} else if (difference < 0) {
+			return CALL_FAILURE;	// full
+		} else {
+			position = atomic_load_explicit(&queue->enqueue_position, memory_order_relaxed);
+		}
+	}
+	// copy only used part of name
+	memcpy(&cell->event, event, offsetof(struct monitor_event, name) + name_length + 1);
+	atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+	sem_post(&queue->items);
+	return CALL_SUCCESS;
+}
+
+static int queue_pop(struct event_queue* queue, struct monitor_event* event) {
+	struct event_cell* cell;
+	size_t position = atomic_load_explicit(&queue->dequeue_position, memory_order_relaxed);
+	while (1) {
+		cell = &queue->cells[position & queue->mask];
+		size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+		if (difference == 0) {
+			if (atomic_compare_exchange_weak_explicit(&queue->dequeue_position, &position,
+													  position + 1, memory_order_relaxed,
+													  memory_order_relaxed)) {
+				break;
+			}
+		} else if (difference < 0) {
+			return CALL_FAILURE;	// empty
+		} else {
+			position = atomic_load_explicit(&queue->dequeue_position, memory_order_relaxed);
+		}
+	}
+	*event = cell->event;
+	atomic_store_explicit(&cell->sequence, position + queue->mask + 1, memory_order_release);
+	return CALL_SUCCESS;
+}
+
+/*
+ * Sleeps until worker processed an event after progress was read
+ */
+static void wait_progress(struct event_queue* queue, int progress) {
+	syscall(SYS_futex, (int*)&queue->progress, FUTEX_WAIT_PRIVATE, progress, NULL, NULL, 0);
+}
+
+/*
+ * Called by worker with number of events its monitor has left,
+ * or with -1 after it freed cells of queue
+ */
+static void notify_progress(struct event_queue* queue, int left) {
+	if (atomic_load(&queue->push_waiters) == 0
+		&& ((left != 0 && left != MONITOR_QUEUE_RESUME) || atomic_load(&queue->waiters) == 0)) {
+		return;
+	}
+	atomic_fetch_add(&queue->progress, 1);
+	syscall(SYS_futex, (int*)&queue->progress, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+int event_pipeline_start(int count, size_t queue_capacity) {
+	if (count <= 0 || workers != NULL) return CALL_SUCCESS;
+	workers = (struct event_queue*)aligned_alloc(CACHE_LINE_SIZE,
+			((count * sizeof(struct event_queue) + CACHE_LINE_SIZE - 1)
+			 / CACHE_LINE_SIZE) * CACHE_LINE_SIZE);
+	if (workers == NULL) return E_OUT_OF_MEMORY;
+	atomic_store(&stopping, 0);
+	for (int i = 0; i < count; i++) {
+		if (queue_init(&workers[i], queue_capacity) != CALL_SUCCESS
+			|| pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]) != 0) {
+			log_error("cannot start event worker %d", i);
+			workers_count = i;
+			event_pipeline_stop();
+			return CALL_FAILURE;
+		}
+	}
+	workers_count = count;
+	return CALL_SUCCESS;
+}
+
+void event_pipeline_stop() {
+	if (workers == NULL) return;
+	atomic_store(&stopping, 1);
+	for (int i = 0; i < workers_count; i++) {
+		sem_post(&workers[i].items);
+	}
+	for (int i = 0; i < workers_count; i++) {
+		pthread_join(workers[i].thread, NULL);
+		queue_destroy(&workers[i]);
+	}
+	free(workers);
+	workers = NULL;
+	workers_count = 0;
+}
+
+int backpressure_from_string(const char* name) {
+	if (strcmp(name, "block") == 0) return BACKPRESSURE_BLOCK;
+	if (strcmp(name, "drop-oldest") == 0) return BACKPRESSURE_DROP_OLDEST;
+	if (strcmp(name, "sample") == 0) return BACKPRESSURE_SAMPLE;
+	return -1;
+}
+
+void monitor_queue_init(struct monitor_queue_state* state, int backpressure) {
+	state->backpressure = backpressure;
+	state->worker = atomic_fetch_add(&next_worker, 1);
+	atomic_init(&state->queued, 0);
+	atomic_init(&state->handled, 0);
+	atomic_init(&state->skip, 0);
+	atomic_init(&state->dropped, 0);
+	state->sampled = 0;
+}
+
+void submit_monitor_event(monitor_t monitor, monitor_event_handler handler,
+						  uint32_t kind, uint32_t value, const char* name) {
+	struct monitor_event event;
+	event.monitor = monitor;
+	event.handler = handler;
+	event.kind = kind;
+	event.value = value;
+	size_t name_length = 0;
+	if (name != NULL) {
+		name_length = strnlen(name, MONITOR_EVENT_NAME_LENGTH - 1);
+		memcpy(event.name, name, name_length);
+	}
+	event.name[name_length] = '\0';
+
+	if (workers == NULL) {
+		atomic_int* scope = log_scope;
+		log_scope = &monitor->log_level;
+		handler(monitor, &event);
+		log_scope = scope;
+		atomic_fetch_add(&monitor->events.handled, 1);
+		return;
+	}
+
+	struct monitor_queue_state* state = &monitor->events;
+	struct event_queue* queue = &workers[state->worker % workers_count];
+	int live = atomic_load(&state->queued) - atomic_load(&state->skip);
+	if (live >= MONITOR_QUEUE_LIMIT) {
+		if (state->backpressure == BACKPRESSURE_DROP_OLDEST) {
+			// worker will discard oldest queued event of this monitor
+			atomic_fetch_add(&state->skip, 1);
+			atomic_fetch_add(&state->dropped, 1);
+		} else if (state->backpressure == BACKPRESSURE_SAMPLE
+				   && (state->sampled++ % BACKPRESSURE_SAMPLE_RATE) != 0) {
+			atomic_fetch_add(&state->dropped, 1);
+			return;
+		}
+	}
+
+	if (state->backpressure == BACKPRESSURE_BLOCK) {
+		// waiter is counted before its condition is checked, so worker
+		// which made room after the check sees it and wakes it up
+		atomic_fetch_add(&queue->waiters, 1);
+		int progress = atomic_load(&queue->progress);
+		if (atomic_load(&state->queued) >= MONITOR_QUEUE_LIMIT) {
+			while (atomic_load(&state->queued) > MONITOR_QUEUE_RESUME) {
+				wait_progress(queue, progress);
+				progress = atomic_load(&queue->progress);
+			}
+		}
+		atomic_fetch_sub(&queue->waiters, 1);
+	}
+	// worker holds back events stamped after it saw no producer in flight
+	atomic_fetch_add(&queue->in_flight, 1);
+	event.time_ns = monotonic_ns();
+	atomic_fetch_add(&state->queued, 1);
+	if (queue_push(queue, &event, name_length) == CALL_SUCCESS) {
+		atomic_fetch_sub(&queue->in_flight, 1);
+		return;
+	}
+	if (state->backpressure != BACKPRESSURE_BLOCK) {
+		atomic_fetch_sub(&state->queued, 1);
+		atomic_fetch_add(&state->dropped, 1);
+		atomic_fetch_sub(&queue->in_flight, 1);
+		return;
+	}
+	// queue is shared with other monitors of the worker
+	atomic_fetch_add(&queue->push_waiters, 1);
+	int progress = atomic_load(&queue->progress);
+	while (queue_push(queue, &event, name_length) != CALL_SUCCESS) {
+		wait_progress(queue, progress);
+		progress = atomic_load(&queue->progress);
+	}
+	atomic_fetch_sub(&queue->push_waiters, 1);
+	atomic_fetch_sub(&queue->in_flight, 1);
+}
+
+void drain_monitor_events(monitor_t monitor) {
+	if (workers == NULL) return;
+	struct event_queue* queue = &workers[monitor->events.worker % workers_count];
+	atomic_fetch_add(&queue->waiters, 1);
+	int progress = atomic_load(&queue->progress);
+	while (atomic_load(&monitor->events.queued) > 0) {
+		wait_progress(queue, progress);
+		progress = atomic_load(&queue->progress);
+	}
+	atomic_fetch_sub(&queue->waiters, 1);
+}
+
+unsigned long wait_monitor_handled(monitor_t monitor, unsigned long count, long timeout_ms) {
+	unsigned long handled = atomic_load(&monitor->events.handled);
+	if (workers == NULL || handled >= count) return handled;
+	struct event_queue* queue = &workers[monitor->events.worker % workers_count];
+	struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+	atomic_fetch_add(&queue->waiters, 1);
+	int progress = atomic_load(&queue->progress);
+	// worker wakes waiters when monitor has no events left
+	while ((handled = atomic_load(&monitor->events.handled)) < count) {
+		if (syscall(SYS_futex, (int*)&queue->progress, FUTEX_WAIT_PRIVATE, progress,
+					&timeout, NULL, 0) != 0 && errno == ETIMEDOUT) {
+			break;
+		}
+		progress = atomic_load(&queue->progress);
+	}
+	atomic_fetch_sub(&queue->waiters, 1);
+	return atomic_load(&monitor->events.handled);
+}
+
+static void handle_event(struct event_queue* queue, struct monitor_event* event) {
+	struct monitor_queue_state* state = &event->monitor->events;
+	int skip = atomic_load(&state->skip);
+	while (skip > 0 && !atomic_compare_exchange_weak(&state->skip, &skip, skip - 1));
+	if (skip <= 0) {
+		log_scope = &event->monitor->log_level;
+		event->handler(event->monitor, event);
+		log_scope = &log_level;
+		atomic_fetch_add(&state->handled, 1);
+	}
+	notify_progress(queue, atomic_fetch_sub(&state->queued, 1) - 1);
+}
+
+/*
+ * Moves queued events to reorder buffer, sleeps for them only if the
+ * buffer is empty. Returns CALL_FAILURE once pipeline is stopping.
+ */
+static int collect_events(struct event_queue* queue) {
+	struct reorder_buffer* buffer = &queue->reorder;
+	struct monitor_event event;
+	int collected = 0;
+	while (buffer->count < buffer->capacity) {
+		if (buffer->count == 0) {
+			while (sem_wait(&queue->items) != 0 && errno == EINTR);
+		} else if (sem_trywait(&queue->items) != 0) {
+			break;
+		}
+		if (queue_pop(queue, &event) != CALL_SUCCESS) {
+			if (atomic_load(&stopping)) return CALL_FAILURE;
+			continue;
+		}
+		reorder_add(buffer, &event);
+		collected = 1;
+	}
+	if (collected) notify_progress(queue, -1);
+	return CALL_SUCCESS;
+}
+
+/*
+ * Events are handled once none older can arrive: producer takes stamp
+ * after it is counted in flight and pushes before it leaves, so after
+ * seeing none in flight all events stamped before are in the queue
+ */
+static void* worker_thread(void* queue_ptr) {
+	struct event_queue* queue = (struct event_queue*)queue_ptr;
+	struct reorder_buffer* buffer = &queue->reorder;
+	sigset_t blocking_mask;
+	sigfillset(&blocking_mask);
+	pthread_sigmask(SIG_BLOCK, &blocking_mask, NULL);
+
+	while (collect_events(queue) == CALL_SUCCESS) {
+		uint64_t horizon_ns = (uint64_t)monotonic_ns();
+		if (atomic_load(&queue->in_flight) > 0 && buffer->count < buffer->capacity) {
+			sched_yield();
+			continue;
+		}
+		if (collect_events(queue) != CALL_SUCCESS) break;
+		while (buffer->count > 0 && (buffer->events[buffer->heap[0]].time_ns < horizon_ns
+									 || buffer->count == buffer->capacity)) {
+			handle_event(queue, reorder_take(buffer));
+		}
+	}
+	while (buffer->count > 0) {
+		handle_event(queue, reorder_take(buffer));
+	}
+	return NULL;
+}
@@ -0,0 +1,269 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "errors.h"
+#include "logging.h"
+#include "content_hash.h"
+#include "hot_files.h"
+
+#define HOT_FILES_SEED		0x686f7466696c6573ULL
+
+struct hot_counter {
+	struct hot_file file;
+	uint64_t key;
+	int heap_position;
+};
+
+/*
+ * Counters are found by open addressing index of key -> counter + 1
+ * (0 is empty slot) and kept in min-heap by count, so counter of least
+ * frequent path is replaced in O(log capacity).
+ */
+struct hot_files {
+	struct hot_counter* counters;
+	int* heap;
+	int* index;
+	uint32_t index_mask;
+	int capacity;
+	int used;
+	uint64_t events;
+};
+
+static pthread_mutex_t hot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct hot_files hot = { NULL, NULL, NULL, 0, 0, 0, 0 };
+static atomic_int hot_enabled = 0;	// lets disabled record skip the mutex
+
+int hot_files_enable(int capacity) {
+	if (capacity <= 0) return E_INVALID_INPUT;
+	uint32_t index_size = 2;
+	while (index_size < (uint32_t)capacity * 2) index_size <<= 1;
+	struct hot_counter* counters =
+			(struct hot_counter*)malloc(capacity * sizeof(struct hot_counter));
+	int* heap = (int*)malloc(capacity * sizeof(int));
+	int* index = (int*)calloc(index_size, sizeof(int));
+	if (counters == NULL || heap == NULL || index == NULL) {
+		free(counters);
+		free(heap);
+		free(index);
+		return E_OUT_OF_MEMORY;
+	}
+	pthread_mutex_lock(&hot_mutex);
+	free(hot.counters);
+	free(hot.heap);
+	free(hot.index);
+	hot.counters = counters;
+	hot.heap = heap;
+	hot.index = index;
+	hot.index_mask = index_size - 1;
+	hot.capacity = capacity;
+	hot.used = 0;
+	hot.events = 0;
+	atomic_store(&hot_enabled, 1);
+	pthread_mutex_unlock(&hot_mutex);
+	log_info("hot files: %d counters in %zu bytes", capacity,
+			 capacity * (sizeof(struct hot_counter) + sizeof(int))
+			 + index_size * sizeof(int));
+	return CALL_SUCCESS;
+}
+
+void hot_files_disable() {
+	pthread_mutex_lock(&hot_mutex);
+	atomic_store(&hot_enabled, 0);
+	free(hot.counters);
+	free(hot.heap);
+	free(hot.index);
+	memset(&hot, 0, sizeof(hot));
+	pthread_mutex_unlock(&hot_mutex);
+}
+
+static void heap_swap(int a, int b) {
+	int counter = hot.heap[a];
+	hot.heap[a] = hot.heap[b];
+	hot.heap[b] = counter;
+	hot.counters[hot.heap[a]].heap_position = a;
+	hot.counters[hot.heap[b]].heap_position = b;
+}
+
+static void heap_sift_down(int position) {
+	while (1) {
+		int smallest = position;
+		int left = 2 * position + 1;
+		int right = left + 1;
+		if (left < hot.used && hot.counters[hot.heap[left]].file.count
+							   < hot.counters[hot.heap[smallest]].file.count) {
+			smallest = left;
+		}
+		if (right < hot.used && hot.counters[hot.heap[right]].file.count
+								< hot.counters[hot.heap[smallest]].file.count) {
+			smallest = right;
+		}
+		if (smallest == position) return;
+		heap_swap(position, smallest);
+		position = smallest;
+	}
+}
+
+static void heap_sift_up(int position) {
+	while (position > 0) {
+		int parent = (position - 1) / 2;
+		if (hot.counters[hot.heap[parent]].file.count
+			<= hot.counters[hot.heap[position]].file.count) {
+			return;
+		}
+		heap_swap(position, parent);
+		position = parent;
+	}
+}
+
+/*
+ * Returns index slot holding key or empty slot where it belongs
+ */
+static uint32_t index_find(uint64_t key) {
+	uint32_t slot = (uint32_t)key & hot.index_mask;
+	while (hot.index[slot] != 0 && hot.counters[hot.index[slot] - 1].key != key) {
+		slot = (slot + 1) & hot.index_mask;
+	}
+	return slot;
+}
+
+/*
+ * Removes key with backward shift, so probe chains stay without holes
+ */
+static void index_remove(uint64_t key) {
+	uint32_t hole = index_find(key);
+	if (hot.index[hole] == 0) return;
+	uint32_t slot = hole;
+	while (1) {
+		slot = (slot + 1) & hot.index_mask;
+		if (hot.index[slot] == 0) break;
+		uint32_t home = (uint32_t)hot.counters[hot.index[slot] - 1].key & hot.index_mask;
+		// entry may fill the hole unless its home lies cyclically in (hole, slot]
+		if (((slot - home) & hot.index_mask) >= ((slot - hole) & hot.index_mask)) {
+			hot.index[hole] = hot.index[slot];
+			hole = slot;
+		}
+	}
+	hot.index[hole] = 0;
+}
+
+void hot_files_record(const char* directory, const char* name) {
+	if (!atomic_load_explicit(&hot_enabled, memory_order_relaxed)) return;
+	size_t name_length = strlen(name);
+	uint64_t key = hash64(name, name_length, hash64(directory, strlen(directory),
+													 HOT_FILES_SEED));
+	pthread_mutex_lock(&hot_mutex);
+	if (hot.capacity == 0) {
+		pthread_mutex_unlock(&hot_mutex);
+		return;
+	}
+	hot.events++;
+	uint32_t slot = index_find(key);
+	if (hot.index[slot] != 0) {
+		struct hot_counter* counter = &hot.counters[hot.index[slot] - 1];
+		counter->file.count++;
+		heap_sift_down(counter->heap_position);
+		pthread_mutex_unlock(&hot_mutex);
+		return;
+	}
+	struct hot_counter* counter;
+	if (hot.used < hot.capacity) {
+		counter = &hot.counters[hot.used];
+		counter->file.count = 1;
+		counter->file.error = 0;
+		counter->heap_position = hot.used;
+		hot.heap[hot.used] = hot.used;
+		hot.used++;
+	} else {
+		// least frequent path gives its counter away, its count becomes error
+		counter = &hot.counters[hot.heap[0]];
+		index_remove(counter->key);
+		slot = index_find(key);
+		counter->file.error = counter->file.count;
+		counter->file.count++;
+	}
+	counter->key = key;
+	counter->file.directory = directory;
+	if (name_length >= sizeof(counter->file.name)) {
+		name_length = sizeof(counter->file.name) - 1;
+	}
+	memcpy(counter->file.name, name, name_length);
+	counter->file.name[name_length] = '\0';
+	hot.index[slot] = (int)(counter - hot.counters) + 1;
+	if (counter->file.count == 1) {
+		heap_sift_up(counter->heap_position);
+	} else {
+		heap_sift_down(counter->heap_position);
+	}
+	pthread_mutex_unlock(&hot_mutex);
+}
+
+static int compare_hot_files(const void* a, const void* b) {
+	uint64_t first = ((const struct hot_file*)a)->count;
+	uint64_t second = ((const struct hot_file*)b)->count;
+	return first < second ? 1 : (first > second ? -1 : 0);
+}
+
+/*
+ * Copies counters sorted by count, then starts new period if reset is set.
+ * Returns NULL with used set to 0 if counters are not enabled.
+ */
+static struct hot_file* sorted_files(int reset, int* used, uint64_t* events) {
+	pthread_mutex_lock(&hot_mutex);
+	*used = hot.used;
+	*events = hot.events;
+	if (hot.capacity == 0) {
+		pthread_mutex_unlock(&hot_mutex);
+		return NULL;
+	}
+	struct hot_file* files = (struct hot_file*)malloc(hot.used * sizeof(struct hot_file) + 1);
+	if (files != NULL) {
+		for (int i = 0; i < hot.used; i++) {
+			files[i] = hot.counters[i].file;
+		}
+	}
+	if (reset) {
+		hot.used = 0;
+		hot.events = 0;
+		memset(hot.index, 0, (hot.index_mask + 1) * sizeof(int));
+	}
+	pthread_mutex_unlock(&hot_mutex);
+	if (files != NULL) {
+		qsort(files, *used, sizeof(struct hot_file), compare_hot_files);
+	}
+	return files;
+}
+
+int hot_files_top(struct hot_file* files, int* count) {
+	int used;
+	uint64_t events;
+	struct hot_file* sorted = sorted_files(0, &used, &events);
+	if (sorted == NULL) {
+		*count = 0;
+		return used == 0 ? CALL_SUCCESS : E_OUT_OF_MEMORY;
+	}
+	if (*count > used) *count = used;
+	memcpy(files, sorted, *count * sizeof(struct hot_file));
+	free(sorted);
+	return CALL_SUCCESS;
+}
+
+void hot_files_report(int count, int reset) {
+	int used;
+	uint64_t events;
+	struct hot_file* files = sorted_files(reset, &used, &events);
+	if (files == NULL) {
+		if (used > 0) log_error("cannot report hot files: out of memory");
+		return;
+	}
+
+	if (count > used) count = used;
+	log_info("%d hottest files of %llu events", count, (unsigned long long)events);
+	for (int i = 0; i < count; i++) {
+		const struct hot_file* file = &files[i];
+		log_info("  %llu events (at least %llu): %s%s%s", (unsigned long long)file->count,
+				 (unsigned long long)(file->count - file->error), file->directory,
+				 file->name[0] != '\0' ? "/" : "", file->name);
+	}
+	free(files);
+}
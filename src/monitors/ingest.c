@@ -0,0 +1,555 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdalign.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#ifdef SLM_WITH_IO_URING
+#include <liburing.h>
+#endif
+#include <logging/logging.h>
+#include "errors.h"
+#include "ingest.h"
+
+#define INGEST_BATCH_SIZE		64
+#define INGEST_RING_ENTRIES		256
+#define INGEST_FIXED_BUFFERS	64
+
+#define SOURCE_READ		1
+#define SOURCE_READY	2
+
+#define REQUEST_ADD		1
+#define REQUEST_REMOVE	2
+
+/*
+ * Caller of add waits on its stack for engine to attach source
+ */
+struct add_waiter {
+	int done;
+	int result;
+};
+
+struct ingest_source {
+	int fd;
+	int kind;
+	int poll_events;	// of ready source, EPOLLIN or EPOLLPRI
+	ingest_read_handler on_data;
+	ingest_ready_handler on_ready;
+	ingest_release_handler on_release;
+	void* context;
+
+	// guarded by commands_mutex
+	int requests;
+	int queued;
+	struct ingest_source* next_command;
+	struct add_waiter* waiter;
+
+	// engine thread only
+	int attached;
+	int active;			// handlers are still called
+	int pending;		// io_uring operation in flight
+	int removing;
+	int buffer_index;	// registered buffer or -1
+	char* buffer;
+};
+
+static pthread_mutex_t commands_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t added_cond = PTHREAD_COND_INITIALIZER;
+static struct ingest_source* commands_head = NULL;
+static struct ingest_source* commands_tail = NULL;
+
+static pthread_t engine;
+static int engine_running = 0;
+static atomic_int stopping = 0;
+static int wake_fd = -1;
+static unsigned long wakeups_count = 0;
+static unsigned long events_count = 0;
+
+static int epoll_fd = -1;
+static alignas(max_align_t) char read_buffer[INGEST_READ_BUFFER_SIZE];
+
+#ifdef SLM_WITH_IO_URING
+static int use_uring = 0;
+static struct io_uring ring;
+static char* fixed_buffers = NULL;
+static int free_buffers[INGEST_FIXED_BUFFERS];
+static int free_buffers_count = 0;
+static uint64_t wake_value;
+static int wake_token;
+#endif
+
+static void* engine_thread(void* unused);
+
+static void wake_engine() {
+	uint64_t one = 1;
+	while (write(wake_fd, &one, sizeof(one)) < 0 && errno == EINTR);
+}
+
+static void release_source(struct ingest_source* source) {
+#ifdef SLM_WITH_IO_URING
+	if (source->buffer_index >= 0) {
+		free_buffers[free_buffers_count++] = source->buffer_index;
+	} else {
+		free(source->buffer);
+	}
+#endif
+	source->on_release(source->context);
+	free(source);
+}
+
+/*
+ * Common part of completion handling, returns 0 when source must not
+ * be read any more
+ */
+static int deliver(struct ingest_source* source, const char* data, ssize_t length) {
+	events_count++;
+	if (source->kind == SOURCE_READ) {
+		// on read error handler decides whether source is read further
+		return source->on_data(source->context, data, length) == INGEST_CONTINUE
+			   && length != 0;
+	}
+	return source->on_ready(source->context) == INGEST_CONTINUE;
+}
+
+/*
+ * epoll engine: level triggered readiness, reads into shared buffer
+ */
+
+static int epoll_init() {
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) return CALL_FAILURE;
+	struct epoll_event event = {0};
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) < 0) {
+		close(epoll_fd);
+		return CALL_FAILURE;
+	}
+	return CALL_SUCCESS;
+}
+
+static int epoll_attach(struct ingest_source* source) {
+	struct epoll_event event = {0};
+	event.events = source->poll_events;
+	event.data.ptr = source;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, source->fd, &event) < 0) {
+		log_error("ingest epoll_ctl: %s", strerror(errno));
+		return CALL_FAILURE;
+	}
+	source->attached = 1;
+	source->active = 1;
+	return CALL_SUCCESS;
+}
+
+static void epoll_deactivate(struct ingest_source* source) {
+	if (source->active) {
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+		source->active = 0;
+	}
+}
+
+static void epoll_dispatch() {
+	struct epoll_event events[INGEST_BATCH_SIZE];
+	int count = epoll_wait(epoll_fd, events, INGEST_BATCH_SIZE, -1);
+	if (count < 0) {
+		if (errno != EINTR) log_error("ingest epoll_wait: %s", strerror(errno));
+		return;
+	}
+	wakeups_count++;
+	for (int i = 0; i < count; i++) {
+		struct ingest_source* source = (struct ingest_source*)events[i].data.ptr;
+		if (source == NULL) {
+			uint64_t value;
+			while (read(wake_fd, &value, sizeof(value)) < 0 && errno == EINTR);
+			continue;
+		}
+		// commands are applied after batch, so source is still alive here
+		if (!source->active) continue;
+		ssize_t length = 0;
+		if (source->kind == SOURCE_READ) {
+			length = read(source->fd, read_buffer, INGEST_READ_BUFFER_SIZE);
+			if (length < 0) {
+				if (errno == EAGAIN || errno == EINTR) continue;
+				length = -errno;
+			}
+		}
+		if (!deliver(source, read_buffer, length)) {
+			epoll_deactivate(source);
+		}
+	}
+}
+
+#ifdef SLM_WITH_IO_URING
+
+/*
+ * io_uring engine: read sources always have read posted into their
+ * (preferably registered) buffer, ready sources have multishot poll armed
+ */
+
+static struct io_uring_sqe* get_sqe() {
+	struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+	while (sqe == NULL) {
+		io_uring_submit(&ring);
+		sqe = io_uring_get_sqe(&ring);
+	}
+	return sqe;
+}
+
+static void post_wake_read() {
+	struct io_uring_sqe* sqe = get_sqe();
+	io_uring_prep_read(sqe, wake_fd, &wake_value, sizeof(wake_value), 0);
+	io_uring_sqe_set_data(sqe, &wake_token);
+}
+
+static int uring_init() {
+	int result = io_uring_queue_init(INGEST_RING_ENTRIES, &ring, 0);
+	if (result < 0) {
+		log_error("io_uring_queue_init: %s, falling back to epoll", strerror(-result));
+		return CALL_FAILURE;
+	}
+	fixed_buffers = (char*)aligned_alloc(4096, INGEST_FIXED_BUFFERS * INGEST_READ_BUFFER_SIZE);
+	if (fixed_buffers != NULL) {
+		struct iovec iovecs[INGEST_FIXED_BUFFERS];
+		for (int i = 0; i < INGEST_FIXED_BUFFERS; i++) {
+			iovecs[i].iov_base = fixed_buffers + i * INGEST_READ_BUFFER_SIZE;
+			iovecs[i].iov_len = INGEST_READ_BUFFER_SIZE;
+		}
+		if (io_uring_register_buffers(&ring, iovecs, INGEST_FIXED_BUFFERS) == 0) {
+			for (int i = 0; i < INGEST_FIXED_BUFFERS; i++) {
+				free_buffers[i] = INGEST_FIXED_BUFFERS - 1 - i;
+			}
+			free_buffers_count = INGEST_FIXED_BUFFERS;
+		} else {
+			// e.g. RLIMIT_MEMLOCK, sources get plain buffers
+			free(fixed_buffers);
+			fixed_buffers = NULL;
+		}
+	}
+	post_wake_read();
+	return CALL_SUCCESS;
+}
+
+static void uring_destroy() {
+	io_uring_queue_exit(&ring);
+	free(fixed_buffers);
+	fixed_buffers = NULL;
+	free_buffers_count = 0;
+}
+
+static void uring_post(struct ingest_source* source) {
+	struct io_uring_sqe* sqe = get_sqe();
+	if (source->kind == SOURCE_READ) {
+		if (source->buffer_index >= 0) {
+			io_uring_prep_read_fixed(sqe, source->fd, source->buffer,
+									 INGEST_READ_BUFFER_SIZE, 0, source->buffer_index);
+		} else {
+			io_uring_prep_read(sqe, source->fd, source->buffer, INGEST_READ_BUFFER_SIZE, 0);
+		}
+	} else {
+		io_uring_prep_poll_multishot(sqe, source->fd, source->poll_events);
+	}
+	io_uring_sqe_set_data(sqe, source);
+	source->pending = 1;
+}
+
+static void uring_cancel(struct ingest_source* source) {
+	struct io_uring_sqe* sqe = get_sqe();
+	io_uring_prep_cancel64(sqe, (uint64_t)(uintptr_t)source, 0);
+	io_uring_sqe_set_data(sqe, NULL);
+}
+
+static int uring_attach(struct ingest_source* source) {
+	if (source->kind == SOURCE_READ) {
+		if (free_buffers_count > 0) {
+			source->buffer_index = free_buffers[--free_buffers_count];
+			source->buffer = fixed_buffers + source->buffer_index * INGEST_READ_BUFFER_SIZE;
+		} else {
+			source->buffer = (char*)malloc(INGEST_READ_BUFFER_SIZE);
+			if (source->buffer == NULL) {
+				log_error("ingest: %s", strerror(ENOMEM));
+				return E_OUT_OF_MEMORY;
+			}
+		}
+	}
+	source->attached = 1;
+	source->active = 1;
+	uring_post(source);
+	return CALL_SUCCESS;
+}
+
+static void uring_complete(struct io_uring_cqe* cqe) {
+	void* data = io_uring_cqe_get_data(cqe);
+	if (data == NULL) return;	// cancel request
+	if (data == &wake_token) {
+		post_wake_read();
+		return;
+	}
+	struct ingest_source* source = (struct ingest_source*)data;
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		source->pending = 0;
+	}
+	if (source->removing) {
+		if (!source->pending) release_source(source);
+		return;
+	}
+	if (!source->active) return;
+	if (source->kind == SOURCE_READY && cqe->res < 0) {
+		source->active = 0;
+		return;
+	}
+	if (!deliver(source, source->buffer, cqe->res)) {
+		source->active = 0;
+		if (source->pending) uring_cancel(source);
+	} else if (!source->pending) {
+		uring_post(source);
+	}
+}
+
+static void uring_dispatch() {
+	int result = io_uring_submit_and_wait(&ring, 1);
+	if (result < 0 && result != -EINTR) {
+		log_error("io_uring_submit_and_wait: %s", strerror(-result));
+		return;
+	}
+	wakeups_count++;
+	struct io_uring_cqe* cqes[INGEST_BATCH_SIZE];
+	unsigned count;
+	while ((count = io_uring_peek_batch_cqe(&ring, cqes, INGEST_BATCH_SIZE)) > 0) {
+		for (unsigned i = 0; i < count; i++) {
+			uring_complete(cqes[i]);
+		}
+		io_uring_cq_advance(&ring, count);
+	}
+}
+
+#endif
+
+static int attach_source(struct ingest_source* source) {
+#ifdef SLM_WITH_IO_URING
+	if (use_uring) return uring_attach(source);
+#endif
+	return epoll_attach(source);
+}
+
+static void remove_source(struct ingest_source* source) {
+	if (!source->attached) {
+		release_source(source);
+		return;
+	}
+#ifdef SLM_WITH_IO_URING
+	if (use_uring) {
+		source->removing = 1;
+		source->active = 0;
+		if (source->pending) {
+			// released on completion of cancelled operation
+			uring_cancel(source);
+		} else {
+			release_source(source);
+		}
+		return;
+	}
+#endif
+	epoll_deactivate(source);
+	release_source(source);
+}
+
+static void process_commands() {
+	while (1) {
+		pthread_mutex_lock(&commands_mutex);
+		struct ingest_source* source = commands_head;
+		int requests = 0;
+		struct add_waiter* waiter = NULL;
+		if (source != NULL) {
+			commands_head = source->next_command;
+			if (commands_head == NULL) commands_tail = NULL;
+			requests = source->requests;
+			source->requests = 0;
+			source->queued = 0;
+			waiter = source->waiter;
+			source->waiter = NULL;
+		}
+		pthread_mutex_unlock(&commands_mutex);
+		if (source == NULL) return;
+
+		int result = CALL_SUCCESS;
+		if (requests & REQUEST_REMOVE) {
+			remove_source(source);
+		} else if (requests & REQUEST_ADD) {
+			result = attach_source(source);
+			if (result != CALL_SUCCESS) {
+				// never handed to owner, so neither removed nor released by it
+				free(source);
+			}
+		}
+		if (waiter != NULL) {
+			pthread_mutex_lock(&commands_mutex);
+			waiter->result = result;
+			waiter->done = 1;
+			pthread_cond_broadcast(&added_cond);
+			pthread_mutex_unlock(&commands_mutex);
+		}
+	}
+}
+
+static void queue_request(struct ingest_source* source, int request,
+						  struct add_waiter* waiter) {
+	pthread_mutex_lock(&commands_mutex);
+	source->requests |= request;
+	if (waiter != NULL) source->waiter = waiter;
+	if (!source->queued) {
+		source->queued = 1;
+		source->next_command = NULL;
+		if (commands_tail != NULL) {
+			commands_tail->next_command = source;
+		} else {
+			commands_head = source;
+		}
+		commands_tail = source;
+	}
+	pthread_mutex_unlock(&commands_mutex);
+	wake_engine();
+}
+
+int ingest_start() {
+	if (engine_running) return CALL_SUCCESS;
+	wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (wake_fd < 0) {
+		log_error("ingest eventfd: %s", strerror(errno));
+		return CALL_FAILURE;
+	}
+#ifdef SLM_WITH_IO_URING
+	const char* engine_name = getenv(INGEST_ENGINE_ENVIRONMENT);
+	use_uring = (engine_name == NULL || strcmp(engine_name, "epoll") != 0)
+				&& uring_init() == CALL_SUCCESS;
+	if (!use_uring && epoll_init() != CALL_SUCCESS) {
+#else
+	if (epoll_init() != CALL_SUCCESS) {
+#endif
+		log_error("ingest epoll_create: %s", strerror(errno));
+		close(wake_fd);
+		return CALL_FAILURE;
+	}
+	atomic_store(&stopping, 0);
+	wakeups_count = 0;
+	events_count = 0;
+	if (pthread_create(&engine, NULL, engine_thread, NULL) != 0) {
+		log_error("ingest pthread_create: %s", strerror(errno));
+		ingest_stop();
+		return CALL_FAILURE;
+	}
+	engine_running = 1;
+	log_info("%s ingestion engine started", ingest_engine_name());
+	return CALL_SUCCESS;
+}
+
+void ingest_stop() {
+	if (engine_running) {
+		atomic_store(&stopping, 1);
+		wake_engine();
+		pthread_join(engine, NULL);
+		engine_running = 0;
+		log_info("%s ingestion engine: %lu events in %lu wakeups",
+				 ingest_engine_name(), events_count, wakeups_count);
+	}
+#ifdef SLM_WITH_IO_URING
+	if (use_uring) {
+		uring_destroy();
+		use_uring = 0;
+	}
+#endif
+	if (epoll_fd >= 0) {
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
+	if (wake_fd >= 0) {
+		close(wake_fd);
+		wake_fd = -1;
+	}
+}
+
+const char* ingest_engine_name() {
+#ifdef SLM_WITH_IO_URING
+	if (use_uring) return "io_uring";
+#endif
+	return "epoll";
+}
+
+static int add_source(int fd, int kind, int poll_events, ingest_read_handler on_data,
+					  ingest_ready_handler on_ready, ingest_release_handler on_release,
+					  void* context, ingest_source_t* source_ptr) {
+	if (!engine_running) {
+		log_error("ingestion engine is not started");
+		return CALL_FAILURE;
+	}
+	struct ingest_source* source = (struct ingest_source*)calloc(1, sizeof(struct ingest_source));
+	if (source == NULL) return E_OUT_OF_MEMORY;
+	source->fd = fd;
+	source->kind = kind;
+	source->poll_events = poll_events;
+	source->on_data = on_data;
+	source->on_ready = on_ready;
+	source->on_release = on_release;
+	source->context = context;
+	source->buffer_index = -1;
+	*source_ptr = source;
+	if (pthread_equal(pthread_self(), engine)) {
+		// added by handler, engine thread owns sources anyway
+		int result = attach_source(source);
+		if (result != CALL_SUCCESS) free(source);
+		return result;
+	}
+	struct add_waiter waiter = { 0, CALL_SUCCESS };
+	queue_request(source, REQUEST_ADD, &waiter);
+	pthread_mutex_lock(&commands_mutex);
+	while (!waiter.done) {
+		pthread_cond_wait(&added_cond, &commands_mutex);
+	}
+	pthread_mutex_unlock(&commands_mutex);
+	return waiter.result;
+}
+
+int ingest_add_read(int fd, ingest_read_handler on_data, ingest_release_handler on_release,
+					void* context, ingest_source_t* source) {
+	return add_source(fd, SOURCE_READ, EPOLLIN, on_data, NULL, on_release, context, source);
+}
+
+int ingest_add_ready(int fd, ingest_ready_handler on_ready, ingest_release_handler on_release,
+					 void* context, ingest_source_t* source) {
+	return add_source(fd, SOURCE_READY, EPOLLIN, NULL, on_ready, on_release, context, source);
+}
+
+int ingest_add_priority(int fd, ingest_ready_handler on_ready, ingest_release_handler on_release,
+						void* context, ingest_source_t* source) {
+	return add_source(fd, SOURCE_READY, EPOLLPRI, NULL, on_ready, on_release, context, source);
+}
+
+void ingest_remove(ingest_source_t source) {
+	queue_request(source, REQUEST_REMOVE, NULL);
+}
+
+static void* engine_thread(void* unused) {
+	sigset_t blocking_mask;
+	sigfillset(&blocking_mask);
+	pthread_sigmask(SIG_BLOCK, &blocking_mask, NULL);
+
+	while (!atomic_load(&stopping)) {
+#ifdef SLM_WITH_IO_URING
+		if (use_uring) {
+			uring_dispatch();
+		} else {
+			epoll_dispatch();
+		}
+#else
+		epoll_dispatch();
+#endif
+		process_commands();
+	}
+	return NULL;
+}
@@ -0,0 +1,28 @@
+#include <stdlib.h>
+#include <monitors/monitor.h>
+#include <logging/logging.h>
+#include "errors.h"
+#include "injector.h"
+
+int inject_events(monitor_t monitor, unsigned long count, int mode) {
+	if (monitor->ops->inject == NULL) {
+		log_error("events can be injected only into udev and dbus monitors");
+		return E_INVALID_MONITOR_TYPE;
+	}
+	return monitor->ops->inject(monitor, count, mode);
+}
+
+static int compare_latencies(const void* first, const void* second) {
+	long a = *(const long*)first;
+	long b = *(const long*)second;
+	return (a > b) - (a < b);
+}
+
+void log_inject_latency(const char* what, long* latencies_ns, unsigned long count) {
+	if (count == 0) return;
+	qsort(latencies_ns, count, sizeof(long), compare_latencies);
+	log_info("inject: %lu %s, latency to logged event min %.1f us, median %.1f us,"
+			 " p99 %.1f us, max %.1f us", count, what, latencies_ns[0] / 1e3,
+			 latencies_ns[count / 2] / 1e3, latencies_ns[count * 99 / 100] / 1e3,
+			 latencies_ns[count - 1] / 1e3);
+}
@@ -2,280 +2,708 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
-#include <pthread.h>
+#include <getopt.h>
 
 #include <sys/inotify.h>
 #include <monitors/monitor.h>
-#include <signal.h>
-#include <sys/poll.h>
 #include <logging/logging.h>
 #include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
 #include "errors.h"
+#include "monotonic.h"
+#include "monitor_alloc.h"
+#include "ingest.h"
+#include "hot_files.h"
 
 #define MODE_OPEN 'o'
 #define MODE_WRITE 'w'
 #define MODE_CLOSE 'c'
 #define MODE_MOVE 'm'
 #define MODE_DELETE 'd'
-#define MODES_COUNT 5
+#define MODES_COUNT INOTIFY_MODES_COUNT
 
-#define MAX_FILE_NAME_LENGTH 256
+#define OPTION_INCLUDE 'I'
+#define OPTION_EXCLUDE 'X'
+#define OPTION_CONTENT 'C'
+#define OPTION_TAIL 'T'
 
-#define EVENTS_COUNT_BUFFER 20
-#define EVENTS_BYTE_BUFFER sizeof(struct inotify_event)*EVENTS_COUNT_BUFFER
+// events after which content is compared, file is complete at that point
+#define CONTENT_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+// and after which stored hashes are dropped
+#define CONTENT_WATCH_EVENTS (CONTENT_EVENTS | IN_MOVED_FROM | IN_DELETE)
 
-static void* monitoring_thread(void* inotify_monitor_ptr);
-static void mark_dead(monitor_t monitor);
-static uint32_t mask_from_mode(char* mode);
+// events of path itself, it is watched again after it is gone
+#define SELF_EVENTS (IN_MOVE_SELF | IN_DELETE_SELF)
+// events of followed file in --tail mode
+#define TAIL_EVENTS (IN_MODIFY | SELF_EVENTS)
+// events of parent directory: path reappeared or directory itself is gone
+#define PARENT_EVENTS (IN_CREATE | IN_MOVED_TO | SELF_EVENTS)
+
+static int read_events(void* monitor_ptr, const char* data, ssize_t length);
+static void release_monitor(void* monitor_ptr);
+static uint32_t mask_from_mode(const char* mode);
+static void process_event(monitor_t monitor, struct monitor_event* event);
+static int split_watch_path(inotify_monitor_t inotify_monitor, char* parent);
+static const char* base_name(inotify_monitor_t inotify_monitor);
+static uint32_t watch_mask(inotify_monitor_t inotify_monitor);
+static struct inotify_rearm_stats* rearm_stats(inotify_monitor_t inotify_monitor);
+static int tailing(inotify_monitor_t inotify_monitor);
+static content_table_t content_table(inotify_monitor_t inotify_monitor);
+static void rearm_watch(inotify_monitor_t inotify_monitor, long appeared_ns);
+static int follow_file(inotify_monitor_t inotify_monitor, int from_end);
+static void record_watches(inotify_monitor_t inotify_monitor);
+
+struct inotify_monitor_object {
+	struct monitor_t monitor;
+	struct inotify_monitor inotify;
+};
+
+struct monitor_slab inotify_monitor_slab =
+		MONITOR_SLAB_INITIALIZER(struct inotify_monitor_object);
+
+static const struct monitor_ops inotify_ops = {
+	inotify_start, inotify_stop, inotify_join, inotify_monitor_destroy, inotify_replay, NULL
+};
+
+static void release_object(struct inotify_monitor_object* object) {
+	path_filter_destroy(object->inotify.filter);
+	struct inotify_extras* extras = object->inotify.extras;
+	if (extras != NULL) {
+		if (extras->tail_fd >= 0) close(extras->tail_fd);
+		content_table_destroy(extras->content, object->inotify.file_path);
+		free(extras);
+	}
+	free(object->inotify.rearm);
+	slab_free(&inotify_monitor_slab, object);
+}
+
+/*
+ * Allocates state of --content and --tail modes on first of them
+ */
+static struct inotify_extras* get_extras(inotify_monitor_t inotify_monitor) {
+	if (inotify_monitor->extras == NULL) {
+		inotify_monitor->extras = (struct inotify_extras*)calloc(1, sizeof(struct inotify_extras));
+		if (inotify_monitor->extras != NULL) inotify_monitor->extras->tail_fd = -1;
+	}
+	return inotify_monitor->extras;
+}
 
 int inotify_monitor_from_args(int argc, char* argv[], monitor_t* monitor) {
 //	if (argc < 2) return E_INVALID_MONITOR_ARGUMENT;
-	*monitor = (monitor_t)malloc(sizeof(struct monitor_t));
-	if (*monitor == NULL) {
-		log_error("malloc: %s", strerror(errno));
+	struct inotify_monitor_object* object =
+			(struct inotify_monitor_object*)slab_alloc(&inotify_monitor_slab);
+	if (object == NULL) {
+		log_error("slab_alloc: %s", strerror(errno));
 		return E_OUT_OF_MEMORY;
 	}
+	*monitor = &object->monitor;
 	(*monitor)->type = MONITOR_TYPE_INOTIFY;
-
-	(*monitor)->inotify = (inotify_monitor_t)malloc(sizeof(struct inotify_monitor));
-	if ((*monitor)->inotify == NULL) {
-		log_error("malloc: %s", strerror(errno));
-		free(monitor);
-		return E_OUT_OF_MEMORY;
-	}
+	(*monitor)->ops = &inotify_ops;
+	(*monitor)->inotify = &object->inotify;
 	inotify_monitor_t inotify_monitor = (*monitor)->inotify;
-	inotify_monitor->mode = (char*)malloc(MODES_COUNT*sizeof(char));
-	if (inotify_monitor->mode == NULL) {
-		log_error("malloc: %s", strerror(errno));
-		free(inotify_monitor);
-		free((*monitor));
-		return E_OUT_OF_MEMORY;
-	}
-	memset(inotify_monitor->mode, '\0', MODES_COUNT);
-	if (pthread_mutex_init(&(inotify_monitor->state_mutex), NULL) != 0) {
-		free(inotify_monitor->mode);
-		free(inotify_monitor);
-		free((*monitor));
-		return CALL_FAILURE;
-	};
+	inotify_monitor->parent_watch = -1;
+	inotify_monitor->file_watch = -1;
+	char mode[MODES_COUNT + 1] = "";
 
-	char argument_string[MODES_COUNT+1];
+	char argument_string[MODES_COUNT+2];
 	argument_string[0] = '+';	// sets POSIX parsing mode: parse until first no-arg
 	argument_string[1] = MODE_OPEN;
 	argument_string[2] = MODE_WRITE;
 	argument_string[3] = MODE_CLOSE;
 	argument_string[4] = MODE_MOVE;
 	argument_string[5] = MODE_DELETE;
+	argument_string[6] = '\0';
+
+	static struct option long_options[] = {
+		{"include", required_argument, 0, OPTION_INCLUDE},
+		{"exclude", required_argument, 0, OPTION_EXCLUDE},
+		{"content", no_argument, 0, OPTION_CONTENT},
+		{"tail", no_argument, 0, OPTION_TAIL},
+		{NULL, 0, 0, 0}
+	};
 
 	opterr = 0;
 	optind = 1;
 	int c;
-	while ((c = getopt(argc, argv, argument_string)) != -1) {
+	while ((c = getopt_long(argc, argv, argument_string, long_options, NULL)) != -1) {
 		switch (c) {
-			case MODE_OPEN: {
-				inotify_monitor->mode[strlen(inotify_monitor->mode)] = MODE_OPEN;
+			case MODE_OPEN:
+			case MODE_WRITE:
+			case MODE_CLOSE:
+			case MODE_MOVE:
+			case MODE_DELETE: {
+				if (strchr(mode, c) == NULL) {
+					mode[strlen(mode)] = (char)c;
+				}
 				break;
 			}
-			case MODE_WRITE: {
-				inotify_monitor->mode[strlen(inotify_monitor->mode)] = MODE_WRITE;
+			case OPTION_INCLUDE:
+			case OPTION_EXCLUDE: {
+				if (inotify_monitor->filter == NULL) {
+					inotify_monitor->filter = path_filter_new();
+				}
+				if (inotify_monitor->filter == NULL
+					|| path_filter_add(inotify_monitor->filter, optarg,
+									   c == OPTION_EXCLUDE) != CALL_SUCCESS) {
+					log_error("cannot compile path pattern %s", optarg);
+					release_object(object);
+					return E_OUT_OF_MEMORY;
+				}
 				break;
 			}
-			case MODE_CLOSE: {
-				inotify_monitor->mode[strlen(inotify_monitor->mode)] = MODE_CLOSE;
+			case OPTION_CONTENT: {
+				struct inotify_extras* extras = get_extras(inotify_monitor);
+				if (extras != NULL && extras->content == NULL) {
+					extras->content = content_table_new();
+				}
+				if (extras == NULL || extras->content == NULL) {
+					release_object(object);
+					return E_OUT_OF_MEMORY;
+				}
 				break;
 			}
-			case MODE_MOVE: {
-				inotify_monitor->mode[strlen(inotify_monitor->mode)] = MODE_MOVE;
-				break;
-			}
-			case MODE_DELETE: {
-				inotify_monitor->mode[strlen(inotify_monitor->mode)] = MODE_DELETE;
+			case OPTION_TAIL: {
+				struct inotify_extras* extras = get_extras(inotify_monitor);
+				if (extras == NULL) {
+					release_object(object);
+					return E_OUT_OF_MEMORY;
+				}
+				extras->tail = 1;
 				break;
 			}
 			case '?':
 			default: {
-				free(inotify_monitor->mode);
-				free(inotify_monitor);
-				free((*monitor));
+				release_object(object);
 				return E_INVALID_MONITOR_ARGUMENT;
 			}
 		}
 	}
 	if (argc != optind+1) {
-		free(inotify_monitor->mode);
-		free(inotify_monitor);
-		free((*monitor));
+		release_object(object);
+		return E_INVALID_MONITOR_ARGUMENT;
+	}
+	inotify_monitor->mask = mask_from_mode(mode);
+	inotify_monitor->file_path = intern_path(argv[optind]);
+	if (inotify_monitor->file_path == NULL) {
+		log_error("path is too long: %s", argv[optind]);
+		release_object(object);
 		return E_INVALID_MONITOR_ARGUMENT;
 	}
-	inotify_monitor->inotify_file_descriptor = inotify_init();
+	char parent[PATH_MAX];
+	if (split_watch_path(inotify_monitor, parent) != CALL_SUCCESS && tailing(inotify_monitor)) {
+		log_error("cannot follow %s", inotify_monitor->file_path);
+		release_object(object);
+		return E_INVALID_MONITOR_ARGUMENT;
+	}
+	inotify_monitor->inotify_file_descriptor = inotify_init1(IN_NONBLOCK);
 	if (inotify_monitor->inotify_file_descriptor < 0) {
 		log_error("inotify_init: %s", strerror(errno));
-		free(inotify_monitor->mode);
-		free(inotify_monitor);
-		free((*monitor));
+		release_object(object);
 		return CALL_FAILURE;
 	}
-	inotify_monitor->file_path = (char*)malloc(sizeof(char)*MAX_FILE_NAME_LENGTH);
-	if (inotify_monitor->file_path == NULL) {
-		log_error("malloc: %s", strerror(errno));
-		close(inotify_monitor->inotify_file_descriptor);
-		free(inotify_monitor->mode);
-		free(inotify_monitor);
-		free((*monitor));
-		return E_OUT_OF_MEMORY;
-	}
-	strcpy(inotify_monitor->file_path, argv[optind]);
-	pthread_mutex_lock(&(inotify_monitor->state_mutex));
-	(*monitor)->state = MONITOR_STATE_INITIALIZED;
-	pthread_mutex_unlock(&(inotify_monitor->state_mutex));
+	atomic_init(&(*monitor)->state, MONITOR_STATE_INITIALIZED);
 	return CALL_SUCCESS;
 }
 
 int inotify_start(monitor_t monitor) {
-	pthread_mutex_lock(&(monitor->inotify->state_mutex));
-	if (monitor->state != MONITOR_STATE_INITIALIZED) {
+	if (monitor_transition(monitor, MONITOR_STATE_INITIALIZED,
+						   MONITOR_STATE_RUNNING) != CALL_SUCCESS) {
 		log_error("cannot start monitor wich is not in \'initialized\' state");
-		pthread_mutex_unlock(&(monitor->inotify->state_mutex));
 		return E_MONITOR_INVALID_STATE;
 	}
-	if (pthread_create(&(monitor->inotify->thread),
-		NULL, monitoring_thread, monitor) != 0) {
-		log_error("inotify pthread_create: %s", strerror(errno));
-		pthread_mutex_unlock(&(monitor->inotify->state_mutex));
+	inotify_monitor_t inotify_monitor = monitor->inotify;
+	if (content_table(inotify_monitor) != NULL) {
+		// first change must be compared with something
+		content_baseline(content_table(inotify_monitor), inotify_monitor->file_path);
+	}
+	char parent[PATH_MAX];
+	if (split_watch_path(inotify_monitor, parent) == CALL_SUCCESS) {
+		// parent is watched first, so path created in between is not missed
+		inotify_monitor->parent_watch =
+				inotify_add_watch(inotify_monitor->inotify_file_descriptor,
+								  parent, PARENT_EVENTS | IN_ONLYDIR);
+		if (inotify_monitor->parent_watch == -1) {
+			log_error("inotify add watch for %s: %s, %s will not be watched again "
+					  "once it is gone", parent, strerror(errno),
+					  inotify_monitor->file_path);
+			if (tailing(inotify_monitor)) {
+				monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
+				return CALL_FAILURE;
+			}
+		}
+	}
+	inotify_monitor->file_watch = inotify_add_watch(inotify_monitor->inotify_file_descriptor,
+													inotify_monitor->file_path,
+													watch_mask(inotify_monitor));
+	if (inotify_monitor->file_watch == -1 && tailing(inotify_monitor) && errno == ENOENT) {
+		log_info("file %s does not exist, waiting for it to appear",
+				 inotify_monitor->file_path);
+	} else if (inotify_monitor->file_watch == -1) {
+		log_error("inotify add watch for %s: %s",
+				  inotify_monitor->file_path, strerror(errno));
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
+		return CALL_FAILURE;
+	} else if (tailing(inotify_monitor) && follow_file(inotify_monitor, 1) != CALL_SUCCESS) {
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
 		return CALL_FAILURE;
 	}
-	monitor->state = MONITOR_STATE_RUNNING;
-	pthread_mutex_unlock(&(monitor->inotify->state_mutex));
+	record_watches(inotify_monitor);
+	if (ingest_add_read(inotify_monitor->inotify_file_descriptor, read_events,
+						release_monitor, monitor, &inotify_monitor->source) != CALL_SUCCESS) {
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
+		return CALL_FAILURE;
+	}
+	log_info("inotify monitor %s created", inotify_monitor->file_path);
 	return CALL_SUCCESS;
 }
 
 int inotify_stop(monitor_t monitor) {
-	pthread_mutex_lock(&(monitor->inotify->state_mutex));
-	if (monitor->state != MONITOR_STATE_RUNNING) {
-		pthread_mutex_unlock(&(monitor->inotify->state_mutex));
+	if (monitor_transition(monitor, MONITOR_STATE_RUNNING,
+						   MONITOR_STATE_DYING) != CALL_SUCCESS) {
 		return E_MONITOR_INVALID_STATE;
 	}
-	monitor->state = MONITOR_STATE_DYING;
-	pthread_mutex_unlock(&(monitor->inotify->state_mutex));
+	ingest_remove(monitor->inotify->source);
 	return CALL_SUCCESS;
 }
 
 void inotify_join(monitor_t monitor) {
-	pthread_join(monitor->inotify->thread, NULL);
+	wait_monitor_dead(monitor);
 	log_info("inotify monitor was stopped");
 }
 
 void inotify_print_usage() {
-	printf("%s%s%s%s%s%s%s%s%s",
+	printf("%s%s%s%s%s%s%s%s%s%s%s%s%s",
 		"Aimed to monitors file system events\n",
 		"Usage: slm --file [watch_options] [path_to_file]\n",
-		"\t path_to_file - full path to monitoring file\n",
+		"\t path_to_file - full path to monitoring file or directory\n",
 		"\t watch_options: \n",
 		"\t\t -o - file opened \n",
 		"\t\t -w - file changed \n",
 		"\t\t -c - file closed \n",
 		"\t\t -d - file deleted \n",
-		"\t\t -m - file moved \n");
+		"\t\t -m - file moved \n",
+		"\t\t --include pattern - report only directory entries matching glob\n",
+		"\t\t --exclude pattern - skip directory entries matching glob\n",
+		"\t\t --content - report writes only if file content really changed;\n"
+		"\t\t          when file grew by a write and its first, last and 6 sampled\n"
+		"\t\t          old blocks are intact, only appended bytes are hashed\n",
+		"\t\t --tail - copy bytes appended to file to log, follow it through\n"
+		"\t\t          truncation and rotation like tail -F\n");
 }
 
 int inotify_monitor_destroy(monitor_t monitor) {
-	if (monitor->state == MONITOR_STATE_RUNNING
-		|| monitor->state == MONITOR_STATE_DYING) {
+	if (claim_monitor_for_destroy(monitor) != CALL_SUCCESS) {
 		return E_MONITOR_INVALID_STATE;
 	}
 	log_info("inotify monitor %s was killed", monitor->inotify->file_path);
 	inotify_monitor_t inotify_monitor = monitor->inotify;
+	struct inotify_rearm_stats* rearm = inotify_monitor->rearm;
+	if (rearm != NULL && (rearm->count > 0 || rearm->overflows > 0)) {
+		log_info("inotify monitor %s was re-armed %lu times: dead window %ld us max, "
+				 "%ld us mean, unwatched %ld us max, %lu queue overflows",
+				 inotify_monitor->file_path, rearm->count, rearm->max_dead_window_ns / 1000,
+				 rearm->count > 0 ? rearm->total_dead_window_ns / (long)rearm->count / 1000 : 0,
+				 rearm->max_unwatched_ns / 1000, rearm->overflows);
+	}
 	close(inotify_monitor->inotify_file_descriptor);
-	free(inotify_monitor->mode);
-	free(inotify_monitor);
-	free(monitor);
+	release_object((struct inotify_monitor_object*)monitor);
 	return CALL_SUCCESS;
 }
 
-static void* monitoring_thread(void* monitor_ptr) {
-	monitor_t monitor = (monitor_t)monitor_ptr;
-	inotify_monitor_t inotify_monitor = monitor->inotify;
-
-	log_info("inotify monitor %s created", monitor->inotify->file_path);
-
-	sigset_t blocking_mask;
-	if (sigfillset(&blocking_mask) != 0) {
-		log_error("cannot create sigmask for inotify thread, exit");
-		mark_dead(monitor);
-		return NULL;
+/*
+ * Records read bytes up to end, so watches set by an event of them
+ * follow it in trace. Returns end.
+ */
+static const char* record_events(const char* from, const char* end) {
+	if (from < end && trace_is_recording()) {
+		struct iovec part = { (void*)from, (size_t)(end - from) };
+		trace_write(TRACE_SOURCE_INOTIFY, &part, 1);
 	}
-	if (pthread_sigmask(SIG_BLOCK, &blocking_mask, NULL) != 0) {
-		log_error("cannot mask inotify thread signals, exit");
-		mark_dead(monitor);
-		return NULL;
-	}
-	if(inotify_add_watch(inotify_monitor->inotify_file_descriptor,
-						 inotify_monitor->file_path,
-						mask_from_mode(inotify_monitor->mode)) == -1) {
-		log_error("inotify add watch for %s: %s",
-				  inotify_monitor->file_path, strerror(errno));
-		mark_dead(monitor);
-		return NULL;
-	}
-
-	char buf[EVENTS_BYTE_BUFFER];
-	char* eventPtr;
-	struct inotify_event* event;
-	struct pollfd inotify_poll_fd;
-	inotify_poll_fd.fd = inotify_monitor->inotify_file_descriptor;
-	inotify_poll_fd.events = POLLIN;
-	inotify_poll_fd.revents = 0;
-
-	while(1) {
-		do {
-			pthread_mutex_lock(&(inotify_monitor->state_mutex));
-			if (monitor->state == MONITOR_STATE_DYING) {
-				pthread_mutex_unlock(&(inotify_monitor->state_mutex));
-				mark_dead(monitor);
-				return NULL;
-			}
-			pthread_mutex_unlock(&(inotify_monitor->state_mutex));
-		    poll(&inotify_poll_fd, 1, 500);
-		} while (inotify_poll_fd.revents != POLLIN);
-
-		ssize_t bytesRead = read(inotify_monitor->inotify_file_descriptor, buf, EVENTS_BYTE_BUFFER);
+	return end;
+}
 
-		for (eventPtr = buf; eventPtr < buf + bytesRead;
-			eventPtr += sizeof(struct inotify_event) + event->len) {
+/*
+ * Splits buffer read from inotify into events, runs on engine thread.
+ * Replay takes watches from trace instead of changing them.
+ */
+static int decode_events(monitor_t monitor, const char* data, ssize_t length, int replaying) {
+	inotify_monitor_t inotify_monitor = monitor->inotify;
+	int self_gone = 0;
+	long read_ns = monotonic_ns();
+	const char* recorded = data;
 
-			event = (struct inotify_event*)eventPtr;
+	if (length <= 0) {
+		log_error("inotify read for %s: %s", inotify_monitor->file_path,
+				  length == 0 ? "end of file" : strerror(-length));
+		self_gone = 1;
+	}
+	const struct inotify_event* event;
+	for (const char* eventPtr = data; length > 0 && eventPtr < data + length;
+		eventPtr += sizeof(struct inotify_event) + event->len) {
 
-			if (event->mask & IN_OPEN) {
-				log_info("file %s was opened", inotify_monitor->file_path);
+		event = (const struct inotify_event*)eventPtr;
+		const char* event_end = eventPtr + sizeof(struct inotify_event) + event->len;
+		if (event->mask & IN_Q_OVERFLOW) {
+			// wd is -1, path may have been replaced during lost events
+			struct inotify_rearm_stats* rearm = rearm_stats(inotify_monitor);
+			if (rearm != NULL) rearm->overflows++;
+			if (!replaying && inotify_monitor->parent_watch >= 0) {
+				recorded = record_events(recorded, event_end);
+				rearm_watch(inotify_monitor, read_ns);
 			}
-			if (event->mask & IN_CLOSE) {
-				log_info("file %s was closed", inotify_monitor->file_path);
+			submit_monitor_event(monitor, process_event, event->mask, (uint32_t)event->wd, NULL);
+			continue;
+		}
+		if (event->wd == inotify_monitor->parent_watch) {
+			if (!replaying && (event->mask & (IN_CREATE | IN_MOVED_TO)) && event->len > 0
+				&& strcmp(event->name, base_name(inotify_monitor)) == 0) {
+				recorded = record_events(recorded, event_end);
+				rearm_watch(inotify_monitor, read_ns);
 			}
-			if (event->mask & IN_CLOSE_WRITE) {
-				log_info("file %s was changed", inotify_monitor->file_path);
+			// path cannot reappear in directory which is gone
+			self_gone = (event->mask & SELF_EVENTS) != 0;
+		} else if (event->mask & SELF_EVENTS) {
+			if (event->wd != inotify_monitor->file_watch) {
+				continue;	// file which was replaced at path
 			}
-			if (event->mask & IN_MOVE_SELF) {
-				log_info("file %s was moved", inotify_monitor->file_path);
-				mark_dead(monitor);
-				return NULL;
+			self_gone = inotify_monitor->parent_watch < 0;
+			struct inotify_rearm_stats* rearm = rearm_stats(inotify_monitor);
+			if (rearm != NULL && rearm->gone_at_ns == 0) {
+				rearm->gone_at_ns = read_ns;
 			}
 			if (event->mask & IN_DELETE_SELF) {
-				log_info("file %s was deleted", inotify_monitor->file_path);
-				mark_dead(monitor);
-				return NULL;
+				inotify_monitor->file_watch = -1;
+			} else if (!tailing(inotify_monitor)) {
+				// moved file is not at path any more, --tail keeps reading it
+				if (!replaying) {
+					inotify_rm_watch(inotify_monitor->inotify_file_descriptor, event->wd);
+				}
+				inotify_monitor->file_watch = -1;
 			}
 		}
+		submit_monitor_event(monitor, process_event, event->mask, (uint32_t)event->wd,
+							 event->len > 0 ? event->name : NULL);
+		if (self_gone) break;
+	}
+	if (length > 0) record_events(recorded, data + length);
+	if (!self_gone) return INGEST_CONTINUE;
+	// if stop won the race, it has already removed the source
+	if (monitor_transition(monitor, MONITOR_STATE_RUNNING,
+						   MONITOR_STATE_DYING) == CALL_SUCCESS) {
+		ingest_remove(inotify_monitor->source);
+	}
+	return INGEST_STOP;
+}
+
+static int read_events(void* monitor_ptr, const char* data, ssize_t length) {
+	return decode_events((monitor_t)monitor_ptr, data, length, 0);
+}
+
+static void release_monitor(void* monitor_ptr) {
+	mark_monitor_dead((monitor_t)monitor_ptr);
+}
+
+/*
+ * Watch descriptors depend on file system state, so trace keeps them
+ * each time they are set and replay takes them instead of adding watches
+ */
+static void record_watches(inotify_monitor_t inotify_monitor) {
+	if (!trace_is_recording()) return;
+	int32_t watches[2] = { inotify_monitor->parent_watch, inotify_monitor->file_watch };
+	struct iovec part = { watches, sizeof(watches) };
+	trace_write(TRACE_SOURCE_INOTIFY_WATCHES, &part, 1);
+}
+
+int inotify_replay(monitor_t monitor, uint32_t source, const char* data, size_t length) {
+	inotify_monitor_t inotify_monitor = monitor->inotify;
+	if (source == TRACE_SOURCE_INOTIFY_WATCHES && length == 2 * sizeof(int32_t)) {
+		int32_t watches[2];
+		memcpy(watches, data, sizeof(watches));
+		inotify_monitor->parent_watch = watches[0];
+		inotify_monitor->file_watch = watches[1];
+		return CALL_SUCCESS;
 	}
-	return NULL;
+	if (source != TRACE_SOURCE_INOTIFY) return CALL_FAILURE;
+	decode_events(monitor, data, (ssize_t)length, 1);
+	return CALL_SUCCESS;
 }
 
-static void mark_dead(monitor_t monitor) {
-	pthread_mutex_lock(&(monitor->inotify->state_mutex));
-	monitor->state = MONITOR_STATE_DEAD;
-	pthread_mutex_unlock(&(monitor->inotify->state_mutex));
+/*
+ * Compares content of written file with its hashes, returns event kind
+ * without flags which were only needed for content check
+ */
+static uint32_t check_content(inotify_monitor_t inotify_monitor, uint32_t kind,
+							  const char* separator, const char* name) {
+	if (kind & (IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM | IN_MOVE_SELF)) {
+		content_forget(content_table(inotify_monitor), name);
+	}
+	if (kind & CONTENT_EVENTS) {
+		char path[PATH_MAX];
+		struct content_change change;
+		snprintf(path, sizeof(path), "%s%s%s", inotify_monitor->file_path, separator, name);
+		if (content_update(content_table(inotify_monitor), path, name, &change) == CALL_SUCCESS) {
+			if (!change.known) {
+				log_info("file %s has new content (%llu bytes)", path,
+						 (unsigned long long)change.new_size);
+			} else if (change.changed) {
+				char ranges[CONTENT_MAX_RANGES * 48];
+				size_t used = 0;
+				ranges[0] = '\0';
+				for (int i = 0; i < change.ranges_count && used < sizeof(ranges); i++) {
+					used += snprintf(ranges + used, sizeof(ranges) - used, "%s%llu-%llu",
+									 i > 0 ? ", " : "",
+									 (unsigned long long)change.ranges[i].from,
+									 (unsigned long long)change.ranges[i].to);
+				}
+				log_info("file %s content changed in bytes %s%s (size %llu -> %llu)", path,
+						 ranges, change.ranges_truncated ? " and more" : "",
+						 (unsigned long long)change.old_size, (unsigned long long)change.new_size);
+			} else {
+				log_info("file %s was rewritten with same content", path);
+			}
+		}
+	}
+	kind &= ~IN_MODIFY;
+	kind &= ~(CONTENT_WATCH_EVENTS & ~inotify_monitor->mask);
+	return kind;
+}
+
+/*
+ * Splits path into parent directory, copied to parent (PATH_MAX long),
+ * and name looked for in it
+ */
+static int split_watch_path(inotify_monitor_t inotify_monitor, char* parent) {
+	const char* path = inotify_monitor->file_path;
+	const char* slash = strrchr(path, '/');
+	if (slash == NULL) {
+		strcpy(parent, ".");
+	} else {
+		size_t length = slash == path ? 1 : (size_t)(slash - path);
+		memcpy(parent, path, length);
+		parent[length] = '\0';
+	}
+	const char* name = base_name(inotify_monitor);
+	if (name[0] == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+		return CALL_FAILURE;
+	}
+	return CALL_SUCCESS;
+}
+
+static const char* base_name(inotify_monitor_t inotify_monitor) {
+	const char* slash = strrchr(inotify_monitor->file_path, '/');
+	return slash != NULL ? slash + 1 : inotify_monitor->file_path;
+}
+
+static int tailing(inotify_monitor_t inotify_monitor) {
+	return inotify_monitor->extras != NULL && inotify_monitor->extras->tail;
+}
+
+static content_table_t content_table(inotify_monitor_t inotify_monitor) {
+	return inotify_monitor->extras != NULL ? inotify_monitor->extras->content : NULL;
+}
+
+static uint32_t watch_mask(inotify_monitor_t inotify_monitor) {
+	uint32_t mask = inotify_monitor->mask | SELF_EVENTS;
+	if (content_table(inotify_monitor) != NULL) mask |= CONTENT_WATCH_EVENTS;
+	if (tailing(inotify_monitor)) mask |= TAIL_EVENTS;
+	return mask;
+}
+
+/*
+ * Allocates stats when path is gone or reappeared first time, runs on engine
+ * thread. Stats are just not kept if memory is exhausted.
+ */
+static struct inotify_rearm_stats* rearm_stats(inotify_monitor_t inotify_monitor) {
+	if (inotify_monitor->rearm == NULL) {
+		inotify_monitor->rearm =
+				(struct inotify_rearm_stats*)calloc(1, sizeof(struct inotify_rearm_stats));
+	}
+	return inotify_monitor->rearm;
+}
+
+/*
+ * Watches path which reappeared in parent directory, runs on engine thread
+ * right after event is read, so dead window is one syscall long
+ */
+static void rearm_watch(inotify_monitor_t inotify_monitor, long appeared_ns) {
+	int watch = inotify_add_watch(inotify_monitor->inotify_file_descriptor,
+								  inotify_monitor->file_path, watch_mask(inotify_monitor));
+	if (watch == -1) return;	// gone again, next event about it follows
+	long armed_ns = monotonic_ns();
+	if (inotify_monitor->file_watch >= 0 && inotify_monitor->file_watch != watch) {
+		inotify_rm_watch(inotify_monitor->inotify_file_descriptor,
+						 inotify_monitor->file_watch);
+	}
+	inotify_monitor->file_watch = watch;
+	record_watches(inotify_monitor);
+
+	struct inotify_rearm_stats* rearm = rearm_stats(inotify_monitor);
+	if (rearm == NULL) return;
+	long dead_window = armed_ns - appeared_ns;
+	rearm->count++;
+	rearm->total_dead_window_ns += dead_window;
+	if (dead_window > rearm->max_dead_window_ns) rearm->max_dead_window_ns = dead_window;
+	if (rearm->gone_at_ns != 0 && armed_ns - rearm->gone_at_ns > rearm->max_unwatched_ns) {
+		rearm->max_unwatched_ns = armed_ns - rearm->gone_at_ns;
+	}
+	rearm->gone_at_ns = 0;
+}
+
+/*
+ * Copies bytes appended since last call, restarts from beginning
+ * if file was truncated
+ */
+static void ship_appended(inotify_monitor_t inotify_monitor) {
+	struct inotify_extras* extras = inotify_monitor->extras;
+	struct stat file_stat;
+	if (extras->tail_fd < 0 || fstat(extras->tail_fd, &file_stat) != 0) {
+		return;
+	}
+	if (file_stat.st_size < extras->tail_offset) {
+		log_info("file %s was truncated", inotify_monitor->file_path);
+		extras->tail_offset = 0;
+	}
+	if (file_stat.st_size > extras->tail_offset
+		&& log_copy_from(extras->tail_fd, &extras->tail_offset,
+						 file_stat.st_size - extras->tail_offset) < 0) {
+		log_error("cannot copy %s: %s", inotify_monitor->file_path, strerror(errno));
+	}
+}
+
+/*
+ * Opens path and watches it, starting at its end on monitor start and
+ * at its beginning when path reappeared. Old file is drained first:
+ * writers may still append to it until they reopen the path.
+ */
+static int follow_file(inotify_monitor_t inotify_monitor, int from_end) {
+	int fd = open(inotify_monitor->file_path, O_RDONLY | O_CLOEXEC);
+	struct stat file_stat;
+	if (fd < 0 || fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+		int reason = fd < 0 ? errno : EINVAL;
+		if (fd >= 0) close(fd);
+		if (reason == ENOENT) return CALL_SUCCESS;	// gone again, wait for next one
+		log_error("cannot follow %s: %s", inotify_monitor->file_path,
+				  reason == EINVAL ? "not a regular file" : strerror(reason));
+		return CALL_FAILURE;
+	}
+	struct inotify_extras* extras = inotify_monitor->extras;
+	if (extras->tail_fd >= 0) {
+		ship_appended(inotify_monitor);
+		close(extras->tail_fd);
+	}
+	if (!from_end) {
+		log_info("file %s appeared, following new file", inotify_monitor->file_path);
+	}
+	extras->tail_fd = fd;
+	extras->tail_offset = from_end ? file_stat.st_size : 0;
+	ship_appended(inotify_monitor);
+	return CALL_SUCCESS;
+}
+
+/*
+ * Handles event of parent directory, path is already watched again
+ */
+static void process_parent_event(inotify_monitor_t inotify_monitor,
+								 struct monitor_event* event) {
+	if ((event->kind & (IN_CREATE | IN_MOVED_TO))
+		&& strcmp(event->name, base_name(inotify_monitor)) == 0) {
+		if (tailing(inotify_monitor)) {
+			follow_file(inotify_monitor, 0);
+		} else {
+			log_info("file %s reappeared, watching it again", inotify_monitor->file_path);
+		}
+	}
+	if (event->kind & SELF_EVENTS) {
+		char parent[PATH_MAX];
+		split_watch_path(inotify_monitor, parent);
+		log_info("directory %s is gone, stopped watching %s",
+				 parent, inotify_monitor->file_path);
+	}
+}
+
+/*
+ * Handles event of followed file in --tail mode
+ */
+static void process_tail_event(inotify_monitor_t inotify_monitor,
+							   struct monitor_event* event) {
+	if (event->kind & IN_MODIFY) {
+		ship_appended(inotify_monitor);
+	}
+	if (event->kind & SELF_EVENTS) {
+		// keep reading old file until path reappears
+		ship_appended(inotify_monitor);
+		log_info("file %s was rotated, waiting for it to reappear",
+				 inotify_monitor->file_path);
+	}
+}
+
+/*
+ * Filters and reports single event, runs on pipeline worker.
+ * Event kind is inotify mask, name is set for directory entries.
+ */
+static void process_event(monitor_t monitor, struct monitor_event* event) {
+	inotify_monitor_t inotify_monitor = monitor->inotify;
+	const char* separator = "";
+	const char* name = "";
+	if (event->kind & IN_Q_OVERFLOW) {
+		log_warn("inotify queue of %s overflowed, events were lost",
+				 inotify_monitor->file_path);
+		return;
+	}
+	if ((int)event->value == inotify_monitor->parent_watch) {
+		process_parent_event(inotify_monitor, event);
+		return;
+	}
+	if (tailing(inotify_monitor)) {
+		process_tail_event(inotify_monitor, event);
+	}
+	if (event->name[0] != '\0') {
+		// event on directory entry
+		if (!path_filter_accepts(inotify_monitor->filter, event->name)) {
+			return;
+		}
+		separator = "/";
+		name = event->name;
+	}
+	uint32_t kind = event->kind;
+	if (content_table(inotify_monitor) != NULL) {
+		kind = check_content(inotify_monitor, kind, separator, name);
+	}
+	kind &= ~(TAIL_EVENTS & ~inotify_monitor->mask);
+	if (kind & inotify_monitor->mask) {
+		hot_files_record(inotify_monitor->file_path, name);
+	}
+
+	if (kind & IN_OPEN) {
+		log_info("file %s%s%s was opened", inotify_monitor->file_path, separator, name);
+	}
+	if (kind & IN_MODIFY) {
+		log_info("file %s%s%s was modified", inotify_monitor->file_path, separator, name);
+	}
+	if (kind & IN_CLOSE) {
+		log_info("file %s%s%s was closed", inotify_monitor->file_path, separator, name);
+	}
+	if ((kind & IN_CLOSE_WRITE) && content_table(inotify_monitor) == NULL) {
+		log_info("file %s%s%s was changed", inotify_monitor->file_path, separator, name);
+	}
+	if (kind & IN_MOVE) {
+		log_info("file %s%s%s was moved", inotify_monitor->file_path, separator, name);
+	}
+	if (kind & IN_DELETE) {
+		log_info("file %s%s%s was deleted", inotify_monitor->file_path, separator, name);
+	}
+	if (kind & IN_MOVE_SELF) {
+		log_info("file %s was moved", inotify_monitor->file_path);
+	}
+	if (kind & IN_DELETE_SELF) {
+		log_info("file %s was deleted", inotify_monitor->file_path);
+	}
 }
 
-static uint32_t mask_from_mode(char* mode) {
+static uint32_t mask_from_mode(const char* mode) {
 	uint32_t mask = 0;
 	if(strchr(mode, MODE_OPEN) != NULL) {
 		mask |= IN_OPEN;
@@ -287,10 +715,10 @@ static uint32_t mask_from_mode(char* mode) {
 		mask |= IN_CLOSE;
 	}
 	if(strchr(mode, MODE_DELETE) != NULL) {
-		mask |= IN_DELETE_SELF;
+		mask |= IN_DELETE_SELF | IN_DELETE;
 	}
 	if(strchr(mode, MODE_MOVE) != NULL) {
-		mask |= IN_MOVE_SELF;
+		mask |= IN_MOVE_SELF | IN_MOVE;
 	}
 	return mask;
 }
\ No newline at end of file
@@ -1,121 +1,317 @@
 #include <memory.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dlfcn.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <logging/logging.h>
 #include "monitor.h"
 #include "errors.h"
-#include "udev_monitor.h"
-#include "dbus_monitor.h"
 
+#define BACKPRESSURE_OPTION "--backpressure"
+#define BACKEND_OPTION "--backend"
 
+#ifndef SLM_MODULE_DIR
+#define SLM_MODULE_DIR "/usr/lib/slm"
+#endif
+
+#define MONITOR_MODULES_MAX 8
+
+static const struct monitor_backend monitor_backends[] = {
+	{ "--file", "inotify", 1, NULL, inotify_monitor_from_args, inotify_print_usage,
+	  &inotify_monitor_slab },
+	{ "--network", "netlink", 0, NULL, netlink_monitor_from_args, netlink_print_usage,
+	  &netlink_monitor_slab },
+	{ "--netstat", "netstat", 1, NULL, netstat_monitor_from_args, netstat_print_usage,
+	  &netstat_monitor_slab },
+	{ "--process", "process", 1, NULL, process_monitor_from_args, process_print_usage,
+	  &process_monitor_slab },
+	{ "--mounts", "mounts", 1, NULL, mounts_monitor_from_args, mounts_print_usage,
+	  &mounts_monitor_slab },
+	{ "--pressure", "pressure", 1, NULL, pressure_monitor_from_args, pressure_print_usage,
+	  &pressure_monitor_slab },
+	{ "--cgroup", "cgroup", 1, NULL, cgroup_monitor_from_args, cgroup_print_usage,
+	  &cgroup_monitor_slab },
+	// GLib and libudev are loaded only with monitor using them
+	{ "--network", "dbus", 1, "dbus", NULL, NULL, NULL },
+	{ "--disks", "dbus", 1, "dbus", NULL, NULL, NULL },
+	{ "--disks", "udev", 0, "udev", NULL, NULL, NULL },
+	{ "--power", "udev", 1, "udev", NULL, NULL, NULL },
+	{ "--bluetooth", "udev", 1, "udev", NULL, NULL, NULL },
+	{ NULL }
+};
+
+/*
+ * Modules are loaded while monitors are parsed, on main thread,
+ * and stay loaded as code of destroyed monitors may still be queued
+ */
+static struct {
+	const char* name;
+	const struct monitor_backend* backends;
+} loaded_modules[MONITOR_MODULES_MAX];
+static int loaded_modules_count = 0;
+
+static int backend_from_args(int argc, char* argv[], const char* backend,
+							 monitor_t* monitor);
+
+/*
+ * Takes value of "--option=value" or "--option value" at argv[*i]
+ */
+static const char* option_value(int argc, char* argv[], int* i, const char* option) {
+	size_t length = strlen(option);
+	if (strncmp(argv[*i], option, length) != 0) return NULL;
+	if (argv[*i][length] == '=') return argv[*i] + length + 1;
+	if (argv[*i][length] == '\0' && *i + 1 < argc) return argv[++(*i)];
+	return NULL;
+}
+
+/*
+ * Options common to all monitor types are taken out of argv
+ * before it is passed to backend parser.
+ */
 int monitor_from_args(int argc, char* argv[], monitor_t* monitor) {
-	if (argc < 1) {
-		return E_INVALID_INPUT;
-	}else if (strcmp(argv[0], "--file") == 0) {
-		int return_code = inotify_monitor_from_args(argc, argv, monitor);
-#ifndef DAEMON
-		if (return_code == E_INVALID_MONITOR_ARGUMENT) {
-			inotify_print_usage();
+	char** backend_argv = (char**)malloc((argc + 1) * sizeof(char*));
+	if (backend_argv == NULL) {
+		return E_OUT_OF_MEMORY;
+	}
+	int backend_argc = 0;
+	int backpressure = BACKPRESSURE_BLOCK;
+	const char* backend = NULL;
+	for (int i = 0; i < argc; i++) {
+		const char* value = NULL;
+		if ((value = option_value(argc, argv, &i, BACKEND_OPTION)) != NULL) {
+			backend = value;
+			continue;
 		}
-#endif
-		return return_code;
-	} else if (strcmp(argv[0], "--network") == 0
-			   || strcmp(argv[0], "--disks") == 0) {
-		int return_code = dbus_monitor_from_args(argc, argv, monitor);
-#ifndef DAEMON
-		if (return_code == E_INVALID_MONITOR_ARGUMENT) {
-			if (strcmp(argv[0], "--network") == 0) {
-				dbus_print_usage(DBUS_MONITOR_TYPE_NM);
-			} else {
-				dbus_print_usage(DBUS_MONITOR_TYPE_UDISKS);
-			}
+		const char* policy = option_value(argc, argv, &i, BACKPRESSURE_OPTION);
+		if (policy == NULL) {
+			backend_argv[backend_argc++] = argv[i];
+			continue;
 		}
-#endif
-		return return_code;
-	} else if (strcmp(argv[0], "--power") == 0
-			   || strcmp(argv[0], "--bluetooth") == 0) {
-		int return_code = udev_monitor_from_args(argc, argv, monitor);
-#ifndef DAEMON
-		if (return_code == E_INVALID_MONITOR_ARGUMENT) {
-			if (strcmp(argv[0], "--bluetooth") == 0) {
-				udev_print_usage(UDEV_MONITOR_TYPE_BLUETOOTH);
-			} else {
-				udev_print_usage(UDEV_MONITOR_TYPE_POWER);
-			}
+		backpressure = backpressure_from_string(policy);
+		if (backpressure < 0) {
+			log_error("unknown backpressure policy %s", policy);
+			free(backend_argv);
+			return E_INVALID_MONITOR_ARGUMENT;
 		}
-#endif
-		return return_code;
-	} else {
-		return E_INVALID_INPUT;
 	}
-	return CALL_SUCCESS;
+	backend_argv[backend_argc] = NULL;
+
+	int return_code = backend_from_args(backend_argc, backend_argv, backend, monitor);
+	free(backend_argv);
+	if (return_code == CALL_SUCCESS) {
+		monitor_queue_init(&((*monitor)->events), backpressure);
+		atomic_init(&(*monitor)->log_level, atomic_load(&log_level));
+	}
+	return return_code;
 }
 
-int start_monitor(monitor_t monitor) {
-	printf("starting monitor of type %d", monitor->type);
-	switch (monitor->type) {
-		case MONITOR_TYPE_INOTIFY : {
-			return inotify_start(monitor);
-		}
-		case MONITOR_TYPE_DBUS : {
-			return dbus_start(monitor);
-		}
-		case MONITOR_TYPE_UDEV : {
-			return udev_start(monitor);
-		}
-		default: {
-			return MONITOR_TYPE_INVALID;
+/*
+ * Finds backend of command, the default one if name is NULL
+ */
+static const struct monitor_backend* find_backend(const struct monitor_backend* backends,
+												  const char* command, const char* name) {
+	for (; backends->command != NULL; backends++) {
+		if (strcmp(backends->command, command) != 0) continue;
+		if (name == NULL ? backends->is_default : strcmp(backends->name, name) == 0) {
+			return backends;
 		}
 	}
+	return NULL;
 }
 
-int stop_monitor(monitor_t monitor) {
-	switch (monitor->type) {
-		case MONITOR_TYPE_INOTIFY : {
-			return inotify_stop(monitor);
+/*
+ * Loads shared module once and returns backend table it exports.
+ * SLM_MODULE_DIR in environment overrides install directory.
+ */
+static const struct monitor_backend* load_module(const char* module) {
+	for (int i = 0; i < loaded_modules_count; i++) {
+		if (strcmp(loaded_modules[i].name, module) == 0) return loaded_modules[i].backends;
+	}
+	if (loaded_modules_count == MONITOR_MODULES_MAX) return NULL;
+	const char* directory = getenv("SLM_MODULE_DIR");
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/libslm-%s.so",
+			 directory != NULL ? directory : SLM_MODULE_DIR, module);
+	void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (handle == NULL) {
+		char error[PATH_MAX + 128];
+		snprintf(error, sizeof(error), "%s", dlerror());
+		// library search path, e.g. LD_LIBRARY_PATH of build tree
+		handle = dlopen(strrchr(path, '/') + 1, RTLD_NOW | RTLD_LOCAL);
+		if (handle == NULL) {
+			log_error("cannot load %s backend: %s", module, error);
+			return NULL;
 		}
-		case MONITOR_TYPE_DBUS : {
-			return dbus_stop(monitor);
+	}
+	const struct monitor_backend* backends =
+			(const struct monitor_backend*)dlsym(handle, MONITOR_MODULE_SYMBOL);
+	if (backends == NULL) {
+		log_error("%s is not a monitor module", path);
+		dlclose(handle);
+		return NULL;
+	}
+	loaded_modules[loaded_modules_count].name = module;
+	loaded_modules[loaded_modules_count].backends = backends;
+	loaded_modules_count++;
+	return backends;
+}
+
+static int backend_from_args(int argc, char* argv[], const char* backend,
+							 monitor_t* monitor) {
+	if (argc < 1) {
+		return E_INVALID_INPUT;
+	}
+	const struct monitor_backend* entry = find_backend(monitor_backends, argv[0], backend);
+	if (entry == NULL) {
+		if (backend != NULL && find_backend(monitor_backends, argv[0], NULL) != NULL) {
+			log_error("unknown backend %s", backend);
+			return E_INVALID_MONITOR_ARGUMENT;
 		}
-		case MONITOR_TYPE_UDEV : {
-			return udev_stop(monitor);
+		return E_INVALID_INPUT;
+	}
+	if (entry->module != NULL) {
+		const char* module = entry->module;
+		const struct monitor_backend* module_backends = load_module(module);
+		if (module_backends == NULL) return E_BACKEND_UNAVAILABLE;
+		entry = find_backend(module_backends, entry->command, entry->name);
+		if (entry == NULL) {
+			log_error("%s module has no %s backend", module, argv[0]);
+			return E_BACKEND_UNAVAILABLE;
 		}
-		default: {
-			return MONITOR_TYPE_INVALID;
+	}
+	int return_code = entry->from_args(argc, argv, monitor);
+#ifndef DAEMON
+	if (return_code == E_INVALID_MONITOR_ARGUMENT) {
+		entry->print_usage();
+	}
+#endif
+	return return_code;
+}
+
+int monitor_transition(monitor_t monitor, int from, int to) {
+	int expected = from;
+	if (atomic_compare_exchange_strong_explicit(&monitor->state, &expected, to,
+												memory_order_acq_rel, memory_order_acquire)) {
+		return CALL_SUCCESS;
+	}
+	return E_MONITOR_INVALID_STATE;
+}
+
+void mark_monitor_dead(monitor_t monitor) {
+	if (monitor_transition(monitor, MONITOR_STATE_DYING,
+						   MONITOR_STATE_EXITING) != CALL_SUCCESS
+		&& monitor_transition(monitor, MONITOR_STATE_RUNNING,
+							  MONITOR_STATE_EXITING) != CALL_SUCCESS) {
+		log_error("monitor of type %d cannot die in state %d",
+				  monitor->type, monitor_state(monitor));
+		return;
+	}
+	syscall(SYS_futex, (int*)&monitor->state, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+	// last access: joiners may free monitor once it is dead
+	atomic_store_explicit(&monitor->state, MONITOR_STATE_DEAD, memory_order_release);
+}
+
+void wait_monitor_dead(monitor_t monitor) {
+	int state;
+	while ((state = monitor_state(monitor)) != MONITOR_STATE_DEAD
+		   && state != MONITOR_STATE_INITIALIZED) {
+		if (state == MONITOR_STATE_EXITING) {
+			// dying thread is one syscall away from DEAD and wakes nobody after it
+			sched_yield();
+			continue;
 		}
+		// sleeps only if state is still the same, so wake-up cannot be missed
+		syscall(SYS_futex, (int*)&monitor->state, FUTEX_WAIT_PRIVATE, state, NULL, NULL, 0);
+	}
+}
+
+int claim_monitor_for_destroy(monitor_t monitor) {
+	if (monitor_transition(monitor, MONITOR_STATE_DEAD,
+						   MONITOR_STATE_NOT_INITIALIZED) == CALL_SUCCESS
+		|| monitor_transition(monitor, MONITOR_STATE_INITIALIZED,
+							  MONITOR_STATE_NOT_INITIALIZED) == CALL_SUCCESS) {
+		return CALL_SUCCESS;
 	}
+	return E_MONITOR_INVALID_STATE;
+}
+
+int start_monitor_thread(monitor_t monitor, void* (*routine)(void*)) {
+	pthread_attr_t attributes;
+	pthread_t thread;
+	if (pthread_attr_init(&attributes) != 0) return CALL_FAILURE;
+	pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+	int result = pthread_create(&thread, &attributes, routine, monitor);
+	pthread_attr_destroy(&attributes);
+	return result == 0 ? CALL_SUCCESS : CALL_FAILURE;
+}
+
+int start_monitor(monitor_t monitor) {
+	log_debug("starting monitor of type %d", monitor->type);
+	return monitor->ops->start(monitor);
+}
+
+int stop_monitor(monitor_t monitor) {
+	return monitor->ops->stop(monitor);
 }
 
 void join_monitor(monitor_t monitor) {
-	switch (monitor->type) {
-		case MONITOR_TYPE_INOTIFY : {
-			inotify_join(monitor);
-			break;
-		}
-		case MONITOR_TYPE_DBUS : {
-			dbus_join(monitor);
-			break;
-		}
-		case MONITOR_TYPE_UDEV : {
-			udev_join(monitor);
-			break;
-		}
-		default: {}
+	monitor->ops->join(monitor);
+	drain_monitor_events(monitor);
+	unsigned long dropped = atomic_load(&monitor->events.dropped);
+	if (dropped > 0) {
+		log_error("monitor dropped %lu events under backpressure", dropped);
 	}
 }
 
 int destroy_monitor(monitor_t monitor) {
-	switch (monitor->type) {
-		case MONITOR_TYPE_INOTIFY : {
-			return inotify_monitor_destroy(monitor);
-		}
-		case MONITOR_TYPE_DBUS : {
-			return dbus_monitor_destroy(monitor);
-		}
-		case MONITOR_TYPE_UDEV : {
-			return udev_monitor_destroy(monitor);
-		}
-		default: {
-			return E_INVALID_MONITOR_TYPE;
+	return monitor->ops->destroy(monitor);
+}
+
+int replay_monitor_input(monitor_t monitor, uint32_t source, const char* data,
+						 size_t length) {
+	if (monitor->ops->replay == NULL) return E_INVALID_MONITOR_TYPE;
+	return monitor->ops->replay(monitor, source, data, length);
+}
+
+int set_monitors_log_level(monitor_t* monitors, int count, int request) {
+	int level = request & 0xff;
+	int index = request >> 8;
+	if (level > LOG_LEVEL_ERROR || index < 0 || index > count) return E_INVALID_INPUT;
+	if (index > 0) {
+		atomic_store(&monitors[index - 1]->log_level, level);
+		return CALL_SUCCESS;
+	}
+	atomic_store(&log_level, level);
+	for (int i = 0; i < count; i++) {
+		atomic_store(&monitors[i]->log_level, level);
+	}
+	return CALL_SUCCESS;
+}
+
+/*
+ * Adds slabs of backends, several commands of one backend share its slab
+ */
+static void add_backends_stats(const struct monitor_backend* backends,
+							   struct monitor_memory_stats* stats) {
+	for (const struct monitor_backend* entry = backends; entry->command != NULL; entry++) {
+		int counted = entry->slab == NULL;
+		for (const struct monitor_backend* other = backends; other != entry; other++) {
+			if (other->slab == entry->slab) counted = 1;
 		}
+		if (!counted) monitor_memory_stats_add(entry->slab, stats);
 	}
-}
\ No newline at end of file
+}
+
+void get_monitor_memory_stats(struct monitor_memory_stats* stats) {
+	memset(stats, 0, sizeof(struct monitor_memory_stats));
+	add_backends_stats(monitor_backends, stats);
+	for (int i = 0; i < loaded_modules_count; i++) {
+		add_backends_stats(loaded_modules[i].backends, stats);
+	}
+	monitor_memory_stats_add(NULL, stats);
+}
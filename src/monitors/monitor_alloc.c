@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <stdalign.h>
+#include <pthread.h>
+#include "monitor_alloc.h"
+
+#define SLAB_OBJECTS_PER_CHUNK	32
+#define ARENA_CHUNK_SIZE		16384
+#define INTERN_INITIAL_BUCKETS	64
+
+struct slab_chunk {
+	struct slab_chunk* next;
+	alignas(max_align_t) char objects[];
+};
+
+struct arena_chunk {
+	struct arena_chunk* next;
+	size_t used;
+	size_t size;
+	char data[];
+};
+
+static pthread_mutex_t arena_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct arena_chunk* arena_chunks = NULL;
+static const char** intern_table = NULL;
+static size_t intern_buckets = 0;
+static size_t intern_count = 0;
+static size_t arena_bytes_used = 0;
+
+static size_t slab_stride(struct monitor_slab* slab) {
+	size_t alignment = slab->object_alignment;
+	return (slab->object_size + alignment - 1) / alignment * alignment;
+}
+
+void* slab_alloc(struct monitor_slab* slab) {
+	pthread_mutex_lock(&slab->mutex);
+	if (slab->free_list == NULL) {
+		size_t stride = slab_stride(slab);
+		size_t chunk_size = sizeof(struct slab_chunk) + stride * SLAB_OBJECTS_PER_CHUNK;
+		struct slab_chunk* chunk = (struct slab_chunk*)malloc(chunk_size);
+		if (chunk == NULL) {
+			pthread_mutex_unlock(&slab->mutex);
+			return NULL;
+		}
+		chunk->next = (struct slab_chunk*)slab->chunks;
+		slab->chunks = chunk;
+		slab->bytes_reserved += chunk_size;
+		for (int i = SLAB_OBJECTS_PER_CHUNK - 1; i >= 0; i--) {
+			void* object = chunk->objects + stride * i;
+			*(void**)object = slab->free_list;
+			slab->free_list = object;
+		}
+	}
+	void* object = slab->free_list;
+	slab->free_list = *(void**)object;
+	slab->objects_used++;
+	pthread_mutex_unlock(&slab->mutex);
+	memset(object, 0, slab->object_size);
+	return object;
+}
+
+void slab_free(struct monitor_slab* slab, void* object) {
+	if (object == NULL) return;
+	pthread_mutex_lock(&slab->mutex);
+	*(void**)object = slab->free_list;
+	slab->free_list = object;
+	slab->objects_used--;
+	pthread_mutex_unlock(&slab->mutex);
+}
+
+static size_t hash_path(const char* path) {
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	for (; *path != '\0'; path++) {
+		hash ^= (unsigned char)*path;
+		hash *= 1099511628211ULL;
+	}
+	return (size_t)hash;
+}
+
+static int grow_intern_table() {
+	size_t new_buckets = intern_buckets == 0 ? INTERN_INITIAL_BUCKETS : intern_buckets * 2;
+	const char** new_table = (const char**)calloc(new_buckets, sizeof(const char*));
+	if (new_table == NULL) return 0;
+	for (size_t i = 0; i < intern_buckets; i++) {
+		if (intern_table[i] == NULL) continue;
+		size_t bucket = hash_path(intern_table[i]) & (new_buckets - 1);
+		while (new_table[bucket] != NULL) bucket = (bucket + 1) & (new_buckets - 1);
+		new_table[bucket] = intern_table[i];
+	}
+	free(intern_table);
+	intern_table = new_table;
+	intern_buckets = new_buckets;
+	return 1;
+}
+
+static char* arena_copy(const char* path, size_t length) {
+	if (arena_chunks == NULL || arena_chunks->size - arena_chunks->used < length + 1) {
+		size_t size = length + 1 > ARENA_CHUNK_SIZE ? length + 1 : ARENA_CHUNK_SIZE;
+		struct arena_chunk* chunk = (struct arena_chunk*)malloc(sizeof(struct arena_chunk) + size);
+		if (chunk == NULL) return NULL;
+		chunk->next = arena_chunks;
+		chunk->used = 0;
+		chunk->size = size;
+		arena_chunks = chunk;
+	}
+	char* copy = arena_chunks->data + arena_chunks->used;
+	memcpy(copy, path, length + 1);
+	arena_chunks->used += length + 1;
+	arena_bytes_used += length + 1;
+	return copy;
+}
+
+const char* intern_path(const char* path) {
+	size_t length = strnlen(path, PATH_MAX);
+	if (length >= PATH_MAX) return NULL;
+
+	pthread_mutex_lock(&arena_mutex);
+	if ((intern_count + 1) * 2 > intern_buckets && !grow_intern_table()) {
+		pthread_mutex_unlock(&arena_mutex);
+		return NULL;
+	}
+	size_t bucket = hash_path(path) & (intern_buckets - 1);
+	while (intern_table[bucket] != NULL) {
+		if (strcmp(intern_table[bucket], path) == 0) {
+			const char* interned = intern_table[bucket];
+			pthread_mutex_unlock(&arena_mutex);
+			return interned;
+		}
+		bucket = (bucket + 1) & (intern_buckets - 1);
+	}
+	char* copy = arena_copy(path, length);
+	if (copy != NULL) {
+		intern_table[bucket] = copy;
+		intern_count++;
+	}
+	pthread_mutex_unlock(&arena_mutex);
+	return copy;
+}
+
+void monitor_memory_stats_add(struct monitor_slab* slab, struct monitor_memory_stats* stats) {
+	if (slab == NULL) {
+		pthread_mutex_lock(&arena_mutex);
+		stats->path_bytes += arena_bytes_used + intern_buckets * sizeof(const char*);
+		pthread_mutex_unlock(&arena_mutex);
+		return;
+	}
+	pthread_mutex_lock(&slab->mutex);
+	stats->monitors += slab->objects_used;
+	stats->slab_bytes += slab->objects_used * slab_stride(slab);
+	pthread_mutex_unlock(&slab->mutex);
+}
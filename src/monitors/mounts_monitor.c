@@ -0,0 +1,400 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <monitors/monitor.h>
+#include <logging/logging.h>
+#include "errors.h"
+#include "monitor_alloc.h"
+#include "ingest.h"
+
+#define MOUNTINFO_PATH			"/proc/self/mountinfo"
+#define MOUNTINFO_BUFFER_SIZE	65536
+
+#define MOUNTS_EVENT_MOUNT		1
+#define MOUNTS_EVENT_UNMOUNT	2
+#define MOUNTS_EVENT_REMOUNT	3
+
+/*
+ * Fields of one mountinfo line, pointing into read buffer
+ */
+struct mountinfo_line {
+	int id;
+	char* point;
+	char* mount_options;
+	char* fstype;
+	char* source;
+	char* super_options;
+};
+
+static int read_mounts(void* monitor_ptr);
+static void release_monitor(void* monitor_ptr);
+static void process_event(monitor_t monitor, struct monitor_event* event);
+
+struct mounts_monitor_object {
+	struct monitor_t monitor;
+	struct mounts_monitor mounts;
+};
+
+struct monitor_slab mounts_monitor_slab =
+		MONITOR_SLAB_INITIALIZER(struct mounts_monitor_object);
+
+static const struct monitor_ops mounts_ops = {
+	mounts_start, mounts_stop, mounts_join, mounts_monitor_destroy, NULL, NULL
+};
+
+int mounts_monitor_from_args(int argc, char* argv[], monitor_t* monitor) {
+	if (argc > 1) return E_INVALID_MONITOR_ARGUMENT;
+	struct mounts_monitor_object* object =
+			(struct mounts_monitor_object*)slab_alloc(&mounts_monitor_slab);
+	if (object == NULL) {
+		log_error("slab_alloc: %s", strerror(errno));
+		return E_OUT_OF_MEMORY;
+	}
+	*monitor = &object->monitor;
+	(*monitor)->type = MONITOR_TYPE_MOUNTS;
+	(*monitor)->ops = &mounts_ops;
+	(*monitor)->mounts = &object->mounts;
+	(*monitor)->mounts->fd = -1;
+	atomic_init(&(*monitor)->state, MONITOR_STATE_INITIALIZED);
+	return CALL_SUCCESS;
+}
+
+static void free_mounts(mounts_monitor_t mounts_monitor) {
+	for (int i = 0; i < mounts_monitor->count; i++) {
+		free(mounts_monitor->mounts[i].point);
+	}
+	free(mounts_monitor->mounts);
+	free(mounts_monitor->index);
+	free(mounts_monitor->buffer);
+	mounts_monitor->mounts = NULL;
+	mounts_monitor->index = NULL;
+	mounts_monitor->buffer = NULL;
+	mounts_monitor->count = 0;
+	mounts_monitor->capacity = 0;
+}
+
+static int diff_mounts(monitor_t monitor, int report);
+
+int mounts_start(monitor_t monitor) {
+	if (monitor_transition(monitor, MONITOR_STATE_INITIALIZED,
+						   MONITOR_STATE_RUNNING) != CALL_SUCCESS) {
+		log_error("cannot start monitor wich is not in \'initialized\' state");
+		return E_MONITOR_INVALID_STATE;
+	}
+	mounts_monitor_t mounts_monitor = monitor->mounts;
+	mounts_monitor->fd = open(MOUNTINFO_PATH, O_RDONLY | O_CLOEXEC);
+	if (mounts_monitor->fd < 0) {
+		log_error("cannot open %s: %s", MOUNTINFO_PATH, strerror(errno));
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
+		return CALL_FAILURE;
+	}
+	// table read before source is added is baseline, it is not reported
+	int result = diff_mounts(monitor, 0);
+	// table belongs to engine thread once source is added
+	int count = mounts_monitor->count;
+	if (result != CALL_SUCCESS
+		|| ingest_add_priority(mounts_monitor->fd, read_mounts, release_monitor, monitor,
+							   &mounts_monitor->source) != CALL_SUCCESS) {
+		close(mounts_monitor->fd);
+		mounts_monitor->fd = -1;
+		free_mounts(mounts_monitor);
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
+		return CALL_FAILURE;
+	}
+	log_info("mounts monitor was created, %d mounts", count);
+	return CALL_SUCCESS;
+}
+
+int mounts_stop(monitor_t monitor) {
+	if (monitor_transition(monitor, MONITOR_STATE_RUNNING,
+						   MONITOR_STATE_DYING) != CALL_SUCCESS) {
+		return E_MONITOR_INVALID_STATE;
+	}
+	ingest_remove(monitor->mounts->source);
+	return CALL_SUCCESS;
+}
+
+void mounts_join(monitor_t monitor) {
+	wait_monitor_dead(monitor);
+	log_info("mounts monitor was stopped");
+}
+
+void mounts_print_usage() {
+	printf("%s%s",
+		   "Aimed to monitor mount, unmount and remount events\n",
+		   "Usage: slm --mounts\n");
+}
+
+int mounts_monitor_destroy(monitor_t monitor) {
+	if (claim_monitor_for_destroy(monitor) != CALL_SUCCESS) {
+		return E_MONITOR_INVALID_STATE;
+	}
+	mounts_monitor_t mounts_monitor = monitor->mounts;
+	if (mounts_monitor->fd >= 0) close(mounts_monitor->fd);
+	free_mounts(mounts_monitor);
+	log_info("mounts monitor was killed");
+	slab_free(&mounts_monitor_slab, monitor);
+	return CALL_SUCCESS;
+}
+
+/*
+ * Reads whole mountinfo from beginning, seq_file regenerates it
+ */
+static ssize_t read_mountinfo(mounts_monitor_t mounts_monitor) {
+	if (lseek(mounts_monitor->fd, 0, SEEK_SET) < 0) return -1;
+	size_t length = 0;
+	while (1) {
+		if (mounts_monitor->buffer_size - length < 2) {
+			size_t size = mounts_monitor->buffer_size == 0
+						  ? MOUNTINFO_BUFFER_SIZE : mounts_monitor->buffer_size * 2;
+			char* buffer = (char*)realloc(mounts_monitor->buffer, size);
+			if (buffer == NULL) return -1;
+			mounts_monitor->buffer = buffer;
+			mounts_monitor->buffer_size = size;
+		}
+		ssize_t count = read(mounts_monitor->fd, mounts_monitor->buffer + length,
+							 mounts_monitor->buffer_size - length - 1);
+		if (count < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		if (count == 0) break;
+		length += count;
+	}
+	mounts_monitor->buffer[length] = '\0';
+	return (ssize_t)length;
+}
+
+/*
+ * Replaces octal escapes (\040 for space) in place
+ */
+static void unescape(char* string) {
+	char* to = string;
+	for (char* from = string; *from != '\0'; from++) {
+		if (from[0] == '\\' && from[1] >= '0' && from[1] <= '3'
+			&& from[2] >= '0' && from[2] <= '7' && from[3] >= '0' && from[3] <= '7') {
+			*to++ = (char)((from[1] - '0') * 64 + (from[2] - '0') * 8 + (from[3] - '0'));
+			from += 3;
+		} else {
+			*to++ = *from;
+		}
+	}
+	*to = '\0';
+}
+
+/*
+ * Splits line in place: id parent major:minor root point options
+ * [optional...] - fstype source super_options
+ */
+static int parse_line(char* line, struct mountinfo_line* parsed) {
+	char* fields[6];
+	char* save;
+	char* token = strtok_r(line, " ", &save);
+	for (int i = 0; i < 6; i++) {
+		if (token == NULL) return CALL_FAILURE;
+		fields[i] = token;
+		token = strtok_r(NULL, " ", &save);
+	}
+	while (token != NULL && strcmp(token, "-") != 0) {
+		token = strtok_r(NULL, " ", &save);
+	}
+	if (token == NULL) return CALL_FAILURE;
+	parsed->fstype = strtok_r(NULL, " ", &save);
+	parsed->source = strtok_r(NULL, " ", &save);
+	parsed->super_options = strtok_r(NULL, " ", &save);
+	if (parsed->super_options == NULL) return CALL_FAILURE;
+	parsed->id = (int)strtol(fields[0], NULL, 10);
+	parsed->point = fields[4];
+	parsed->mount_options = fields[5];
+	unescape(parsed->point);
+	unescape(parsed->source);
+	return CALL_SUCCESS;
+}
+
+/*
+ * Copies strings of line into entry, options are joined with space
+ */
+static int assign_mount(struct mount_entry* mount, const struct mountinfo_line* line) {
+	size_t point_length = strlen(line->point) + 1;
+	size_t fstype_length = strlen(line->fstype) + 1;
+	size_t source_length = strlen(line->source) + 1;
+	size_t options_length = strlen(line->mount_options);
+	size_t super_length = strlen(line->super_options) + 1;
+	char* text = (char*)malloc(point_length + fstype_length + source_length
+							   + options_length + 1 + super_length);
+	if (text == NULL) return E_OUT_OF_MEMORY;
+	free(mount->point);
+	mount->id = line->id;
+	mount->point = text;
+	memcpy(mount->point, line->point, point_length);
+	mount->fstype = mount->point + point_length;
+	memcpy(mount->fstype, line->fstype, fstype_length);
+	mount->source = mount->fstype + fstype_length;
+	memcpy(mount->source, line->source, source_length);
+	mount->options = mount->source + source_length;
+	memcpy(mount->options, line->mount_options, options_length);
+	mount->options[options_length] = ' ';
+	memcpy(mount->options + options_length + 1, line->super_options, super_length);
+	return CALL_SUCCESS;
+}
+
+static int same_options(const struct mount_entry* mount, const struct mountinfo_line* line) {
+	size_t length = strlen(line->mount_options);
+	return strncmp(mount->options, line->mount_options, length) == 0
+		   && mount->options[length] == ' '
+		   && strcmp(mount->options + length + 1, line->super_options) == 0;
+}
+
+static uint32_t index_slot(mounts_monitor_t mounts_monitor, int id) {
+	uint32_t slot = ((uint32_t)id * 2654435761u) & mounts_monitor->index_mask;
+	while (mounts_monitor->index[slot] != 0
+		   && mounts_monitor->mounts[mounts_monitor->index[slot] - 1].id != id) {
+		slot = (slot + 1) & mounts_monitor->index_mask;
+	}
+	return slot;
+}
+
+/*
+ * Rebuilds index after mounts were removed, so it never needs tombstones,
+ * or grows it to keep load under half
+ */
+static int rebuild_index(mounts_monitor_t mounts_monitor) {
+	uint32_t size = mounts_monitor->index_mask + 1;
+	if (mounts_monitor->index == NULL || (uint32_t)mounts_monitor->capacity * 2 > size) {
+		size = 64;
+		while (size < (uint32_t)mounts_monitor->capacity * 2) size <<= 1;
+		int* index = (int*)malloc(size * sizeof(int));
+		if (index == NULL) return E_OUT_OF_MEMORY;
+		free(mounts_monitor->index);
+		mounts_monitor->index = index;
+		mounts_monitor->index_mask = size - 1;
+	}
+	memset(mounts_monitor->index, 0, size * sizeof(int));
+	for (int i = 0; i < mounts_monitor->count; i++) {
+		mounts_monitor->index[index_slot(mounts_monitor, mounts_monitor->mounts[i].id)] = i + 1;
+	}
+	return CALL_SUCCESS;
+}
+
+static struct mount_entry* add_mount(mounts_monitor_t mounts_monitor,
+									 const struct mountinfo_line* line) {
+	if (mounts_monitor->count == mounts_monitor->capacity) {
+		int capacity = mounts_monitor->capacity == 0 ? 64 : mounts_monitor->capacity * 2;
+		struct mount_entry* mounts = (struct mount_entry*)realloc(
+				mounts_monitor->mounts, capacity * sizeof(struct mount_entry));
+		if (mounts == NULL) return NULL;
+		mounts_monitor->mounts = mounts;
+		mounts_monitor->capacity = capacity;
+		if (rebuild_index(mounts_monitor) != CALL_SUCCESS) return NULL;
+	}
+	struct mount_entry* mount = &mounts_monitor->mounts[mounts_monitor->count];
+	memset(mount, 0, sizeof(struct mount_entry));
+	if (assign_mount(mount, line) != CALL_SUCCESS) return NULL;
+	mounts_monitor->count++;
+	mounts_monitor->index[index_slot(mounts_monitor, line->id)] = mounts_monitor->count;
+	return mount;
+}
+
+static void report(monitor_t monitor, uint32_t kind, const struct mount_entry* mount) {
+	char text[MONITOR_EVENT_NAME_LENGTH];
+	switch (kind) {
+		case MOUNTS_EVENT_MOUNT: {
+			snprintf(text, sizeof(text), "%s was mounted on %s (%s)",
+					 mount->source, mount->point, mount->fstype);
+			break;
+		}
+		case MOUNTS_EVENT_UNMOUNT: {
+			snprintf(text, sizeof(text), "%s was unmounted from %s",
+					 mount->source, mount->point);
+			break;
+		}
+		default: {
+			snprintf(text, sizeof(text), "%s was remounted %s", mount->point, mount->options);
+		}
+	}
+	submit_monitor_event(monitor, process_event, kind, (uint32_t)mount->id, text);
+}
+
+static int diff_mounts(monitor_t monitor, int report_changes) {
+	if (read_mountinfo(monitor->mounts) < 0) {
+		log_error("cannot read %s: %s", MOUNTINFO_PATH, strerror(errno));
+		return CALL_FAILURE;
+	}
+	return mounts_diff(monitor, monitor->mounts->buffer, report_changes);
+}
+
+/*
+ * One pass over mountinfo: listed mounts are looked up by ID and marked with
+ * pass generation, then mounts left unmarked are unmounted ones.
+ */
+int mounts_diff(monitor_t monitor, char* mountinfo, int report_changes) {
+	mounts_monitor_t mounts_monitor = monitor->mounts;
+	if (mounts_monitor->index == NULL && rebuild_index(mounts_monitor) != CALL_SUCCESS) {
+		return E_OUT_OF_MEMORY;
+	}
+	uint32_t generation = ++mounts_monitor->generation;
+	char* save;
+	for (char* line = strtok_r(mountinfo, "\n", &save); line != NULL;
+		 line = strtok_r(NULL, "\n", &save)) {
+		struct mountinfo_line parsed;
+		if (parse_line(line, &parsed) != CALL_SUCCESS) continue;
+		int position = mounts_monitor->index[index_slot(mounts_monitor, parsed.id)];
+		struct mount_entry* mount = position > 0 ? &mounts_monitor->mounts[position - 1] : NULL;
+		if (mount != NULL && (strcmp(mount->point, parsed.point) != 0
+							  || strcmp(mount->source, parsed.source) != 0
+							  || strcmp(mount->fstype, parsed.fstype) != 0)) {
+			// ID was reused by another mount between two passes
+			if (report_changes) report(monitor, MOUNTS_EVENT_UNMOUNT, mount);
+			if (assign_mount(mount, &parsed) != CALL_SUCCESS) return E_OUT_OF_MEMORY;
+			if (report_changes) report(monitor, MOUNTS_EVENT_MOUNT, mount);
+		} else if (mount != NULL) {
+			if (!same_options(mount, &parsed)) {
+				if (assign_mount(mount, &parsed) != CALL_SUCCESS) return E_OUT_OF_MEMORY;
+				if (report_changes) report(monitor, MOUNTS_EVENT_REMOUNT, mount);
+			}
+		} else {
+			mount = add_mount(mounts_monitor, &parsed);
+			if (mount == NULL) return E_OUT_OF_MEMORY;
+			if (report_changes) report(monitor, MOUNTS_EVENT_MOUNT, mount);
+		}
+		mount->generation = generation;
+	}
+	int kept = 0;
+	for (int i = 0; i < mounts_monitor->count; i++) {
+		struct mount_entry* mount = &mounts_monitor->mounts[i];
+		if (mount->generation != generation) {
+			if (report_changes) report(monitor, MOUNTS_EVENT_UNMOUNT, mount);
+			free(mount->point);
+			continue;
+		}
+		mounts_monitor->mounts[kept++] = *mount;
+	}
+	if (kept != mounts_monitor->count) {
+		mounts_monitor->count = kept;
+		return rebuild_index(mounts_monitor);
+	}
+	return CALL_SUCCESS;
+}
+
+/*
+ * Runs on engine thread each time mount table of namespace changed
+ */
+static int read_mounts(void* monitor_ptr) {
+	monitor_t monitor = (monitor_t)monitor_ptr;
+	if (diff_mounts(monitor, 1) == E_OUT_OF_MEMORY) {
+		log_error("mounts monitor: %s", strerror(ENOMEM));
+	}
+	return INGEST_CONTINUE;
+}
+
+static void release_monitor(void* monitor_ptr) {
+	mark_monitor_dead((monitor_t)monitor_ptr);
+}
+
+static void process_event(monitor_t monitor, struct monitor_event* event) {
+	log_info("%s", event->name);
+}
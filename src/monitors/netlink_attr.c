@@ -0,0 +1,16 @@
+#include <string.h>
+#include "netlink_attr.h"
+
+void netlink_parse_attributes(const struct rtattr* table[], int max,
+							  const struct rtattr* attribute, int length) {
+	memset(table, 0, (max + 1) * sizeof(struct rtattr*));
+	for (; RTA_OK(attribute, length); attribute = RTA_NEXT(attribute, length)) {
+		unsigned short type = attribute->rta_type & NLA_TYPE_MASK;
+		if (type <= max) table[type] = attribute;
+	}
+}
+
+const void* netlink_attribute_data(const struct rtattr* attribute, size_t size) {
+	if (attribute == NULL || RTA_PAYLOAD(attribute) < size) return NULL;
+	return RTA_DATA(attribute);
+}
@@ -0,0 +1,338 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <monitors/monitor.h>
+#include <logging/logging.h>
+#include "errors.h"
+#include "monitor_alloc.h"
+#include "netlink_attr.h"
+#include "ingest.h"
+
+#define NETLINK_GROUPS (RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR \
+						| RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE)
+#define NETLINK_RECEIVE_BUFFER	(1 << 20)
+
+#define NETLINK_EVENT_LINK		1
+#define NETLINK_EVENT_ADDRESS	2
+#define NETLINK_EVENT_ROUTE		3
+#define NETLINK_EVENT_OVERRUN	4
+
+#ifndef IFF_LOWER_UP
+#define IFF_LOWER_UP			0x10000		// carrier, only in linux/if.h
+#endif
+
+// link state bits which are reported
+#define LINK_STATE_FLAGS (IFF_UP | IFF_LOWER_UP)
+
+static int read_messages(void* monitor_ptr, const char* data, ssize_t length);
+static void release_monitor(void* monitor_ptr);
+static void process_event(monitor_t monitor, struct monitor_event* event);
+
+struct netlink_monitor_object {
+	struct monitor_t monitor;
+	struct netlink_monitor netlink;
+};
+
+struct monitor_slab netlink_monitor_slab =
+		MONITOR_SLAB_INITIALIZER(struct netlink_monitor_object);
+
+static const struct monitor_ops netlink_ops = {
+	netlink_start, netlink_stop, netlink_join, netlink_monitor_destroy, NULL, NULL
+};
+
+int netlink_monitor_from_args(int argc, char* argv[], monitor_t* monitor) {
+	if (argc > 1) return E_INVALID_MONITOR_ARGUMENT;
+	struct netlink_monitor_object* object =
+			(struct netlink_monitor_object*)slab_alloc(&netlink_monitor_slab);
+	if (object == NULL) {
+		log_error("slab_alloc: %s", strerror(errno));
+		return E_OUT_OF_MEMORY;
+	}
+	*monitor = &object->monitor;
+	(*monitor)->type = MONITOR_TYPE_NETLINK;
+	(*monitor)->ops = &netlink_ops;
+	(*monitor)->netlink = &object->netlink;
+	(*monitor)->netlink->socket_fd = -1;
+	atomic_init(&(*monitor)->state, MONITOR_STATE_INITIALIZED);
+	return CALL_SUCCESS;
+}
+
+int netlink_start(monitor_t monitor) {
+	if (monitor_transition(monitor, MONITOR_STATE_INITIALIZED,
+						   MONITOR_STATE_RUNNING) != CALL_SUCCESS) {
+		log_error("cannot start monitor wich is not in \'initialized\' state");
+		return E_MONITOR_INVALID_STATE;
+	}
+	netlink_monitor_t netlink_monitor = monitor->netlink;
+	int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0) {
+		log_error("netlink socket: %s", strerror(errno));
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
+		return CALL_FAILURE;
+	}
+	// bursts of route changes should not overrun socket
+	int buffer_size = NETLINK_RECEIVE_BUFFER;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+
+	struct sockaddr_nl address;
+	memset(&address, 0, sizeof(address));
+	address.nl_family = AF_NETLINK;
+	address.nl_groups = NETLINK_GROUPS;
+	if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+		log_error("netlink bind: %s", strerror(errno));
+		close(fd);
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
+		return CALL_FAILURE;
+	}
+	netlink_monitor->socket_fd = fd;
+	if (ingest_add_read(fd, read_messages, release_monitor, monitor,
+						&netlink_monitor->source) != CALL_SUCCESS) {
+		close(fd);
+		netlink_monitor->socket_fd = -1;
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
+		return CALL_FAILURE;
+	}
+	log_info("netlink network monitor was created");
+	return CALL_SUCCESS;
+}
+
+int netlink_stop(monitor_t monitor) {
+	if (monitor_transition(monitor, MONITOR_STATE_RUNNING,
+						   MONITOR_STATE_DYING) != CALL_SUCCESS) {
+		return E_MONITOR_INVALID_STATE;
+	}
+	ingest_remove(monitor->netlink->source);
+	return CALL_SUCCESS;
+}
+
+void netlink_join(monitor_t monitor) {
+	wait_monitor_dead(monitor);
+	log_info("netlink network monitor was stopped");
+}
+
+void netlink_print_usage() {
+	printf("%s%s%s",
+		   "Aimed to monitor network events (link up/down, address and route changes)\n",
+		   "without NetworkManager, straight from kernel\n",
+		   "Usage: slm --network --backend=netlink\n");
+}
+
+int netlink_monitor_destroy(monitor_t monitor) {
+	if (claim_monitor_for_destroy(monitor) != CALL_SUCCESS) {
+		return E_MONITOR_INVALID_STATE;
+	}
+	netlink_monitor_t netlink_monitor = monitor->netlink;
+	if (netlink_monitor->overruns > 0) {
+		log_error("netlink socket overran %lu times, network events were lost",
+				  netlink_monitor->overruns);
+	}
+	if (netlink_monitor->socket_fd >= 0) close(netlink_monitor->socket_fd);
+	log_info("netlink network monitor was killed");
+	slab_free(&netlink_monitor_slab, monitor);
+	return CALL_SUCCESS;
+}
+
+static struct netlink_link* link_slot(netlink_monitor_t netlink_monitor, int index) {
+	return &netlink_monitor->links[(unsigned int)index % NETLINK_LINKS_COUNT];
+}
+
+/*
+ * Name of link by its index, from cache or kernel if link was not seen yet
+ */
+static const char* link_name(netlink_monitor_t netlink_monitor, int index,
+							 char buffer[IF_NAMESIZE]) {
+	struct netlink_link* link = link_slot(netlink_monitor, index);
+	if (link->index == index) return link->name;
+	if (if_indextoname(index, buffer) == NULL) {
+		snprintf(buffer, IF_NAMESIZE, "if%d", index);
+	}
+	return buffer;
+}
+
+static const char* link_state_string(unsigned int state) {
+	if (!(state & IFF_UP)) return "down";
+	return (state & IFF_LOWER_UP) ? "up" : "up without carrier";
+}
+
+/*
+ * Reports link only when its state or name changed since last message
+ */
+static void decode_link(monitor_t monitor, const struct nlmsghdr* header) {
+	const struct ifinfomsg* info = (const struct ifinfomsg*)NLMSG_DATA(header);
+	const struct rtattr* attributes[IFLA_MAX + 1];
+	netlink_parse_attributes(attributes, IFLA_MAX, IFLA_RTA(info),
+							 header->nlmsg_len - NLMSG_LENGTH(sizeof(*info)));
+	const char* name = (const char*)netlink_attribute_data(attributes[IFLA_IFNAME], 1);
+	char name_buffer[IF_NAMESIZE];
+	if (name == NULL) {
+		name = link_name(monitor->netlink, info->ifi_index, name_buffer);
+	}
+	char text[MONITOR_EVENT_NAME_LENGTH];
+	struct netlink_link* link = link_slot(monitor->netlink, info->ifi_index);
+	if (header->nlmsg_type == RTM_DELLINK) {
+		if (link->index == info->ifi_index) link->index = 0;
+		snprintf(text, sizeof(text), "link %s was removed", name);
+		submit_monitor_event(monitor, process_event, NETLINK_EVENT_LINK,
+							 info->ifi_index, text);
+		return;
+	}
+	unsigned int state = info->ifi_flags & LINK_STATE_FLAGS;
+	if (link->index == info->ifi_index && strncmp(link->name, name, IF_NAMESIZE) != 0) {
+		snprintf(text, sizeof(text), "link %s was renamed to %s", link->name, name);
+		submit_monitor_event(monitor, process_event, NETLINK_EVENT_LINK,
+							 info->ifi_index, text);
+	}
+	if (link->index != info->ifi_index || link->state != state) {
+		snprintf(text, sizeof(text), "link %s is %s", name, link_state_string(state));
+		submit_monitor_event(monitor, process_event, NETLINK_EVENT_LINK,
+							 info->ifi_index, text);
+	}
+	link->index = info->ifi_index;
+	link->state = state;
+	snprintf(link->name, IF_NAMESIZE, "%s", name);
+}
+
+static void decode_address(monitor_t monitor, const struct nlmsghdr* header) {
+	const struct ifaddrmsg* info = (const struct ifaddrmsg*)NLMSG_DATA(header);
+	const struct rtattr* attributes[IFA_MAX + 1];
+	netlink_parse_attributes(attributes, IFA_MAX, IFA_RTA(info),
+							 header->nlmsg_len - NLMSG_LENGTH(sizeof(*info)));
+	// IFA_LOCAL is own address on point-to-point links, IFA_ADDRESS is peer then
+	const struct rtattr* address = attributes[IFA_LOCAL] != NULL ? attributes[IFA_LOCAL]
+																  : attributes[IFA_ADDRESS];
+	size_t size = info->ifa_family == AF_INET6 ? 16 : 4;
+	const void* address_data = netlink_attribute_data(address, size);
+	char address_string[INET6_ADDRSTRLEN];
+	if (address_data == NULL
+		|| inet_ntop(info->ifa_family, address_data, address_string,
+					 sizeof(address_string)) == NULL) {
+		return;
+	}
+	char name_buffer[IF_NAMESIZE];
+	char text[MONITOR_EVENT_NAME_LENGTH];
+	int added = header->nlmsg_type == RTM_NEWADDR;
+	snprintf(text, sizeof(text), "address %s/%u was %s %s", address_string,
+			 info->ifa_prefixlen, added ? "added to" : "removed from",
+			 link_name(monitor->netlink, info->ifa_index, name_buffer));
+	submit_monitor_event(monitor, process_event, NETLINK_EVENT_ADDRESS,
+						 info->ifa_index, text);
+}
+
+static void decode_route(monitor_t monitor, const struct nlmsghdr* header) {
+	const struct rtmsg* info = (const struct rtmsg*)NLMSG_DATA(header);
+	// local table mirrors addresses, cloned entries are route cache
+	if (info->rtm_table == RT_TABLE_LOCAL || (info->rtm_flags & RTM_F_CLONED)) {
+		return;
+	}
+	const struct rtattr* attributes[RTA_MAX + 1];
+	netlink_parse_attributes(attributes, RTA_MAX, RTM_RTA(info),
+							 header->nlmsg_len - NLMSG_LENGTH(sizeof(*info)));
+	size_t size = info->rtm_family == AF_INET6 ? 16 : 4;
+	char destination[INET6_ADDRSTRLEN + 8] = "default";
+	char gateway[INET6_ADDRSTRLEN + 8] = "";
+	const void* data = netlink_attribute_data(attributes[RTA_DST], size);
+	if (data != NULL && inet_ntop(info->rtm_family, data, destination,
+								  INET6_ADDRSTRLEN) != NULL) {
+		size_t used = strlen(destination);
+		snprintf(destination + used, sizeof(destination) - used, "/%u", info->rtm_dst_len);
+	}
+	data = netlink_attribute_data(attributes[RTA_GATEWAY], size);
+	if (data != NULL) {
+		strcpy(gateway, " via ");
+		inet_ntop(info->rtm_family, data, gateway + 5, INET6_ADDRSTRLEN);
+	}
+	char device[IF_NAMESIZE + 8] = "";
+	char name_buffer[IF_NAMESIZE];
+	const int* output = (const int*)netlink_attribute_data(attributes[RTA_OIF], sizeof(int));
+	if (output != NULL) {
+		snprintf(device, sizeof(device), " dev %s",
+				 link_name(monitor->netlink, *output, name_buffer));
+	}
+	char text[MONITOR_EVENT_NAME_LENGTH];
+	snprintf(text, sizeof(text), "route %s%s%s was %s", destination, gateway, device,
+			 header->nlmsg_type == RTM_NEWROUTE ? "added" : "removed");
+	submit_monitor_event(monitor, process_event, NETLINK_EVENT_ROUTE,
+						 output != NULL ? (uint32_t)*output : 0, text);
+}
+
+/*
+ * Decodes datagram read by ingestion engine, runs on engine thread.
+ * Messages are decoded in place, nothing is allocated.
+ */
+static int read_messages(void* monitor_ptr, const char* data, ssize_t length) {
+	monitor_t monitor = (monitor_t)monitor_ptr;
+	if (length == -ENOBUFS) {
+		// socket is still usable, kernel dropped what did not fit
+		monitor->netlink->overruns++;
+		submit_monitor_event(monitor, process_event, NETLINK_EVENT_OVERRUN, 0, NULL);
+		return INGEST_CONTINUE;
+	}
+	if (length <= 0) {
+		log_error("netlink read: %s", length == 0 ? "end of file" : strerror(-length));
+		// if stop won the race, it has already removed the source
+		if (monitor_transition(monitor, MONITOR_STATE_RUNNING,
+							   MONITOR_STATE_DYING) == CALL_SUCCESS) {
+			ingest_remove(monitor->netlink->source);
+		}
+		return INGEST_STOP;
+	}
+	int remaining = (int)length;
+	for (const struct nlmsghdr* header = (const struct nlmsghdr*)data;
+		 NLMSG_OK(header, remaining); header = NLMSG_NEXT(header, remaining)) {
+		switch (header->nlmsg_type) {
+			case RTM_NEWLINK:
+			case RTM_DELLINK: {
+				if (header->nlmsg_len >= NLMSG_LENGTH(sizeof(struct ifinfomsg))) {
+					decode_link(monitor, header);
+				}
+				break;
+			}
+			case RTM_NEWADDR:
+			case RTM_DELADDR: {
+				if (header->nlmsg_len >= NLMSG_LENGTH(sizeof(struct ifaddrmsg))) {
+					decode_address(monitor, header);
+				}
+				break;
+			}
+			case RTM_NEWROUTE:
+			case RTM_DELROUTE: {
+				if (header->nlmsg_len >= NLMSG_LENGTH(sizeof(struct rtmsg))) {
+					decode_route(monitor, header);
+				}
+				break;
+			}
+			default: {}
+		}
+	}
+	return INGEST_CONTINUE;
+}
+
+static void release_monitor(void* monitor_ptr) {
+	mark_monitor_dead((monitor_t)monitor_ptr);
+}
+
+/*
+ * Reports event decoded on engine thread, runs on pipeline worker
+ */
+static void process_event(monitor_t monitor, struct monitor_event* event) {
+	switch (event->kind) {
+		case NETLINK_EVENT_LINK:
+		case NETLINK_EVENT_ADDRESS:
+		case NETLINK_EVENT_ROUTE: {
+			log_info("%s", event->name);
+			break;
+		}
+		case NETLINK_EVENT_OVERRUN: {
+			log_error("netlink socket overrun, network events were lost");
+			break;
+		}
+		default: {}
+	}
+}
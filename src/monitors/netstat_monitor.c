@@ -0,0 +1,487 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <monitors/monitor.h>
+#include <logging/logging.h>
+#include "errors.h"
+#include "monotonic.h"
+#include "monitor_alloc.h"
+#include "netlink_attr.h"
+#include "ingest.h"
+
+#define OPTION_INTERVAL 'i'
+#define OPTION_THRESHOLD 't'
+#define OPTION_CHANGE 'c'
+
+#define DEFAULT_INTERVAL_MS			1000
+#define DEFAULT_CHANGE_PERCENT		50
+// smaller changes of rate are noise whatever percentage they make
+#define MIN_RATE_CHANGE				1024.0
+// dump still pending after it is given up and requested again
+#define DUMP_TIMEOUT_MS				1000
+
+#define NETSTAT_EVENT_RATE			1
+
+static const char* direction_names[NETSTAT_DIRECTIONS] = { "rx", "tx" };
+
+static int sample_interfaces(void* monitor_ptr);
+static int read_dump(void* monitor_ptr, const char* data, ssize_t length);
+static void release_source(void* monitor_ptr);
+static void process_event(monitor_t monitor, struct monitor_event* event);
+
+struct netstat_monitor_object {
+	struct monitor_t monitor;
+	struct netstat_monitor netstat;
+};
+
+struct monitor_slab netstat_monitor_slab =
+		MONITOR_SLAB_INITIALIZER(struct netstat_monitor_object);
+
+static const struct monitor_ops netstat_ops = {
+	netstat_start, netstat_stop, netstat_join, netstat_monitor_destroy, NULL, NULL
+};
+
+static double parse_rate(const char* rate_string) {
+	char* suffix;
+	double rate = strtod(rate_string, &suffix);
+	switch (*suffix) {
+		case 'G': rate *= 1024;	// fall through
+		case 'M': rate *= 1024;	// fall through
+		case 'K': rate *= 1024;	break;
+		default: {}
+	}
+	return rate;
+}
+
+int netstat_monitor_from_args(int argc, char* argv[], monitor_t* monitor) {
+	struct netstat_monitor_object* object =
+			(struct netstat_monitor_object*)slab_alloc(&netstat_monitor_slab);
+	if (object == NULL) {
+		log_error("slab_alloc: %s", strerror(errno));
+		return E_OUT_OF_MEMORY;
+	}
+	*monitor = &object->monitor;
+	(*monitor)->type = MONITOR_TYPE_NETSTAT;
+	(*monitor)->ops = &netstat_ops;
+	(*monitor)->netstat = &object->netstat;
+	netstat_monitor_t netstat_monitor = (*monitor)->netstat;
+	netstat_monitor->interval_ms = DEFAULT_INTERVAL_MS;
+	netstat_monitor->change_percent = DEFAULT_CHANGE_PERCENT;
+	netstat_monitor->timer_fd = -1;
+	netstat_monitor->socket_fd = -1;
+
+	static struct option long_options[] = {
+		{"interval", required_argument, 0, OPTION_INTERVAL},
+		{"threshold", required_argument, 0, OPTION_THRESHOLD},
+		{"change", required_argument, 0, OPTION_CHANGE},
+		{NULL, 0, 0, 0}
+	};
+	opterr = 0;
+	optind = 1;
+	int c;
+	while ((c = getopt_long(argc, argv, "+", long_options, NULL)) != -1) {
+		switch (c) {
+			case OPTION_INTERVAL: {
+				netstat_monitor->interval_ms = strtol(optarg, NULL, 10);
+				break;
+			}
+			case OPTION_THRESHOLD: {
+				netstat_monitor->threshold = parse_rate(optarg);
+				break;
+			}
+			case OPTION_CHANGE: {
+				netstat_monitor->change_percent = strtod(optarg, NULL);
+				break;
+			}
+			case '?':
+			default: {
+				slab_free(&netstat_monitor_slab, object);
+				return E_INVALID_MONITOR_ARGUMENT;
+			}
+		}
+	}
+	if (argc != optind || netstat_monitor->interval_ms <= 0
+		|| netstat_monitor->threshold < 0 || netstat_monitor->change_percent < 0) {
+		slab_free(&netstat_monitor_slab, object);
+		return E_INVALID_MONITOR_ARGUMENT;
+	}
+	atomic_init(&(*monitor)->state, MONITOR_STATE_INITIALIZED);
+	return CALL_SUCCESS;
+}
+
+static void close_descriptors(netstat_monitor_t netstat_monitor) {
+	if (netstat_monitor->timer_fd >= 0) close(netstat_monitor->timer_fd);
+	if (netstat_monitor->socket_fd >= 0) close(netstat_monitor->socket_fd);
+	netstat_monitor->timer_fd = -1;
+	netstat_monitor->socket_fd = -1;
+}
+
+int netstat_start(monitor_t monitor) {
+	if (monitor_transition(monitor, MONITOR_STATE_INITIALIZED,
+						   MONITOR_STATE_RUNNING) != CALL_SUCCESS) {
+		log_error("cannot start monitor wich is not in \'initialized\' state");
+		return E_MONITOR_INVALID_STATE;
+	}
+	netstat_monitor_t netstat_monitor = monitor->netstat;
+	// dump is read by engine as its datagrams arrive, timer only requests it
+	netstat_monitor->socket_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+										NETLINK_ROUTE);
+	netstat_monitor->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (netstat_monitor->socket_fd < 0 || netstat_monitor->timer_fd < 0) {
+		log_error("netstat monitor: %s", strerror(errno));
+		close_descriptors(netstat_monitor);
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
+		return CALL_FAILURE;
+	}
+	netstat_monitor->dump_pending = 0;
+	atomic_store(&netstat_monitor->live_sources, 2);
+	if (ingest_add_read(netstat_monitor->socket_fd, read_dump, release_source, monitor,
+						&netstat_monitor->dump_source) != CALL_SUCCESS) {
+		close_descriptors(netstat_monitor);
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
+		return CALL_FAILURE;
+	}
+
+	struct itimerspec period;
+	period.it_interval.tv_sec = netstat_monitor->interval_ms / 1000;
+	period.it_interval.tv_nsec = (netstat_monitor->interval_ms % 1000) * 1000000;
+	period.it_value.tv_sec = 0;
+	period.it_value.tv_nsec = 1;	// first sample at once, it is baseline
+	if (timerfd_settime(netstat_monitor->timer_fd, 0, &period, NULL) != 0
+		|| ingest_add_ready(netstat_monitor->timer_fd, sample_interfaces, release_source,
+							monitor, &netstat_monitor->source) != CALL_SUCCESS) {
+		log_error("netstat monitor: cannot arm sampling timer");
+		// dump source is released asynchronously, monitor dies with it
+		atomic_store(&netstat_monitor->live_sources, 1);
+		if (monitor_transition(monitor, MONITOR_STATE_RUNNING,
+							   MONITOR_STATE_DYING) == CALL_SUCCESS) {
+			ingest_remove(netstat_monitor->dump_source);
+		}
+		wait_monitor_dead(monitor);
+		close_descriptors(netstat_monitor);
+		monitor_transition(monitor, MONITOR_STATE_DEAD, MONITOR_STATE_INITIALIZED);
+		return CALL_FAILURE;
+	}
+	log_info("netstat monitor was created, sampling every %ld ms", netstat_monitor->interval_ms);
+	return CALL_SUCCESS;
+}
+
+int netstat_stop(monitor_t monitor) {
+	if (monitor_transition(monitor, MONITOR_STATE_RUNNING,
+						   MONITOR_STATE_DYING) != CALL_SUCCESS) {
+		return E_MONITOR_INVALID_STATE;
+	}
+	ingest_remove(monitor->netstat->source);
+	ingest_remove(monitor->netstat->dump_source);
+	return CALL_SUCCESS;
+}
+
+void netstat_join(monitor_t monitor) {
+	wait_monitor_dead(monitor);
+	if (monitor->netstat->dumps_abandoned > 0) {
+		log_warn("netstat monitor gave up %lu dumps not completed in %d ms",
+				 monitor->netstat->dumps_abandoned, DUMP_TIMEOUT_MS);
+	}
+	log_info("netstat monitor was stopped after %lu dumps", monitor->netstat->dumps_completed);
+}
+
+void netstat_print_usage() {
+	printf("%s%s%s%s%s%s",
+		   "Aimed to monitor throughput of network interfaces\n",
+		   "Usage: slm --netstat [options]\n",
+		   "\t --interval ms - sampling interval, 1000 by default\n",
+		   "\t --threshold rate - report rx/tx rate crossing rate in bytes/s (K, M, G suffixes)\n",
+		   "\t --change percent - report rate changed by percent since it was reported,\n",
+		   "\t                    50 by default, 0 disables\n");
+}
+
+int netstat_monitor_destroy(monitor_t monitor) {
+	if (claim_monitor_for_destroy(monitor) != CALL_SUCCESS) {
+		return E_MONITOR_INVALID_STATE;
+	}
+	netstat_monitor_t netstat_monitor = monitor->netstat;
+	close_descriptors(netstat_monitor);
+	free(netstat_monitor->interfaces);
+	log_info("netstat monitor was killed");
+	slab_free(&netstat_monitor_slab, monitor);
+	return CALL_SUCCESS;
+}
+
+static void format_rate(double rate, char* buffer, size_t size) {
+	static const char* units[] = { "B/s", "KB/s", "MB/s", "GB/s" };
+	int unit = 0;
+	while (rate >= 1024 && unit < 3) {
+		rate /= 1024;
+		unit++;
+	}
+	snprintf(buffer, size, "%.1f %s", rate, units[unit]);
+}
+
+/*
+ * Dump usually lists interfaces in the same order, so search starts
+ * after interface found last time
+ */
+static struct netstat_interface* find_interface(netstat_monitor_t netstat_monitor,
+												int index, int* cursor) {
+	int count = netstat_monitor->interfaces_count;
+	for (int i = 0; i < count; i++) {
+		struct netstat_interface* interface =
+				&netstat_monitor->interfaces[(*cursor + i) % count];
+		if (interface->index == index) {
+			*cursor = (*cursor + i + 1) % count;
+			return interface;
+		}
+	}
+	return NULL;
+}
+
+static struct netstat_interface* add_interface(netstat_monitor_t netstat_monitor, int index) {
+	if (netstat_monitor->interfaces_count == netstat_monitor->interfaces_capacity) {
+		int capacity = netstat_monitor->interfaces_capacity == 0
+					   ? 16 : netstat_monitor->interfaces_capacity * 2;
+		struct netstat_interface* interfaces = (struct netstat_interface*)realloc(
+				netstat_monitor->interfaces, capacity * sizeof(struct netstat_interface));
+		if (interfaces == NULL) return NULL;
+		netstat_monitor->interfaces = interfaces;
+		netstat_monitor->interfaces_capacity = capacity;
+	}
+	struct netstat_interface* interface =
+			&netstat_monitor->interfaces[netstat_monitor->interfaces_count++];
+	memset(interface, 0, sizeof(struct netstat_interface));
+	interface->index = index;
+	if (if_indextoname(index, interface->name) == NULL) {
+		snprintf(interface->name, IF_NAMESIZE, "if%d", index);
+	}
+	return interface;
+}
+
+static void report(monitor_t monitor, const char* format, ...)
+		__attribute__((format(printf, 2, 3)));
+
+static void report(monitor_t monitor, const char* format, ...) {
+	char text[MONITOR_EVENT_NAME_LENGTH];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+	submit_monitor_event(monitor, process_event, NETSTAT_EVENT_RATE, 0, text);
+}
+
+/*
+ * Compares rate of one direction with threshold and with last reported rate
+ */
+static void check_rate(monitor_t monitor, struct netstat_interface* interface,
+					   int direction, double rate) {
+	netstat_monitor_t netstat_monitor = monitor->netstat;
+	const char* name = direction_names[direction];
+	char rate_string[32];
+	char old_rate_string[32];
+	format_rate(rate, rate_string, sizeof(rate_string));
+	if (netstat_monitor->threshold > 0) {
+		int above = rate >= netstat_monitor->threshold;
+		if (above != interface->above_threshold[direction]) {
+			char threshold_string[32];
+			format_rate(netstat_monitor->threshold, threshold_string, sizeof(threshold_string));
+			report(monitor, "interface %s %s rate %s %s: %s", interface->name, name,
+				   above ? "rose above" : "fell below", threshold_string, rate_string);
+			interface->above_threshold[direction] = above;
+			interface->reported_rate[direction] = rate;
+			return;
+		}
+	}
+	if (netstat_monitor->change_percent > 0) {
+		double reported = interface->reported_rate[direction];
+		double change = rate > reported ? rate - reported : reported - rate;
+		if (change >= MIN_RATE_CHANGE
+			&& change * 100 >= netstat_monitor->change_percent * reported) {
+			format_rate(reported, old_rate_string, sizeof(old_rate_string));
+			report(monitor, "interface %s %s rate changed from %s to %s", interface->name,
+				   name, old_rate_string, rate_string);
+			interface->reported_rate[direction] = rate;
+		}
+	}
+}
+
+static void update_interface(monitor_t monitor, struct netstat_interface* interface,
+							 const struct rtnl_link_stats64* stats, long sampled_at_ns,
+							 int is_new) {
+	double seconds = interface->sampled_at_ns == 0
+					 ? 0 : (sampled_at_ns - interface->sampled_at_ns) / 1e9;
+	uint64_t bytes[NETSTAT_DIRECTIONS] = { stats->rx_bytes, stats->tx_bytes };
+	uint64_t faults[NETSTAT_DIRECTIONS] = { stats->rx_errors + stats->rx_dropped,
+											stats->tx_errors + stats->tx_dropped };
+	for (int direction = 0; direction < NETSTAT_DIRECTIONS; direction++) {
+		// new interface is baseline, counters going back mean it was reset
+		if (!is_new && seconds > 0 && bytes[direction] >= interface->bytes[direction]) {
+			check_rate(monitor, interface, direction,
+					   (bytes[direction] - interface->bytes[direction]) / seconds);
+		}
+		if (!is_new && faults[direction] > interface->faults[direction]) {
+			report(monitor, "interface %s has %llu new %s errors and drops", interface->name,
+				   (unsigned long long)(faults[direction] - interface->faults[direction]),
+				   direction_names[direction]);
+		}
+		interface->bytes[direction] = bytes[direction];
+		interface->faults[direction] = faults[direction];
+	}
+	interface->sampled_at_ns = sampled_at_ns;
+	interface->seen = 1;
+}
+
+static int request_stats(netstat_monitor_t netstat_monitor) {
+	struct {
+		struct nlmsghdr header;
+		struct if_stats_msg stats;
+	} request;
+	memset(&request, 0, sizeof(request));
+	request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct if_stats_msg));
+	request.header.nlmsg_type = RTM_GETSTATS;
+	request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	request.header.nlmsg_seq = ++netstat_monitor->sequence;
+	request.stats.family = AF_UNSPEC;
+	// only 64-bit link counters, whole RTM_GETLINK dump is ten times larger
+	request.stats.filter_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_64);
+	if (send(netstat_monitor->socket_fd, &request, request.header.nlmsg_len, 0) < 0) {
+		log_error("netstat request: %s", strerror(errno));
+		return CALL_FAILURE;
+	}
+	return CALL_SUCCESS;
+}
+
+/*
+ * Interfaces missing from complete dump are gone
+ */
+static void drop_unseen_interfaces(netstat_monitor_t netstat_monitor) {
+	int kept = 0;
+	for (int i = 0; i < netstat_monitor->interfaces_count; i++) {
+		if (netstat_monitor->interfaces[i].seen) {
+			netstat_monitor->interfaces[kept++] = netstat_monitor->interfaces[i];
+		}
+	}
+	netstat_monitor->interfaces_count = kept;
+}
+
+static void update_from_message(monitor_t monitor, const struct nlmsghdr* header) {
+	netstat_monitor_t netstat_monitor = monitor->netstat;
+	if (header->nlmsg_type != RTM_NEWSTATS
+		|| header->nlmsg_len < NLMSG_LENGTH(sizeof(struct if_stats_msg))) {
+		return;
+	}
+	const struct if_stats_msg* info = (const struct if_stats_msg*)NLMSG_DATA(header);
+	const struct rtattr* attributes[IFLA_STATS_MAX + 1];
+	netlink_parse_attributes(attributes, IFLA_STATS_MAX,
+			(const struct rtattr*)((const char*)info + NLMSG_ALIGN(sizeof(*info))),
+			header->nlmsg_len - NLMSG_LENGTH(sizeof(*info)));
+	const void* data = netlink_attribute_data(attributes[IFLA_STATS_LINK_64],
+											  sizeof(struct rtnl_link_stats64));
+	if (data == NULL) return;
+	struct rtnl_link_stats64 stats;
+	memcpy(&stats, data, sizeof(stats));	// payload is only 4-byte aligned
+	struct netstat_interface* interface =
+			find_interface(netstat_monitor, info->ifindex, &netstat_monitor->dump_cursor);
+	int is_new = interface == NULL;
+	if (is_new) interface = add_interface(netstat_monitor, info->ifindex);
+	if (interface != NULL) {
+		update_interface(monitor, interface, &stats, netstat_monitor->dump_started_ns, is_new);
+	}
+}
+
+/*
+ * Runs on engine thread for each datagram of dump. Each interface keeps
+ * time of dump which updated it, so one that failed halfway leaves rates
+ * of both updated and skipped interfaces right; only complete one drops
+ * interfaces.
+ */
+static int read_dump(void* monitor_ptr, const char* data, ssize_t length) {
+	monitor_t monitor = (monitor_t)monitor_ptr;
+	netstat_monitor_t netstat_monitor = monitor->netstat;
+	if (length == -ENOBUFS) {
+		log_error("netstat dump: %s", strerror(ENOBUFS));
+		netstat_monitor->dump_pending = 0;
+		return INGEST_CONTINUE;
+	}
+	if (length <= 0) {
+		log_error("netstat dump: %s", length == 0 ? "end of file" : strerror(-length));
+		// if stop won the race, it has already removed sources
+		if (monitor_transition(monitor, MONITOR_STATE_RUNNING,
+							   MONITOR_STATE_DYING) == CALL_SUCCESS) {
+			ingest_remove(netstat_monitor->source);
+			ingest_remove(netstat_monitor->dump_source);
+		}
+		return INGEST_STOP;
+	}
+	int remaining = (int)length;
+	for (const struct nlmsghdr* header = (const struct nlmsghdr*)data;
+		 NLMSG_OK(header, remaining); header = NLMSG_NEXT(header, remaining)) {
+		// rest of given up dump
+		if (!netstat_monitor->dump_pending || header->nlmsg_seq != netstat_monitor->sequence) {
+			continue;
+		}
+		if (header->nlmsg_type == NLMSG_DONE) {
+			drop_unseen_interfaces(netstat_monitor);
+			netstat_monitor->dump_pending = 0;
+			netstat_monitor->dumps_completed++;
+		} else if (header->nlmsg_type == NLMSG_ERROR) {
+			const struct nlmsgerr* error = (const struct nlmsgerr*)NLMSG_DATA(header);
+			log_error("netstat dump: %s", strerror(-error->error));
+			netstat_monitor->dump_pending = 0;
+		} else {
+			update_from_message(monitor, header);
+		}
+	}
+	return INGEST_CONTINUE;
+}
+
+/*
+ * Runs on engine thread each time sampling timer expires
+ */
+static int sample_interfaces(void* monitor_ptr) {
+	monitor_t monitor = (monitor_t)monitor_ptr;
+	netstat_monitor_t netstat_monitor = monitor->netstat;
+	uint64_t expirations;
+	if (read(netstat_monitor->timer_fd, &expirations, sizeof(expirations)) < 0) {
+		return INGEST_CONTINUE;
+	}
+	long now = monotonic_ns();
+	if (netstat_monitor->dump_pending) {
+		if (now - netstat_monitor->dump_started_ns < DUMP_TIMEOUT_MS * 1000000L) {
+			return INGEST_CONTINUE;
+		}
+		netstat_monitor->dumps_abandoned++;
+	}
+	netstat_monitor->dump_pending = 0;
+	if (request_stats(netstat_monitor) != CALL_SUCCESS) return INGEST_CONTINUE;
+	for (int i = 0; i < netstat_monitor->interfaces_count; i++) {
+		netstat_monitor->interfaces[i].seen = 0;
+	}
+	netstat_monitor->dump_started_ns = now;
+	netstat_monitor->dump_cursor = 0;
+	netstat_monitor->dump_pending = 1;
+	return INGEST_CONTINUE;
+}
+
+static void release_source(void* monitor_ptr) {
+	monitor_t monitor = (monitor_t)monitor_ptr;
+	if (atomic_fetch_sub(&monitor->netstat->live_sources, 1) == 1) {
+		mark_monitor_dead(monitor);
+	}
+}
+
+/*
+ * Reports event sampled on engine thread, runs on pipeline worker
+ */
+static void process_event(monitor_t monitor, struct monitor_event* event) {
+	if (event->kind == NETSTAT_EVENT_RATE) {
+		log_info("%s", event->name);
+	}
+}
@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include "errors.h"
+#include "path_filter.h"
+
+#define TRIE_INITIAL_CAPACITY	64
+
+#define TRIE_FLAG_EXACT		1	// pattern ends here
+#define TRIE_FLAG_ANY_TAIL	2	// pattern ends here with trailing '*'
+
+static int trie_child(struct pattern_trie* trie, int node, unsigned char byte) {
+	for (int child = trie->nodes[node].first_child; child != -1;
+		 child = trie->nodes[child].next_sibling) {
+		if (trie->nodes[child].byte == byte) return child;
+	}
+	return -1;
+}
+
+static int trie_new_node(struct pattern_trie* trie, unsigned char byte) {
+	if (trie->nodes_count == trie->nodes_capacity) {
+		int new_capacity = trie->nodes_capacity == 0 ? TRIE_INITIAL_CAPACITY
+													 : trie->nodes_capacity * 2;
+		struct pattern_trie_node* new_nodes = (struct pattern_trie_node*)realloc(
+				trie->nodes, new_capacity * sizeof(struct pattern_trie_node));
+		if (new_nodes == NULL) return -1;
+		trie->nodes = new_nodes;
+		trie->nodes_capacity = new_capacity;
+	}
+	struct pattern_trie_node* node = &trie->nodes[trie->nodes_count];
+	node->first_child = -1;
+	node->next_sibling = -1;
+	node->byte = byte;
+	node->flags = 0;
+	return trie->nodes_count++;
+}
+
+static int trie_insert(struct pattern_trie* trie, const char* key, size_t length,
+					   int reversed, unsigned char flag) {
+	if (trie->nodes_count == 0 && trie_new_node(trie, 0) < 0) return E_OUT_OF_MEMORY;
+	int node = 0;
+	for (size_t i = 0; i < length; i++) {
+		unsigned char byte = (unsigned char)key[reversed ? length - 1 - i : i];
+		int child = trie_child(trie, node, byte);
+		if (child == -1) {
+			child = trie_new_node(trie, byte);
+			if (child < 0) return E_OUT_OF_MEMORY;
+			trie->nodes[child].next_sibling = trie->nodes[node].first_child;
+			trie->nodes[node].first_child = child;
+		}
+		node = child;
+	}
+	trie->nodes[node].flags |= flag;
+	return CALL_SUCCESS;
+}
+
+static int trie_match(struct pattern_trie* trie, const char* name, size_t length, int reversed) {
+	if (trie->nodes_count == 0) return 0;
+	int node = 0;
+	for (size_t i = 0; ; i++) {
+		if (trie->nodes[node].flags & TRIE_FLAG_ANY_TAIL) return 1;
+		if (i == length) return (trie->nodes[node].flags & TRIE_FLAG_EXACT) != 0;
+		node = trie_child(trie, node, (unsigned char)name[reversed ? length - 1 - i : i]);
+		if (node == -1) return 0;
+	}
+}
+
+static int has_glob_chars(const char* string, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		if (string[i] == '*' || string[i] == '?' || string[i] == '[' || string[i] == '\\') {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int matcher_add(struct path_matcher* matcher, const char* pattern) {
+	size_t length = strlen(pattern);
+	int result;
+	if (!has_glob_chars(pattern, length)) {
+		result = trie_insert(&matcher->prefixes, pattern, length, 0, TRIE_FLAG_EXACT);
+	} else if (length > 0 && pattern[length - 1] == '*'
+			   && !has_glob_chars(pattern, length - 1)) {
+		result = trie_insert(&matcher->prefixes, pattern, length - 1, 0, TRIE_FLAG_ANY_TAIL);
+	} else if (pattern[0] == '*' && !has_glob_chars(pattern + 1, length - 1)) {
+		result = trie_insert(&matcher->suffixes, pattern + 1, length - 1, 1, TRIE_FLAG_ANY_TAIL);
+	} else {
+		char** new_globs = (char**)realloc(matcher->globs,
+										   (matcher->globs_count + 1) * sizeof(char*));
+		if (new_globs == NULL) return E_OUT_OF_MEMORY;
+		matcher->globs = new_globs;
+		matcher->globs[matcher->globs_count] = strdup(pattern);
+		if (matcher->globs[matcher->globs_count] == NULL) return E_OUT_OF_MEMORY;
+		matcher->globs_count++;
+		result = CALL_SUCCESS;
+	}
+	if (result == CALL_SUCCESS) matcher->patterns_count++;
+	return result;
+}
+
+static int matcher_match(struct path_matcher* matcher, const char* name) {
+	size_t length = strlen(name);
+	if (trie_match(&matcher->prefixes, name, length, 0)
+		|| trie_match(&matcher->suffixes, name, length, 1)) {
+		return 1;
+	}
+	for (int i = 0; i < matcher->globs_count; i++) {
+		if (fnmatch(matcher->globs[i], name, 0) == 0) return 1;
+	}
+	return 0;
+}
+
+static void matcher_destroy(struct path_matcher* matcher) {
+	free(matcher->prefixes.nodes);
+	free(matcher->suffixes.nodes);
+	for (int i = 0; i < matcher->globs_count; i++) {
+		free(matcher->globs[i]);
+	}
+	free(matcher->globs);
+}
+
+path_filter_t path_filter_new() {
+	return (path_filter_t)calloc(1, sizeof(struct path_filter));
+}
+
+int path_filter_add(path_filter_t filter, const char* pattern, int exclude) {
+	return matcher_add(exclude ? &filter->exclude : &filter->include, pattern);
+}
+
+int path_filter_accepts(path_filter_t filter, const char* name) {
+	if (filter == NULL) return 1;
+	if (filter->exclude.patterns_count > 0 && matcher_match(&filter->exclude, name)) {
+		return 0;
+	}
+	if (filter->include.patterns_count > 0) {
+		return matcher_match(&filter->include, name);
+	}
+	return 1;
+}
+
+void path_filter_destroy(path_filter_t filter) {
+	if (filter == NULL) return;
+	matcher_destroy(&filter->include);
+	matcher_destroy(&filter->exclude);
+	free(filter);
+}
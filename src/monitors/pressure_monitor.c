@@ -0,0 +1,349 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <getopt.h>
+
+#include <monitors/monitor.h>
+#include <logging/logging.h>
+#include "errors.h"
+#include "monitor_alloc.h"
+#include "ingest.h"
+
+#define OPTION_FULL 'f'
+#define OPTION_STALL 's'
+#define OPTION_WINDOW 'w'
+#define OPTION_RESOURCE 'r'
+
+#define SYSTEM_PRESSURE_DIRECTORY	"/proc/pressure"
+#define DEFAULT_STALL_MS			150
+#define DEFAULT_WINDOW_MS			1000
+#define PRESSURE_READ_SIZE			256
+
+#define PRESSURE_EVENT_TRIGGER		1
+#define PRESSURE_EVENT_GONE			2
+
+static const char* resource_names[PRESSURE_RESOURCES_COUNT] = { "memory", "cpu", "io" };
+
+static int read_pressure(void* trigger_ptr);
+static void release_trigger(void* trigger_ptr);
+static void process_event(monitor_t monitor, struct monitor_event* event);
+
+struct pressure_monitor_object {
+	struct monitor_t monitor;
+	struct pressure_monitor pressure;
+};
+
+struct monitor_slab pressure_monitor_slab =
+		MONITOR_SLAB_INITIALIZER(struct pressure_monitor_object);
+
+static const struct monitor_ops pressure_ops = {
+	pressure_start, pressure_stop, pressure_join, pressure_monitor_destroy, NULL, NULL
+};
+
+static void release_object(struct pressure_monitor_object* object) {
+	free(object->pressure.directories);
+	free(object->pressure.triggers);
+	slab_free(&pressure_monitor_slab, object);
+}
+
+static int parse_resources(const char* list) {
+	int resources = 0;
+	char copy[64];
+	strncpy(copy, list, sizeof(copy) - 1);
+	copy[sizeof(copy) - 1] = '\0';
+	char* save;
+	for (char* name = strtok_r(copy, ",", &save); name != NULL;
+		 name = strtok_r(NULL, ",", &save)) {
+		int found = 0;
+		for (int i = 0; i < PRESSURE_RESOURCES_COUNT; i++) {
+			if (strcmp(name, resource_names[i]) == 0) {
+				resources |= 1 << i;
+				found = 1;
+			}
+		}
+		if (!found) return -1;
+	}
+	return resources;
+}
+
+int pressure_monitor_from_args(int argc, char* argv[], monitor_t* monitor) {
+	struct pressure_monitor_object* object =
+			(struct pressure_monitor_object*)slab_alloc(&pressure_monitor_slab);
+	if (object == NULL) {
+		log_error("slab_alloc: %s", strerror(errno));
+		return E_OUT_OF_MEMORY;
+	}
+	*monitor = &object->monitor;
+	(*monitor)->type = MONITOR_TYPE_PRESSURE;
+	(*monitor)->ops = &pressure_ops;
+	(*monitor)->pressure = &object->pressure;
+	pressure_monitor_t pressure_monitor = (*monitor)->pressure;
+	pressure_monitor->stall_us = DEFAULT_STALL_MS * 1000L;
+	pressure_monitor->window_us = DEFAULT_WINDOW_MS * 1000L;
+	pressure_monitor->resources = (1 << PRESSURE_RESOURCES_COUNT) - 1;
+
+	static struct option long_options[] = {
+		{"full", no_argument, 0, OPTION_FULL},
+		{"stall", required_argument, 0, OPTION_STALL},
+		{"window", required_argument, 0, OPTION_WINDOW},
+		{"resource", required_argument, 0, OPTION_RESOURCE},
+		{NULL, 0, 0, 0}
+	};
+	opterr = 0;
+	optind = 1;
+	int c;
+	while ((c = getopt_long(argc, argv, "+", long_options, NULL)) != -1) {
+		switch (c) {
+			case OPTION_FULL: {
+				pressure_monitor->full = 1;
+				break;
+			}
+			case OPTION_STALL: {
+				pressure_monitor->stall_us = strtol(optarg, NULL, 10) * 1000L;
+				break;
+			}
+			case OPTION_WINDOW: {
+				pressure_monitor->window_us = strtol(optarg, NULL, 10) * 1000L;
+				break;
+			}
+			case OPTION_RESOURCE: {
+				pressure_monitor->resources = parse_resources(optarg);
+				break;
+			}
+			case '?':
+			default: {
+				release_object(object);
+				return E_INVALID_MONITOR_ARGUMENT;
+			}
+		}
+	}
+	if (pressure_monitor->resources <= 0 || pressure_monitor->stall_us <= 0
+		|| pressure_monitor->stall_us >= pressure_monitor->window_us) {
+		release_object(object);
+		return E_INVALID_MONITOR_ARGUMENT;
+	}
+	// no directories means system-wide pressure
+	int count = argc > optind ? argc - optind : 1;
+	pressure_monitor->directories = (const char**)malloc(count * sizeof(const char*));
+	if (pressure_monitor->directories == NULL) {
+		release_object(object);
+		return E_OUT_OF_MEMORY;
+	}
+	for (int i = 0; i < count; i++) {
+		const char* path = argc > optind ? argv[optind + i] : SYSTEM_PRESSURE_DIRECTORY;
+		pressure_monitor->directories[i] = intern_path(path);
+		if (pressure_monitor->directories[i] == NULL) {
+			log_error("path is too long: %s", path);
+			release_object(object);
+			return E_INVALID_MONITOR_ARGUMENT;
+		}
+	}
+	pressure_monitor->directories_count = count;
+	atomic_init(&(*monitor)->state, MONITOR_STATE_INITIALIZED);
+	return CALL_SUCCESS;
+}
+
+/*
+ * Registers trigger on directory/resource (system) or
+ * directory/resource.pressure (cgroup), returns descriptor or -1
+ */
+static int open_trigger(pressure_monitor_t pressure_monitor, const char* directory,
+						const char* resource) {
+	char path[PATH_MAX];
+	int is_system = strcmp(directory, SYSTEM_PRESSURE_DIRECTORY) == 0;
+	snprintf(path, sizeof(path), "%s/%s%s", directory, resource, is_system ? "" : ".pressure");
+	int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		log_error("cannot open %s: %s", path, strerror(errno));
+		return -1;
+	}
+	char trigger[64];
+	int length = snprintf(trigger, sizeof(trigger), "%s %ld %ld",
+						  pressure_monitor->full ? "full" : "some",
+						  pressure_monitor->stall_us, pressure_monitor->window_us);
+	if (write(fd, trigger, length + 1) < 0) {
+		log_error("cannot set trigger \"%s\" on %s: %s%s", trigger, path, strerror(errno),
+				  errno == EINVAL && pressure_monitor->window_us % 2000000 != 0
+				  ? " (without CAP_SYS_RESOURCE window must be multiple of 2000 ms)" : "");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void close_triggers(pressure_monitor_t pressure_monitor) {
+	for (int i = 0; i < pressure_monitor->triggers_count; i++) {
+		close(pressure_monitor->triggers[i].fd);
+	}
+	free(pressure_monitor->triggers);
+	pressure_monitor->triggers = NULL;
+	pressure_monitor->triggers_count = 0;
+}
+
+int pressure_start(monitor_t monitor) {
+	if (monitor_transition(monitor, MONITOR_STATE_INITIALIZED,
+						   MONITOR_STATE_RUNNING) != CALL_SUCCESS) {
+		log_error("cannot start monitor wich is not in \'initialized\' state");
+		return E_MONITOR_INVALID_STATE;
+	}
+	pressure_monitor_t pressure_monitor = monitor->pressure;
+	pressure_monitor->triggers = (struct pressure_trigger*)calloc(
+			pressure_monitor->directories_count * PRESSURE_RESOURCES_COUNT,
+			sizeof(struct pressure_trigger));
+	if (pressure_monitor->triggers == NULL) {
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
+		return E_OUT_OF_MEMORY;
+	}
+	// resources without controller in cgroup are skipped
+	for (int i = 0; i < pressure_monitor->directories_count; i++) {
+		for (int resource = 0; resource < PRESSURE_RESOURCES_COUNT; resource++) {
+			if (!(pressure_monitor->resources & (1 << resource))) continue;
+			int fd = open_trigger(pressure_monitor, pressure_monitor->directories[i],
+								  resource_names[resource]);
+			if (fd < 0) continue;
+			struct pressure_trigger* trigger =
+					&pressure_monitor->triggers[pressure_monitor->triggers_count++];
+			trigger->monitor = monitor;
+			trigger->fd = fd;
+			trigger->directory = pressure_monitor->directories[i];
+			trigger->resource = resource_names[resource];
+		}
+	}
+	// all triggers share epoll set of ingestion engine
+	int count = pressure_monitor->triggers_count;
+	atomic_store(&pressure_monitor->live_sources, count);
+	int added = 0;
+	while (added < count && ingest_add_priority(
+			pressure_monitor->triggers[added].fd, read_pressure, release_trigger,
+			&pressure_monitor->triggers[added],
+			&pressure_monitor->triggers[added].source) == CALL_SUCCESS) {
+		added++;
+	}
+	if (added == 0) {
+		close_triggers(pressure_monitor);
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
+		return CALL_FAILURE;
+	}
+	for (int i = added; i < count; i++) {
+		close(pressure_monitor->triggers[i].fd);
+	}
+	pressure_monitor->triggers_count = added;
+	atomic_fetch_sub(&pressure_monitor->live_sources, count - added);
+	log_info("pressure monitor was created, %d triggers \"%s %ld %ld\"", added,
+			 pressure_monitor->full ? "full" : "some",
+			 pressure_monitor->stall_us, pressure_monitor->window_us);
+	return CALL_SUCCESS;
+}
+
+int pressure_stop(monitor_t monitor) {
+	if (monitor_transition(monitor, MONITOR_STATE_RUNNING,
+						   MONITOR_STATE_DYING) != CALL_SUCCESS) {
+		return E_MONITOR_INVALID_STATE;
+	}
+	pressure_monitor_t pressure_monitor = monitor->pressure;
+	for (int i = 0; i < pressure_monitor->triggers_count; i++) {
+		ingest_remove(pressure_monitor->triggers[i].source);
+	}
+	return CALL_SUCCESS;
+}
+
+void pressure_join(monitor_t monitor) {
+	wait_monitor_dead(monitor);
+	log_info("pressure monitor was stopped");
+}
+
+void pressure_print_usage() {
+	printf("%s%s%s%s%s%s%s%s",
+		   "Aimed to warn about resource pressure (PSI) before OOM killer fires\n",
+		   "Usage: slm --pressure [options] [cgroup directory...]\n",
+		   "\t without directories system-wide pressure is watched\n",
+		   "\t --resource list - comma separated memory, cpu, io; all by default\n",
+		   "\t --full - report when all tasks stall, not some of them\n",
+		   "\t --stall ms - stall time which fires trigger, 150 by default\n",
+		   "\t --window ms - window of stall time, 1000 by default\n",
+		   "\t             (500..10000, unprivileged users need multiple of 2000)\n");
+}
+
+int pressure_monitor_destroy(monitor_t monitor) {
+	if (claim_monitor_for_destroy(monitor) != CALL_SUCCESS) {
+		return E_MONITOR_INVALID_STATE;
+	}
+	pressure_monitor_t pressure_monitor = monitor->pressure;
+	unsigned long fired = 0;
+	for (int i = 0; i < pressure_monitor->triggers_count; i++) {
+		fired += pressure_monitor->triggers[i].fired;
+	}
+	close_triggers(pressure_monitor);
+	log_info("pressure monitor was killed, triggers fired %lu times", fired);
+	release_object((struct pressure_monitor_object*)monitor);
+	return CALL_SUCCESS;
+}
+
+/*
+ * Picks avg10 and avg60 of "some" or "full" line, -1 if line is absent
+ */
+static void parse_averages(const char* text, const char* line, double* avg10, double* avg60) {
+	*avg10 = -1;
+	*avg60 = -1;
+	const char* start = strstr(text, line);
+	if (start == NULL) return;
+	char format[32];
+	snprintf(format, sizeof(format), "%s avg10=%%lf avg60=%%lf", line);
+	if (sscanf(start, format, avg10, avg60) != 2) {
+		*avg10 = -1;
+		*avg60 = -1;
+	}
+}
+
+/*
+ * Runs on engine thread when trigger fired, reads averages
+ * through the same descriptor
+ */
+static int read_pressure(void* trigger_ptr) {
+	struct pressure_trigger* trigger = (struct pressure_trigger*)trigger_ptr;
+	monitor_t monitor = trigger->monitor;
+	uint32_t index = (uint32_t)(trigger - monitor->pressure->triggers);
+	char text[PRESSURE_READ_SIZE];
+	ssize_t length = pread(trigger->fd, text, sizeof(text) - 1, 0);
+	if (length <= 0) {
+		// cgroup was removed, trigger will not fire any more
+		submit_monitor_event(monitor, process_event, PRESSURE_EVENT_GONE, index, NULL);
+		return INGEST_STOP;
+	}
+	text[length] = '\0';
+	trigger->fired++;
+	double some10, some60, full10, full60;
+	parse_averages(text, "some", &some10, &some60);
+	parse_averages(text, "full", &full10, &full60);
+	char report[MONITOR_EVENT_NAME_LENGTH];
+	int offset = snprintf(report, sizeof(report), "some avg10=%.2f avg60=%.2f",
+						  some10, some60);
+	if (full10 >= 0) {
+		snprintf(report + offset, sizeof(report) - offset, ", full avg10=%.2f avg60=%.2f",
+				 full10, full60);
+	}
+	submit_monitor_event(monitor, process_event, PRESSURE_EVENT_TRIGGER, index, report);
+	return INGEST_CONTINUE;
+}
+
+static void release_trigger(void* trigger_ptr) {
+	struct pressure_trigger* trigger = (struct pressure_trigger*)trigger_ptr;
+	if (atomic_fetch_sub(&trigger->monitor->pressure->live_sources, 1) == 1) {
+		mark_monitor_dead(trigger->monitor);
+	}
+}
+
+static void process_event(monitor_t monitor, struct monitor_event* event) {
+	const struct pressure_trigger* trigger = &monitor->pressure->triggers[event->value];
+	const char* where = strcmp(trigger->directory, SYSTEM_PRESSURE_DIRECTORY) == 0
+						? "system" : trigger->directory;
+	if (event->kind == PRESSURE_EVENT_TRIGGER) {
+		log_info("%s pressure of %s: %s", trigger->resource, where, event->name);
+	} else if (event->kind == PRESSURE_EVENT_GONE) {
+		log_error("%s pressure of %s cannot be read any more", trigger->resource, where);
+	}
+}
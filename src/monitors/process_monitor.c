@@ -0,0 +1,523 @@
+#define _GNU_SOURCE	// recvmmsg
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <linux/filter.h>
+
+#include <monitors/monitor.h>
+#include <logging/logging.h>
+#include "errors.h"
+#include "monitor_alloc.h"
+#include "ingest.h"
+
+#define OPTION_COMM 'c'
+#define OPTION_CGROUP 'g'
+
+#define PROCESS_RECEIVE_BUFFER	(8 << 20)
+#define PROCESS_BATCH			64
+#define PROCESS_MESSAGE_SIZE	256
+
+// proc_event follows netlink and connector headers in every message
+#define EVENT_OFFSET			(NLMSG_LENGTH(0) + sizeof(struct cn_msg))
+#define EVENT_DATA_OFFSET		(EVENT_OFFSET + offsetof(struct proc_event, event_data))
+#define FORK_PID_OFFSET			(EVENT_DATA_OFFSET + offsetof(struct fork_proc_event, child_pid))
+#define FORK_TGID_OFFSET		(EVENT_DATA_OFFSET + offsetof(struct fork_proc_event, child_tgid))
+#define EXIT_PID_OFFSET			(EVENT_DATA_OFFSET + offsetof(struct exit_proc_event, process_pid))
+#define EXIT_TGID_OFFSET		(EVENT_DATA_OFFSET + offsetof(struct exit_proc_event, process_tgid))
+
+// htonl is not constant expression
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define NETWORK_ORDER(value)	__builtin_bswap32(value)
+#else
+#define NETWORK_ORDER(value)	(value)
+#endif
+
+static int read_events(void* monitor_ptr);
+static void release_monitor(void* monitor_ptr);
+static void process_event(monitor_t monitor, struct monitor_event* event);
+
+struct process_monitor_object {
+	struct monitor_t monitor;
+	struct process_monitor process;
+};
+
+struct monitor_slab process_monitor_slab =
+		MONITOR_SLAB_INITIALIZER(struct process_monitor_object);
+
+static const struct monitor_ops process_ops = {
+	process_start, process_stop, process_join, process_monitor_destroy, NULL, NULL
+};
+
+/*
+ * Kernel drops everything but fork, exec and exit before it is queued:
+ * uid/gid/sid/comm/ptrace changes and thread creation and exit (pid of
+ * thread differs from its tgid) never reach socket buffer. Absolute loads
+ * are big-endian, so event types are compared in network order.
+ */
+static struct sock_filter event_filter[] = {
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, EVENT_OFFSET),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, NETWORK_ORDER(PROC_EVENT_FORK), 3, 0),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, NETWORK_ORDER(PROC_EVENT_EXIT), 6, 0),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, NETWORK_ORDER(PROC_EVENT_EXEC), 10, 0),
+	BPF_STMT(BPF_RET | BPF_K, 0),
+	// fork: child_pid == child_tgid
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, FORK_TGID_OFFSET),
+	BPF_STMT(BPF_MISC | BPF_TAX, 0),
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, FORK_PID_OFFSET),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_X, 0, 5, 4),
+	// exit: process_pid == process_tgid
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, EXIT_TGID_OFFSET),
+	BPF_STMT(BPF_MISC | BPF_TAX, 0),
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, EXIT_PID_OFFSET),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_X, 0, 1, 0),
+	BPF_STMT(BPF_RET | BPF_K, 0),
+	BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+};
+
+int process_attach_filter(int fd) {
+	struct sock_fprog program = {
+		sizeof(event_filter) / sizeof(event_filter[0]), event_filter
+	};
+	return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) == 0
+		   ? CALL_SUCCESS : CALL_FAILURE;
+}
+
+int process_monitor_from_args(int argc, char* argv[], monitor_t* monitor) {
+	struct process_monitor_object* object =
+			(struct process_monitor_object*)slab_alloc(&process_monitor_slab);
+	if (object == NULL) {
+		log_error("slab_alloc: %s", strerror(errno));
+		return E_OUT_OF_MEMORY;
+	}
+	*monitor = &object->monitor;
+	(*monitor)->type = MONITOR_TYPE_PROCESS;
+	(*monitor)->ops = &process_ops;
+	(*monitor)->process = &object->process;
+	process_monitor_t process_monitor = (*monitor)->process;
+	process_monitor->socket_fd = -1;
+	process_monitor->newest = -1;
+	process_monitor->oldest = -1;
+	memset(process_monitor->buckets, 0xff, sizeof(process_monitor->buckets));
+
+	static struct option long_options[] = {
+		{"comm", required_argument, 0, OPTION_COMM},
+		{"cgroup", required_argument, 0, OPTION_CGROUP},
+		{NULL, 0, 0, 0}
+	};
+	opterr = 0;
+	optind = 1;
+	int c;
+	while ((c = getopt_long(argc, argv, "+", long_options, NULL)) != -1) {
+		switch (c) {
+			case OPTION_COMM: {
+				strncpy(process_monitor->comm_filter, optarg, PROCESS_COMM_LENGTH - 1);
+				break;
+			}
+			case OPTION_CGROUP: {
+				process_monitor->cgroup_filter = intern_path(optarg);
+				if (process_monitor->cgroup_filter == NULL) {
+					log_error("path is too long: %s", optarg);
+					slab_free(&process_monitor_slab, object);
+					return E_INVALID_MONITOR_ARGUMENT;
+				}
+				break;
+			}
+			case '?':
+			default: {
+				slab_free(&process_monitor_slab, object);
+				return E_INVALID_MONITOR_ARGUMENT;
+			}
+		}
+	}
+	if (argc != optind) {
+		slab_free(&process_monitor_slab, object);
+		return E_INVALID_MONITOR_ARGUMENT;
+	}
+	atomic_init(&(*monitor)->state, MONITOR_STATE_INITIALIZED);
+	return CALL_SUCCESS;
+}
+
+/*
+ * Subscribes socket to process events or cancels subscription
+ */
+static int send_control(int fd, enum proc_cn_mcast_op operation) {
+	struct {
+		struct nlmsghdr header;
+		struct cn_msg message;
+		enum proc_cn_mcast_op operation;
+	} __attribute__((packed)) request;
+	memset(&request, 0, sizeof(request));
+	request.header.nlmsg_len = sizeof(request);
+	request.header.nlmsg_type = NLMSG_DONE;
+	request.message.id.idx = CN_IDX_PROC;
+	request.message.id.val = CN_VAL_PROC;
+	request.message.len = sizeof(enum proc_cn_mcast_op);
+	request.operation = operation;
+	return send(fd, &request, sizeof(request), 0) < 0 ? CALL_FAILURE : CALL_SUCCESS;
+}
+
+int process_start(monitor_t monitor) {
+	if (monitor_transition(monitor, MONITOR_STATE_INITIALIZED,
+						   MONITOR_STATE_RUNNING) != CALL_SUCCESS) {
+		log_error("cannot start monitor wich is not in \'initialized\' state");
+		return E_MONITOR_INVALID_STATE;
+	}
+	process_monitor_t process_monitor = monitor->process;
+	int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+	if (fd < 0) {
+		log_error("proc connector socket: %s", strerror(errno));
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
+		return CALL_FAILURE;
+	}
+	// fork storms of build hosts are absorbed by buffer, FORCE works for root only
+	int buffer_size = PROCESS_RECEIVE_BUFFER;
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &buffer_size, sizeof(buffer_size)) != 0) {
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+	}
+	if (process_attach_filter(fd) != CALL_SUCCESS) {
+		log_error("proc connector filter: %s", strerror(errno));
+	}
+
+	struct sockaddr_nl address;
+	memset(&address, 0, sizeof(address));
+	address.nl_family = AF_NETLINK;
+	address.nl_groups = CN_IDX_PROC;
+	if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0
+		|| send_control(fd, PROC_CN_MCAST_LISTEN) != CALL_SUCCESS) {
+		log_error("proc connector subscription: %s", strerror(errno));
+		close(fd);
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
+		return CALL_FAILURE;
+	}
+	process_monitor->socket_fd = fd;
+	if (ingest_add_ready(fd, read_events, release_monitor, monitor,
+						 &process_monitor->source) != CALL_SUCCESS) {
+		close(fd);
+		process_monitor->socket_fd = -1;
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
+		return CALL_FAILURE;
+	}
+	log_info("process monitor was created");
+	return CALL_SUCCESS;
+}
+
+int process_stop(monitor_t monitor) {
+	if (monitor_transition(monitor, MONITOR_STATE_RUNNING,
+						   MONITOR_STATE_DYING) != CALL_SUCCESS) {
+		return E_MONITOR_INVALID_STATE;
+	}
+	ingest_remove(monitor->process->source);
+	return CALL_SUCCESS;
+}
+
+void process_join(monitor_t monitor) {
+	wait_monitor_dead(monitor);
+	log_info("process monitor was stopped");
+}
+
+void process_print_usage() {
+	printf("%s%s%s%s%s",
+		   "Aimed to monitor process starts, executions and exits (requires root)\n",
+		   "Usage: slm --process [options]\n",
+		   "\t --comm name - only processes with that name\n",
+		   "\t --cgroup path - only processes in cgroup v2 path or below it,\n",
+		   "\t                 e.g. /system.slice\n");
+}
+
+int process_monitor_destroy(monitor_t monitor) {
+	if (claim_monitor_for_destroy(monitor) != CALL_SUCCESS) {
+		return E_MONITOR_INVALID_STATE;
+	}
+	process_monitor_t process_monitor = monitor->process;
+	if (process_monitor->overruns > 0) {
+		log_error("proc connector socket overran %lu times, process events were lost",
+				  process_monitor->overruns);
+	}
+	if (process_monitor->socket_fd >= 0) {
+		send_control(process_monitor->socket_fd, PROC_CN_MCAST_IGNORE);
+		close(process_monitor->socket_fd);
+	}
+	log_info("process monitor was killed after %lu events", process_monitor->received);
+	slab_free(&process_monitor_slab, monitor);
+	return CALL_SUCCESS;
+}
+
+static void submit_process_event(monitor_t monitor, uint32_t kind, pid_t pid, int detail) {
+	char text[16];
+	snprintf(text, sizeof(text), "%d", detail);
+	submit_monitor_event(monitor, process_event, kind, (uint32_t)pid, text);
+}
+
+int process_decode(const char* data, size_t length, struct process_message* decoded) {
+	memset(decoded, 0, sizeof(struct process_message));
+	if (length < EVENT_DATA_OFFSET) return CALL_FAILURE;
+	struct cn_msg message;
+	memcpy(&message, data + NLMSG_LENGTH(0), sizeof(message));
+	if (message.id.idx != CN_IDX_PROC || message.id.val != CN_VAL_PROC) return CALL_FAILURE;
+	struct proc_event event;
+	memset(&event, 0, sizeof(event));
+	// data holds 64-bit timestamp only 4-byte aligned
+	size_t event_length = length - EVENT_OFFSET;
+	memcpy(&event, data + EVENT_OFFSET,
+		   event_length < sizeof(event) ? event_length : sizeof(event));
+	switch (event.what) {
+		case PROC_EVENT_FORK: {
+			decoded->kind = PROCESS_EVENT_FORK;
+			decoded->pid = event.event_data.fork.child_tgid;
+			decoded->detail = event.event_data.fork.parent_tgid;
+			break;
+		}
+		case PROC_EVENT_EXEC: {
+			decoded->kind = PROCESS_EVENT_EXEC;
+			decoded->pid = event.event_data.exec.process_tgid;
+			break;
+		}
+		case PROC_EVENT_EXIT: {
+			decoded->kind = PROCESS_EVENT_EXIT;
+			decoded->pid = event.event_data.exit.process_tgid;
+			decoded->detail = (int)event.event_data.exit.exit_code;
+			break;
+		}
+		default: {}
+	}
+	return CALL_SUCCESS;
+}
+
+static void decode_message(monitor_t monitor, const char* data, size_t length) {
+	struct process_message decoded;
+	if (process_decode(data, length, &decoded) != CALL_SUCCESS) return;
+	monitor->process->received++;
+	if (decoded.kind != 0) {
+		submit_process_event(monitor, decoded.kind, decoded.pid, decoded.detail);
+	}
+}
+
+/*
+ * Runs on engine thread, drains socket in batches of messages
+ */
+static int read_events(void* monitor_ptr) {
+	monitor_t monitor = (monitor_t)monitor_ptr;
+	process_monitor_t process_monitor = monitor->process;
+	char buffers[PROCESS_BATCH][PROCESS_MESSAGE_SIZE] __attribute__((aligned(8)));
+	struct iovec vectors[PROCESS_BATCH];
+	struct mmsghdr messages[PROCESS_BATCH];
+	memset(messages, 0, sizeof(messages));
+	for (int i = 0; i < PROCESS_BATCH; i++) {
+		vectors[i].iov_base = buffers[i];
+		vectors[i].iov_len = PROCESS_MESSAGE_SIZE;
+		messages[i].msg_hdr.msg_iov = &vectors[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+	}
+	while (1) {
+		int count = recvmmsg(process_monitor->socket_fd, messages, PROCESS_BATCH,
+							 MSG_DONTWAIT, NULL);
+		if (count < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return INGEST_CONTINUE;
+			if (errno == ENOBUFS) {
+				// messages were lost, socket stays subscribed
+				process_monitor->overruns++;
+				submit_monitor_event(monitor, process_event, PROCESS_EVENT_OVERRUN, 0, NULL);
+				continue;
+			}
+			log_error("proc connector read: %s", strerror(errno));
+			// if stop won the race, it has already removed the source
+			if (monitor_transition(monitor, MONITOR_STATE_RUNNING,
+								   MONITOR_STATE_DYING) == CALL_SUCCESS) {
+				ingest_remove(process_monitor->source);
+			}
+			return INGEST_STOP;
+		}
+		for (int i = 0; i < count; i++) {
+			decode_message(monitor, buffers[i], messages[i].msg_len);
+		}
+		if (count < PROCESS_BATCH) return INGEST_CONTINUE;
+	}
+}
+
+static void release_monitor(void* monitor_ptr) {
+	mark_monitor_dead((monitor_t)monitor_ptr);
+}
+
+static void cache_unlink(process_monitor_t process_monitor, int index) {
+	struct process_entry* entry = &process_monitor->cache[index];
+	if (entry->newer >= 0) {
+		process_monitor->cache[entry->newer].older = entry->older;
+	} else {
+		process_monitor->newest = entry->older;
+	}
+	if (entry->older >= 0) {
+		process_monitor->cache[entry->older].newer = entry->newer;
+	} else {
+		process_monitor->oldest = entry->newer;
+	}
+}
+
+static void cache_push(process_monitor_t process_monitor, int index, int newest) {
+	struct process_entry* entry = &process_monitor->cache[index];
+	if (newest) {
+		entry->newer = -1;
+		entry->older = process_monitor->newest;
+		if (process_monitor->newest >= 0) process_monitor->cache[process_monitor->newest].newer = index;
+		process_monitor->newest = index;
+		if (process_monitor->oldest < 0) process_monitor->oldest = index;
+	} else {
+		entry->older = -1;
+		entry->newer = process_monitor->oldest;
+		if (process_monitor->oldest >= 0) process_monitor->cache[process_monitor->oldest].older = index;
+		process_monitor->oldest = index;
+		if (process_monitor->newest < 0) process_monitor->newest = index;
+	}
+}
+
+static void cache_unhash(process_monitor_t process_monitor, int index) {
+	int* link = &process_monitor->buckets[process_monitor->cache[index].pid
+										  & (PROCESS_CACHE_SIZE - 1)];
+	while (*link >= 0 && *link != index) link = &process_monitor->cache[*link].next;
+	if (*link == index) *link = process_monitor->cache[index].next;
+}
+
+static struct process_entry* cache_find(process_monitor_t process_monitor, pid_t pid) {
+	int index = process_monitor->buckets[pid & (PROCESS_CACHE_SIZE - 1)];
+	while (index >= 0 && process_monitor->cache[index].pid != pid) {
+		index = process_monitor->cache[index].next;
+	}
+	if (index < 0) return NULL;
+	cache_unlink(process_monitor, index);
+	cache_push(process_monitor, index, 1);
+	return &process_monitor->cache[index];
+}
+
+/*
+ * Frees entry of exited process, it is reused first
+ */
+static void cache_remove(process_monitor_t process_monitor, struct process_entry* entry) {
+	int index = (int)(entry - process_monitor->cache);
+	cache_unhash(process_monitor, index);
+	cache_unlink(process_monitor, index);
+	entry->pid = 0;
+	cache_push(process_monitor, index, 0);
+}
+
+static int read_proc_file(pid_t pid, const char* file, char* buffer, size_t size) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/%s", pid, file);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return -1;
+	ssize_t length = read(fd, buffer, size - 1);
+	close(fd);
+	if (length <= 0) return -1;
+	buffer[length] = '\0';
+	return (int)length;
+}
+
+/*
+ * Checks cgroup v2 path of process ("0::/path" line) is filter or below it
+ */
+static int cgroup_matches(pid_t pid, const char* filter) {
+	char cgroups[4096];
+	if (read_proc_file(pid, "cgroup", cgroups, sizeof(cgroups)) < 0) return 0;
+	char* line = strstr(cgroups, "0::");
+	if (line == NULL || (line != cgroups && line[-1] != '\n')) return 0;
+	line += 3;
+	size_t length = strlen(filter);
+	if (length > 1 && filter[length - 1] == '/') length--;
+	return strncmp(line, filter, length) == 0
+		   && (line[length] == '\n' || line[length] == '/' || line[length] == '\0'
+			   || length == 1);
+}
+
+/*
+ * Reads name of process into cache, NULL if process is already gone
+ */
+static struct process_entry* cache_load(process_monitor_t process_monitor, pid_t pid) {
+	char comm[PROCESS_COMM_LENGTH + 1];
+	int length = read_proc_file(pid, "comm", comm, sizeof(comm));
+	if (length < 0) return NULL;
+	if (comm[length - 1] == '\n') comm[length - 1] = '\0';
+	struct process_entry* entry = cache_find(process_monitor, pid);
+	if (entry == NULL) {
+		int index;
+		if (process_monitor->cached < PROCESS_CACHE_SIZE) {
+			index = process_monitor->cached++;
+		} else {
+			index = process_monitor->oldest;
+			if (process_monitor->cache[index].pid != 0) cache_unhash(process_monitor, index);
+			cache_unlink(process_monitor, index);
+		}
+		entry = &process_monitor->cache[index];
+		entry->pid = pid;
+		int* bucket = &process_monitor->buckets[pid & (PROCESS_CACHE_SIZE - 1)];
+		entry->next = *bucket;
+		*bucket = index;
+		cache_push(process_monitor, index, 1);
+	}
+	strncpy(entry->comm, comm, PROCESS_COMM_LENGTH - 1);
+	entry->comm[PROCESS_COMM_LENGTH - 1] = '\0';
+	entry->matches = (process_monitor->comm_filter[0] == '\0'
+					  || strcmp(entry->comm, process_monitor->comm_filter) == 0)
+					 && (process_monitor->cgroup_filter == NULL
+						 || cgroup_matches(pid, process_monitor->cgroup_filter));
+	return entry;
+}
+
+/*
+ * Enriches event with process name and applies filters, runs on pipeline
+ * worker. Unknown processes (gone before their name was read) are reported
+ * only when no filter is set.
+ */
+static void process_event(monitor_t monitor, struct monitor_event* event) {
+	process_monitor_t process_monitor = monitor->process;
+	int filtered = process_monitor->comm_filter[0] != '\0'
+				   || process_monitor->cgroup_filter != NULL;
+	pid_t pid = (pid_t)event->value;
+	int detail = (int)strtol(event->name, NULL, 10);
+	struct process_entry* entry = NULL;
+	switch (event->kind) {
+		case PROCESS_EVENT_FORK: {
+			// child has name of parent until it executes something
+			entry = cache_find(process_monitor, detail);
+			if (entry == NULL) entry = cache_load(process_monitor, detail);
+			if (entry == NULL ? filtered : !entry->matches) return;
+			log_info("process %d started by %d (%s)", pid, detail,
+					 entry != NULL ? entry->comm : "?");
+			break;
+		}
+		case PROCESS_EVENT_EXEC: {
+			entry = cache_load(process_monitor, pid);
+			if (entry == NULL ? filtered : !entry->matches) return;
+			log_info("process %d executed %s", pid, entry != NULL ? entry->comm : "?");
+			break;
+		}
+		case PROCESS_EVENT_EXIT: {
+			entry = cache_find(process_monitor, pid);
+			if (entry == NULL) entry = cache_load(process_monitor, pid);
+			if (entry == NULL ? filtered : !entry->matches) {
+				if (entry != NULL) cache_remove(process_monitor, entry);
+				return;
+			}
+			const char* comm = entry != NULL ? entry->comm : "?";
+			if ((detail & 0x7f) != 0) {
+				log_info("process %d (%s) was killed by signal %d", pid, comm, detail & 0x7f);
+			} else {
+				log_info("process %d (%s) exited with code %d", pid, comm, (detail >> 8) & 0xff);
+			}
+			if (entry != NULL) cache_remove(process_monitor, entry);
+			break;
+		}
+		case PROCESS_EVENT_OVERRUN: {
+			log_error("proc connector socket overrun, process events were lost");
+			break;
+		}
+		default: {}
+	}
+}
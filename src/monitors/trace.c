@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <monitors/monitor.h>
+#include <logging/logging.h>
+#include "errors.h"
+#include "monotonic.h"
+#include "trace.h"
+
+#define TRACE_ALIGNMENT		8
+#define TRACE_PADDING(length)	((TRACE_ALIGNMENT - (length) % TRACE_ALIGNMENT) % TRACE_ALIGNMENT)
+
+atomic_int trace_recording = 0;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE* trace_file = NULL;
+static long trace_started_ns;
+static unsigned long records_written;
+static atomic_int replay_stopped = 0;
+
+int trace_record_start(const char* path, monitor_t monitor) {
+	FILE* file = fopen(path, "we");
+	if (file == NULL) {
+		log_error("cannot create trace %s: %s", path, strerror(errno));
+		return CALL_FAILURE;
+	}
+	struct trace_header header = { TRACE_MAGIC, TRACE_VERSION, (uint32_t)monitor->type, 0 };
+	if (fwrite(&header, sizeof(header), 1, file) != 1) {
+		log_error("cannot write trace %s: %s", path, strerror(errno));
+		fclose(file);
+		return CALL_FAILURE;
+	}
+	pthread_mutex_lock(&trace_lock);
+	trace_file = file;
+	trace_started_ns = monotonic_ns();
+	records_written = 0;
+	pthread_mutex_unlock(&trace_lock);
+	atomic_store(&trace_recording, 1);
+	return CALL_SUCCESS;
+}
+
+unsigned long trace_record_stop() {
+	atomic_store(&trace_recording, 0);
+	pthread_mutex_lock(&trace_lock);
+	unsigned long written = 0;
+	if (trace_file != NULL) {
+		if (fclose(trace_file) != 0) {
+			log_error("cannot write trace: %s", strerror(errno));
+		}
+		log_info("trace: %lu inputs recorded", records_written);
+		trace_file = NULL;
+		written = records_written;
+	}
+	pthread_mutex_unlock(&trace_lock);
+	return written;
+}
+
+void trace_write(uint32_t source, const struct iovec* parts, int parts_count) {
+	struct trace_record record;
+	record.source = source;
+	record.length = 0;
+	for (int i = 0; i < parts_count; i++) {
+		record.length += parts[i].iov_len;
+	}
+	static const char padding[TRACE_ALIGNMENT] = {0};
+
+	pthread_mutex_lock(&trace_lock);
+	if (trace_file == NULL) {
+		pthread_mutex_unlock(&trace_lock);
+		return;
+	}
+	record.time_ns = monotonic_ns() - trace_started_ns;
+	fwrite(&record, sizeof(record), 1, trace_file);
+	for (int i = 0; i < parts_count; i++) {
+		fwrite(parts[i].iov_base, 1, parts[i].iov_len, trace_file);
+	}
+	fwrite(padding, 1, TRACE_PADDING(record.length), trace_file);
+	records_written++;
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_replay_stop() {
+	atomic_store(&replay_stopped, 1);
+}
+
+/*
+ * Sleeps until record is due, relative to replay start
+ */
+static void wait_record_time(long started_ns, uint64_t time_ns) {
+	long due_ns = started_ns + (long)time_ns;
+	long now_ns = monotonic_ns();
+	if (due_ns <= now_ns) return;
+	struct timespec pause = { (due_ns - now_ns) / 1000000000L, (due_ns - now_ns) % 1000000000L };
+	nanosleep(&pause, NULL);
+}
+
+int trace_replay(const char* path, monitor_t monitor, int speed) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat file_stat;
+	if (fd < 0 || fstat(fd, &file_stat) != 0) {
+		log_error("cannot open trace %s: %s", path, strerror(errno));
+		if (fd >= 0) close(fd);
+		return CALL_FAILURE;
+	}
+	size_t size = (size_t)file_stat.st_size;
+	if (size < sizeof(struct trace_header)) {
+		log_error("%s is not a trace", path);
+		close(fd);
+		return CALL_FAILURE;
+	}
+	const char* data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		log_error("cannot map trace %s: %s", path, strerror(errno));
+		return CALL_FAILURE;
+	}
+	const struct trace_header* header = (const struct trace_header*)data;
+	if (header->magic != TRACE_MAGIC || header->version != TRACE_VERSION) {
+		log_error("%s is not a trace", path);
+		munmap((void*)data, size);
+		return CALL_FAILURE;
+	}
+	if (header->monitor_type != (uint32_t)monitor->type) {
+		log_error("trace %s was recorded by monitor of other type (%u)", path,
+				  header->monitor_type);
+		munmap((void*)data, size);
+		return E_INVALID_MONITOR_TYPE;
+	}
+
+	atomic_store(&replay_stopped, 0);
+	unsigned long replayed = 0;
+	size_t offset = sizeof(struct trace_header);
+	long started_ns = monotonic_ns();
+	int result = CALL_SUCCESS;
+	while (offset + sizeof(struct trace_record) <= size && !atomic_load(&replay_stopped)) {
+		const struct trace_record* record = (const struct trace_record*)(data + offset);
+		const char* payload = data + offset + sizeof(struct trace_record);
+		if (record->length > size - offset - sizeof(struct trace_record)) {
+			log_error("trace %s is truncated", path);
+			break;
+		}
+		if (speed == TRACE_REPLAY_ORIGINAL_SPEED) {
+			wait_record_time(started_ns, record->time_ns);
+		}
+		result = replay_monitor_input(monitor, record->source, payload, record->length);
+		if (result != CALL_SUCCESS) {
+			log_error("trace %s has input monitor cannot decode (source %u)", path,
+					  record->source);
+			break;
+		}
+		replayed++;
+		offset += sizeof(struct trace_record) + record->length + TRACE_PADDING(record->length);
+	}
+	drain_monitor_events(monitor);
+	long elapsed_ns = monotonic_ns() - started_ns;
+	log_info("trace: %lu inputs replayed in %.3f s, %.0f inputs/s, %.0f ns per input",
+			 replayed, elapsed_ns / 1e9,
+			 elapsed_ns > 0 ? replayed * 1e9 / elapsed_ns : 0.0,
+			 replayed > 0 ? (double)elapsed_ns / replayed : 0.0);
+	munmap((void*)data, size);
+	return result;
+}
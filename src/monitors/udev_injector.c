@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include <monitors/monitor.h>
+#include <logging/logging.h>
+#include "errors.h"
+#include "monotonic.h"
+#include "injector.h"
+
+// property lists as udev_datagram_source takes them, in pairs of opposite events
+static const char power_off[] = "ACTION=change\0SUBSYSTEM=power_supply\0"
+								"POWER_SUPPLY_STATUS=Discharging";
+static const char power_on[] = "ACTION=change\0SUBSYSTEM=power_supply\0"
+							   "POWER_SUPPLY_STATUS=Charging";
+static const char bluetooth_on[] = "ACTION=add\0SUBSYSTEM=bluetooth\0DEVTYPE=host";
+static const char bluetooth_off[] = "ACTION=remove\0SUBSYSTEM=bluetooth\0DEVTYPE=host";
+static const char disk_added[] = "ACTION=add\0SUBSYSTEM=block\0DEVTYPE=disk\0"
+								 "DEVNAME=/dev/sdz\0ID_MODEL=Injected_Disk\0ID_BUS=usb";
+static const char disk_removed[] = "ACTION=remove\0SUBSYSTEM=block\0DEVTYPE=disk\0"
+								   "DEVNAME=/dev/sdz";
+
+int udev_inject(monitor_t monitor, unsigned long count, int mode) {
+	const char* uevents[2] = { power_off, power_on };
+	size_t lengths[2] = { sizeof(power_off), sizeof(power_on) };
+	if (monitor->udev->type == UDEV_MONITOR_TYPE_BLUETOOTH) {
+		uevents[0] = bluetooth_on;
+		lengths[0] = sizeof(bluetooth_on);
+		uevents[1] = bluetooth_off;
+		lengths[1] = sizeof(bluetooth_off);
+	} else if (monitor->udev->type == UDEV_MONITOR_TYPE_DISKS) {
+		uevents[0] = disk_added;
+		lengths[0] = sizeof(disk_added);
+		uevents[1] = disk_removed;
+		lengths[1] = sizeof(disk_removed);
+	}
+
+	long* latencies = NULL;
+	if (mode == INJECT_LATENCY) {
+		latencies = (long*)malloc(count * sizeof(long));
+		if (latencies == NULL) return E_OUT_OF_MEMORY;
+	}
+
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0) {
+		log_error("socketpair: %s", strerror(errno));
+		free(latencies);
+		return CALL_FAILURE;
+	}
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+	if (udev_monitor_use_datagrams(monitor, fds[0]) != CALL_SUCCESS) {
+		close(fds[0]);
+		close(fds[1]);
+		free(latencies);
+		return E_MONITOR_INVALID_STATE;
+	}
+	if (start_monitor(monitor) != CALL_SUCCESS) {
+		close(fds[1]);
+		free(latencies);
+		return CALL_FAILURE;
+	}
+	int result = CALL_SUCCESS;
+	unsigned long handled = atomic_load(&monitor->events.handled);
+	long started_ns = monotonic_ns();
+	unsigned long sent = 0;
+	while (sent < count) {
+		long sent_ns = monotonic_ns();
+		// blocks while socket buffer is full, so producer cannot outrun monitor
+		if (send(fds[1], uevents[sent % 2], lengths[sent % 2], 0) < 0) {
+			if (errno == EINTR) continue;
+			log_error("uevent send: %s", strerror(errno));
+			break;
+		}
+		sent++;
+		if (latencies == NULL) continue;
+		handled++;
+		if (wait_monitor_handled(monitor, handled, INJECT_STALL_TIMEOUT * 1000) < handled) {
+			log_error("uevent %lu was not logged", sent);
+			result = CALL_FAILURE;
+			break;
+		}
+		latencies[sent - 1] = monotonic_ns() - sent_ns;
+	}
+	close(fds[1]);	// end of file stops monitor
+	join_monitor(monitor);
+	long elapsed_ns = monotonic_ns() - started_ns;
+	if (latencies != NULL) {
+		if (result == CALL_SUCCESS) log_inject_latency("uevents", latencies, sent);
+		free(latencies);
+	} else {
+		log_info("inject: %lu uevents in %.3f s, %.0f ns per event", sent,
+				 elapsed_ns / 1e9, sent > 0 ? (double)elapsed_ns / sent : 0.0);
+	}
+	return result;
+}
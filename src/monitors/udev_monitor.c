@@ -2,93 +2,173 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
-#include <pthread.h>
+#include <time.h>
 
 #include <monitors/monitor.h>
 #include <logging/logging.h>
 #include <errno.h>
-#include <sys/epoll.h>
 #include <libudev.h>
 #include "errors.h"
+#include "monotonic.h"
+#include "monitor_alloc.h"
+#include "ingest.h"
+#include "trace.h"
 
-#define EVENTS_COUNT_BUFFER 20
+#define UDEV_EVENT_POWER_STATUS	1
+#define UDEV_EVENT_ACTION		2
+#define UDEV_EVENT_DISK_ADDED	3
+#define UDEV_EVENT_DISK_REMOVED	4
+#define UDEV_EVENT_SNAPSHOT		5
 
+#define SECTOR_SIZE				512
 
-static void* monitoring_thread(void* udev_monitor_ptr);
-static void mark_dead(monitor_t monitor);
+
+static int receive_devices(void* monitor_ptr);
+static int read_datagram(void* monitor_ptr, const char* data, ssize_t length);
+static void submit_snapshot(monitor_t monitor);
+static void release_monitor(void* monitor_ptr);
+static void process_event(monitor_t monitor, struct monitor_event* event);
+
+struct udev_monitor_object {
+	struct monitor_t monitor;
+	struct z_udev_monitor udev;
+};
+
+struct monitor_slab udev_monitor_slab =
+		MONITOR_SLAB_INITIALIZER(struct udev_monitor_object);
+
+static const struct monitor_ops udev_ops = {
+	udev_start, udev_stop, udev_join, udev_monitor_destroy, udev_replay, udev_inject
+};
 
 int udev_monitor_from_args(int argc, char* argv[], monitor_t* monitor) {
 	if (argc > 1) return E_INVALID_MONITOR_ARGUMENT;
-	printf("her\n");
-	*monitor = (monitor_t)malloc(sizeof(struct monitor_t));
-	if (*monitor == NULL) {
-		log_error("malloc: %s", strerror(errno));
+	struct udev_monitor_object* object =
+			(struct udev_monitor_object*)slab_alloc(&udev_monitor_slab);
+	if (object == NULL) {
+		log_error("slab_alloc: %s", strerror(errno));
 		return E_OUT_OF_MEMORY;
 	}
+	*monitor = &object->monitor;
 	(*monitor)->type = MONITOR_TYPE_UDEV;
-
-	(*monitor)->udev = (udev_monitor_t)malloc(sizeof(struct z_udev_monitor));
-	if ((*monitor)->udev == NULL) {
-		log_error("malloc: %s", strerror(errno));
-		free(monitor);
-		return E_OUT_OF_MEMORY;
-	}
+	(*monitor)->ops = &udev_ops;
+	(*monitor)->udev = &object->udev;
 	udev_monitor_t udev_monitor = (*monitor)->udev;
-
-	if (pthread_mutex_init(&(udev_monitor->state_mutex), NULL) != 0) {
-		free(udev_monitor);
-		free((*monitor));
-		return CALL_FAILURE;
-	};
+	udev_monitor->source_ops = &udev_netlink_source;
+	udev_monitor->datagram_fd = -1;
 
 	if(strcmp(argv[0], "--power") == 0) {
 		udev_monitor->type = UDEV_MONITOR_TYPE_POWER;
 	} else if(strcmp(argv[0], "--bluetooth") == 0) {
 		udev_monitor->type = UDEV_MONITOR_TYPE_BLUETOOTH;
+	} else if(strcmp(argv[0], "--disks") == 0) {
+		udev_monitor->type = UDEV_MONITOR_TYPE_DISKS;
 	} else {
 		log_error("unknow udev monitor type %s", argv[0]);
-		free(udev_monitor);
-		free((*monitor));
+		slab_free(&udev_monitor_slab, object);
 		return E_INVALID_MONITOR_ARGUMENT;
 	}
 
-	pthread_mutex_lock(&(udev_monitor->state_mutex));
-	(*monitor)->state = MONITOR_STATE_INITIALIZED;
-	pthread_mutex_unlock(&(udev_monitor->state_mutex));
+	atomic_init(&(*monitor)->state, MONITOR_STATE_INITIALIZED);
 	return CALL_SUCCESS;
 }
 
 int udev_start(monitor_t monitor) {
-	pthread_mutex_lock(&(monitor->udev->state_mutex));
-	if (monitor->state != MONITOR_STATE_INITIALIZED) {
+	if (monitor_transition(monitor, MONITOR_STATE_INITIALIZED,
+						   MONITOR_STATE_RUNNING) != CALL_SUCCESS) {
 		log_error("cannot start monitor wich is not in \'initialized\' state");
-		pthread_mutex_unlock(&(monitor->udev->state_mutex));
 		return E_MONITOR_INVALID_STATE;
 	}
-	if (pthread_create(&(monitor->udev->thread),
-					   NULL, monitoring_thread, monitor) != 0) {
-		log_error("udev pthread_create: %s", strerror(errno));
-		pthread_mutex_unlock(&(monitor->udev->state_mutex));
+	if (monitor->udev->source_ops->open(monitor) != CALL_SUCCESS) {
+		monitor_transition(monitor, MONITOR_STATE_RUNNING, MONITOR_STATE_INITIALIZED);
+		return CALL_FAILURE;
+	}
+	log_info("udev monitor was created");
+	return CALL_SUCCESS;
+}
+
+int udev_monitor_use_datagrams(monitor_t monitor, int fd) {
+	if (monitor_state(monitor) != MONITOR_STATE_INITIALIZED) {
+		return E_MONITOR_INVALID_STATE;
+	}
+	monitor->udev->source_ops = &udev_datagram_source;
+	monitor->udev->datagram_fd = fd;
+	return CALL_SUCCESS;
+}
+
+static int open_netlink(monitor_t monitor) {
+	udev_monitor_t udev_monitor = monitor->udev;
+	udev_monitor->udev = udev_new();
+	if (!udev_monitor->udev) {
+		log_error("can not create udev struct, exit monitor\n");
+		return CALL_FAILURE;
+	}
+	udev_monitor->connection = udev_monitor_new_from_netlink(udev_monitor->udev, "udev");
+	if (udev_monitor->connection == NULL) {
+		log_error("can not create udev monitor, exit monitor\n");
+		udev_unref(udev_monitor->udev);
+		return CALL_FAILURE;
+	}
+	if(udev_monitor->type == UDEV_MONITOR_TYPE_POWER) {
+		udev_monitor_filter_add_match_subsystem_devtype(udev_monitor->connection,
+														"power_supply", NULL);
+	} else if(udev_monitor->type == UDEV_MONITOR_TYPE_BLUETOOTH) {
+		udev_monitor_filter_add_match_subsystem_devtype(udev_monitor->connection,
+														"bluetooth", NULL);
+	} else if(udev_monitor->type == UDEV_MONITOR_TYPE_DISKS) {
+		// loop, ram and dm devices have devtype disk too, they are skipped later
+		udev_monitor_filter_add_match_subsystem_devtype(udev_monitor->connection,
+														"block", "disk");
+		udev_monitor_filter_add_match_subsystem_devtype(udev_monitor->connection,
+														"block", "partition");
+		udev_monitor_set_receive_buffer_size(udev_monitor->connection,
+											 UDEV_DISKS_RECEIVE_BUFFER);
+	}
+	udev_monitor_enable_receiving(udev_monitor->connection);
+	// changes made during scan are already queued on socket and follow it
+	submit_snapshot(monitor);
+
+	// libudev receives by itself, engine only reports readiness
+	if (ingest_add_ready(udev_monitor_get_fd(udev_monitor->connection), receive_devices,
+						 release_monitor, monitor, &udev_monitor->source) != CALL_SUCCESS) {
+		drain_monitor_events(monitor);
+		udev_monitor_unref(udev_monitor->connection);
+		udev_unref(udev_monitor->udev);
 		return CALL_FAILURE;
 	}
-	monitor->state = MONITOR_STATE_RUNNING;
-	pthread_mutex_unlock(&(monitor->udev->state_mutex));
 	return CALL_SUCCESS;
 }
 
+static void close_netlink(monitor_t monitor) {
+	udev_monitor_unref(monitor->udev->connection);
+	udev_unref(monitor->udev->udev);
+}
+
+static int open_datagrams(monitor_t monitor) {
+	return ingest_add_read(monitor->udev->datagram_fd, read_datagram, release_monitor,
+						   monitor, &monitor->udev->source);
+}
+
+static void close_datagrams(monitor_t monitor) {
+	close(monitor->udev->datagram_fd);
+	monitor->udev->datagram_fd = -1;
+}
+
+const struct udev_source_ops udev_netlink_source = { open_netlink, close_netlink };
+
+const struct udev_source_ops udev_datagram_source = { open_datagrams, close_datagrams };
+
 int udev_stop(monitor_t monitor) {
-	pthread_mutex_lock(&(monitor->udev->state_mutex));
-	if (monitor->state != MONITOR_STATE_RUNNING) {
-		pthread_mutex_unlock(&(monitor->udev->state_mutex));
+	if (monitor_transition(monitor, MONITOR_STATE_RUNNING,
+						   MONITOR_STATE_DYING) != CALL_SUCCESS) {
 		return E_MONITOR_INVALID_STATE;
 	}
-	monitor->state = MONITOR_STATE_DYING;
-	pthread_mutex_unlock(&(monitor->udev->state_mutex));
+	ingest_remove(monitor->udev->source);
 	return CALL_SUCCESS;
 }
 
 void udev_join(monitor_t monitor) {
-	pthread_join(monitor->udev->thread, NULL);
+	wait_monitor_dead(monitor);
 	log_info("udev monitor was stopped");
 }
 
@@ -97,6 +177,11 @@ void udev_print_usage(int type) {
 		printf("%s%s",
 			   "Aimed to monitor blutooth events (bluetooth on/off)\n",
 			   "Usage: slm --bluetooth\n");
+	} else if (type == UDEV_MONITOR_TYPE_DISKS) {
+		printf("%s%s%s",
+			   "Aimed to monitor disks events (disk added/removed)\n",
+			   "straight from udev, without UDisks2\n",
+			   "Usage: slm --disks --backend=udev\n");
 	} else {
 		printf("%s%s",
 			   "Aimed to monitor power supply events (power on/off)\n",
@@ -104,123 +189,311 @@ void udev_print_usage(int type) {
 	}
 }
 
+static void print_power_usage() {
+	udev_print_usage(UDEV_MONITOR_TYPE_POWER);
+}
+
+static void print_bluetooth_usage() {
+	udev_print_usage(UDEV_MONITOR_TYPE_BLUETOOTH);
+}
+
+static void print_disks_usage() {
+	udev_print_usage(UDEV_MONITOR_TYPE_DISKS);
+}
+
+const struct monitor_backend slm_module_backends[] = {
+	{ "--power", "udev", 1, NULL, udev_monitor_from_args, print_power_usage,
+	  &udev_monitor_slab },
+	{ "--bluetooth", "udev", 1, NULL, udev_monitor_from_args, print_bluetooth_usage,
+	  &udev_monitor_slab },
+	{ "--disks", "udev", 0, NULL, udev_monitor_from_args, print_disks_usage,
+	  &udev_monitor_slab },
+	{ NULL }
+};
+
 int udev_monitor_destroy(monitor_t monitor) {
-	if (monitor->state == MONITOR_STATE_RUNNING
-		|| monitor->state == MONITOR_STATE_DYING) {
+	if (claim_monitor_for_destroy(monitor) != CALL_SUCCESS) {
 		return E_MONITOR_INVALID_STATE;
 	}
 	log_info("udev monitor was killed");
-	udev_monitor_t udev_monitor = monitor->udev;
-	free(udev_monitor);
-	free(monitor);
+	if (monitor->udev->datagram_fd >= 0) close(monitor->udev->datagram_fd);
+	slab_free(&udev_monitor_slab, monitor);
 	return CALL_SUCCESS;
 }
 
-static void* monitoring_thread(void* monitor_ptr) {
-	monitor_t monitor = (monitor_t)monitor_ptr;
-	udev_monitor_t udev_monitor = monitor->udev;
+static void format_size(unsigned long long bytes, char* buffer, size_t size) {
+	static const char* units[] = { "B", "KB", "MB", "GB", "TB" };
+	double value = (double)bytes;
+	int unit = 0;
+	while (value >= 1000 && unit < 4) {
+		value /= 1000;
+		unit++;
+	}
+	snprintf(buffer, size, "%.1f %s", value, units[unit]);
+}
 
-	log_info("udev monitor was created");
+/*
+ * Device as decoding sees it: received from udev or replayed from trace,
+ * where only its properties are kept
+ */
+struct uevent {
+	struct udev_device* device;		// NULL on replay
+	const char* properties;			// KEY=VALUE\0 list on replay
+	size_t length;
+};
 
-	sigset_t blocking_mask;
-	if (sigfillset(&blocking_mask) != 0) {
-		log_error("cannot create sigmask for udev thread, exit");
-		pthread_mutex_lock(&(udev_monitor->state_mutex));
-		monitor->state = MONITOR_STATE_DEAD;
-		pthread_mutex_unlock(&(udev_monitor->state_mutex));
-		return NULL;
+static const char* uevent_property(struct uevent* uevent, const char* key) {
+	if (uevent->device != NULL) {
+		return udev_device_get_property_value(uevent->device, key);
 	}
-	if (pthread_sigmask(SIG_BLOCK, &blocking_mask, NULL) != 0) {
-		log_error("cannot mask udev thread signals, exit");
-		pthread_mutex_lock(&(udev_monitor->state_mutex));
-		monitor->state = MONITOR_STATE_DEAD;
-		pthread_mutex_unlock(&(udev_monitor->state_mutex));
-		return NULL;
+	size_t key_length = strlen(key);
+	const char* end = uevent->properties + uevent->length;
+	for (const char* property = uevent->properties; property < end;
+		 property += strnlen(property, end - property) + 1) {
+		if (strncmp(property, key, key_length) == 0 && property[key_length] == '=') {
+			return property + key_length + 1;
+		}
 	}
+	return NULL;
+}
 
-	struct udev* udev;
-	struct udev_monitor* _udev_monitor;
+/*
+ * Sysfs attributes are not part of trace, they are unknown on replay
+ */
+static const char* uevent_sysattr(struct uevent* uevent, const char* name) {
+	return uevent->device != NULL ? udev_device_get_sysattr_value(uevent->device, name) : NULL;
+}
 
-	udev = udev_new();
-	if (!udev) {
-		log_error("can not create udev struct, exit monitor\n");
-		mark_dead(monitor);
-		return NULL;
+static void record_uevent(struct udev_device* device) {
+	struct iovec parts[3 * TRACE_UEVENT_MAX_PROPERTIES];
+	int count = 0;
+	struct udev_list_entry* entry;
+	udev_list_entry_foreach(entry, udev_device_get_properties_list_entry(device)) {
+		if (count == 3 * TRACE_UEVENT_MAX_PROPERTIES) break;
+		const char* name = udev_list_entry_get_name(entry);
+		const char* value = udev_list_entry_get_value(entry);
+		parts[count].iov_base = (void*)name;
+		parts[count++].iov_len = strlen(name);
+		parts[count].iov_base = (void*)"=";
+		parts[count++].iov_len = 1;
+		parts[count].iov_base = (void*)value;
+		parts[count++].iov_len = strlen(value) + 1;	// with terminating zero
 	}
+	trace_write(TRACE_SOURCE_UEVENT, parts, count);
+}
 
-	_udev_monitor = udev_monitor_new_from_netlink(udev, "udev");
+/*
+ * Describes block device from properties of uevent itself, so no request
+ * is made per device. Only size of whole disk is not among properties,
+ * it is read from sysfs attribute while device is there. Devices found
+ * by initial scan are passed with "add" action and initial flag.
+ */
+static void submit_disk(monitor_t monitor, struct uevent* device,
+						const char* action, int initial) {
+	const char* name = uevent_property(device, "DEVNAME");
+	if (action == NULL || name == NULL) return;
+	const char* base_name = strrchr(name, '/') != NULL ? strrchr(name, '/') + 1 : name;
+	if (strncmp(base_name, "loop", 4) == 0 || strncmp(base_name, "ram", 3) == 0
+		|| strncmp(base_name, "dm-", 3) == 0 || strncmp(base_name, "zram", 4) == 0) {
+		return;
+	}
+	const char* devtype = uevent_property(device, "DEVTYPE");
+	int is_partition = devtype != NULL && strcmp(devtype, "partition") == 0;
+	char text[MONITOR_EVENT_NAME_LENGTH];
+	if (strcmp(action, "remove") == 0) {
+		snprintf(text, sizeof(text), "%s %s", is_partition ? "Partition" : "Disk", base_name);
+		submit_monitor_event(monitor, process_event, UDEV_EVENT_DISK_REMOVED, 0, text);
+		return;
+	}
+	if (strcmp(action, "add") != 0) return;
+	const char* model = uevent_property(device, "ID_MODEL");
+	const char* bus = uevent_property(device, "ID_BUS");
+	unsigned long long bytes = 0;
+	const char* sectors = uevent_property(device, "ID_PART_ENTRY_SIZE");
+	if (sectors == NULL) sectors = uevent_sysattr(device, "size");
+	if (sectors != NULL) bytes = strtoull(sectors, NULL, 10) * SECTOR_SIZE;
+	char size[32] = "unknown size";
+	if (bytes > 0) format_size(bytes, size, sizeof(size));
+	if (is_partition) {
+		snprintf(text, sizeof(text), "Partition %s (%s) %s", base_name, size,
+				 initial ? "is present" : "has been added");
+	} else {
+		snprintf(text, sizeof(text), "Disk \'%s\' (%s, %s) %s via %s",
+				 model != NULL ? model : "unknown", base_name, size,
+				 initial ? "is connected" : "has been connected",
+				 bus != NULL ? bus : "unknown bus");
+	}
+	submit_monitor_event(monitor, process_event, UDEV_EVENT_DISK_ADDED, 0, text);
+}
+
+/*
+ * Reports change of device, runs on engine thread or on replaying thread
+ */
+static void decode_uevent(monitor_t monitor, struct uevent* device) {
+	udev_monitor_t udev_monitor = monitor->udev;
 	if(udev_monitor->type == UDEV_MONITOR_TYPE_POWER) {
-		udev_monitor_filter_add_match_subsystem_devtype(_udev_monitor, "power_supply", NULL);
+		const char* status = uevent_property(device, "POWER_SUPPLY_STATUS");
+		if (status != NULL) {
+			submit_monitor_event(monitor, process_event, UDEV_EVENT_POWER_STATUS, 0, status);
+		}
 	} else if(udev_monitor->type == UDEV_MONITOR_TYPE_BLUETOOTH) {
-		udev_monitor_filter_add_match_subsystem_devtype(_udev_monitor, "bluetooth", NULL);
-	}
-	udev_monitor_enable_receiving(_udev_monitor);
-
-	int epoll_fd = epoll_create1(0);
-	if (epoll_fd < 0) {
-		log_error("can not create epoll fd, udev monitor exit\n");
-		mark_dead(monitor);
-		return NULL;
-	}
-
-	int udev_fd = udev_monitor_get_fd(_udev_monitor);
-	struct epoll_event ep_udev = {0};
-	ep_udev.events = EPOLLIN;
-	ep_udev.data.fd = udev_fd;
-	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, udev_fd, &ep_udev) < 0) {
-		log_error("can not add event to epoll, udev monitor exit\n");
-		mark_dead(monitor);
-		return NULL;
-	}
-
-	while (1) {
-		int events_count;
-		struct epoll_event events_buffer[EVENTS_COUNT_BUFFER];
-
-		events_count = epoll_wait(epoll_fd, events_buffer, EVENTS_COUNT_BUFFER, 500);
-		while (events_count == 0) {
-			pthread_mutex_lock(&(udev_monitor->state_mutex));
-			if (monitor->state == MONITOR_STATE_DYING) {
-				pthread_mutex_unlock(&(udev_monitor->state_mutex));
-				mark_dead(monitor);
-				close(epoll_fd);
-				close(udev_fd);
-				return NULL;
-			}
-			pthread_mutex_unlock(&(udev_monitor->state_mutex));
-			events_count = epoll_wait(epoll_fd, events_buffer, EVENTS_COUNT_BUFFER, 500);
+		const char* action = uevent_property(device, "ACTION");
+		if (action != NULL) {
+			submit_monitor_event(monitor, process_event, UDEV_EVENT_ACTION, 0, action);
+		}
+	} else if(udev_monitor->type == UDEV_MONITOR_TYPE_DISKS) {
+		submit_disk(monitor, device, uevent_property(device, "ACTION"), 0);
+	}
+}
+
+/*
+ * Drains netlink socket when it became readable, runs on engine thread
+ */
+static int receive_devices(void* monitor_ptr) {
+	monitor_t monitor = (monitor_t)monitor_ptr;
+	udev_monitor_t udev_monitor = monitor->udev;
+	struct udev_device* device;
+
+	while ((device = udev_monitor_receive_device(udev_monitor->connection)) != NULL) {
+		if (trace_is_recording()) {
+			record_uevent(device);
+		}
+		struct uevent uevent = { device, NULL, 0 };
+		decode_uevent(monitor, &uevent);
+		udev_device_unref(device);
+	}
+	return INGEST_CONTINUE;
+}
+
+/*
+ * Takes one KEY=VALUE\0 property list per datagram, runs on engine thread
+ */
+static int read_datagram(void* monitor_ptr, const char* data, ssize_t length) {
+	monitor_t monitor = (monitor_t)monitor_ptr;
+	if (length <= 0) {
+		if (length < 0) log_error("uevent datagram read: %s", strerror(-length));
+		// if stop won the race, it has already removed the source
+		if (monitor_transition(monitor, MONITOR_STATE_RUNNING,
+							   MONITOR_STATE_DYING) == CALL_SUCCESS) {
+			ingest_remove(monitor->udev->source);
 		}
+		return INGEST_STOP;
+	}
+	if (trace_is_recording()) {
+		struct iovec part = { (void*)data, (size_t)length };
+		trace_write(TRACE_SOURCE_UEVENT, &part, 1);
+	}
+	struct uevent uevent = { NULL, data, (size_t)length };
+	decode_uevent(monitor, &uevent);
+	return INGEST_CONTINUE;
+}
 
-		for (int i = 0; i < events_count; i++) {
-			if (events_buffer[i].data.fd == udev_fd && events_buffer[i].events & EPOLLIN) {
-				struct udev_device* power_device = udev_monitor_receive_device(_udev_monitor);
-				if (power_device == NULL)
-					continue;
-				if(udev_monitor->type == UDEV_MONITOR_TYPE_POWER) {
-					const char* status = udev_device_get_property_value(power_device, "POWER_SUPPLY_STATUS");
-					if (status != NULL) printf("%s\n", status);
-					if (status != NULL && strcmp(status, "Discharging") == 0) {
-						log_info("power supply off");
-					} else if (status != NULL) {
-						log_info("power supply on");
-					}
-				} else if(udev_monitor->type == UDEV_MONITOR_TYPE_BLUETOOTH) {
-					if (strcmp(udev_device_get_action(power_device), "add") == 0) {
-						log_info("bluetooth on");
-					} else if (strcmp(udev_device_get_action(power_device), "remove") == 0) {
-						log_info("bluetooth off");
-					}
-				}
-
-				udev_unref(udev);
+int udev_replay(monitor_t monitor, uint32_t source, const char* data, size_t length) {
+	if (source != TRACE_SOURCE_UEVENT) return CALL_FAILURE;
+	struct uevent uevent = { NULL, data, length };
+	decode_uevent(monitor, &uevent);
+	return CALL_SUCCESS;
+}
+
+/*
+ * Reports current state from one enumeration of monitored subsystem,
+ * properties come from udev database, no uevent is triggered
+ */
+static void submit_snapshot(monitor_t monitor) {
+	udev_monitor_t udev_monitor = monitor->udev;
+	long started = monotonic_us();
+	struct udev_enumerate* enumerate = udev_enumerate_new(udev_monitor->udev);
+	if (enumerate == NULL) {
+		log_error("can not create udev enumeration, no initial state");
+		return;
+	}
+	const char* subsystem = "power_supply";
+	if (udev_monitor->type == UDEV_MONITOR_TYPE_BLUETOOTH) {
+		subsystem = "bluetooth";
+	} else if (udev_monitor->type == UDEV_MONITOR_TYPE_DISKS) {
+		subsystem = "block";
+	}
+	udev_enumerate_add_match_subsystem(enumerate, subsystem);
+	if (udev_enumerate_scan_devices(enumerate) < 0) {
+		log_error("can not enumerate %s devices, no initial state", subsystem);
+		udev_enumerate_unref(enumerate);
+		return;
+	}
+
+	unsigned int devices_count = 0;
+	struct udev_list_entry* entry;
+	udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(enumerate)) {
+		devices_count++;
+		// bluetooth state is only whether any adapter exists
+		if (udev_monitor->type == UDEV_MONITOR_TYPE_BLUETOOTH) continue;
+		struct udev_device* device = udev_device_new_from_syspath(udev_monitor->udev,
+																  udev_list_entry_get_name(entry));
+		if (device == NULL) continue;	// removed meanwhile
+		if (udev_monitor->type == UDEV_MONITOR_TYPE_POWER) {
+			const char* status = udev_device_get_property_value(device, "POWER_SUPPLY_STATUS");
+			if (status != NULL) {
+				submit_monitor_event(monitor, process_event, UDEV_EVENT_POWER_STATUS, 0, status);
 			}
+		} else {
+			struct uevent uevent = { device, NULL, 0 };
+			submit_disk(monitor, &uevent, "add", 1);
 		}
+		udev_device_unref(device);
 	}
-	return NULL;
+	udev_enumerate_unref(enumerate);
+	if (udev_monitor->type == UDEV_MONITOR_TYPE_BLUETOOTH) {
+		submit_monitor_event(monitor, process_event, UDEV_EVENT_ACTION, 0,
+							 devices_count > 0 ? "add" : "remove");
+	}
+
+	char count[16];
+	snprintf(count, sizeof(count), "%u", devices_count);
+	submit_monitor_event(monitor, process_event, UDEV_EVENT_SNAPSHOT,
+						 (uint32_t)(monotonic_us() - started), count);
 }
 
-static void mark_dead(monitor_t monitor) {
-	pthread_mutex_lock(&(monitor->udev->state_mutex));
-	monitor->state = MONITOR_STATE_DEAD;
-	pthread_mutex_unlock(&(monitor->udev->state_mutex));
+static void release_monitor(void* monitor_ptr) {
+	monitor_t monitor = (monitor_t)monitor_ptr;
+	monitor->udev->source_ops->close(monitor);
+	mark_monitor_dead(monitor);
 }
+
+/*
+ * Reports event read on engine thread, runs on pipeline worker
+ */
+static void process_event(monitor_t monitor, struct monitor_event* event) {
+	switch (event->kind) {
+		case UDEV_EVENT_POWER_STATUS: {
+			log_trace("power supply status %s", event->name);
+			if (strcmp(event->name, "Discharging") == 0) {
+				log_info("power supply off");
+			} else {
+				log_info("power supply on");
+			}
+			break;
+		}
+		case UDEV_EVENT_ACTION: {
+			if (strcmp(event->name, "add") == 0) {
+				log_info("bluetooth on");
+			} else if (strcmp(event->name, "remove") == 0) {
+				log_info("bluetooth off");
+			}
+			break;
+		}
+		case UDEV_EVENT_DISK_ADDED: {
+			log_info("%s", event->name);
+			break;
+		}
+		case UDEV_EVENT_DISK_REMOVED: {
+			log_info("%s removed", event->name);
+			break;
+		}
+		case UDEV_EVENT_SNAPSHOT: {
+			log_info("initial state of %s udev devices read in %.2f ms",
+					 event->name, event->value / 1000.0);
+			break;
+		}
+		default: {}
+	}
+}
+
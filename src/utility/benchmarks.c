@@ -0,0 +1,1508 @@
+#define _GNU_SOURCE	// pipe2
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <errno.h>
+#include <sched.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <logging/logging.h>
+#include "errors.h"
+#include "monotonic.h"
+#include "path_filter.h"
+#include "monitor.h"
+#include "content_hash.h"
+#include "hot_files.h"
+#include "trace.h"
+#include "injector.h"
+#include "utility/benchmarks.h"
+
+#define LOG_DISABLED_CALLS 100000000UL
+#define LOG_COMPRESS_LINES 1000000UL
+#define FILTER_NAMES 1000000UL
+#define FILTER_DISTINCT_NAMES 1024
+#define FILTER_NAME_LENGTH 32
+#define LIFECYCLE_MONITORS 4000UL
+#define LIFECYCLE_THREADS 4
+// each monitor holds inotify instance, 128 per user by default
+#define LIFECYCLE_BATCH 64
+#define INGEST_SOURCES 2000UL
+#define INGEST_WRITES 1000000UL
+#define INGEST_MESSAGE_SIZE 32
+#define HASH_MEGABYTES 4096UL
+#define HASH_BUFFER_SIZE (1024 * 1024)
+#define CHURN_RENAMES 2000UL
+#define HOT_EVENTS 10000000UL
+#define HOT_PATHS 1000000UL
+#define HOT_TOP 20
+// "f" and up to 20 digits of unsigned long
+#define HOT_NAME_LENGTH 24
+#define REPLAY_WRITES 20000UL
+#define REPLAY_UEVENTS 2500UL
+#define MERGE_EVENTS 1000000UL
+#define MERGE_THREADS 4
+#define MOUNTINFO_MOUNTS 2000UL
+#define MOUNTINFO_PASSES 1000
+#define CONNECTOR_MESSAGES 1000000UL
+#define CONNECTOR_MESSAGE_SIZE 256
+#define CGROUP_DIRECTORIES 200UL
+#define CGROUP_ROUNDS 50UL
+#define CGROUP_SETTLE_NS 20000000L
+#define NETSTAT_SECONDS 5UL
+#define NETSTAT_INTERVAL_MS 100UL
+#define NETSTAT_MAX_CPU_PERCENT 1.0
+// time for engine thread to read last rename before final write
+#define CHURN_SETTLE_NS 100000000L
+
+struct benchmark {
+	const char* name;
+	const char* arguments;
+	const char* description;
+	int (*run)(int argc, char* argv[]);
+};
+
+static int log_disabled_benchmark(int argc, char* argv[]);
+static int log_compress_benchmark(int argc, char* argv[]);
+static int filter_benchmark(int argc, char* argv[]);
+static int lifecycle_benchmark(int argc, char* argv[]);
+static int ingest_benchmark(int argc, char* argv[]);
+static int hash_benchmark(int argc, char* argv[]);
+static int rename_churn_benchmark(int argc, char* argv[]);
+static int hot_files_benchmark(int argc, char* argv[]);
+static int replay_benchmark(int argc, char* argv[]);
+static int merge_benchmark(int argc, char* argv[]);
+static int mountinfo_benchmark(int argc, char* argv[]);
+static int connector_benchmark(int argc, char* argv[]);
+static int cgroup_churn_benchmark(int argc, char* argv[]);
+static int netstat_benchmark(int argc, char* argv[]);
+
+static const struct benchmark benchmarks[] = {
+	{ "log-disabled", "[calls]", "cost of disabled log calls against empty loop, checks"
+	  " their arguments are not evaluated", log_disabled_benchmark },
+	{ "log-compress", "[lines]", "cpu time and bytes of plain and stream compressed log",
+	  log_compress_benchmark },
+	{ "filter", "[names]", "--exclude match cost at 1, 100 and 1000 patterns, fnmatch loop"
+	  " for reference", filter_benchmark },
+	{ "lifecycle", "[monitors] [threads]", "starts monitors, stops half of them from"
+	  " threads while the rest die by themselves, checks all are destroyed",
+	  lifecycle_benchmark },
+	{ "ingest", "[sources] [writes]", "ingestion engine throughput with many read sources,"
+	  " io_uring and epoll when built with io_uring", ingest_benchmark },
+	{ "hash", "[megabytes]", "GB/s of content hash over 4 KiB blocks and 1 MiB buffers,"
+	  " checks XXH64 reference values", hash_benchmark },
+	{ "rename-churn", "[renames]", "replaces watched file by rename over and over, checks"
+	  " each replacement and write after the churn are reported", rename_churn_benchmark },
+	{ "hot-files", "[events] [paths]", "records zipf distributed paths with 400 and 160"
+	  " counters, compares top 20 with exact counts", hot_files_benchmark },
+	{ "replay", "[writes] [uevents]", "records file monitor trace of writes and udev disks"
+	  " trace of injected uevents, replays them as fast as possible", replay_benchmark },
+	{ "merge", "[events] [threads]", "threads submit events of their monitors to one worker,"
+	  " checks it handles them in order of stamps", merge_benchmark },
+	{ "mountinfo", "[mounts]", "checks mount table diff against fixture mountinfo passes,"
+	  " times passes over table of that many mounts", mountinfo_benchmark },
+	{ "proc-connector", "[messages]", "sends synthetic proc connector messages through"
+	  " process socket filter on socketpair, checks which pass and what is decoded",
+	  connector_benchmark },
+	{ "cgroup-churn", "[directories] [rounds]", "creates and removes directories under"
+	  " --cgroup monitor at random, checks its index still finds each watched one",
+	  cgroup_churn_benchmark },
+	{ "netstat", "[seconds] [interval_ms]", "runs --netstat sampler on interfaces of network"
+	  " namespace, checks it takes under 1% of one core and completes its dumps",
+	  netstat_benchmark },
+	{ NULL }
+};
+
+/*
+ * Takes positive count from argv[i], fallback if it is not given
+ */
+static unsigned long count_argument(int argc, char* argv[], int i, unsigned long fallback) {
+	if (i >= argc) return fallback;
+	unsigned long count = strtoul(argv[i], NULL, 10);
+	return count > 0 ? count : fallback;
+}
+
+static double cpu_seconds(const struct rusage* usage) {
+	return usage->ru_utime.tv_sec + usage->ru_stime.tv_sec
+		   + (usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) / 1e6;
+}
+
+/*
+ * Logs lines to path in child process, so its cpu time includes compressor
+ * thread and logging state of slm is left as it is
+ */
+static int log_lines_in_child(const char* path, int compressed, unsigned long count,
+							  struct rusage* usage, long* bytes) {
+	pid_t pid = fork();
+	if (pid < 0) return CALL_FAILURE;
+	if (pid == 0) {
+		if (set_log_files(path, NULL) != CALL_SUCCESS
+			|| set_log_stream_compression(compressed) != CALL_SUCCESS) {
+			_exit(EXIT_FAILURE);
+		}
+		for (unsigned long i = 0; i < count; i++) {
+			log_info("file /var/lib/slm/data/%lu.db was modified by process %lu",
+					 i % 4096, 1000 + i % 37);
+		}
+		destroy_logging();
+		_exit(EXIT_SUCCESS);
+	}
+	int status;
+	if (wait4(pid, &status, 0, usage) != pid
+		|| !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+		return CALL_FAILURE;
+	}
+	struct stat file_stat;
+	if (stat(path, &file_stat) != 0) return CALL_FAILURE;
+	*bytes = file_stat.st_size;
+	return CALL_SUCCESS;
+}
+
+static unsigned long arguments_evaluated = 0;
+
+static unsigned long benchmark_argument(unsigned long i) {
+	arguments_evaluated++;
+	return i * 2;
+}
+
+/*
+ * Times disabled debug calls against empty loop, compiler barrier makes
+ * each call load level again. Arguments must not be evaluated.
+ */
+static int log_disabled_benchmark(int argc, char* argv[]) {
+	unsigned long count = count_argument(argc, argv, 0, LOG_DISABLED_CALLS);
+	int level = atomic_load(&log_level);
+	atomic_store(&log_level, LOG_LEVEL_INFO);
+	long started_ns = monotonic_ns();
+	for (unsigned long i = 0; i < count; i++) {
+		__asm__ volatile("" ::: "memory");
+	}
+	long empty_ns = monotonic_ns() - started_ns;
+	started_ns = monotonic_ns();
+	for (unsigned long i = 0; i < count; i++) {
+		log_debug("benchmark call %lu of %lu", benchmark_argument(i), count);
+		__asm__ volatile("" ::: "memory");
+	}
+	long disabled_ns = monotonic_ns() - started_ns;
+	atomic_store(&log_level, level);
+	log_info("log-disabled: %lu calls, %.2f ns per call, %.2f ns per empty iteration,"
+			 " arguments evaluated %lu times", count, (double)disabled_ns / count,
+			 (double)empty_ns / count, arguments_evaluated);
+	return arguments_evaluated == 0 ? CALL_SUCCESS : CALL_FAILURE;
+}
+
+static int log_compress_benchmark(int argc, char* argv[]) {
+	unsigned long count = count_argument(argc, argv, 0, LOG_COMPRESS_LINES);
+	char path[] = "/tmp/slm-logbench-XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) return CALL_FAILURE;
+	close(fd);
+	int result = CALL_SUCCESS;
+	for (int compressed = 0; compressed <= 1 && result == CALL_SUCCESS; compressed++) {
+		struct rusage usage;
+		long bytes = 0;
+		unlink(path);
+		long started_ns = monotonic_ns();
+		result = log_lines_in_child(path, compressed, count, &usage, &bytes);
+		long elapsed_ns = monotonic_ns() - started_ns;
+		if (result != CALL_SUCCESS) {
+			log_error("log-compress: %s logging failed%s", compressed ? "compressed" : "plain",
+					  compressed ? ", slm may be built without zlib" : "");
+			break;
+		}
+		log_info("log-compress: %s, %lu lines, %.3f s cpu, %.3f s elapsed, %ld bytes,"
+				 " %.1f bytes per line", compressed ? "compressed" : "plain", count,
+				 cpu_seconds(&usage), elapsed_ns / 1e9, bytes, (double)bytes / count);
+	}
+	unlink(path);
+	return result;
+}
+
+/*
+ * Pattern i of a set: suffix, prefix and literal ones in turn, as given
+ * to --exclude
+ */
+static void filter_pattern(int i, char* pattern, size_t size) {
+	if (i % 3 == 0) {
+		snprintf(pattern, size, "*.x%d", i);
+	} else if (i % 3 == 1) {
+		snprintf(pattern, size, "cache%d*", i);
+	} else {
+		snprintf(pattern, size, "lock%d", i);
+	}
+}
+
+static int fnmatch_accepts(char patterns[][FILTER_NAME_LENGTH], int count, const char* name) {
+	for (int i = 0; i < count; i++) {
+		if (fnmatch(patterns[i], name, 0) == 0) return 0;
+	}
+	return 1;
+}
+
+/*
+ * Names hit all three kinds of patterns, and miss them. fnmatch loop runs
+ * over fewer names as it gets slow, its results must match filter.
+ */
+static int filter_benchmark(int argc, char* argv[]) {
+	static const int sizes[] = { 1, 100, 1000 };
+	static char names[FILTER_DISTINCT_NAMES][FILTER_NAME_LENGTH];
+	static char patterns[1000][FILTER_NAME_LENGTH];
+	unsigned long count = count_argument(argc, argv, 0, FILTER_NAMES);
+	for (int i = 0; i < FILTER_DISTINCT_NAMES; i++) {
+		const char* formats[] = { "data%d.x%d", "cache%d-%d.tmp", "lock%d", "file%d.log%d" };
+		snprintf(names[i], FILTER_NAME_LENGTH, formats[i % 4], i / 4 % 1100, i);
+	}
+	for (size_t size = 0; size < sizeof(sizes) / sizeof(sizes[0]); size++) {
+		int patterns_count = sizes[size];
+		path_filter_t filter = path_filter_new();
+		for (int i = 0; i < patterns_count && filter != NULL; i++) {
+			filter_pattern(i, patterns[i], FILTER_NAME_LENGTH);
+			if (path_filter_add(filter, patterns[i], 1) != CALL_SUCCESS) {
+				path_filter_destroy(filter);
+				filter = NULL;
+			}
+		}
+		if (filter == NULL) return E_OUT_OF_MEMORY;
+
+		unsigned long accepted = 0;
+		long started_ns = monotonic_ns();
+		for (unsigned long i = 0; i < count; i++) {
+			accepted += path_filter_accepts(filter, names[i % FILTER_DISTINCT_NAMES]);
+		}
+		long filter_ns = monotonic_ns() - started_ns;
+
+		unsigned long reference_count = count / patterns_count;
+		if (reference_count < FILTER_DISTINCT_NAMES) reference_count = FILTER_DISTINCT_NAMES;
+		static int expected[FILTER_DISTINCT_NAMES];
+		started_ns = monotonic_ns();
+		for (unsigned long i = 0; i < reference_count; i++) {
+			expected[i % FILTER_DISTINCT_NAMES] =
+					fnmatch_accepts(patterns, patterns_count, names[i % FILTER_DISTINCT_NAMES]);
+		}
+		long reference_ns = monotonic_ns() - started_ns;
+		int mismatches = 0;
+		for (int i = 0; i < FILTER_DISTINCT_NAMES; i++) {
+			if (expected[i] != path_filter_accepts(filter, names[i])) mismatches++;
+		}
+		path_filter_destroy(filter);
+		log_info("filter: %d patterns, %.1f ns per name, %lu of %lu accepted,"
+				 " fnmatch loop %.1f ns per name", patterns_count, (double)filter_ns / count,
+				 accepted, count, (double)reference_ns / reference_count);
+		if (mismatches > 0) {
+			log_error("filter: %d patterns, %d names judged unlike fnmatch",
+					  patterns_count, mismatches);
+			return CALL_FAILURE;
+		}
+	}
+	return CALL_SUCCESS;
+}
+
+struct lifecycle_batch {
+	monitor_t monitors[LIFECYCLE_BATCH];
+	int count;
+	int threads;
+	atomic_int failures;
+	atomic_int died_first;
+};
+
+struct lifecycle_thread {
+	struct lifecycle_batch* batch;
+	int index;
+};
+
+/*
+ * Even monitors of the thread are stopped, odd ones are left to die when
+ * their directory is removed; stop may lose that race too
+ */
+static void* lifecycle_thread(void* arg) {
+	struct lifecycle_thread* thread = (struct lifecycle_thread*)arg;
+	struct lifecycle_batch* batch = thread->batch;
+	for (int i = thread->index; i < batch->count; i += batch->threads) {
+		if (i % 2 == 0 && stop_monitor(batch->monitors[i]) != CALL_SUCCESS) {
+			atomic_fetch_add(&batch->died_first, 1);
+		}
+		join_monitor(batch->monitors[i]);
+		if (destroy_monitor(batch->monitors[i]) != CALL_SUCCESS) {
+			atomic_fetch_add(&batch->failures, 1);
+		}
+	}
+	return NULL;
+}
+
+static int lifecycle_round(struct lifecycle_batch* batch, int threads_count) {
+	char directory[] = "/tmp/slm-lifecycle-XXXXXX";
+	char path[sizeof(directory) + 8];
+	batch->count = 0;
+	if (mkdtemp(directory) == NULL) return CALL_FAILURE;
+	snprintf(path, sizeof(path), "%s/file", directory);
+	FILE* file = fopen(path, "w");
+	if (file != NULL) fclose(file);
+
+	int result = file != NULL ? CALL_SUCCESS : CALL_FAILURE;
+	char* argv[] = { "--file", "-w", path, NULL };
+	batch->threads = threads_count;
+	for (batch->count = 0; batch->count < LIFECYCLE_BATCH && result == CALL_SUCCESS;
+		 batch->count++) {
+		monitor_t* monitor = &batch->monitors[batch->count];
+		if (monitor_from_args(3, argv, monitor) != CALL_SUCCESS) {
+			result = CALL_FAILURE;
+			break;
+		}
+		if (start_monitor(*monitor) != CALL_SUCCESS) {
+			destroy_monitor(*monitor);
+			result = CALL_FAILURE;
+			break;
+		}
+	}
+	pthread_t threads[threads_count];
+	struct lifecycle_thread contexts[threads_count];
+	int created[threads_count];
+	for (int i = 0; i < threads_count; i++) {
+		contexts[i].batch = batch;
+		contexts[i].index = i;
+		created[i] = pthread_create(&threads[i], NULL, lifecycle_thread, &contexts[i]) == 0;
+	}
+	unlink(path);
+	rmdir(directory);
+	for (int i = 0; i < threads_count; i++) {
+		if (created[i]) {
+			pthread_join(threads[i], NULL);
+		} else {
+			lifecycle_thread(&contexts[i]);
+		}
+	}
+	return result;
+}
+
+/*
+ * Monitors are started in batches, and stopped by several threads while
+ * the engine thread kills the rest, which exercises stop, join and destroy
+ * against monitors dying by themselves
+ */
+static int lifecycle_benchmark(int argc, char* argv[]) {
+	unsigned long count = count_argument(argc, argv, 0, LIFECYCLE_MONITORS);
+	int threads_count = (int)count_argument(argc, argv, 1, LIFECYCLE_THREADS);
+	if (event_pipeline_start(1, EVENT_QUEUE_CAPACITY) != CALL_SUCCESS
+		|| ingest_start() != CALL_SUCCESS) {
+		event_pipeline_stop();
+		return CALL_FAILURE;
+	}
+	// monitors take level on parse, created and stopped ones are not logged
+	int level = atomic_load(&log_level);
+	atomic_store(&log_level, LOG_LEVEL_WARN);
+	struct lifecycle_batch batch;
+	atomic_init(&batch.failures, 0);
+	atomic_init(&batch.died_first, 0);
+	unsigned long done = 0;
+	int result = CALL_SUCCESS;
+	long started_ns = monotonic_ns();
+	while (done < count && result == CALL_SUCCESS) {
+		result = lifecycle_round(&batch, threads_count);
+		done += batch.count;
+	}
+	long elapsed_ns = monotonic_ns() - started_ns;
+	ingest_stop();
+	event_pipeline_stop();
+	atomic_store(&log_level, level);
+
+	struct monitor_memory_stats stats;
+	get_monitor_memory_stats(&stats);
+	int failures = atomic_load(&batch.failures);
+	log_info("lifecycle: %lu monitors by %d threads in %.2f s, %d stops lost to monitor"
+			 " dying first, %d destroys failed, %zu monitors left", done, threads_count,
+			 elapsed_ns / 1e9, atomic_load(&batch.died_first), failures, stats.monitors);
+	if (result != CALL_SUCCESS) log_error("lifecycle: cannot start monitors");
+	return result == CALL_SUCCESS && failures == 0 && stats.monitors == 0
+		   ? CALL_SUCCESS : CALL_FAILURE;
+}
+
+struct ingest_pipe {
+	int fds[2];
+	ingest_source_t source;
+};
+
+static atomic_ulong ingested_bytes;
+static atomic_ulong released_sources;
+
+static int count_ingested(void* context, const char* data, ssize_t length) {
+	if (length > 0) atomic_fetch_add_explicit(&ingested_bytes, length, memory_order_relaxed);
+	return INGEST_CONTINUE;
+}
+
+static void count_released(void* context) {
+	atomic_fetch_add(&released_sources, 1);
+}
+
+/*
+ * Writes messages round robin into pipes read by engine, until all bytes
+ * are delivered. Pipes stand for monitors: each read source costs engine
+ * the same, and inotify instances are limited to 128 per user.
+ */
+static int ingest_round(struct ingest_pipe* pipes, unsigned long sources_count,
+						unsigned long writes, const char** engine) {
+	if (ingest_start() != CALL_SUCCESS) return CALL_FAILURE;
+	*engine = ingest_engine_name();
+	atomic_store(&ingested_bytes, 0);
+	atomic_store(&released_sources, 0);
+	unsigned long added = 0;
+	for (; added < sources_count; added++) {
+		if (ingest_add_read(pipes[added].fds[0], count_ingested, count_released, NULL,
+							&pipes[added].source) != CALL_SUCCESS) {
+			break;
+		}
+	}
+	int result = added == sources_count ? CALL_SUCCESS : CALL_FAILURE;
+	char message[INGEST_MESSAGE_SIZE];
+	memset(message, 'e', sizeof(message));
+	struct rusage started_usage, usage;
+	getrusage(RUSAGE_SELF, &started_usage);
+	long started_ns = monotonic_ns();
+	unsigned long written = 0;
+	for (unsigned long i = 0; i < writes && result == CALL_SUCCESS; i++) {
+		if (write(pipes[i % sources_count].fds[1], message, sizeof(message))
+			== (ssize_t)sizeof(message)) {
+			written += sizeof(message);
+		}
+	}
+	while (result == CALL_SUCCESS && atomic_load(&ingested_bytes) < written) {
+		sched_yield();
+	}
+	long elapsed_ns = monotonic_ns() - started_ns;
+	getrusage(RUSAGE_SELF, &usage);
+	for (unsigned long i = 0; i < added; i++) {
+		ingest_remove(pipes[i].source);
+	}
+	while (atomic_load(&released_sources) < added) {
+		sched_yield();
+	}
+	ingest_stop();
+	if (result != CALL_SUCCESS) return result;
+	log_info("ingest: %s, %lu sources, %lu writes of %d bytes in %.3f s, %.0f ns and"
+			 " %.0f ns cpu per write", *engine, sources_count, writes, INGEST_MESSAGE_SIZE,
+			 elapsed_ns / 1e9, (double)elapsed_ns / writes,
+			 (cpu_seconds(&usage) - cpu_seconds(&started_usage)) * 1e9 / writes);
+	return CALL_SUCCESS;
+}
+
+static int ingest_benchmark(int argc, char* argv[]) {
+	unsigned long sources_count = count_argument(argc, argv, 0, INGEST_SOURCES);
+	unsigned long writes = count_argument(argc, argv, 1, INGEST_WRITES);
+	struct rlimit files;
+	if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < sources_count * 2 + 64) {
+		files.rlim_cur = files.rlim_max < sources_count * 2 + 64
+						 ? files.rlim_max : sources_count * 2 + 64;
+		setrlimit(RLIMIT_NOFILE, &files);
+		if (files.rlim_cur < sources_count * 2 + 64) {
+			sources_count = (files.rlim_cur - 64) / 2;
+			log_info("ingest: open files limit allows %lu sources", sources_count);
+		}
+	}
+	struct ingest_pipe* pipes = (struct ingest_pipe*)calloc(sources_count,
+														   sizeof(struct ingest_pipe));
+	if (pipes == NULL) return E_OUT_OF_MEMORY;
+	unsigned long opened = 0;
+	int result = CALL_SUCCESS;
+	for (; opened < sources_count && result == CALL_SUCCESS; opened++) {
+		// writes block if engine falls behind, reads do not
+		if (pipe2(pipes[opened].fds, O_CLOEXEC) != 0) {
+			log_error("ingest: pipe: %s", strerror(errno));
+			result = CALL_FAILURE;
+			break;
+		}
+		fcntl(pipes[opened].fds[0], F_SETFL, O_NONBLOCK);
+	}
+	const char* engine = "epoll";
+	if (result == CALL_SUCCESS) {
+		result = ingest_round(pipes, sources_count, writes, &engine);
+	}
+	if (result == CALL_SUCCESS && strcmp(engine, "epoll") != 0) {
+		// same sources again on epoll
+		setenv(INGEST_ENGINE_ENVIRONMENT, "epoll", 1);
+		result = ingest_round(pipes, sources_count, writes, &engine);
+		unsetenv(INGEST_ENGINE_ENVIRONMENT);
+	}
+	for (unsigned long i = 0; i < opened; i++) {
+		close(pipes[i].fds[0]);
+		close(pipes[i].fds[1]);
+	}
+	free(pipes);
+	return result;
+}
+
+/*
+ * Hashes buffer again and again in pieces of block size
+ */
+static double hash_throughput(const unsigned char* buffer, size_t block,
+							  unsigned long megabytes, uint64_t* sink) {
+	unsigned long rounds = megabytes * 1024 * 1024 / HASH_BUFFER_SIZE;
+	long started_ns = monotonic_ns();
+	for (unsigned long round = 0; round < rounds; round++) {
+		for (size_t offset = 0; offset < HASH_BUFFER_SIZE; offset += block) {
+			*sink ^= hash64(buffer + offset, block, round);
+		}
+	}
+	long elapsed_ns = monotonic_ns() - started_ns;
+	return (double)rounds * HASH_BUFFER_SIZE / elapsed_ns;
+}
+
+static int hash_benchmark(int argc, char* argv[]) {
+	unsigned long megabytes = count_argument(argc, argv, 0, HASH_MEGABYTES);
+	// reference values of XXH64
+	if (hash64("", 0, 0) != 0xef46db3751d8e999ULL
+		|| hash64("abc", 3, 0) != 0x44bc2cf5ad770999ULL) {
+		log_error("hash: hash64 does not match XXH64 reference values");
+		return CALL_FAILURE;
+	}
+	unsigned char* buffer = (unsigned char*)malloc(HASH_BUFFER_SIZE);
+	if (buffer == NULL) return E_OUT_OF_MEMORY;
+	uint64_t state = 88172645463325252ULL;
+	for (size_t i = 0; i < HASH_BUFFER_SIZE; i++) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		buffer[i] = (unsigned char)state;
+	}
+	uint64_t sink = 0;
+	double blocks = hash_throughput(buffer, CONTENT_BLOCK_SIZE, megabytes, &sink);
+	double whole = hash_throughput(buffer, HASH_BUFFER_SIZE, megabytes, &sink);
+	free(buffer);
+	log_info("hash: %lu MiB, %.2f GB/s in %d byte blocks, %.2f GB/s in %d byte buffers"
+			 " (%016llx)", megabytes, blocks, CONTENT_BLOCK_SIZE, whole, HASH_BUFFER_SIZE,
+			 (unsigned long long)sink);
+	return CALL_SUCCESS;
+}
+
+/*
+ * Replaces file at path by renames as fast as possible, then writes to
+ * the last one and removes directory, so the monitor dies after reading
+ * all events. Runs in child process, which logs to log_path.
+ */
+static int churn_in_child(const char* directory, const char* log_path, unsigned long renames) {
+	pid_t pid = fork();
+	if (pid < 0) return CALL_FAILURE;
+	if (pid > 0) {
+		int status;
+		return waitpid(pid, &status, 0) == pid && WIFEXITED(status)
+			   && WEXITSTATUS(status) == EXIT_SUCCESS ? CALL_SUCCESS : CALL_FAILURE;
+	}
+	char path[PATH_MAX];
+	char next[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/config", directory);
+	snprintf(next, sizeof(next), "%s/config.new", directory);
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || set_log_files(log_path, NULL) != CALL_SUCCESS) _exit(EXIT_FAILURE);
+	close(fd);
+
+	monitor_t monitor;
+	char* argv[] = { "--file", "-w", "-d", path, NULL };
+	if (event_pipeline_start(1, EVENT_QUEUE_CAPACITY) != CALL_SUCCESS
+		|| ingest_start() != CALL_SUCCESS
+		|| monitor_from_args(4, argv, &monitor) != CALL_SUCCESS) {
+		_exit(EXIT_FAILURE);
+	}
+	if (start_monitor(monitor) != CALL_SUCCESS) _exit(EXIT_FAILURE);
+	char content[32];
+	long started_ns = monotonic_ns();
+	for (unsigned long i = 0; i < renames; i++) {
+		int length = snprintf(content, sizeof(content), "generation %lu\n", i);
+		fd = open(next, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || write(fd, content, length) != length || close(fd) != 0
+			|| rename(next, path) != 0) {
+			_exit(EXIT_FAILURE);
+		}
+	}
+	long elapsed_ns = monotonic_ns() - started_ns;
+	struct timespec settle = { 0, CHURN_SETTLE_NS };
+	nanosleep(&settle, NULL);
+	fd = open(path, O_WRONLY | O_APPEND);
+	if (fd < 0 || write(fd, "final\n", 6) != 6) _exit(EXIT_FAILURE);
+	close(fd);
+	unlink(path);
+	rmdir(directory);
+	join_monitor(monitor);
+	destroy_monitor(monitor);
+	ingest_stop();
+	event_pipeline_stop();
+	log_info("rename-churn: %lu renames in %.3f s", renames, elapsed_ns / 1e9);
+	destroy_logging();
+	_exit(EXIT_SUCCESS);
+}
+
+/*
+ * Every rename over watched file must be reported as reappeared path,
+ * and write after the churn must reach file watched at the end
+ */
+static int rename_churn_benchmark(int argc, char* argv[]) {
+	unsigned long renames = count_argument(argc, argv, 0, CHURN_RENAMES);
+	char directory[] = "/tmp/slm-churn-XXXXXX";
+	char log_path[] = "/tmp/slm-churn-log-XXXXXX";
+	if (mkdtemp(directory) == NULL) return CALL_FAILURE;
+	int fd = mkstemp(log_path);
+	if (fd < 0) {
+		rmdir(directory);
+		return CALL_FAILURE;
+	}
+	close(fd);
+	int result = churn_in_child(directory, log_path, renames);
+
+	unsigned long reappeared = 0, modified = 0, overflows = 0;
+	FILE* log = fopen(log_path, "r");
+	char line[1024];
+	while (log != NULL && fgets(line, sizeof(line), log) != NULL) {
+		if (strstr(line, " reappeared, watching it again") != NULL) reappeared++;
+		if (strstr(line, "/config was modified") != NULL) modified++;
+		if (strstr(line, " overflowed, events were lost") != NULL) overflows++;
+		char* message = strstr(line, "]: ");
+		if (message != NULL && (strstr(message, "rename-churn: ") != NULL
+								|| strstr(message, " was re-armed ") != NULL)) {
+			message[strcspn(message, "\n")] = '\0';
+			log_info("%s", message + 3);
+		}
+	}
+	if (log != NULL) fclose(log);
+	unlink(log_path);
+	rmdir(directory);	// child left it if it failed
+
+	log_info("rename-churn: %lu of %lu replacements reported, final write %s,"
+			 " %lu queue overflows", reappeared, renames,
+			 modified == 1 ? "reported" : "lost", overflows);
+	if (result != CALL_SUCCESS) log_error("rename-churn: churn process failed");
+	return result == CALL_SUCCESS && reappeared == renames && modified == 1 && overflows == 0
+		   ? CALL_SUCCESS : CALL_FAILURE;
+}
+
+/*
+ * Same seed every run, so numbers of two builds come from the same stream
+ */
+static uint64_t next_random(uint64_t* state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1dULL;
+}
+
+/*
+ * Draws events from zipf distribution with s = 1 over paths ranks
+ * by binary search in its cumulative weights, counts each rank exactly
+ */
+static int zipf_events(uint32_t* events, unsigned long count, uint64_t* exact,
+					   unsigned long paths) {
+	double* cumulative = (double*)malloc(paths * sizeof(double));
+	if (cumulative == NULL) return E_OUT_OF_MEMORY;
+	double sum = 0;
+	for (unsigned long rank = 0; rank < paths; rank++) {
+		sum += 1.0 / (rank + 1);
+		cumulative[rank] = sum;
+	}
+	uint64_t state = 0x736c6d686f74ULL;
+	for (unsigned long i = 0; i < count; i++) {
+		double point = (next_random(&state) >> 11) * (1.0 / 9007199254740992.0) * sum;
+		unsigned long low = 0, high = paths - 1;
+		while (low < high) {
+			unsigned long middle = (low + high) / 2;
+			if (cumulative[middle] < point) {
+				low = middle + 1;
+			} else {
+				high = middle;
+			}
+		}
+		events[i] = (uint32_t)low;
+		exact[low]++;
+	}
+	free(cumulative);
+	return CALL_SUCCESS;
+}
+
+/*
+ * Ranks of count paths with highest exact counts, ties go to lower rank
+ */
+static void exact_top(const uint64_t* exact, unsigned long paths, unsigned long* top, int count) {
+	for (int i = 0; i < count; i++) {
+		unsigned long best = paths;
+		for (unsigned long rank = 0; rank < paths; rank++) {
+			if (best != paths && exact[rank] <= exact[best]) continue;
+			int taken = 0;
+			for (int j = 0; j < i && !taken; j++) taken = top[j] == rank;
+			if (!taken) best = rank;
+		}
+		top[i] = best;
+	}
+}
+
+/*
+ * Leading reported paths in true order tell how deep top list can be
+ * trusted; lower bound above exact count would break the guarantee
+ */
+static int hot_files_round(const uint32_t* events, unsigned long count, const uint64_t* exact,
+						   const unsigned long* truth, char names[][HOT_NAME_LENGTH],
+						   int capacity) {
+	if (hot_files_enable(capacity) != CALL_SUCCESS) return CALL_FAILURE;
+	long started_ns = monotonic_ns();
+	for (unsigned long i = 0; i < count; i++) {
+		hot_files_record("/var/lib/slm", names[events[i]]);
+	}
+	long elapsed_ns = monotonic_ns() - started_ns;
+	struct hot_file top[HOT_TOP];
+	int reported = HOT_TOP;
+	int result = hot_files_top(top, &reported);
+	hot_files_disable();
+	if (result != CALL_SUCCESS) return result;
+
+	int in_order = 0, exact_counts = 0, broken = 0;
+	uint64_t overcount = 0;
+	for (int i = 0; i < reported; i++) {
+		unsigned long rank = strtoul(top[i].name + 1, NULL, 10);
+		if (rank == truth[i] && in_order == i) in_order++;
+		if (top[i].count == exact[rank]) exact_counts++;
+		if (top[i].count - exact[rank] > overcount) overcount = top[i].count - exact[rank];
+		if (top[i].count - top[i].error > exact[rank] || top[i].count < exact[rank]) broken++;
+	}
+	log_info("hot-files: %d counters, %.2fM events/s, first %d of top %d in true order,"
+			 " %d counts exact, overcount %llu max, %d bounds broken", capacity,
+			 count * 1e3 / elapsed_ns, in_order, reported, exact_counts,
+			 (unsigned long long)overcount, broken);
+	return broken == 0 ? CALL_SUCCESS : CALL_FAILURE;
+}
+
+static int hot_files_benchmark(int argc, char* argv[]) {
+	unsigned long count = count_argument(argc, argv, 0, HOT_EVENTS);
+	unsigned long paths = count_argument(argc, argv, 1, HOT_PATHS);
+	if (paths < HOT_TOP) paths = HOT_TOP;
+	uint32_t* events = (uint32_t*)malloc(count * sizeof(uint32_t));
+	uint64_t* exact = (uint64_t*)calloc(paths, sizeof(uint64_t));
+	char (*names)[HOT_NAME_LENGTH] = malloc(paths * HOT_NAME_LENGTH);
+	unsigned long truth[HOT_TOP];
+	int result = events != NULL && exact != NULL && names != NULL
+				 ? zipf_events(events, count, exact, paths) : E_OUT_OF_MEMORY;
+	if (result == CALL_SUCCESS) {
+		for (unsigned long rank = 0; rank < paths; rank++) {
+			snprintf(names[rank], HOT_NAME_LENGTH, "f%lu", rank);
+		}
+		exact_top(exact, paths, truth, HOT_TOP);
+		log_info("hot-files: %lu zipf events (s = 1) over %lu paths", count, paths);
+		result = hot_files_round(events, count, exact, truth, names,
+								 HOT_TOP * HOT_FILES_CAPACITY_FACTOR);
+	}
+	if (result == CALL_SUCCESS) {
+		result = hot_files_round(events, count, exact, truth, names, HOT_TOP * 8);
+	}
+	free(events);
+	free(exact);
+	free(names);
+	return result;
+}
+
+/*
+ * Replays trace as fast as possible to new monitor made of same arguments,
+ * returns elapsed ns or -1
+ */
+static long replay_trace(const char* trace, int argc, char* argv[]) {
+	monitor_t monitor;
+	if (monitor_from_args(argc, argv, &monitor) != CALL_SUCCESS) return -1;
+	long started_ns = monotonic_ns();
+	int result = trace_replay(trace, monitor, TRACE_REPLAY_AS_FAST);
+	long elapsed_ns = monotonic_ns() - started_ns;
+	destroy_monitor(monitor);
+	return result == CALL_SUCCESS ? elapsed_ns : -1;
+}
+
+/*
+ * Records monitor of file while appending to it writes times, removing
+ * its directory at the end kills the monitor
+ */
+static int record_file_trace(const char* trace, const char* directory, char* argv[],
+							 unsigned long writes, unsigned long* inputs) {
+	monitor_t monitor;
+	const char* path = argv[2];
+	int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0 || monitor_from_args(3, argv, &monitor) != CALL_SUCCESS) {
+		if (fd >= 0) close(fd);
+		return CALL_FAILURE;
+	}
+	if (trace_record_start(trace, monitor) != CALL_SUCCESS
+		|| start_monitor(monitor) != CALL_SUCCESS) {
+		trace_record_stop();
+		close(fd);
+		destroy_monitor(monitor);
+		return CALL_FAILURE;
+	}
+	int result = CALL_SUCCESS;
+	for (unsigned long i = 0; i < writes && result == CALL_SUCCESS; i++) {
+		if (write(fd, "line appended by replay benchmark\n", 34) != 34) result = CALL_FAILURE;
+	}
+	close(fd);
+	unlink(path);
+	rmdir(directory);
+	join_monitor(monitor);
+	*inputs = trace_record_stop();
+	destroy_monitor(monitor);
+	return result;
+}
+
+/*
+ * Records traces of live monitors, then replays them with logging of
+ * events disabled, so replay time is decoding and dispatch. udev trace
+ * needs udev module, it is skipped without it.
+ */
+static int replay_benchmark(int argc, char* argv[]) {
+	unsigned long writes = count_argument(argc, argv, 0, REPLAY_WRITES);
+	unsigned long uevents = count_argument(argc, argv, 1, REPLAY_UEVENTS);
+	char directory[] = "/tmp/slm-replay-XXXXXX";
+	char trace[] = "/tmp/slm-replay-trace-XXXXXX";
+	if (mkdtemp(directory) == NULL) return CALL_FAILURE;
+	int fd = mkstemp(trace);
+	if (fd < 0) {
+		rmdir(directory);
+		return CALL_FAILURE;
+	}
+	close(fd);
+	char path[sizeof(directory) + 8];
+	snprintf(path, sizeof(path), "%s/file", directory);
+	char* file_argv[] = { "--file", "-w", path, NULL };
+	char* disks_argv[] = { "--disks", "--backend=udev", NULL };
+	if (event_pipeline_start(1, EVENT_QUEUE_CAPACITY) != CALL_SUCCESS
+		|| ingest_start() != CALL_SUCCESS) {
+		event_pipeline_stop();
+		unlink(trace);
+		rmdir(directory);
+		return CALL_FAILURE;
+	}
+	// monitors take level on parse, their events are not logged
+	int level = atomic_load(&log_level);
+	atomic_store(&log_level, LOG_LEVEL_WARN);
+	unsigned long file_inputs = 0;
+	int result = record_file_trace(trace, directory, file_argv, writes, &file_inputs);
+	long file_ns = result == CALL_SUCCESS ? replay_trace(trace, 3, file_argv) : -1;
+
+	monitor_t monitor;
+	long disks_ns = -1;
+	if (monitor_from_args(2, disks_argv, &monitor) == CALL_SUCCESS) {
+		if (trace_record_start(trace, monitor) == CALL_SUCCESS
+			&& inject_events(monitor, uevents, INJECT_THROUGHPUT) == CALL_SUCCESS) {
+			trace_record_stop();
+			disks_ns = replay_trace(trace, 2, disks_argv);
+		}
+		trace_record_stop();
+		destroy_monitor(monitor);
+	}
+	atomic_store(&log_level, level);
+	ingest_stop();
+	event_pipeline_stop();
+	unlink(trace);
+	rmdir(directory);	// left there if recording failed
+
+	if (file_ns < 0) {
+		log_error("replay: cannot record or replay file trace");
+		return CALL_FAILURE;
+	}
+	// inotify merges writes not read yet, inputs are reads and watch changes
+	log_info("replay: file trace of %lu writes, %lu inputs, replayed in %.2f ms,"
+			 " %.0f ns per input", writes, file_inputs, file_ns / 1e6,
+			 file_inputs > 0 ? (double)file_ns / file_inputs : 0.0);
+	if (disks_ns < 0) {
+		log_info("replay: udev disks trace skipped, udev module is not available");
+	} else {
+		log_info("replay: udev disks trace of %lu uevents, replayed in %.2f ms,"
+				 " %.0f ns per uevent", uevents, disks_ns / 1e6, (double)disks_ns / uevents);
+	}
+	return CALL_SUCCESS;
+}
+
+struct merge_thread {
+	monitor_t monitor;
+	unsigned long count;
+};
+
+// handled by the only worker
+static uint64_t merge_last_ns;
+static unsigned long merge_handled;
+static unsigned long merge_inversions;
+
+static void merge_handle(monitor_t monitor, struct monitor_event* event) {
+	if (event->time_ns < merge_last_ns) merge_inversions++;
+	merge_last_ns = event->time_ns;
+	merge_handled++;
+}
+
+static void* merge_thread(void* arg) {
+	struct merge_thread* thread = (struct merge_thread*)arg;
+	for (unsigned long i = 0; i < thread->count; i++) {
+		submit_monitor_event(thread->monitor, merge_handle, 0, (uint32_t)i, NULL);
+	}
+	return NULL;
+}
+
+/*
+ * Monitors are parsed but not started, events come from threads
+ * standing for their readers
+ */
+static int merge_benchmark(int argc, char* argv[]) {
+	unsigned long count = count_argument(argc, argv, 0, MERGE_EVENTS);
+	int threads_count = (int)count_argument(argc, argv, 1, MERGE_THREADS);
+	if (event_pipeline_start(1, EVENT_QUEUE_CAPACITY) != CALL_SUCCESS) return CALL_FAILURE;
+	struct merge_thread contexts[threads_count];
+	pthread_t threads[threads_count];
+	char* monitor_argv[] = { "--file", "-w", "/tmp", NULL };
+	int created = 0;
+	int result = CALL_SUCCESS;
+	merge_last_ns = 0;
+	merge_handled = 0;
+	merge_inversions = 0;
+	for (int i = 0; i < threads_count; i++) {
+		contexts[i].count = count / threads_count;
+		if (monitor_from_args(3, monitor_argv, &contexts[i].monitor) != CALL_SUCCESS) {
+			threads_count = i;
+			result = CALL_FAILURE;
+			break;
+		}
+	}
+	long started_ns = monotonic_ns();
+	for (; created < threads_count && result == CALL_SUCCESS; created++) {
+		if (pthread_create(&threads[created], NULL, merge_thread, &contexts[created]) != 0) {
+			result = CALL_FAILURE;
+			break;
+		}
+	}
+	for (int i = 0; i < created; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	for (int i = 0; i < threads_count; i++) {
+		drain_monitor_events(contexts[i].monitor);
+	}
+	long elapsed_ns = monotonic_ns() - started_ns;
+	event_pipeline_stop();
+	for (int i = 0; i < threads_count; i++) {
+		destroy_monitor(contexts[i].monitor);
+	}
+	if (result != CALL_SUCCESS) {
+		log_error("merge: cannot create monitors or threads");
+		return result;
+	}
+	log_info("merge: %lu events of %d threads in %.3f s, %.0f ns per event,"
+			 " %lu out of stamp order", merge_handled, threads_count, elapsed_ns / 1e9,
+			 merge_handled > 0 ? (double)elapsed_ns / merge_handled : 0.0, merge_inversions);
+	return merge_inversions == 0
+		   && merge_handled == count / threads_count * threads_count ? CALL_SUCCESS : CALL_FAILURE;
+}
+
+/*
+ * Fixture mountinfo passes, with number of events each must report and
+ * number of mounts left
+ */
+struct mountinfo_pass {
+	const char* text;
+	unsigned long events;
+	int count;
+};
+
+#define MOUNTINFO_BASE \
+	"21 1 0:19 / /proc rw,nosuid - proc proc rw\n" \
+	"22 1 8:1 / / rw,relatime shared:1 - ext4 /dev/sda1 rw,errors=remount-ro\n"
+
+static const struct mountinfo_pass mountinfo_passes[] = {
+	// baseline is not reported, escapes and optional fields are parsed
+	{ MOUNTINFO_BASE "23 22 0:45 / /mnt/with\\040space rw shared:2 master:1 - tmpfs"
+	  " my\\040tmp rw,size=1024k\n", 0, 3 },
+	{ MOUNTINFO_BASE "23 22 0:45 / /mnt/with\\040space rw shared:2 master:1 - tmpfs"
+	  " my\\040tmp rw,size=1024k\n40 22 0:50 / /mnt/data rw - tmpfs data rw\n", 1, 4 },
+	// remount
+	{ MOUNTINFO_BASE "23 22 0:45 / /mnt/with\\040space rw shared:2 master:1 - tmpfs"
+	  " my\\040tmp rw,size=1024k\n40 22 0:50 / /mnt/data ro - tmpfs data rw\n", 1, 4 },
+	// ID reused by other mount between passes is unmount and mount
+	{ MOUNTINFO_BASE "23 22 0:45 / /mnt/with\\040space rw shared:2 master:1 - tmpfs"
+	  " my\\040tmp rw,size=1024k\n40 22 0:51 / /mnt/other rw - tmpfs other rw\n", 2, 4 },
+	// lines without separator or fields are skipped, 23 and 40 are unmounted
+	{ MOUNTINFO_BASE "41 22 0:52 /\n42 22 0:53 / /mnt/x rw shared:3 tmpfs x rw\n", 2, 2 },
+	{ NULL }
+};
+
+static struct mount_entry* find_mount(monitor_t monitor, int id) {
+	for (int i = 0; i < monitor->mounts->count; i++) {
+		if (monitor->mounts->mounts[i].id == id) return &monitor->mounts->mounts[i];
+	}
+	return NULL;
+}
+
+/*
+ * Diffs copy of text, returns number of events reported
+ */
+static long mountinfo_pass(monitor_t monitor, const char* text, int report_changes) {
+	char* copy = strdup(text);
+	if (copy == NULL) return -1;
+	unsigned long handled = atomic_load(&monitor->events.handled);
+	int result = mounts_diff(monitor, copy, report_changes);
+	free(copy);
+	return result == CALL_SUCCESS ? (long)(atomic_load(&monitor->events.handled) - handled) : -1;
+}
+
+static int check_mountinfo_fixtures(monitor_t monitor) {
+	for (int i = 0; mountinfo_passes[i].text != NULL; i++) {
+		long events = mountinfo_pass(monitor, mountinfo_passes[i].text, i > 0);
+		if (events != (long)mountinfo_passes[i].events
+			|| monitor->mounts->count != mountinfo_passes[i].count) {
+			log_error("mountinfo: pass %d reported %ld events and left %d mounts,"
+					  " expected %lu and %d", i, events, monitor->mounts->count,
+					  mountinfo_passes[i].events, mountinfo_passes[i].count);
+			return CALL_FAILURE;
+		}
+		struct mount_entry* mount = find_mount(monitor, i < 4 ? 23 : 22);
+		struct mount_entry* reused = find_mount(monitor, 40);
+		if (mount == NULL || (i == 0 && (strcmp(mount->point, "/mnt/with space") != 0
+										 || strcmp(mount->source, "my tmp") != 0
+										 || strcmp(mount->options, "rw rw,size=1024k") != 0))
+			|| (i == 2 && (reused == NULL || strcmp(reused->options, "ro rw") != 0))
+			|| (i == 3 && (reused == NULL || strcmp(reused->point, "/mnt/other") != 0))
+			|| (i == 4 && (reused != NULL || find_mount(monitor, 21) == NULL))) {
+			log_error("mountinfo: pass %d left wrong mount table", i);
+			return CALL_FAILURE;
+		}
+	}
+	return CALL_SUCCESS;
+}
+
+/*
+ * Builds mountinfo of count mounts, skipping one of each skip ones
+ * (none when skip is 0)
+ */
+static char* synthetic_mountinfo(unsigned long count, unsigned long skip) {
+	size_t size = count * 96 + 1;
+	char* text = (char*)malloc(size);
+	if (text == NULL) return NULL;
+	size_t length = 0;
+	for (unsigned long i = 0; i < count; i++) {
+		if (skip > 0 && i % skip == 0) continue;
+		length += snprintf(text + length, size - length, "%lu 22 0:%lu / /srv/volume%lu"
+						   " rw,relatime shared:%lu - ext4 /dev/vd%lu rw\n",
+						   100 + i, 100 + i, i, 100 + i, i);
+	}
+	return text;
+}
+
+/*
+ * Mount table diff is checked against fixture passes, then timed over
+ * synthetic mountinfo: unchanged, one mount added and half removed
+ */
+static int mountinfo_benchmark(int argc, char* argv[]) {
+	unsigned long count = count_argument(argc, argv, 0, MOUNTINFO_MOUNTS);
+	char* monitor_argv[] = { "--mounts", NULL };
+	// events are handled in place as pipeline is not started, monitors take
+	// level on parse, so they are not logged
+	int level = atomic_load(&log_level);
+	atomic_store(&log_level, LOG_LEVEL_WARN);
+	monitor_t monitor;
+	int result = monitor_from_args(1, monitor_argv, &monitor);
+	if (result == CALL_SUCCESS) {
+		result = check_mountinfo_fixtures(monitor);
+		destroy_monitor(monitor);
+	}
+
+	char* table = synthetic_mountinfo(count, 0);
+	char* grown = synthetic_mountinfo(count + 1, 0);
+	char* halved = synthetic_mountinfo(count + 1, 2);
+	long unchanged_ns = 0;
+	long events[3] = { -1, -1, -1 };
+	if (result == CALL_SUCCESS && table != NULL && grown != NULL && halved != NULL
+		&& monitor_from_args(1, monitor_argv, &monitor) == CALL_SUCCESS) {
+		mountinfo_pass(monitor, table, 0);
+		long started_ns = monotonic_ns();
+		for (int i = 0; i < MOUNTINFO_PASSES; i++) {
+			events[0] = mountinfo_pass(monitor, table, 1);
+			if (events[0] != 0) break;
+		}
+		unchanged_ns = (monotonic_ns() - started_ns) / MOUNTINFO_PASSES;
+		events[1] = mountinfo_pass(monitor, grown, 1);
+		events[2] = mountinfo_pass(monitor, halved, 1);
+		// index rebuilt after removal still finds every mount
+		if (mountinfo_pass(monitor, halved, 1) != 0
+			|| monitor->mounts->count != (int)((count + 1) / 2)) {
+			events[2] = -1;
+		}
+		destroy_monitor(monitor);
+	}
+	atomic_store(&log_level, level);
+	free(table);
+	free(grown);
+	free(halved);
+	if (result != CALL_SUCCESS) return result;
+	if (events[0] != 0 || events[1] != 1 || events[2] != (long)((count + 2) / 2)) {
+		log_error("mountinfo: synthetic passes reported %ld, %ld and %ld events,"
+				  " expected 0, 1 and %lu", events[0], events[1], events[2], (count + 2) / 2);
+		return CALL_FAILURE;
+	}
+	log_info("mountinfo: fixtures passed, %lu mounts diffed in %.1f us, %.0f ns per line",
+			 count, unchanged_ns / 1e3, (double)unchanged_ns / count);
+	return CALL_SUCCESS;
+}
+
+/*
+ * Synthetic proc connector messages, whether process socket filter must
+ * pass them and what must be decoded from passed ones (0 if decoding fails)
+ */
+struct connector_case {
+	uint32_t what;
+	pid_t pid;
+	pid_t tgid;
+	int detail;				// parent of fork, exit code
+	uint32_t idx;
+	size_t data_length;		// bytes of proc_event sent, 0 for all
+	int passes;
+	uint32_t kind;
+};
+
+static const struct connector_case connector_cases[] = {
+	{ PROC_EVENT_FORK, 200, 200, 100, CN_IDX_PROC, 0, 1, PROCESS_EVENT_FORK },
+	{ PROC_EVENT_FORK, 201, 200, 100, CN_IDX_PROC, 0, 0, 0 },		// thread
+	{ PROC_EVENT_EXEC, 200, 200, 0, CN_IDX_PROC, 0, 1, PROCESS_EVENT_EXEC },
+	{ PROC_EVENT_UID, 200, 200, 0, CN_IDX_PROC, 0, 0, 0 },
+	{ PROC_EVENT_COMM, 200, 200, 0, CN_IDX_PROC, 0, 0, 0 },
+	{ PROC_EVENT_EXIT, 201, 200, 0, CN_IDX_PROC, 0, 0, 0 },		// thread
+	{ PROC_EVENT_EXIT, 200, 200, 9 << 8, CN_IDX_PROC, 0, 1, PROCESS_EVENT_EXIT },
+	{ PROC_EVENT_EXIT, 300, 300, 9, CN_IDX_PROC, 0, 1, PROCESS_EVENT_EXIT },
+	// filter looks at event type only, other connector is rejected by decoding
+	{ PROC_EVENT_FORK, 400, 400, 1, CN_IDX_PROC + 1, 0, 1, 0 },
+	// exec is passed without loading its data, decoding rejects it as short
+	{ PROC_EVENT_EXEC, 200, 200, 0, CN_IDX_PROC, 8, 1, 0 },
+	// load of child pids beyond end of message drops it
+	{ PROC_EVENT_FORK, 200, 200, 100, CN_IDX_PROC, 24, 0, 0 },
+};
+
+#define CONNECTOR_CASES (sizeof(connector_cases) / sizeof(connector_cases[0]))
+#define CONNECTOR_EVENT_OFFSET (NLMSG_LENGTH(0) + sizeof(struct cn_msg))
+
+/*
+ * Lays out netlink header, connector header and proc_event as kernel does,
+ * with case index in connector sequence number
+ */
+static size_t connector_message(uint32_t index, char* buffer) {
+	const struct connector_case* test = &connector_cases[index];
+	struct proc_event event;
+	memset(&event, 0, sizeof(event));
+	event.what = test->what;
+	if (test->what == PROC_EVENT_FORK) {
+		event.event_data.fork.parent_pid = test->detail;
+		event.event_data.fork.parent_tgid = test->detail;
+		event.event_data.fork.child_pid = test->pid;
+		event.event_data.fork.child_tgid = test->tgid;
+	} else if (test->what == PROC_EVENT_EXIT) {
+		event.event_data.exit.process_pid = test->pid;
+		event.event_data.exit.process_tgid = test->tgid;
+		event.event_data.exit.exit_code = test->detail;
+	} else {
+		event.event_data.exec.process_pid = test->pid;
+		event.event_data.exec.process_tgid = test->tgid;
+	}
+	size_t data_length = test->data_length > 0 ? test->data_length : sizeof(event);
+	struct cn_msg message;
+	memset(&message, 0, sizeof(message));
+	message.id.idx = test->idx;
+	message.id.val = CN_VAL_PROC;
+	message.seq = index;
+	message.len = data_length;
+	struct nlmsghdr header;
+	memset(&header, 0, sizeof(header));
+	header.nlmsg_len = CONNECTOR_EVENT_OFFSET + data_length;
+	header.nlmsg_type = NLMSG_DONE;
+	memcpy(buffer, &header, sizeof(header));
+	memcpy(buffer + NLMSG_LENGTH(0), &message, sizeof(message));
+	memcpy(buffer + CONNECTOR_EVENT_OFFSET, &event, data_length);
+	return header.nlmsg_len;
+}
+
+/*
+ * Sends all cases, then checks received ones are exactly the passing ones
+ * and decodes them. Returns number of messages decoded, -1 on mismatch.
+ */
+static long connector_round(int fds[2], char messages[][CONNECTOR_MESSAGE_SIZE],
+							size_t* lengths) {
+	for (uint32_t i = 0; i < CONNECTOR_CASES; i++) {
+		if (send(fds[0], messages[i], lengths[i], 0) < 0) {
+			log_error("proc-connector: send: %s", strerror(errno));
+			return -1;
+		}
+	}
+	char buffer[CONNECTOR_MESSAGE_SIZE] __attribute__((aligned(8)));
+	long decoded = 0;
+	uint32_t expected = 0;
+	while (1) {
+		ssize_t length = recv(fds[1], buffer, sizeof(buffer), MSG_DONTWAIT);
+		if (length < 0) break;
+		while (expected < CONNECTOR_CASES && !connector_cases[expected].passes) expected++;
+		struct cn_msg message;
+		memcpy(&message, buffer + NLMSG_LENGTH(0), sizeof(message));
+		if (expected == CONNECTOR_CASES || message.seq != expected) {
+			log_error("proc-connector: filter passed message %u, expected %u",
+					  message.seq, expected);
+			return -1;
+		}
+		const struct connector_case* test = &connector_cases[expected++];
+		struct process_message event;
+		int result = process_decode(buffer, length, &event);
+		if ((test->kind == 0 && result == CALL_SUCCESS && event.kind != 0)
+			|| (test->kind != 0 && (result != CALL_SUCCESS || event.kind != test->kind
+									|| event.pid != test->tgid
+									|| (test->what != PROC_EVENT_EXEC
+										&& event.detail != test->detail)))) {
+			log_error("proc-connector: message %u decoded as kind %u, pid %d, detail %d",
+					  message.seq, event.kind, event.pid, event.detail);
+			return -1;
+		}
+		decoded++;
+	}
+	while (expected < CONNECTOR_CASES && !connector_cases[expected].passes) expected++;
+	if (expected != CONNECTOR_CASES) {
+		log_error("proc-connector: filter dropped message %u", expected);
+		return -1;
+	}
+	return decoded;
+}
+
+/*
+ * Socket filter is checked by kernel on unix socketpair, so neither root
+ * nor proc connector is needed
+ */
+static int connector_benchmark(int argc, char* argv[]) {
+	unsigned long count = count_argument(argc, argv, 0, CONNECTOR_MESSAGES);
+	char messages[CONNECTOR_CASES][CONNECTOR_MESSAGE_SIZE];
+	size_t lengths[CONNECTOR_CASES];
+	for (uint32_t i = 0; i < CONNECTOR_CASES; i++) {
+		lengths[i] = connector_message(i, messages[i]);
+	}
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds) != 0) {
+		log_error("proc-connector: socketpair: %s", strerror(errno));
+		return CALL_FAILURE;
+	}
+	if (process_attach_filter(fds[1]) != CALL_SUCCESS) {
+		log_error("proc-connector: cannot attach filter: %s", strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
+		return CALL_FAILURE;
+	}
+	unsigned long rounds = (count + CONNECTOR_CASES - 1) / CONNECTOR_CASES;
+	unsigned long decoded = 0;
+	int result = CALL_SUCCESS;
+	long started_ns = monotonic_ns();
+	for (unsigned long i = 0; i < rounds; i++) {
+		long round_decoded = connector_round(fds, messages, lengths);
+		if (round_decoded < 0) {
+			result = CALL_FAILURE;
+			break;
+		}
+		decoded += round_decoded;
+	}
+	long elapsed_ns = monotonic_ns() - started_ns;
+	close(fds[0]);
+	close(fds[1]);
+	if (result != CALL_SUCCESS) return result;
+	unsigned long sent = rounds * CONNECTOR_CASES;
+	log_info("proc-connector: %lu messages sent, %lu passed filter and were decoded as"
+			 " expected, %.0f ns per message sent", sent, decoded,
+			 (double)elapsed_ns / sent);
+	return CALL_SUCCESS;
+}
+
+/*
+ * Waits until inotify queue of cgroup monitor stayed empty for a while, then
+ * stops it, so its tables are no longer touched by engine thread
+ */
+static void settle_and_stop(monitor_t monitor) {
+	long empty_since_ns = 0;
+	long started_ns = monotonic_ns();
+	while (monotonic_ns() - started_ns < INJECT_STALL_TIMEOUT * 1000000000L) {
+		int pending = 0;
+		if (ioctl(monitor->cgroup->inotify_fd, FIONREAD, &pending) != 0) break;
+		long now_ns = monotonic_ns();
+		if (pending > 0) {
+			empty_since_ns = 0;
+		} else if (empty_since_ns == 0) {
+			empty_since_ns = now_ns;
+		} else if (now_ns - empty_since_ns > CGROUP_SETTLE_NS) {
+			break;
+		}
+		struct timespec pause = { 0, 1000000 };
+		nanosleep(&pause, NULL);
+	}
+	stop_monitor(monitor);
+	join_monitor(monitor);
+}
+
+/*
+ * Every entry must be found through index, index must hold nothing else,
+ * and entries must be exactly root and present directories
+ */
+static int check_cgroup_index(monitor_t monitor, const char* root, const char* present,
+							  unsigned long directories) {
+	cgroup_monitor_t cgroup_monitor = monitor->cgroup;
+	int expected = 1;
+	for (unsigned long i = 0; i < directories; i++) expected += present[i];
+	int used = 0;
+	for (uint32_t slot = 0; slot <= cgroup_monitor->index_mask; slot++) {
+		used += cgroup_monitor->index[slot] != 0;
+	}
+	if (cgroup_monitor->count != expected || used != expected) {
+		log_error("cgroup-churn: %d entries and %d index slots for %d directories",
+				  cgroup_monitor->count, used, expected);
+		return CALL_FAILURE;
+	}
+	size_t root_length = strlen(root);
+	for (int i = 0; i < cgroup_monitor->count; i++) {
+		struct cgroup_entry* entry = &cgroup_monitor->entries[i];
+		if (cgroup_find_entry(cgroup_monitor, entry->wd) != entry) {
+			log_error("cgroup-churn: %s is not found by its watch descriptor", entry->path);
+			return CALL_FAILURE;
+		}
+		if (entry->path[root_length] == '\0') continue;
+		unsigned long number = strtoul(entry->path + root_length + 2, NULL, 10);
+		if (number >= directories || !present[number]) {
+			log_error("cgroup-churn: removed %s is still watched", entry->path);
+			return CALL_FAILURE;
+		}
+	}
+	return CALL_SUCCESS;
+}
+
+/*
+ * --cgroup watches any directory tree, so churn needs no root. Up to 255
+ * directories are kept under first growth of entries, whose rebuild of
+ * index would hide broken removals.
+ */
+static int cgroup_churn_benchmark(int argc, char* argv[]) {
+	unsigned long directories = count_argument(argc, argv, 0, CGROUP_DIRECTORIES);
+	unsigned long rounds = count_argument(argc, argv, 1, CGROUP_ROUNDS);
+	char root[] = "/tmp/slm-cgroup-XXXXXX";
+	if (mkdtemp(root) == NULL) return CALL_FAILURE;
+	char* present = (char*)calloc(directories, 1);
+	char* monitor_argv[] = { "--cgroup", root, NULL };
+	monitor_t monitor = NULL;
+	if (present == NULL || ingest_start() != CALL_SUCCESS) {
+		free(present);
+		rmdir(root);
+		return CALL_FAILURE;
+	}
+	int result = monitor_from_args(2, monitor_argv, &monitor);
+	if (result == CALL_SUCCESS) result = start_monitor(monitor);
+	char path[sizeof(root) + 24];
+	uint64_t random_state = 0x9e3779b97f4a7c15ULL;
+	unsigned long changes = 0;
+	long started_ns = monotonic_ns();
+	for (unsigned long round = 0; round < rounds && result == CALL_SUCCESS; round++) {
+		for (unsigned long i = 0; i < directories; i++) {
+			if (next_random(&random_state) % 3 != 0) continue;
+			snprintf(path, sizeof(path), "%s/c%lu", root, i);
+			if ((present[i] ? rmdir(path) : mkdir(path, 0700)) != 0) {
+				log_error("cgroup-churn: %s: %s", path, strerror(errno));
+				result = CALL_FAILURE;
+				break;
+			}
+			present[i] = !present[i];
+			changes++;
+		}
+	}
+	long elapsed_ns = monotonic_ns() - started_ns;
+	if (monitor != NULL && monitor_state(monitor) == MONITOR_STATE_RUNNING) {
+		settle_and_stop(monitor);
+		if (result == CALL_SUCCESS) {
+			result = check_cgroup_index(monitor, root, present, directories);
+		}
+	}
+	if (monitor != NULL) destroy_monitor(monitor);
+	ingest_stop();
+	for (unsigned long i = 0; i < directories; i++) {
+		if (!present[i]) continue;
+		snprintf(path, sizeof(path), "%s/c%lu", root, i);
+		rmdir(path);
+	}
+	rmdir(root);
+	free(present);
+	if (result != CALL_SUCCESS) return result;
+	log_info("cgroup-churn: %lu directories created or removed in %.3f s, index finds"
+			 " every watched one", changes, elapsed_ns / 1e9);
+	return CALL_SUCCESS;
+}
+
+/*
+ * CPU time of whole process is taken, main thread only sleeps, so it is
+ * sampler on engine thread plus pipeline worker
+ */
+static int netstat_benchmark(int argc, char* argv[]) {
+	unsigned long seconds = count_argument(argc, argv, 0, NETSTAT_SECONDS);
+	unsigned long interval_ms = count_argument(argc, argv, 1, NETSTAT_INTERVAL_MS);
+	char interval[24];
+	snprintf(interval, sizeof(interval), "%lu", interval_ms);
+	char* monitor_argv[] = { "--netstat", "--interval", interval, NULL };
+	if (event_pipeline_start(1, EVENT_QUEUE_CAPACITY) != CALL_SUCCESS
+		|| ingest_start() != CALL_SUCCESS) {
+		event_pipeline_stop();
+		return CALL_FAILURE;
+	}
+	monitor_t monitor;
+	int result = monitor_from_args(3, monitor_argv, &monitor);
+	if (result != CALL_SUCCESS) {
+		ingest_stop();
+		event_pipeline_stop();
+		return result;
+	}
+	struct rusage before, after;
+	getrusage(RUSAGE_SELF, &before);
+	long started_ns = monotonic_ns();
+	result = start_monitor(monitor);
+	if (result == CALL_SUCCESS) {
+		struct timespec pause = { (time_t)seconds, 0 };
+		while (nanosleep(&pause, &pause) != 0 && errno == EINTR);
+		stop_monitor(monitor);
+		join_monitor(monitor);
+	}
+	long elapsed_ns = monotonic_ns() - started_ns;
+	getrusage(RUSAGE_SELF, &after);
+	netstat_monitor_t netstat_monitor = monitor->netstat;
+	unsigned long completed = netstat_monitor->dumps_completed;
+	unsigned long abandoned = netstat_monitor->dumps_abandoned;
+	int interfaces = netstat_monitor->interfaces_count;
+	destroy_monitor(monitor);
+	ingest_stop();
+	event_pipeline_stop();
+	if (result != CALL_SUCCESS) return result;
+
+	double cpu_percent = (cpu_seconds(&after) - cpu_seconds(&before)) * 1e11 / elapsed_ns;
+	unsigned long expected = seconds * 1000 / interval_ms;
+	log_info("netstat: %d interfaces, %lu dumps in %.1f s (%lu expected, %lu given up),"
+			 " %.2f%% of one core", interfaces, completed, elapsed_ns / 1e9, expected,
+			 abandoned, cpu_percent);
+	if (cpu_percent >= NETSTAT_MAX_CPU_PERCENT || completed < expected * 9 / 10
+		|| abandoned > 0 || interfaces == 0) {
+		log_error("netstat: sampler must take under %.0f%% of one core and complete"
+				  " 90%% of its dumps", NETSTAT_MAX_CPU_PERCENT);
+		return CALL_FAILURE;
+	}
+	return CALL_SUCCESS;
+}
+
+void print_benchmarks_usage() {
+	for (const struct benchmark* benchmark = benchmarks; benchmark->name != NULL; benchmark++) {
+		printf("\t\t %s %s \t- %s\n", benchmark->name, benchmark->arguments,
+			   benchmark->description);
+	}
+}
+
+int run_benchmark(int argc, char* argv[]) {
+	for (const struct benchmark* benchmark = benchmarks; benchmark->name != NULL; benchmark++) {
+		if (strcmp(benchmark->name, argv[0]) == 0) {
+			return benchmark->run(argc - 1, argv + 1) == CALL_SUCCESS
+				   ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	printf("unknown benchmark %s, available ones:\n", argv[0]);
+	print_benchmarks_usage();
+	return EXIT_FAILURE;
+}
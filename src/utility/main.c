@@ -1,55 +1,333 @@
 #include <stdio.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
 #include <logging/logging.h>
 #include "monitor.h"
 #include "errors.h"
+#include "injector.h"
+#include "utility/benchmarks.h"
 
 
-monitor_t main_monitor;
+#define MONITORS_SEPARATOR "--"
 
+/*
+ * All monitors share one ingestion thread and one event worker,
+ * so their events come out as one stream in order they were read
+ */
+monitor_t* monitors = NULL;
+int monitors_count = 0;
+volatile sig_atomic_t stopped = 0;
+volatile sig_atomic_t monitors_finished = 0;
+volatile sig_atomic_t log_level_requested = 0;
+volatile sig_atomic_t log_level_request = -1;	// -1 toggles info and debug
+static pthread_t main_thread;
+
+/*
+ * Only sets flag, monitors are stopped by main thread
+ */
 void killHandler(int signal) {
-    if (stop_monitor(main_monitor) == CALL_SUCCESS) {
-        join_monitor(main_monitor);
-    }
-    printf("slm was gracefully stopped\n");
+	stopped = 1;
+	trace_replay_stop();
+}
+
+/*
+ * Wakes main thread from sigsuspend once all monitors died by themselves
+ */
+void wakeHandler(int signal) {
+}
+
+static void* wait_monitors(void* argument) {
+	for (int i = 0; i < monitors_count; i++) {
+		wait_monitor_dead(monitors[i]);
+	}
+	monitors_finished = 1;
+	pthread_kill(main_thread, SIGUSR1);
+	return NULL;
+}
+
+/*
+ * sigqueue value is LOG_LEVEL_REQUEST, plain SIGUSR2 switches
+ * all monitors between info and debug. Request is applied by main thread.
+ */
+void logLevelHandler(int signal, siginfo_t* info, void* context) {
+	log_level_request = info->si_code == SI_QUEUE ? info->si_value.sival_int : -1;
+	log_level_requested = 1;
+}
+
+static void apply_log_level_request() {
+	int request = log_level_request;
+	if (request < 0) {
+		request = LOG_LEVEL_REQUEST(0, atomic_load(&log_level) == LOG_LEVEL_DEBUG
+									   ? LOG_LEVEL_INFO : LOG_LEVEL_DEBUG);
+	}
+	if (set_monitors_log_level(monitors, monitors_count, request) != CALL_SUCCESS) {
+		log_error("invalid log level request %d", request);
+	}
 }
 
 void showUsage() {
-	printf("Usage: slm [command] [command_options]\n");
+	printf("Usage: slm [command] [command_options] [-- command command_options ...]\n");
 	printf("Available commands: \n");
 	printf("\t --file \t- monitors file events\n");
-	printf("\t --network \t- monitors network events\n");
-	printf("\t --disks \t- monitors disks events\n");
+	printf("\t --network \t- monitors network events (--backend=netlink without NetworkManager)\n");
+	printf("\t --netstat \t- monitors throughput of network interfaces\n");
+	printf("\t --process \t- monitors process starts and exits\n");
+	printf("\t --mounts \t- monitors mount, unmount and remount events\n");
+	printf("\t --pressure \t- warns about memory, cpu and io pressure (PSI)\n");
+	printf("\t --cgroup \t- monitors OOM kills and population of cgroups\n");
+	printf("\t --disks \t- monitors disks events (--backend=udev without UDisks2)\n");
 	printf("\t --power \t- monitors power supply events\n");
 	printf("\t --bluetooth \t- monitors bluetooth events\n");
+	printf("\t dump [file] \t- prints log written by slmd --log-stream-compress\n");
+	printf("\t record [trace] [command] \t- runs monitor and records its raw inputs to trace\n");
+	printf("\t replay [trace] [--fast] [command] \t- feeds recorded inputs to monitor\n"
+		   "\t\t created by same command, at original speed or as fast as possible\n");
+	printf("\t inject [count] [command] \t- drives count synthetic events through udev\n"
+		   "\t\t monitor, or dbus monitor on private bus given with --bus-address;\n"
+		   "\t\t inject [count] record [trace] [command] records them as well;\n"
+		   "\t\t inject [count] latency [command] sends each once previous one\n"
+		   "\t\t was logged and reports percentiles of send to log latency\n");
+	printf("\t bench [name] [arguments] \t- runs benchmark:\n");
+	print_benchmarks_usage();
+	printf("Several monitors given in one call, separated by --, share one event loop\n"
+		   "and log to one stream, e.g. slm --file -w a -- --file -w b -- --power\n");
+	printf("Log level is set with SLM_LOG_LEVEL=trace|debug|info|warn|error, and changed at\n"
+		   "run time with SIGUSR2 (sigqueue value level, or monitor number << 8 | level)\n");
 	printf("Use slm [command] -h to get more info about each command\n");
 }
 
-int main(int argc, char* argv[]) {
-    struct sigaction kill_action;
-    kill_action.sa_handler = killHandler;
-    sigaction(SIGINT, &kill_action, NULL);
+void destroy_monitors() {
+	for (int i = 0; i < monitors_count; i++) {
+		destroy_monitor(monitors[i]);
+	}
+	free(monitors);
+	monitors = NULL;
+	monitors_count = 0;
+}
 
-	int parse_result = monitor_from_args(argc-1, (argv+1), &main_monitor);
+/*
+ * Creates monitor for each command of argv, commands are separated by "--"
+ */
+int monitors_from_args(int argc, char* argv[]) {
+	monitors = (monitor_t*)malloc((argc + 1) * sizeof(monitor_t));
+	if (monitors == NULL) {
+		return E_OUT_OF_MEMORY;
+	}
+	int first = 0;
+	for (int i = 0; i <= argc; i++) {
+		if (i < argc && strcmp(argv[i], MONITORS_SEPARATOR) != 0) continue;
+		int parse_result = monitor_from_args(i - first, argv + first, &monitors[monitors_count]);
+		if (parse_result != CALL_SUCCESS) {
+			destroy_monitors();
+			return parse_result;
+		}
+		monitors_count++;
+		first = i + 1;
+	}
+	return CALL_SUCCESS;
+}
+
+/*
+ * Parses monitors, shows usage on invalid command line. record, replay
+ * and inject work with one monitor only.
+ */
+int parse_monitors(int argc, char* argv[], int single) {
+	int parse_result = monitors_from_args(argc, argv);
 	if (parse_result == E_INVALID_INPUT) {
 		showUsage();
-		return EXIT_FAILURE;
+		return CALL_FAILURE;
 	} else if (parse_result != CALL_SUCCESS) {
+		return CALL_FAILURE;
+	}
+	if (single && monitors_count > 1) {
+		printf("record, replay and inject take one monitor\n");
+		destroy_monitors();
+		return CALL_FAILURE;
+	}
+	return CALL_SUCCESS;
+}
+
+/*
+ * Replays trace through monitor which is created but never started,
+ * so neither devices nor system bus are needed
+ */
+int replay(int argc, char* argv[]) {
+	const char* trace_path = argv[0];
+	int speed = TRACE_REPLAY_ORIGINAL_SPEED;
+	int first = 1;
+	if (strcmp(argv[1], "--fast") == 0) {
+		speed = TRACE_REPLAY_AS_FAST;
+		first = 2;
+	}
+	if (parse_monitors(argc - first, argv + first, 1) != CALL_SUCCESS) {
 		return EXIT_FAILURE;
 	}
 	if (initialize_logging() != CALL_SUCCESS) {
 		printf("can not initialize logging module, exit\n");
-		destroy_monitor(main_monitor);
+		destroy_monitors();
+		return EXIT_FAILURE;
+	}
+	// monitors were parsed before SLM_LOG_LEVEL was read
+	set_monitors_log_level(monitors, monitors_count, LOG_LEVEL_REQUEST(0, atomic_load(&log_level)));
+	if (event_pipeline_start(1, EVENT_QUEUE_CAPACITY) != CALL_SUCCESS) {
+		printf("can not start event worker, exit\n");
+		destroy_monitors();
 		return EXIT_FAILURE;
 	}
-	if (start_monitor(main_monitor) != CALL_SUCCESS) {
-		printf("can not start monitor, exit\n");
-		destroy_monitor(main_monitor);
-        return EXIT_FAILURE;
-    }
-    join_monitor(main_monitor);
-	destroy_monitor(main_monitor);
+	// replay runs in this thread, so SIGINT must reach it while it reads trace
+	sigset_t interrupt;
+	sigemptyset(&interrupt);
+	sigaddset(&interrupt, SIGINT);
+	pthread_sigmask(SIG_UNBLOCK, &interrupt, NULL);
+	int result = trace_replay(trace_path, monitors[0], speed);
+	destroy_monitors();
+	event_pipeline_stop();
+	destroy_logging();
+	return result == CALL_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[]) {
+	struct sigaction kill_action;
+	memset(&kill_action, 0, sizeof(kill_action));
+	kill_action.sa_handler = killHandler;
+	sigaction(SIGINT, &kill_action, NULL);
+	struct sigaction wake_action;
+	memset(&wake_action, 0, sizeof(wake_action));
+	wake_action.sa_handler = wakeHandler;
+	sigaction(SIGUSR1, &wake_action, NULL);
+	struct sigaction level_action;
+	memset(&level_action, 0, sizeof(level_action));
+	level_action.sa_sigaction = logLevelHandler;
+	level_action.sa_flags = SA_SIGINFO;
+	sigaction(SIGUSR2, &level_action, NULL);
+
+	// handled signals are delivered only inside sigsuspend of main thread,
+	// threads started later inherit the mask
+	sigset_t handled_signals;
+	sigset_t wait_mask;
+	sigemptyset(&handled_signals);
+	sigaddset(&handled_signals, SIGINT);
+	sigaddset(&handled_signals, SIGUSR1);
+	sigaddset(&handled_signals, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &handled_signals, &wait_mask);
+	main_thread = pthread_self();
+
+	if (argc == 3 && strcmp(argv[1], "dump") == 0) {
+		return dump_compressed_log(argv[2], stdout) == CALL_SUCCESS
+			   ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (argc >= 3 && strcmp(argv[1], "bench") == 0) {
+		if (initialize_logging() != CALL_SUCCESS) return EXIT_FAILURE;
+		int result = run_benchmark(argc - 2, argv + 2);
+		destroy_logging();
+		return result;
+	}
+	if (argc >= 4 && strcmp(argv[1], "replay") == 0) {
+		return replay(argc - 2, argv + 2);
+	}
+	unsigned long inject_count = 0;
+	int inject_mode = INJECT_THROUGHPUT;
+	if (argc >= 4 && strcmp(argv[1], "inject") == 0) {
+		inject_count = strtoul(argv[2], NULL, 10);
+		argc -= 2;
+		argv += 2;
+		if (argc >= 3 && strcmp(argv[1], "latency") == 0) {
+			inject_mode = INJECT_LATENCY;
+			argc--;
+			argv++;
+		}
+	}
+	const char* trace_path = NULL;
+	if (argc >= 4 && strcmp(argv[1], "record") == 0) {
+		trace_path = argv[2];
+		argc -= 2;
+		argv += 2;
+	}
+
+	int single = inject_count > 0 || trace_path != NULL;
+	if (parse_monitors(argc - 1, argv + 1, single) != CALL_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+	if (initialize_logging() != CALL_SUCCESS) {
+		printf("can not initialize logging module, exit\n");
+		destroy_monitors();
+		return EXIT_FAILURE;
+	}
+	// monitors were parsed before SLM_LOG_LEVEL was read
+	set_monitors_log_level(monitors, monitors_count, LOG_LEVEL_REQUEST(0, atomic_load(&log_level)));
+	if (event_pipeline_start(1, EVENT_QUEUE_CAPACITY) != CALL_SUCCESS) {
+		printf("can not start event worker, exit\n");
+		destroy_monitors();
+		return EXIT_FAILURE;
+	}
+	if (ingest_start() != CALL_SUCCESS) {
+		printf("can not start ingestion engine, exit\n");
+		event_pipeline_stop();
+		destroy_monitors();
+		return EXIT_FAILURE;
+	}
+	if (trace_path != NULL && trace_record_start(trace_path, monitors[0]) != CALL_SUCCESS) {
+		ingest_stop();
+		event_pipeline_stop();
+		destroy_monitors();
+		return EXIT_FAILURE;
+	}
+	if (inject_count > 0) {
+		int result = inject_events(monitors[0], inject_count, inject_mode);
+		trace_record_stop();
+		destroy_monitors();
+		ingest_stop();
+		event_pipeline_stop();
+		destroy_logging();
+		return result == CALL_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	for (int i = 0; i < monitors_count; i++) {
+		if (start_monitor(monitors[i]) != CALL_SUCCESS) {
+			printf("can not start monitor, exit\n");
+			for (int j = 0; j < i; j++) {
+				stop_monitor(monitors[j]);
+				join_monitor(monitors[j]);
+			}
+			trace_record_stop();
+			ingest_stop();
+			event_pipeline_stop();
+			destroy_monitors();
+			return EXIT_FAILURE;
+		}
+	}
+	// monitor dying by itself leaves others running
+	pthread_t waiter;
+	int waiting = pthread_create(&waiter, NULL, wait_monitors, NULL) == 0;
+	if (!waiting) {
+		log_error("cannot wait for monitors, they run until SIGINT");
+	}
+	while (!stopped && !monitors_finished) {
+		sigsuspend(&wait_mask);
+		if (log_level_requested) {
+			log_level_requested = 0;
+			apply_log_level_request();
+		}
+	}
+	for (int i = 0; i < monitors_count; i++) {
+		stop_monitor(monitors[i]);
+	}
+	if (waiting) {
+		pthread_join(waiter, NULL);
+	}
+	for (int i = 0; i < monitors_count; i++) {
+		join_monitor(monitors[i]);
+	}
+	if (stopped) {
+		printf("slm was gracefully stopped\n");
+	}
+	trace_record_stop();
+	destroy_monitors();
+	ingest_stop();
+	event_pipeline_stop();
 	destroy_logging();
 	return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
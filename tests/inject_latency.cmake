@@ -0,0 +1,33 @@
+# Injects events one by one into a udev monitor, or a D-Bus monitor on a
+# private bus started here, and checks each of them was logged.
+# cmake -DSLM=<slm> -DMODULE_DIR=<directory of modules> "-DMONITOR=<arguments>"
+#       [-DDBUS_DAEMON=<dbus-daemon>] [-DCOUNT=<events>] -P inject_latency.cmake
+separate_arguments(MONITOR UNIX_COMMAND "${MONITOR}")
+set(ENV{SLM_MODULE_DIR} ${MODULE_DIR})
+if (NOT COUNT)
+    set(COUNT 2000)
+endif ()
+if (DBUS_DAEMON)
+    string(RANDOM LENGTH 8 suffix)
+    set(bus_path "/tmp/slm-test-bus-${suffix}")
+    execute_process(COMMAND ${DBUS_DAEMON} --session --address=unix:path=${bus_path}
+                            --fork --print-pid
+                    OUTPUT_VARIABLE daemon_pid RESULT_VARIABLE result)
+    if (NOT result EQUAL 0)
+        message(FATAL_ERROR "cannot start ${DBUS_DAEMON} (${result})")
+    endif ()
+    string(STRIP "${daemon_pid}" daemon_pid)
+    list(APPEND MONITOR --bus-address unix:path=${bus_path})
+endif ()
+execute_process(COMMAND ${SLM} inject ${COUNT} latency ${MONITOR}
+                OUTPUT_VARIABLE output ERROR_VARIABLE errors RESULT_VARIABLE result
+                TIMEOUT 120)
+if (DBUS_DAEMON)
+    execute_process(COMMAND kill ${daemon_pid})
+    file(REMOVE ${bus_path})
+endif ()
+if (NOT result EQUAL 0 OR NOT output MATCHES "inject: ${COUNT} [a-z]+, latency to logged event")
+    message(FATAL_ERROR "slm inject latency failed (${result}):\n${output}${errors}")
+endif ()
+string(REGEX MATCH "inject: [^\n]*" summary "${output}")
+message(STATUS "${summary}")
@@ -0,0 +1,64 @@
+# Runs --network --backend=netlink in a new user and network namespace,
+# changes a veth pair there with ip and checks the changes were logged in
+# order, skipped where unprivileged namespaces are not allowed.
+# cmake -DSLM=<slm> -DUNSHARE=<unshare> -DIP=<ip> -P netlink_veth.cmake
+execute_process(COMMAND ${UNSHARE} -rn true RESULT_VARIABLE result ERROR_QUIET)
+if (NOT result EQUAL 0)
+    message("SKIPPED: ${UNSHARE} -rn is not allowed here")
+    return()
+endif ()
+string(RANDOM LENGTH 8 suffix)
+set(log_path "/tmp/slm-test-netlink-${suffix}.log")
+set(script "set -e
+${IP} link set lo up
+${SLM} --network --backend=netlink > ${log_path} 2>&1 &
+pid=$!
+tries=0
+until grep -q 'monitor was created' ${log_path}; do
+    tries=$((tries + 1)); [ $tries -lt 100 ] || exit 1; sleep 0.05
+done
+${IP} link add ve0 type veth peer name vp0
+${IP} link set vp0 up
+${IP} link set ve0 up
+${IP} addr add 10.1.0.1/24 dev ve0
+${IP} -6 addr add fd00::1/64 dev ve0 nodad
+${IP} route add 10.2.0.0/16 via 10.1.0.2
+${IP} link set ve0 down
+${IP} link set ve0 name ve1
+${IP} link del ve1
+sleep 0.2
+kill -INT $pid
+wait $pid
+")
+execute_process(COMMAND ${UNSHARE} -rn sh -c "${script}"
+                OUTPUT_VARIABLE output ERROR_VARIABLE errors RESULT_VARIABLE result
+                TIMEOUT 60)
+file(READ ${log_path} log)
+file(REMOVE ${log_path})
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "slm --network --backend=netlink failed (${result}):\n"
+                        "${log}${output}${errors}")
+endif ()
+# each command waits for the kernel, so its first message follows the previous ones
+set(expected
+    "link ve0 is down"
+    "link ve0 is up"
+    "address 10.1.0.1/24 was added to ve0"
+    "address fd00::1/64 was added to ve0"
+    "route 10.2.0.0/16 via 10.1.0.2 dev ve0 was added"
+    "link ve0 is down"
+    "address fd00::1/64 was removed from ve0"
+    "link ve0 was renamed to ve1"
+    "address 10.1.0.1/24 was removed from ve1"
+    "link ve1 was removed"
+    "link vp0 was removed")
+set(rest "${log}")
+foreach (line IN LISTS expected)
+    string(FIND "${rest}" "]: ${line}\n" position)
+    if (position EQUAL -1)
+        message(FATAL_ERROR "'${line}' was not logged in order:\n${log}")
+    endif ()
+    string(SUBSTRING "${rest}" ${position} -1 rest)
+    string(LENGTH "]: ${line}\n" length)
+    string(SUBSTRING "${rest}" ${length} -1 rest)
+endforeach ()
@@ -0,0 +1,32 @@
+# Runs netstat sampler cost bench in a new user and network namespace with
+# veth pairs, skipped where unprivileged namespaces are not allowed.
+# cmake -DSLM=<slm> -DUNSHARE=<unshare> -DIP=<ip> [-DPAIRS=<veth pairs>]
+#       [-DSECONDS=<seconds>] -P netstat_veth.cmake
+if (NOT PAIRS)
+    set(PAIRS 50)
+endif ()
+if (NOT SECONDS)
+    set(SECONDS 3)
+endif ()
+execute_process(COMMAND ${UNSHARE} -rn true RESULT_VARIABLE result ERROR_QUIET)
+if (NOT result EQUAL 0)
+    message("SKIPPED: ${UNSHARE} -rn is not allowed here")
+    return()
+endif ()
+set(script "set -e\n${IP} link set lo up\n")
+math(EXPR last "${PAIRS} - 1")
+foreach (pair RANGE ${last})
+    string(APPEND script "${IP} link add veth${pair} type veth peer name vp${pair}\n"
+                         "${IP} link set veth${pair} up\n${IP} link set vp${pair} up\n")
+endforeach ()
+string(APPEND script "exec ${SLM} bench netstat ${SECONDS} 100\n")
+execute_process(COMMAND ${UNSHARE} -rn sh -c "${script}"
+                OUTPUT_VARIABLE output ERROR_VARIABLE errors RESULT_VARIABLE result
+                TIMEOUT 60)
+math(EXPR interfaces "${PAIRS} * 2 + 1")
+if (NOT result EQUAL 0 OR NOT output MATCHES "netstat: ${interfaces} interfaces")
+    message(FATAL_ERROR "slm bench netstat with ${PAIRS} veth pairs failed (${result}):\n"
+                        "${output}${errors}")
+endif ()
+string(REGEX MATCH "netstat: [^\n]*" summary "${output}")
+message(STATUS "${summary}")
@@ -0,0 +1,20 @@
+# Replays committed trace as fast as possible and compares log of slm with
+# expected one, with timestamps and replay timing removed.
+# cmake -DSLM=<slm> -DTRACE=<trace> -DEXPECTED=<log> "-DMONITOR=<arguments>"
+#       [-DMODULE_DIR=<directory of udev and D-Bus modules>] -P replay_diff.cmake
+separate_arguments(MONITOR UNIX_COMMAND "${MONITOR}")
+if (MODULE_DIR)
+    set(ENV{SLM_MODULE_DIR} ${MODULE_DIR})
+endif ()
+execute_process(COMMAND ${SLM} replay ${TRACE} --fast ${MONITOR}
+                OUTPUT_VARIABLE output ERROR_VARIABLE errors RESULT_VARIABLE result)
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "slm replay of ${TRACE} failed (${result}):\n${output}${errors}")
+endif ()
+string(REGEX REPLACE "[A-Z][a-z][a-z] [A-Z][a-z][a-z] [ 0-9][0-9] [0-9:]+ [0-9]+ \\[" "["
+       output "${output}")
+string(REGEX REPLACE " in [0-9.]+ s, [^\n]*" "" output "${output}")
+file(READ ${EXPECTED} expected)
+if (NOT output STREQUAL expected)
+    message(FATAL_ERROR "log of ${TRACE} differs\n--- expected\n${expected}--- replayed\n${output}")
+endif ()